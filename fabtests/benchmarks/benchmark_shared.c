@@ -31,6 +31,13 @@
  * SOFTWARE.
  */
 
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -39,6 +46,60 @@
 #include "shared.h"
 #include "benchmark_shared.h"
 
+/*
+ * Restrict the process to the CPUs of a NUMA node, so that the resources a
+ * provider allocates at initialization land on that node.  Run the client
+ * and server on different nodes to measure cross-socket transfers.
+ */
+static int ft_bind_numa_node(int node)
+{
+#ifdef __linux__
+	char path[64], *line = NULL, *cur;
+	size_t len = 0;
+	long first, last;
+	cpu_set_t set;
+	FILE *fd;
+	int ret;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/node/node%d/cpulist", node);
+	fd = fopen(path, "r");
+	if (!fd) {
+		FT_ERR("unknown NUMA node %d", node);
+		return -FI_EINVAL;
+	}
+
+	CPU_ZERO(&set);
+	if (getline(&line, &len, fd) > 0) {
+		for (cur = line; *cur && *cur != '\n'; cur++) {
+			first = strtol(cur, &cur, 10);
+			last = (*cur == '-') ? strtol(cur + 1, &cur, 10) : first;
+			for (; first <= last && first < CPU_SETSIZE; first++)
+				CPU_SET(first, &set);
+			if (*cur != ',')
+				break;
+		}
+	}
+	free(line);
+	fclose(fd);
+
+	if (!CPU_COUNT(&set)) {
+		FT_ERR("NUMA node %d has no CPUs", node);
+		return -FI_EINVAL;
+	}
+
+	ret = sched_setaffinity(0, sizeof(set), &set);
+	if (ret) {
+		FT_PRINTERR("sched_setaffinity", -errno);
+		return -errno;
+	}
+	return 0;
+#else
+	FT_ERR("binding to a NUMA node is not supported");
+	return -FI_ENOSYS;
+#endif
+}
+
 void ft_parse_benchmark_opts(int op, char *optarg)
 {
 	switch (op) {
@@ -54,6 +115,10 @@ void ft_parse_benchmark_opts(int op, char *optarg)
 	case 'W':
 		opts.window_size = atoi(optarg);
 		break;
+	case 'N':
+		if (ft_bind_numa_node(atoi(optarg)))
+			exit(EXIT_FAILURE);
+		break;
 	default:
 		break;
 	}
@@ -64,6 +129,7 @@ void ft_benchmark_usage(void)
 	FT_PRINT_OPTS_USAGE("-v", "enables data_integrity checks");
 	FT_PRINT_OPTS_USAGE("-k", "force prefix mode");
 	FT_PRINT_OPTS_USAGE("-j", "maximum inject message size");
+	FT_PRINT_OPTS_USAGE("-N <node>", "run on the CPUs of a NUMA node");
 	FT_PRINT_OPTS_USAGE("-W", "window size* (for bandwidth tests)\n\n"
 			"* The following condition is required to have at least "
 			"one window\nsize # of messsages to be sent: "
@@ -0,0 +1,380 @@
+/*
+ * Copyright (c) 2019 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under the BSD license
+ * below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <rdma/fi_errno.h>
+#include <rdma/fi_endpoint.h>
+
+#include "shared.h"
+#include "benchmark_shared.h"
+
+/*
+ * Packet rate test for datagram endpoints.
+ *
+ * The client sends a window of datagrams, waits until they completed, and
+ * then waits for the server to acknowledge that it received all of them.
+ * The server keeps a window of receives posted, so that the provider can
+ * pick up several datagrams per progress call.  With -M, all but the last
+ * send of a window are posted with FI_MORE, which lets the provider hand
+ * the window to the kernel in fewer system calls.  With -R, each side
+ * posts two multi-receive buffers that hold a window of datagrams each,
+ * instead of one receive per datagram.
+ */
+static struct fi_context *tx_ctxs, *rx_ctxs;
+static int use_more, use_multi;
+static char *multi_buf;
+static size_t multi_size;
+static struct fid_mr *multi_mr;
+
+static int post_recv(void *ctx)
+{
+	ssize_t ret;
+
+	do {
+		ret = fi_recv(ep, rx_buf, rx_size, mr_desc, 0, ctx);
+		if (ret == -FI_EAGAIN)
+			(void) fi_cq_read(rxcq, NULL, 0);
+	} while (ret == -FI_EAGAIN);
+
+	if (ret)
+		FT_PRINTERR("fi_recv", ret);
+	return (int) ret;
+}
+
+static int is_multi_ctx(void *ctx)
+{
+	return use_multi && (ctx == &rx_ctxs[0] || ctx == &rx_ctxs[1]);
+}
+
+static int post_multi_recv(void *ctx)
+{
+	struct iovec iov;
+	struct fi_msg msg;
+	void *desc;
+	ssize_t ret;
+
+	iov.iov_base = multi_buf + (ctx == &rx_ctxs[1] ? multi_size : 0);
+	iov.iov_len = multi_size;
+	desc = multi_mr ? fi_mr_desc(multi_mr) : NULL;
+	msg.msg_iov = &iov;
+	msg.desc = &desc;
+	msg.iov_count = 1;
+	msg.addr = FI_ADDR_UNSPEC;
+	msg.context = ctx;
+	msg.data = 0;
+
+	do {
+		ret = fi_recvmsg(ep, &msg, FI_MULTI_RECV);
+		if (ret == -FI_EAGAIN)
+			(void) fi_cq_read(rxcq, NULL, 0);
+	} while (ret == -FI_EAGAIN);
+
+	if (ret)
+		FT_PRINTERR("fi_recvmsg", ret);
+	return (int) ret;
+}
+
+static int alloc_multi_recv(void)
+{
+	size_t min_size = rx_size;
+	int ret;
+
+	ret = fi_setopt(&ep->fid, FI_OPT_ENDPOINT, FI_OPT_MIN_MULTI_RECV,
+			&min_size, sizeof(min_size));
+	if (ret) {
+		FT_PRINTERR("fi_setopt", ret);
+		return ret;
+	}
+
+	multi_size = rx_size * opts.window_size;
+	multi_buf = malloc(multi_size * 2);
+	if (!multi_buf)
+		return -FI_ENOMEM;
+
+	if (fi->domain_attr->mr_mode & FI_MR_LOCAL) {
+		ret = fi_mr_reg(domain, multi_buf, multi_size * 2, FI_RECV,
+				0, FT_MR_KEY + 1, 0, &multi_mr, NULL);
+		if (ret) {
+			FT_PRINTERR("fi_mr_reg", ret);
+			return ret;
+		}
+	}
+
+	ret = post_multi_recv(&rx_ctxs[0]);
+	return ret ? ret : post_multi_recv(&rx_ctxs[1]);
+}
+
+static int post_send(void *ctx, uint64_t flags)
+{
+	struct iovec iov;
+	struct fi_msg msg;
+	ssize_t ret;
+
+	iov.iov_base = tx_buf;
+	iov.iov_len = opts.transfer_size + ft_tx_prefix_size();
+	msg.msg_iov = &iov;
+	msg.desc = &mr_desc;
+	msg.iov_count = 1;
+	msg.addr = remote_fi_addr;
+	msg.context = ctx;
+	msg.data = 0;
+
+	do {
+		ret = fi_sendmsg(ep, &msg, flags);
+		if (ret == -FI_EAGAIN)
+			(void) fi_cq_read(txcq, NULL, 0);
+	} while (ret == -FI_EAGAIN);
+
+	if (ret)
+		FT_PRINTERR("fi_sendmsg", ret);
+	return (int) ret;
+}
+
+static int wait_tx(int cnt)
+{
+	struct fi_cq_msg_entry comp[16];
+	int ret;
+
+	while (cnt > 0) {
+		ret = fi_cq_read(txcq, comp, MIN(cnt, 16));
+		if (ret > 0)
+			cnt -= ret;
+		else if (ret != -FI_EAGAIN)
+			return ret == -FI_EAVAIL ? ft_cq_readerr(txcq) : ret;
+	}
+	return 0;
+}
+
+/*
+ * Reposts every receive that completes, datagrams may land in any of them.
+ * A multi-receive buffer is reposted once the provider released it.
+ */
+static int wait_rx(int cnt)
+{
+	struct fi_cq_msg_entry comp[16];
+	struct timespec last, now;
+	int i, ret, err;
+
+	clock_gettime(CLOCK_MONOTONIC, &last);
+	while (cnt > 0) {
+		ret = fi_cq_read(rxcq, comp, MIN(cnt, 16));
+		if (ret > 0) {
+			for (i = 0; i < ret; i++) {
+				if (!is_multi_ctx(comp[i].op_context))
+					err = post_recv(comp[i].op_context);
+				else if (comp[i].flags & FI_MULTI_RECV)
+					err = post_multi_recv(comp[i].op_context);
+				else
+					err = 0;
+				if (err)
+					return err;
+			}
+			cnt -= ret;
+			clock_gettime(CLOCK_MONOTONIC, &last);
+		} else if (ret != -FI_EAGAIN) {
+			return ret == -FI_EAVAIL ? ft_cq_readerr(rxcq) : ret;
+		} else if (timeout > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (now.tv_sec - last.tv_sec > timeout) {
+				FT_ERR("%d datagrams lost", cnt);
+				return -FI_ENODATA;
+			}
+		}
+	}
+	return 0;
+}
+
+static int run_client(void)
+{
+	int i, j, cnt, ret;
+
+	for (i = 0; i < opts.iterations; i += cnt) {
+		cnt = MIN(opts.window_size, opts.iterations - i);
+		for (j = 0; j < cnt; j++) {
+			ret = post_send(&tx_ctxs[j], (use_more && j < cnt - 1) ?
+					FI_MORE : 0);
+			if (ret)
+				return ret;
+		}
+
+		ret = wait_tx(cnt);
+		if (ret)
+			return ret;
+
+		ret = wait_rx(1);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int run_server(void)
+{
+	int i, cnt, ret;
+
+	for (i = 0; i < opts.iterations; i += cnt) {
+		cnt = MIN(opts.window_size, opts.iterations - i);
+		ret = wait_rx(cnt);
+		if (ret)
+			return ret;
+
+		ret = post_send(&tx_ctxs[0], 0);
+		if (ret)
+			return ret;
+
+		ret = wait_tx(1);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int run(void)
+{
+	int i, ret;
+
+	ret = ft_init_fabric();
+	if (ret)
+		return ret;
+
+	tx_ctxs = calloc(opts.window_size, sizeof(*tx_ctxs));
+	rx_ctxs = calloc(MAX(opts.window_size, 2), sizeof(*rx_ctxs));
+	if (!tx_ctxs || !rx_ctxs)
+		return -FI_ENOMEM;
+
+	ret = ft_sync();
+	if (ret)
+		return ret;
+
+	/* The receive posted for ft_sync() is part of the window now */
+	if (use_multi) {
+		ret = alloc_multi_recv();
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; !use_multi && i < opts.window_size; i++) {
+		ret = post_recv(&rx_ctxs[i]);
+		if (ret)
+			return ret;
+	}
+
+	ft_start();
+	ret = opts.dst_addr ? run_client() : run_server();
+	ft_stop();
+	if (ret)
+		return ret;
+
+	snprintf(test_name, sizeof(test_name), "%s%s%d",
+		 use_multi ? "multi_" : "", use_more ? "more_" : "window_",
+		 opts.window_size);
+	if (opts.machr)
+		show_perf_mr(opts.transfer_size, opts.iterations, &start, &end,
+			     1, opts.argc, opts.argv);
+	else
+		show_perf(test_name, opts.transfer_size, opts.iterations,
+			  &start, &end, 1);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int ret, op;
+
+	opts = INIT_OPTS;
+	opts.options |= FT_OPT_SIZE;
+	opts.transfer_size = 64;
+	opts.iterations = 100000;
+
+	timeout = 5;
+	cq_attr.format = FI_CQ_FORMAT_MSG;
+
+	hints = fi_allocinfo();
+	if (!hints)
+		return EXIT_FAILURE;
+
+	while ((op = getopt(argc, argv, "hMRT:" CS_OPTS INFO_OPTS
+			    BENCHMARK_OPTS)) != -1) {
+		switch (op) {
+		case 'M':
+			use_more = 1;
+			break;
+		case 'R':
+			use_multi = 1;
+			break;
+		case 'T':
+			timeout = atoi(optarg);
+			break;
+		default:
+			ft_parse_benchmark_opts(op, optarg);
+			ft_parseinfo(op, optarg, hints);
+			ft_parsecsopts(op, optarg, &opts);
+			break;
+		case '?':
+		case 'h':
+			ft_csusage(argv[0], "Packet rate test for datagram "
+				   "endpoints.");
+			ft_benchmark_usage();
+			FT_PRINT_OPTS_USAGE("-M", "post sends with FI_MORE "
+					    "within a window");
+			FT_PRINT_OPTS_USAGE("-R", "receive into multi-receive "
+					    "buffers");
+			FT_PRINT_OPTS_USAGE("-T <timeout>",
+					"seconds before timeout on receive");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc)
+		opts.dst_addr = argv[optind];
+
+	if (opts.window_size < 1) {
+		ft_csusage(argv[0], NULL);
+		return EXIT_FAILURE;
+	}
+
+	hints->ep_attr->type = FI_EP_DGRAM;
+	hints->ep_attr->max_msg_size = opts.transfer_size;
+	hints->caps = FI_MSG | (use_multi ? FI_MULTI_RECV : 0);
+	hints->mode |= FI_CONTEXT;
+	hints->domain_attr->mr_mode = FI_MR_LOCAL | OFI_MR_BASIC_MAP;
+	hints->domain_attr->threading = FI_THREAD_DOMAIN;
+
+	ret = run();
+
+	free(tx_ctxs);
+	free(rx_ctxs);
+	FT_CLOSE_FID(multi_mr);
+	ft_free_res();
+	free(multi_buf);
+	return ft_exit_code(ret);
+}
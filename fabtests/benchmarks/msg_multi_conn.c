@@ -0,0 +1,375 @@
+/*
+ * Copyright (c) 2019 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under the BSD license
+ * below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <rdma/fi_errno.h>
+#include <rdma/fi_cm.h>
+
+#include <shared.h>
+
+/*
+ * Message rate test over many connections.
+ *
+ * In addition to the connection used for control messages, the client
+ * opens the requested number of connections to the server.  All of them
+ * share the CQs and EQ of the test.  In every round, the client sends one
+ * message on each connection, and the server echoes every message back on
+ * the connection it arrived on, so that a round keeps all connections busy
+ * at once.  This exercises how the provider progresses many endpoints that
+ * are bound to the same CQ.
+ */
+struct conn {
+	struct fid_ep		*ep;
+	struct fi_context	rx_ctx;
+	struct fi_context	tx_ctx;
+};
+
+static struct conn *conns;
+static int conn_cnt = 64;
+static int bench_argc;
+static char **bench_argv;
+
+static int post_conn_recv(struct conn *conn)
+{
+	ssize_t ret;
+
+	do {
+		ret = fi_recv(conn->ep, rx_buf, opts.transfer_size, mr_desc, 0,
+			      &conn->rx_ctx);
+		if (ret == -FI_EAGAIN)
+			(void) fi_cq_read(rxcq, NULL, 0);
+	} while (ret == -FI_EAGAIN);
+
+	if (ret)
+		FT_PRINTERR("fi_recv", ret);
+	return (int) ret;
+}
+
+static int post_conn_send(struct conn *conn)
+{
+	ssize_t ret;
+
+	do {
+		ret = fi_send(conn->ep, tx_buf, opts.transfer_size, mr_desc, 0,
+			      &conn->tx_ctx);
+		if (ret == -FI_EAGAIN)
+			(void) fi_cq_read(txcq, NULL, 0);
+	} while (ret == -FI_EAGAIN);
+
+	if (ret)
+		FT_PRINTERR("fi_send", ret);
+	return (int) ret;
+}
+
+static int open_conn(struct conn *conn, struct fi_info *info)
+{
+	int ret;
+
+	ret = fi_endpoint(domain, info, &conn->ep, NULL);
+	if (ret) {
+		FT_PRINTERR("fi_endpoint", ret);
+		return ret;
+	}
+
+	ret = ft_enable_ep(conn->ep, eq, NULL, txcq, rxcq, NULL, NULL);
+	if (ret)
+		return ret;
+
+	return post_conn_recv(conn);
+}
+
+static int server_accept_conns(void)
+{
+	struct fi_info *info;
+	int i, ret;
+
+	for (i = 0; i < conn_cnt; i++) {
+		ret = ft_retrieve_conn_req(eq, &info);
+		if (ret)
+			return ret;
+
+		ret = open_conn(&conns[i], info);
+		if (!ret)
+			ret = ft_accept_connection(conns[i].ep, eq);
+		if (ret) {
+			fi_reject(pep, info->handle, NULL, 0);
+			fi_freeinfo(info);
+			return ret;
+		}
+		fi_freeinfo(info);
+	}
+	return 0;
+}
+
+static int client_connect_conns(void)
+{
+	int i, ret;
+
+	for (i = 0; i < conn_cnt; i++) {
+		ret = open_conn(&conns[i], fi);
+		if (ret)
+			return ret;
+
+		ret = ft_connect_ep(conns[i].ep, eq, fi->dest_addr);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int alloc_conns(void)
+{
+	conns = calloc(conn_cnt, sizeof(*conns));
+	if (!conns)
+		return -FI_ENOMEM;
+
+	return opts.dst_addr ? client_connect_conns() : server_accept_conns();
+}
+
+static void free_conns(void)
+{
+	int i;
+
+	if (!conns)
+		return;
+
+	for (i = 0; i < conn_cnt; i++)
+		FT_CLOSE_FID(conns[i].ep);
+	free(conns);
+}
+
+static int read_comp(struct fid_cq *cq, struct fi_cq_entry *comp)
+{
+	int ret;
+
+	do {
+		ret = fi_cq_read(cq, comp, 1);
+	} while (ret == -FI_EAGAIN);
+
+	if (ret < 0)
+		return ret == -FI_EAVAIL ? ft_cq_readerr(cq) : ret;
+	return 0;
+}
+
+/*
+ * Drains the tx CQ while waiting for received messages.  The control
+ * message of the peer's next ft_sync() may arrive before our echoes.
+ */
+static int wait_rx(struct fi_cq_entry *comp, int *tx_done)
+{
+	int ret;
+
+	for (;;) {
+		ret = fi_cq_read(rxcq, comp, 1);
+		if (ret == 1) {
+			if (comp->op_context != &rx_ctx)
+				return 0;
+			rx_cq_cntr++;
+			continue;
+		}
+		if (ret != -FI_EAGAIN)
+			return ret == -FI_EAVAIL ? ft_cq_readerr(rxcq) : ret;
+
+		ret = fi_cq_read(txcq, comp, 1);
+		if (ret == 1)
+			(*tx_done)++;
+		else if (ret != -FI_EAGAIN)
+			return ret == -FI_EAVAIL ? ft_cq_readerr(txcq) : ret;
+	}
+}
+
+static int run_client(void)
+{
+	struct fi_cq_entry comp;
+	struct conn *conn;
+	int i, j, tx_done, ret;
+
+	for (i = 0; i < opts.iterations; i++) {
+		for (j = 0; j < conn_cnt; j++) {
+			ret = post_conn_send(&conns[j]);
+			if (ret)
+				return ret;
+		}
+
+		tx_done = 0;
+		for (j = 0; j < conn_cnt; j++) {
+			ret = wait_rx(&comp, &tx_done);
+			if (ret)
+				return ret;
+
+			conn = container_of(comp.op_context, struct conn,
+					    rx_ctx);
+			ret = post_conn_recv(conn);
+			if (ret)
+				return ret;
+		}
+
+		for (; tx_done < conn_cnt; tx_done++) {
+			ret = read_comp(txcq, &comp);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+static int run_server(void)
+{
+	struct fi_cq_entry comp;
+	struct conn *conn;
+	int i, total, tx_done = 0, ret;
+
+	total = opts.iterations * conn_cnt;
+	for (i = 0; i < total; i++) {
+		ret = wait_rx(&comp, &tx_done);
+		if (ret)
+			return ret;
+
+		conn = container_of(comp.op_context, struct conn, rx_ctx);
+		ret = post_conn_recv(conn);
+		if (ret)
+			return ret;
+
+		ret = post_conn_send(conn);
+		if (ret)
+			return ret;
+	}
+
+	for (; tx_done < total; tx_done++) {
+		ret = read_comp(txcq, &comp);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int msg_rate(void)
+{
+	int ret;
+
+	ret = ft_sync();
+	if (ret)
+		return ret;
+
+	ft_start();
+	ret = opts.dst_addr ? run_client() : run_server();
+	ft_stop();
+	if (ret)
+		return ret;
+
+	ret = ft_sync();
+	if (ret)
+		return ret;
+
+	snprintf(test_name, sizeof(test_name), "%d_conns", conn_cnt);
+	if (opts.machr)
+		show_perf_mr(opts.transfer_size, opts.iterations * conn_cnt,
+			     &start, &end, 2, bench_argc, bench_argv);
+	else
+		show_perf(test_name, opts.transfer_size,
+			  opts.iterations * conn_cnt, &start, &end, 2);
+	return 0;
+}
+
+static int run(void)
+{
+	int ret;
+
+	ret = ft_init_fabric_cm();
+	if (ret)
+		return ret;
+
+	ret = alloc_conns();
+	if (ret)
+		return ret;
+
+	ret = msg_rate();
+	if (ret)
+		return ret;
+
+	return ft_finalize();
+}
+
+int main(int argc, char **argv)
+{
+	int op, ret;
+
+	opts = INIT_OPTS;
+	opts.options |= FT_OPT_SIZE;
+	opts.transfer_size = 64;
+	opts.iterations = 1000;
+
+	hints = fi_allocinfo();
+	if (!hints)
+		return EXIT_FAILURE;
+
+	while ((op = getopt(argc, argv, "n:h" CS_OPTS INFO_OPTS)) != -1) {
+		switch (op) {
+		default:
+			ft_parseinfo(op, optarg, hints);
+			ft_parsecsopts(op, optarg, &opts);
+			break;
+		case 'n':
+			conn_cnt = atoi(optarg);
+			break;
+		case '?':
+		case 'h':
+			ft_csusage(argv[0], "Message rate test over many "
+				   "connections sharing a CQ.");
+			FT_PRINT_OPTS_USAGE("-n <int>",
+				"number of connections (def 64)");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc)
+		opts.dst_addr = argv[optind];
+
+	if (conn_cnt < 1) {
+		ft_csusage(argv[0], NULL);
+		return EXIT_FAILURE;
+	}
+
+	bench_argc = argc;
+	bench_argv = argv;
+
+	hints->ep_attr->type = FI_EP_MSG;
+	hints->caps = FI_MSG;
+	hints->mode = FI_CONTEXT;
+	hints->domain_attr->mr_mode = FI_MR_LOCAL | OFI_MR_BASIC_MAP;
+
+	ret = run();
+
+	free_conns();
+	ft_free_res();
+	return ft_exit_code(ret);
+}
@@ -0,0 +1,443 @@
+/*
+ * Copyright (c) 2019 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under the BSD license
+ * below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include <rdma/fi_errno.h>
+#include <rdma/fi_tagged.h>
+
+#include <shared.h>
+
+/*
+ * Message rate test for many senders targeting a single receiver.
+ *
+ * The client opens one endpoint per sender and drives each of them from its
+ * own thread.  The server receives from all of them on a single endpoint and
+ * reports the aggregate message rate.  The number of senders is doubled for
+ * every round, up to the requested maximum.  Messages that fit into the
+ * inject size are injected, larger ones are sent with up to window size
+ * transfers outstanding per sender.  The client reports how long the
+ * slowest and the average sender took to finish, which shows how evenly
+ * the receiver is shared under incast.
+ *
+ * Data messages carry a tag that is never used by the control messages
+ * exchanged through ft_sync().
+ */
+#define SENDER_TAG	(1ULL << 63)
+
+struct sender {
+	pthread_t	thread;
+	struct fid_ep	*ep;
+	struct fid_cq	*cq;
+	struct fi_context *ctx;
+	int64_t		elapsed;
+	int		ret;
+};
+
+static struct sender *senders;
+static struct fi_info *sender_fi;
+static struct fi_context *recv_ctx;
+static int max_senders = 8;
+static int bench_argc;
+static char **bench_argv;
+
+static int setup_sender(struct sender *sender)
+{
+	int ret;
+
+	sender->ctx = calloc(opts.window_size, sizeof(*sender->ctx));
+	if (!sender->ctx)
+		return -FI_ENOMEM;
+
+	ret = fi_cq_open(domain, &cq_attr, &sender->cq, NULL);
+	if (ret) {
+		FT_PRINTERR("fi_cq_open", ret);
+		return ret;
+	}
+
+	ret = fi_endpoint(domain, sender_fi, &sender->ep, NULL);
+	if (ret) {
+		FT_PRINTERR("fi_endpoint", ret);
+		return ret;
+	}
+
+	return ft_enable_ep(sender->ep, eq, av, sender->cq, sender->cq,
+			    NULL, NULL);
+}
+
+/*
+ * Senders of larger messages keep a window of them outstanding each, so
+ * the server posts receives for all of them, as far as the receive queue
+ * allows.
+ */
+static int recv_window(int cnt)
+{
+	if (opts.transfer_size <= fi->tx_attr->inject_size)
+		return opts.window_size;
+
+	return (int) MIN((size_t) opts.window_size * cnt, fi->rx_attr->size);
+}
+
+static int alloc_sender_res(void)
+{
+	int i, ret;
+
+	if (!opts.dst_addr) {
+		recv_ctx = calloc(recv_window(max_senders), sizeof(*recv_ctx));
+		return recv_ctx ? 0 : -FI_ENOMEM;
+	}
+
+	senders = calloc(max_senders, sizeof(*senders));
+	if (!senders)
+		return -FI_ENOMEM;
+
+	/* Let the provider pick a distinct address for every sender */
+	ret = fi_getinfo(FT_FIVERSION, NULL, NULL, 0, hints, &sender_fi);
+	if (ret) {
+		FT_PRINTERR("fi_getinfo", ret);
+		return ret;
+	}
+
+	for (i = 0; i < max_senders; i++) {
+		ret = setup_sender(&senders[i]);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static void free_sender_res(void)
+{
+	int i;
+
+	if (senders) {
+		for (i = 0; i < max_senders; i++) {
+			FT_CLOSE_FID(senders[i].ep);
+			FT_CLOSE_FID(senders[i].cq);
+			free(senders[i].ctx);
+		}
+		free(senders);
+	}
+	if (sender_fi)
+		fi_freeinfo(sender_fi);
+	free(recv_ctx);
+}
+
+static ssize_t inject_msgs(struct sender *sender)
+{
+	ssize_t ret = 0;
+	int i;
+
+	for (i = 0; i < opts.iterations; i++) {
+		do {
+			ret = fi_tinject(sender->ep, tx_buf, opts.transfer_size,
+					 remote_fi_addr, SENDER_TAG);
+			if (ret == -FI_EAGAIN)
+				(void) fi_cq_read(sender->cq, NULL, 0);
+		} while (ret == -FI_EAGAIN);
+
+		if (ret) {
+			FT_PRINTERR("fi_tinject", ret);
+			break;
+		}
+	}
+	return ret;
+}
+
+static ssize_t post_send(struct sender *sender, void *context)
+{
+	ssize_t ret;
+
+	do {
+		ret = fi_tsend(sender->ep, tx_buf, opts.transfer_size, mr_desc,
+			       remote_fi_addr, SENDER_TAG, context);
+		if (ret == -FI_EAGAIN)
+			(void) fi_cq_read(sender->cq, NULL, 0);
+	} while (ret == -FI_EAGAIN);
+
+	if (ret)
+		FT_PRINTERR("fi_tsend", ret);
+	return ret;
+}
+
+static ssize_t send_window(struct sender *sender)
+{
+	struct fi_cq_tagged_entry comp;
+	int posted, done;
+	ssize_t ret;
+
+	for (posted = 0; posted < MIN(opts.iterations, opts.window_size);
+	     posted++) {
+		ret = post_send(sender, &sender->ctx[posted]);
+		if (ret)
+			return ret;
+	}
+
+	for (done = 0; done < opts.iterations; ) {
+		ret = fi_cq_read(sender->cq, &comp, 1);
+		if (ret == -FI_EAGAIN)
+			continue;
+		if (ret < 0) {
+			FT_PRINTERR("fi_cq_read", ret);
+			return ret;
+		}
+
+		done++;
+		if (posted < opts.iterations) {
+			ret = post_send(sender, comp.op_context);
+			if (ret)
+				return ret;
+			posted++;
+		}
+	}
+	return 0;
+}
+
+static void *send_msgs(void *arg)
+{
+	struct sender *sender = arg;
+	struct timespec begin, finish;
+	ssize_t ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	if (opts.transfer_size <= fi->tx_attr->inject_size)
+		ret = inject_msgs(sender);
+	else
+		ret = send_window(sender);
+	clock_gettime(CLOCK_MONOTONIC, &finish);
+
+	sender->elapsed = get_elapsed(&begin, &finish, MICRO);
+	sender->ret = (int) ret;
+	return NULL;
+}
+
+static int run_senders(int cnt)
+{
+	int i, ret;
+
+	for (i = 0; i < cnt; i++) {
+		senders[i].ret = 0;
+		ret = pthread_create(&senders[i].thread, NULL, send_msgs,
+				     &senders[i]);
+		if (ret) {
+			FT_PRINTERR("pthread_create", -ret);
+			cnt = i;
+			break;
+		}
+	}
+
+	for (i = 0; i < cnt; i++) {
+		pthread_join(senders[i].thread, NULL);
+		if (senders[i].ret)
+			ret = senders[i].ret;
+	}
+	return ret;
+}
+
+static void show_sender_times(int cnt)
+{
+	int64_t max = 0, sum = 0;
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		max = MAX(max, senders[i].elapsed);
+		sum += senders[i].elapsed;
+	}
+	printf("%d_senders: slowest sender %.2f ms, average %.2f ms\n",
+	       cnt, max / 1000.0, sum / 1000.0 / cnt);
+}
+
+static int post_recv(void *context)
+{
+	ssize_t ret;
+
+	do {
+		ret = fi_trecv(ep, rx_buf, opts.transfer_size, mr_desc, 0,
+			       SENDER_TAG, 0, context);
+	} while (ret == -FI_EAGAIN);
+
+	if (ret)
+		FT_PRINTERR("fi_trecv", ret);
+	return (int) ret;
+}
+
+static int recv_msgs(int cnt)
+{
+	struct fi_cq_tagged_entry comp;
+	int total = cnt * opts.iterations;
+	int posted, done, ret;
+
+	for (posted = 0; posted < MIN(total, recv_window(cnt)); posted++) {
+		ret = post_recv(&recv_ctx[posted]);
+		if (ret)
+			return ret;
+	}
+
+	for (done = 0; done < total; ) {
+		ret = fi_cq_read(rxcq, &comp, 1);
+		if (ret == -FI_EAGAIN)
+			continue;
+		if (ret < 0)
+			return ret == -FI_EAVAIL ? ft_cq_readerr(rxcq) : ret;
+
+		/* The client's ft_sync() may overtake its senders' data */
+		if (comp.op_context == &rx_ctx) {
+			rx_cq_cntr++;
+			continue;
+		}
+
+		done++;
+		if (posted < total) {
+			ret = post_recv(comp.op_context);
+			if (ret)
+				return ret;
+			posted++;
+		}
+	}
+	return 0;
+}
+
+static int msg_rate(int cnt)
+{
+	int ret;
+
+	ret = ft_sync();
+	if (ret)
+		return ret;
+
+	ft_start();
+	if (opts.dst_addr)
+		ret = run_senders(cnt);
+	else
+		ret = recv_msgs(cnt);
+	ft_stop();
+	if (ret)
+		return ret;
+
+	ret = ft_sync();
+	if (ret)
+		return ret;
+
+	if (opts.dst_addr) {
+		show_sender_times(cnt);
+		return 0;
+	}
+
+	snprintf(test_name, sizeof(test_name), "%d_senders", cnt);
+	if (opts.machr)
+		show_perf_mr(opts.transfer_size, cnt * opts.iterations,
+			     &start, &end, 1, bench_argc, bench_argv);
+	else
+		show_perf(test_name, opts.transfer_size,
+			  cnt * opts.iterations, &start, &end, 1);
+	return 0;
+}
+
+static int run(void)
+{
+	int cnt, ret;
+
+	ret = ft_init_fabric();
+	if (ret)
+		return ret;
+
+	ret = alloc_sender_res();
+	if (ret)
+		return ret;
+
+	for (cnt = 1; ; cnt = MIN(cnt * 2, max_senders)) {
+		ret = msg_rate(cnt);
+		if (ret || cnt == max_senders)
+			break;
+	}
+	if (ret)
+		return ret;
+
+	return ft_finalize();
+}
+
+int main(int argc, char **argv)
+{
+	int op, ret;
+
+	opts = INIT_OPTS;
+	opts.options |= FT_OPT_SIZE;
+	opts.transfer_size = 64;
+	opts.iterations = 100000;
+
+	hints = fi_allocinfo();
+	if (!hints)
+		return EXIT_FAILURE;
+
+	while ((op = getopt(argc, argv, "n:h" CS_OPTS INFO_OPTS)) != -1) {
+		switch (op) {
+		default:
+			ft_parseinfo(op, optarg, hints);
+			ft_parsecsopts(op, optarg, &opts);
+			break;
+		case 'n':
+			max_senders = atoi(optarg);
+			break;
+		case '?':
+		case 'h':
+			ft_csusage(argv[0], "Message rate test for many senders "
+				   "targeting one RDM endpoint.");
+			FT_PRINT_OPTS_USAGE("-n <int>",
+				"maximum number of senders (def 8)");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc)
+		opts.dst_addr = argv[optind];
+
+	if (max_senders < 1) {
+		ft_csusage(argv[0], NULL);
+		return EXIT_FAILURE;
+	}
+
+	bench_argc = argc;
+	bench_argv = argv;
+	opts.av_size = max_senders + 1;
+
+	hints->ep_attr->type = FI_EP_RDM;
+	hints->caps = FI_TAGGED;
+	hints->mode = FI_CONTEXT;
+	hints->domain_attr->mr_mode = FI_MR_LOCAL | OFI_MR_BASIC_MAP;
+	hints->domain_attr->threading = FI_THREAD_SAFE;
+
+	ret = run();
+
+	free_sender_res();
+	ft_free_res();
+	return ft_exit_code(ret);
+}
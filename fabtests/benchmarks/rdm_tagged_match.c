@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2019 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under the BSD license
+ * below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <rdma/fi_errno.h>
+#include <rdma/fi_tagged.h>
+
+#include <shared.h>
+
+/*
+ * Tag matching cost versus queue depth.
+ *
+ * For every round the receiver's match queue is loaded with a number of
+ * decoy entries that never match the measured traffic.  By default the
+ * decoys are receives posted ahead of the measured ones, so that every
+ * arriving message is matched against the posted queue.  With -U the
+ * client sends the decoys first instead, and every posted receive is
+ * matched against the unexpected queue.  The depth is doubled for every
+ * round, up to the requested maximum, and the decoys are consumed at the
+ * end of the round.
+ *
+ * Data messages are flow controlled one window at a time, so that they
+ * always find their receives posted.  Tags used by the data and decoy
+ * messages are never used by the control messages exchanged through
+ * ft_tx() and ft_rx().
+ */
+#define MATCH_TAG	(1ULL << 63)
+#define DECOY_TAG	(1ULL << 62)
+
+static struct fi_context *recv_ctx;
+static int max_depth = 512;
+static int unexp_decoys;
+static int bench_argc;
+static char **bench_argv;
+
+static int post_recv(uint64_t tag, void *context)
+{
+	ssize_t ret;
+
+	do {
+		ret = fi_trecv(ep, rx_buf, opts.transfer_size, mr_desc,
+			       remote_fi_addr, tag, 0, context);
+		if (ret == -FI_EAGAIN)
+			(void) fi_cq_read(rxcq, NULL, 0);
+	} while (ret == -FI_EAGAIN);
+
+	if (ret)
+		FT_PRINTERR("fi_trecv", ret);
+	return (int) ret;
+}
+
+static int send_msg(uint64_t tag)
+{
+	ssize_t ret;
+
+	do {
+		ret = fi_tinject(ep, tx_buf, opts.transfer_size,
+				 remote_fi_addr, tag);
+		if (ret == -FI_EAGAIN)
+			(void) fi_cq_read(txcq, NULL, 0);
+	} while (ret == -FI_EAGAIN);
+
+	if (ret)
+		FT_PRINTERR("fi_tinject", ret);
+	return (int) ret;
+}
+
+static int wait_recvs(int cnt)
+{
+	struct fi_cq_tagged_entry comp;
+	int ret;
+
+	while (cnt) {
+		ret = fi_cq_read(rxcq, &comp, 1);
+		if (ret == -FI_EAGAIN)
+			continue;
+		if (ret < 0)
+			return ret == -FI_EAVAIL ? ft_cq_readerr(rxcq) : ret;
+		cnt--;
+	}
+	return 0;
+}
+
+static int post_decoys(int depth)
+{
+	int i, ret;
+
+	for (i = 0; i < depth; i++) {
+		ret = post_recv(DECOY_TAG | i, &recv_ctx[opts.window_size + i]);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int send_decoys(int depth)
+{
+	int i, ret;
+
+	for (i = 0; i < depth; i++) {
+		ret = send_msg(DECOY_TAG | i);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int recv_msgs(void)
+{
+	int i, cnt, done, ret;
+
+	for (done = 0; done < opts.iterations; done += cnt) {
+		cnt = MIN(opts.window_size, opts.iterations - done);
+		for (i = 0; i < cnt; i++) {
+			ret = post_recv(MATCH_TAG, &recv_ctx[i]);
+			if (ret)
+				return ret;
+		}
+
+		ret = ft_tx(ep, remote_fi_addr, 1, &tx_ctx);
+		if (ret)
+			return ret;
+
+		ret = wait_recvs(cnt);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int send_msgs(void)
+{
+	int i, cnt, done, ret;
+
+	for (done = 0; done < opts.iterations; done += cnt) {
+		cnt = MIN(opts.window_size, opts.iterations - done);
+		ret = ft_rx(ep, 1);
+		if (ret)
+			return ret;
+
+		for (i = 0; i < cnt; i++) {
+			ret = send_msg(MATCH_TAG);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+static int load_decoys(int depth)
+{
+	if (opts.dst_addr)
+		return unexp_decoys ? send_decoys(depth) : 0;
+	return unexp_decoys ? 0 : post_decoys(depth);
+}
+
+static int drain_decoys(int depth)
+{
+	int ret;
+
+	if (opts.dst_addr)
+		return unexp_decoys ? 0 : send_decoys(depth);
+
+	if (unexp_decoys) {
+		ret = post_decoys(depth);
+		if (ret)
+			return ret;
+	}
+	return wait_recvs(depth);
+}
+
+static int match_rate(int depth)
+{
+	int ret;
+
+	ret = load_decoys(depth);
+	if (ret)
+		return ret;
+
+	ret = ft_sync();
+	if (ret)
+		return ret;
+
+	ft_start();
+	ret = opts.dst_addr ? send_msgs() : recv_msgs();
+	ft_stop();
+	if (ret)
+		return ret;
+
+	ret = ft_sync();
+	if (ret)
+		return ret;
+
+	ret = drain_decoys(depth);
+	if (ret)
+		return ret;
+
+	ret = ft_sync();
+	if (ret)
+		return ret;
+
+	if (opts.dst_addr)
+		return 0;
+
+	snprintf(test_name, sizeof(test_name), "%d_%s", depth,
+		 unexp_decoys ? "unexp" : "posted");
+	if (opts.machr)
+		show_perf_mr(opts.transfer_size, opts.iterations,
+			     &start, &end, 1, bench_argc, bench_argv);
+	else
+		show_perf(test_name, opts.transfer_size, opts.iterations,
+			  &start, &end, 1);
+	return 0;
+}
+
+static int run(void)
+{
+	int depth, ret;
+
+	ret = ft_init_fabric();
+	if (ret)
+		return ret;
+
+	if (opts.transfer_size > fi->tx_attr->inject_size) {
+		FT_ERR("transfer size %d exceeds inject size %zu",
+		       opts.transfer_size, fi->tx_attr->inject_size);
+		return -FI_EINVAL;
+	}
+
+	/* Leave room for the receive posted by ft_rx() */
+	if (max_depth + opts.window_size >= fi->rx_attr->size) {
+		FT_ERR("queue depth %d and window %d exceed receive size %zu",
+		       max_depth, opts.window_size, fi->rx_attr->size);
+		return -FI_EINVAL;
+	}
+
+	recv_ctx = calloc(opts.window_size + max_depth, sizeof(*recv_ctx));
+	if (!recv_ctx)
+		return -FI_ENOMEM;
+
+	for (depth = 0; ; depth = depth ? MIN(depth * 2, max_depth) : 1) {
+		ret = match_rate(depth);
+		if (ret || depth == max_depth)
+			break;
+	}
+	if (ret)
+		return ret;
+
+	return ft_finalize();
+}
+
+int main(int argc, char **argv)
+{
+	int op, ret;
+
+	opts = INIT_OPTS;
+	opts.options |= FT_OPT_SIZE;
+	opts.transfer_size = 64;
+	opts.iterations = 10000;
+
+	hints = fi_allocinfo();
+	if (!hints)
+		return EXIT_FAILURE;
+
+	while ((op = getopt(argc, argv, "n:Uh" CS_OPTS INFO_OPTS)) != -1) {
+		switch (op) {
+		default:
+			ft_parseinfo(op, optarg, hints);
+			ft_parsecsopts(op, optarg, &opts);
+			break;
+		case 'n':
+			max_depth = atoi(optarg);
+			break;
+		case 'U':
+			unexp_decoys = 1;
+			break;
+		case '?':
+		case 'h':
+			ft_csusage(argv[0], "Tag matching rate versus match "
+				   "queue depth for RDM endpoints.");
+			FT_PRINT_OPTS_USAGE("-n <int>",
+				"maximum queue depth (def 512)");
+			FT_PRINT_OPTS_USAGE("-U",
+				"queue decoys as unexpected messages");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc)
+		opts.dst_addr = argv[optind];
+
+	if (max_depth < 0) {
+		ft_csusage(argv[0], NULL);
+		return EXIT_FAILURE;
+	}
+
+	bench_argc = argc;
+	bench_argv = argv;
+
+	hints->ep_attr->type = FI_EP_RDM;
+	hints->caps = FI_TAGGED;
+	hints->mode = FI_CONTEXT;
+	hints->domain_attr->mr_mode = FI_MR_LOCAL | OFI_MR_BASIC_MAP;
+
+	ret = run();
+
+	free(recv_ctx);
+	ft_free_res();
+	return ft_exit_code(ret);
+}
@@ -127,6 +127,7 @@ short_tests=(
 	"msg_pingpong -I 5 -v"
 	"msg_bw -I 5"
 	"msg_bw -I 5 -v"
+	"msg_multi_conn -I 5 -n 4"
 	"rma_bw -e msg -o write -I 5"
 	"rma_bw -e msg -o read -I 5"
 	"rma_bw -e msg -o writedata -I 5"
@@ -142,7 +143,12 @@ short_tests=(
 	"rdm_tagged_pingpong -I 5 -v"
 	"rdm_tagged_bw -I 5"
 	"rdm_tagged_bw -I 5 -v"
+	"rdm_multi_sender -I 5 -n 4"
+	"rdm_multi_sender -I 5 -n 4 -S 65536"
+	"rdm_tagged_match -I 5 -n 16"
+	"rdm_tagged_match -I 5 -n 16 -U"
 	"dgram_pingpong -I 5"
+	"dgram_bw -I 5"
 )
 
 standard_tests=(
@@ -152,6 +158,7 @@ standard_tests=(
 	"msg_pingpong -k -v"
 	"msg_bw"
 	"msg_bw -v"
+	"msg_multi_conn"
 	"rma_bw -e msg -o write"
 	"rma_bw -e msg -o read"
 	"rma_bw -e msg -o writedata"
@@ -169,8 +176,15 @@ standard_tests=(
 	"rdm_tagged_pingpong -v"
 	"rdm_tagged_bw"
 	"rdm_tagged_bw -v"
+	"rdm_multi_sender"
+	"rdm_multi_sender -S 65536 -I 100"
+	"rdm_tagged_match"
+	"rdm_tagged_match -U"
 	"dgram_pingpong"
 	"dgram_pingpong -k"
+	"dgram_bw"
+	"dgram_bw -M"
+	"dgram_bw -R"
 )
 
 unit_tests=(
@@ -67,6 +67,33 @@ static inline int ofi_free_hugepage_buf(void *memptr, size_t size)
 	return -FI_ENOSYS;
 }
 
+static inline int ofi_get_numa_node(void)
+{
+	return -FI_ENOSYS;
+}
+
+static inline int ofi_mbind_node(void *addr, size_t len, int node)
+{
+	return -FI_ENOSYS;
+}
+
+static inline int ofi_mbind_interleave(void *addr, size_t len)
+{
+	return -FI_ENOSYS;
+}
+
+static inline int ofi_get_shared_file(const void *addr, size_t len,
+				      char *path, size_t path_size,
+				      uint64_t *offset)
+{
+	return -FI_ENOSYS;
+}
+
+static inline int ofi_memfd_create(const char *name)
+{
+	return -FI_ENOSYS;
+}
+
 #endif /* _FREEBSD_OSD_H_ */
 
 
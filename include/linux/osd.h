@@ -56,6 +56,13 @@ static inline int ofi_shm_remap(struct util_shm *shm,
 
 ssize_t ofi_get_hugepage_size(void);
 
+int ofi_get_numa_node(void);
+int ofi_mbind_node(void *addr, size_t len, int node);
+int ofi_mbind_interleave(void *addr, size_t len);
+int ofi_get_shared_file(const void *addr, size_t len, char *path,
+			size_t path_size, uint64_t *offset);
+int ofi_memfd_create(const char *name);
+
 static inline int ofi_alloc_hugepage_buf(void **memptr, size_t size)
 {
 	*memptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
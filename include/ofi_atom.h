@@ -38,6 +38,7 @@
 #include <assert.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 #include <ofi_lock.h>
 #include <ofi_osd.h>
@@ -123,6 +124,15 @@ typedef atomic_long	ofi_atomic_int64_t;
 		ATOMIC_IS_INITIALIZED(atomic);								\
 		return (int##radix##_t)atomic_fetch_sub_explicit(&atomic->val, val,			\
 								 memory_order_acq_rel) - val;		\
+	}												\
+	static inline											\
+	bool ofi_atomic_cas_bool##radix(ofi_atomic##radix##_t *atomic,					\
+					int##radix##_t expected, int##radix##_t desired)		\
+	{												\
+		ATOMIC_IS_INITIALIZED(atomic);								\
+		return atomic_compare_exchange_strong_explicit(&atomic->val, &expected, desired,	\
+							       memory_order_acq_rel,			\
+							       memory_order_relaxed);			\
 	}
 
 #elif defined HAVE_BUILTIN_ATOMICS
@@ -184,6 +194,13 @@ typedef atomic_long	ofi_atomic_int64_t;
 	{												\
 		*(ofi_atomic_ptr(atomic)) = value;							\
 		ATOMIC_INIT(atomic);									\
+	}												\
+	static inline											\
+	bool ofi_atomic_cas_bool##radix(ofi_atomic##radix##_t *atomic,					\
+					int##radix##_t expected, int##radix##_t desired)		\
+	{												\
+		ATOMIC_IS_INITIALIZED(atomic);								\
+		return ofi_atomic_cas_bool(radix, ofi_atomic_ptr(atomic), expected, desired);		\
 	}
 	
 #else /* HAVE_ATOMICS */
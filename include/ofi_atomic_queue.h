@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2019 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _OFI_ATOMIC_QUEUE_H_
+#define _OFI_ATOMIC_QUEUE_H_
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <ofi.h>
+#include <ofi_atom.h>
+
+#if !defined(HAVE_ATOMICS) && !defined(HAVE_BUILTIN_ATOMICS)
+#error "lock-free queues require atomic compare-and-swap"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bounded lock-free queue template
+ *
+ * Every slot carries a sequence number telling which position of the queue
+ * it may currently hold (Vyukov's bounded MPMC queue).  A slot at position
+ * pos is free for producers when seq == pos and holds a committed entry when
+ * seq == pos + 1.  Releasing it sets seq to pos + size, the position it will
+ * hold on the next lap.
+ *
+ * Producers reserve one or more consecutive slots with _next(), fill them in
+ * place, and publish each of them with _commit().  A single consumer may look
+ * at the head in place with _head() and release it with _discard().  When
+ * several consumers share the queue, they must use _pop() instead.
+ *
+ * The queue holds no pointers, so it may be placed in shared memory.
+ */
+#define OFI_ATOMIC_QUEUE_PAD	64
+
+#define OFI_DECLARE_ATOMIC_Q(entrytype, name)				\
+struct name ## _entry {							\
+	ofi_atomic64_t	seq;						\
+	entrytype	buf;						\
+};									\
+									\
+struct name {								\
+	size_t		size;						\
+	size_t		size_mask;					\
+	ofi_atomic64_t	write_pos;					\
+	uint8_t		pad0[OFI_ATOMIC_QUEUE_PAD];			\
+	ofi_atomic64_t	read_pos;					\
+	uint8_t		pad1[OFI_ATOMIC_QUEUE_PAD];			\
+	struct name ## _entry entry[];					\
+};									\
+									\
+static inline void name ## _init(struct name *aq, size_t size)		\
+{									\
+	size_t i;							\
+	assert(size == roundup_power_of_two(size));			\
+	aq->size = size;						\
+	aq->size_mask = size - 1;					\
+	ofi_atomic_initialize64(&aq->write_pos, 0);			\
+	ofi_atomic_initialize64(&aq->read_pos, 0);			\
+	for (i = 0; i < size; i++)					\
+		ofi_atomic_initialize64(&aq->entry[i].seq, i);		\
+}									\
+									\
+static inline struct name * name ## _create(size_t size)		\
+{									\
+	struct name *aq;						\
+	aq = calloc(1, sizeof(*aq) + sizeof(struct name ## _entry) *	\
+		    (roundup_power_of_two(size)));			\
+	if (aq)								\
+		name ##_init(aq, roundup_power_of_two(size));		\
+	return aq;							\
+}									\
+									\
+static inline void name ## _free(struct name *aq)			\
+{									\
+	free(aq);							\
+}									\
+									\
+static inline entrytype *name ## _slot(struct name *aq, int64_t pos)	\
+{									\
+	return &aq->entry[pos & aq->size_mask].buf;			\
+}									\
+									\
+/* Reserve count consecutive slots, starting at *pos */			\
+static inline int name ## _next(struct name *aq, int count,		\
+				int64_t *pos)				\
+{									\
+	int64_t seq, write_pos;						\
+	int i;								\
+									\
+	assert(count > 0 && count <= aq->size);			\
+	write_pos = ofi_atomic_get64(&aq->write_pos);			\
+	for (;;) {							\
+		for (i = 0; i < count; i++) {				\
+			seq = ofi_atomic_get64(&aq->entry[(write_pos +	\
+					i) & aq->size_mask].seq);	\
+			if (seq != write_pos + i)			\
+				break;					\
+		}							\
+		if (i == count) {					\
+			if (ofi_atomic_cas_bool64(&aq->write_pos,	\
+					write_pos, write_pos + count))	\
+				break;					\
+		} else if (seq < write_pos + i) {			\
+			return -FI_ENOENT;				\
+		}							\
+		write_pos = ofi_atomic_get64(&aq->write_pos);		\
+	}								\
+	*pos = write_pos;						\
+	return 0;							\
+}									\
+									\
+static inline void name ## _commit(struct name *aq, int64_t pos)	\
+{									\
+	ofi_atomic_set64(&aq->entry[pos & aq->size_mask].seq, pos + 1);	\
+}									\
+									\
+static inline int name ## _isempty(struct name *aq)			\
+{									\
+	int64_t read_pos = ofi_atomic_get64(&aq->read_pos);		\
+	return ofi_atomic_get64(&aq->entry[read_pos &			\
+				aq->size_mask].seq) != read_pos + 1;	\
+}									\
+									\
+/* Single consumer only */						\
+static inline entrytype *name ## _head(struct name *aq)		\
+{									\
+	return name ## _isempty(aq) ? NULL :				\
+	       name ## _slot(aq, ofi_atomic_get64(&aq->read_pos));	\
+}									\
+									\
+/* Single consumer only */						\
+static inline void name ## _discard(struct name *aq)			\
+{									\
+	int64_t read_pos = ofi_atomic_get64(&aq->read_pos);		\
+	ofi_atomic_set64(&aq->read_pos, read_pos + 1);			\
+	ofi_atomic_set64(&aq->entry[read_pos & aq->size_mask].seq,	\
+			 read_pos + aq->size);				\
+}									\
+									\
+static inline int name ## _pop(struct name *aq, entrytype *buf)	\
+{									\
+	int64_t seq, read_pos;						\
+									\
+	read_pos = ofi_atomic_get64(&aq->read_pos);			\
+	for (;;) {							\
+		seq = ofi_atomic_get64(&aq->entry[read_pos &		\
+				       aq->size_mask].seq);		\
+		if (seq == read_pos + 1) {				\
+			if (ofi_atomic_cas_bool64(&aq->read_pos,	\
+					read_pos, read_pos + 1))	\
+				break;					\
+		} else if (seq < read_pos + 1) {			\
+			return -FI_ENOENT;				\
+		}							\
+		read_pos = ofi_atomic_get64(&aq->read_pos);		\
+	}								\
+	*buf = *name ## _slot(aq, read_pos);				\
+	ofi_atomic_set64(&aq->entry[read_pos & aq->size_mask].seq,	\
+			 read_pos + aq->size);				\
+	return 0;							\
+}									\
+									\
+static inline int name ## _push(struct name *aq, entrytype *buf)	\
+{									\
+	int64_t pos;							\
+									\
+	if (name ## _next(aq, 1, &pos))					\
+		return -FI_ENOENT;					\
+	*name ## _slot(aq, pos) = *buf;					\
+	name ## _commit(aq, pos);					\
+	return 0;							\
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _OFI_ATOMIC_QUEUE_H_ */
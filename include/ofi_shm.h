@@ -42,6 +42,8 @@
 #include <ofi_proto.h>
 #include <ofi_mem.h>
 #include <ofi_rbuf.h>
+#include <ofi_atomic_queue.h>
+#include <ofi_indexer.h>
 
 #include <rdma/providers/fi_prov.h>
 
@@ -50,7 +52,7 @@ extern "C" {
 #endif
 
 
-#define SMR_VERSION	1
+#define SMR_VERSION	8
 
 #ifdef HAVE_ATOMICS
 #define SMR_FLAG_ATOMIC	(1 << 0)
@@ -72,10 +74,13 @@ enum {
 	smr_src_inline,	/* command data */
 	smr_src_inject,	/* inject buffers */
 	smr_src_iov,	/* reference iovec via CMA */
+	smr_src_sar,	/* segmentation and reassembly via bounce buffers */
 };
 
 #define SMR_REMOTE_CQ_DATA	(1 << 0)
 #define SMR_RMA_REQ		(1 << 1)
+#define SMR_NOOP		(1 << 2)	/* reserved slot left unused */
+#define SMR_WINDOW		(1 << 3)	/* iov lies in sender's windows */
 
 /* 
  * Unique smr_op_hdr for smr message protocol:
@@ -109,6 +114,7 @@ struct smr_msg_hdr {
 #define SMR_COMP_DATA_LEN	(SMR_MSG_DATA_LEN / 2)
 union smr_cmd_data {
 	uint8_t			msg[SMR_MSG_DATA_LEN];
+	uint64_t		sar;
 	struct {
 		uint8_t		iov_count;
 		struct iovec	iov[(SMR_MSG_DATA_LEN - 8) /
@@ -146,6 +152,44 @@ struct smr_cmd {
 #define SMR_INJECT_SIZE		4096
 #define SMR_COMP_INJECT_SIZE	(SMR_INJECT_SIZE / 2)
 
+#define SMR_SAR_SIZE		16384
+#define SMR_SAR_BUF_CNT		4	/* bounce buffers per SAR message */
+#define SMR_SAR_POOL_SIZE	16	/* concurrent SAR messages per region */
+
+#ifdef HAVE_ATOMICS
+#define smr_wmb()	atomic_thread_fence(memory_order_release)
+#define smr_rmb()	atomic_thread_fence(memory_order_acquire)
+#define smr_mb()	atomic_thread_fence(memory_order_seq_cst)
+#else
+#define smr_wmb()	__sync_synchronize()
+#define smr_rmb()	__sync_synchronize()
+#define smr_mb()	__sync_synchronize()
+#endif
+
+#define SMR_SIGNAL_ADDR_SIZE	16
+
+#define SMR_MR_WINDOW_CNT	32
+#define SMR_MR_PATH_SIZE	128
+
+/*
+ * Registered memory backed by a file that peers can map themselves,
+ * published so that they can access it without involving the owner.  An
+ * entry is rewritten under its sequence count, which is odd while the
+ * entry is being updated; readers discard what they read if the count was
+ * odd or has changed.  An entry with a zero length is unused.  An entry
+ * with an empty path is backed by a memfd, which the owner passes over its
+ * mr socket to peers that ask for it.
+ */
+struct smr_mr_window {
+	ofi_atomic32_t	seq;
+	uint64_t	key;
+	uint64_t	addr;	/* start of the registration in owner's VA */
+	uint64_t	len;
+	uint64_t	access;
+	uint64_t	offset;	/* of addr in the backing file */
+	char		path[SMR_MR_PATH_SIZE];
+};
+
 #define SMR_NAME_SIZE	32
 struct smr_addr {
 	char		name[SMR_NAME_SIZE];
@@ -154,16 +198,42 @@ struct smr_addr {
 
 struct smr_region;
 
+/*
+ * CMA capability towards a peer, probed on first use.  Targets also publish
+ * theirs in the initiator's region (see smr_peer_cma()), since they do the
+ * copy for sends and ptrace may be allowed in one direction only.
+ */
+enum {
+	SMR_CMA_CAP_NA,
+	SMR_CMA_CAP_ON,
+	SMR_CMA_CAP_OFF,
+};
+
+/*
+ * A peer's region is mapped on the first transfer to or from it.  Regions
+ * left idle for a sweep interval are retired, and unmapped one interval
+ * later unless they are used again in the meantime, so a caller still holding
+ * the region pointer gets a full interval to finish with it.
+ */
 struct smr_peer {
 	struct smr_addr		peer;
 	struct smr_region	*region;
+	struct smr_region	*retired;
+	uint64_t		last_epoch;
+	uint64_t		peer_gen;	/* peer's peer_gen at last lookup */
+	int			cma_cap;
 };
 
-#define SMR_MAX_PEERS	256
+#define SMR_MAX_PEERS	(OFI_IDX_MAX_INDEX + 1)
 
 struct smr_map {
-	fastlock_t	lock;
-	struct smr_peer	peers[SMR_MAX_PEERS];
+	fastlock_t		lock;
+	struct index_map	peers;	/* struct smr_peer *, by fi_addr */
+	int			peer_cnt;
+	uint64_t		epoch;
+	uint64_t		next_sweep;
+	ofi_atomic32_t		busy;	/* pending responses and SAR transfers;
+					   regions stay mapped while nonzero */
 };
 
 struct smr_region {
@@ -171,24 +241,42 @@ struct smr_region {
 	uint8_t		resv;
 	uint16_t	flags;
 	int		pid;
-	fastlock_t	lock; /* lock for shm access
+	fastlock_t	lock; /* serializes the owner's progress and protects
+				 the SAR pool.  The command queue and inject
+				 pool are lock-free.
 				 Must hold smr->lock before tx/rx cq locks
 				 in order to progress or post recv */
 	struct smr_map	*map;
+	void		*base_addr; /* address of region in owner's VA,
+				       used to probe for CMA support */
 
 	size_t		total_size;
-	size_t		cmd_cnt; /* Doubles as a tracker for number of cmds AND
-				    number of inject buffers available for use,
-				    to ensure 1:1 ratio of cmds to inject bufs.
-				    Might not always be paired consistently with
-				    cmd alloc/free depending on protocol
-				    (Ex. unexpected messages, RMA requests) */
+	uint64_t	peer_gen; /* bumped on every name added to the peer
+				     address table */
+
+	ofi_atomic32_t	signal; /* set while the owner sleeps on a wait
+				   object; a peer that clears it must wake
+				   the owner through signal_addr */
+	uint8_t		signal_addrlen;
+	char		signal_addr[SMR_SIGNAL_ADDR_SIZE];
+
+	ofi_atomic32_t	mr_req; /* set by a peer that sent a request to
+				   the owner's mr socket at mr_addr */
+	uint8_t		mr_addrlen;
+	char		mr_addr[SMR_SIGNAL_ADDR_SIZE];
 
 	/* offsets from start of smr_region */
 	size_t		cmd_queue_offset;
 	size_t		resp_queue_offset;
 	size_t		inject_pool_offset;
+	size_t		inject_queue_offset;
+	size_t		sar_pool_offset;
+	size_t		mr_window_offset;
 	size_t		peer_addr_offset;
+	size_t		peer_addr_cnt;
+	size_t		peer_addr_used; /* entries initialized, grown by the
+					   owner as names are published */
+	size_t		peer_cma_offset;
 	size_t		name_offset;
 };
 
@@ -207,13 +295,53 @@ struct smr_inject_buf {
 	};
 };
 
-OFI_DECLARE_CIRQUE(struct smr_cmd, smr_cmd_queue);
+/* SAR bounce buffer status, owned alternately by sender and receiver */
+enum {
+	smr_sar_empty,	/* buffer may be filled by the producer */
+	smr_sar_full,	/* buffer may be drained by the consumer */
+};
+
+struct smr_sar_buf {
+	volatile uint64_t	status;
+	uint8_t			data[SMR_SAR_SIZE];
+};
+
+struct smr_sar_msg {
+	struct smr_sar_buf	buf[SMR_SAR_BUF_CNT];
+};
+
+/*
+ * The command queue is written by every peer and read by the owner only.
+ * Inject buffers are tracked by a queue of free buffer offsets, taken by
+ * senders and returned by the owner (or by the sender for fetch results).
+ */
+OFI_DECLARE_ATOMIC_Q(struct smr_cmd, smr_cmd_queue);
 OFI_DECLARE_CIRQUE(struct smr_resp, smr_resp_queue);
-DECLARE_SMR_FREESTACK(struct smr_inject_buf, smr_inject_pool);
+OFI_DECLARE_ATOMIC_Q(uint64_t, smr_inject_queue);
+DECLARE_SMR_FREESTACK(struct smr_sar_msg, smr_sar_pool);
+
+static inline struct smr_peer *smr_map_peer(struct smr_map *map, int id)
+{
+	return (struct smr_peer *) ofi_idm_lookup(&map->peers, id);
+}
+struct smr_region *smr_map_use(struct smr_map *map, int id);
 
+/*
+ * Region of a peer in use.  The epoch is only stamped under the map lock, by
+ * smr_map_use(); a region seen mapped in the current epoch stays mapped for
+ * at least a full sweep interval.  Returns NULL if the region is not mapped.
+ */
 static inline struct smr_region *smr_peer_region(struct smr_region *smr, int i)
 {
-	return smr->map->peers[i].region;
+	struct smr_peer *peer = ofi_idm_at(&smr->map->peers, i);
+	struct smr_region *region;
+
+	if (peer->last_epoch == smr->map->epoch) {
+		region = peer->region;
+		if (region)
+			return region;
+	}
+	return smr_map_use(smr->map, i);
 }
 static inline struct smr_cmd_queue *smr_cmd_queue(struct smr_region *smr)
 {
@@ -223,14 +351,60 @@ static inline struct smr_resp_queue *smr_resp_queue(struct smr_region *smr)
 {
 	return (struct smr_resp_queue *) ((char *) smr + smr->resp_queue_offset);
 }
-static inline struct smr_inject_pool *smr_inject_pool(struct smr_region *smr)
+static inline struct smr_inject_buf *smr_inject_pool(struct smr_region *smr)
+{
+	return (struct smr_inject_buf *) ((char *) smr + smr->inject_pool_offset);
+}
+static inline struct smr_inject_queue *smr_inject_queue(struct smr_region *smr)
 {
-	return (struct smr_inject_pool *) ((char *) smr + smr->inject_pool_offset);
+	return (struct smr_inject_queue *) ((char *) smr +
+					    smr->inject_queue_offset);
+}
+static inline struct smr_inject_buf *smr_inject_buf_pop(struct smr_region *smr)
+{
+	uint64_t offset;
+
+	if (smr_inject_queue_pop(smr_inject_queue(smr), &offset))
+		return NULL;
+
+	return (struct smr_inject_buf *) ((char **) smr + offset);
+}
+static inline void smr_inject_buf_push(struct smr_region *smr,
+				       struct smr_inject_buf *tx_buf)
+{
+	uint64_t offset = (char **) tx_buf - (char **) smr;
+
+	/*
+	 * The queue has a slot for every inject buffer, but a pop advances
+	 * read_pos before it releases its slot, so the slot this push needs
+	 * may still be held by a concurrent pop for a moment.
+	 */
+	while (smr_inject_queue_push(smr_inject_queue(smr), &offset))
+		;
+}
+static inline struct smr_sar_pool *smr_sar_pool(struct smr_region *smr)
+{
+	return (struct smr_sar_pool *) ((char *) smr + smr->sar_pool_offset);
+}
+static inline struct smr_mr_window *smr_mr_windows(struct smr_region *smr)
+{
+	return (struct smr_mr_window *) ((char *) smr + smr->mr_window_offset);
 }
 static inline struct smr_addr *smr_peer_addr(struct smr_region *smr)
 {
 	return (struct smr_addr *) ((char *) smr + smr->peer_addr_offset); 
 }
+/* CMA capability of each peer towards the owner, set by the peer */
+static inline uint8_t *smr_peer_cma(struct smr_region *smr)
+{
+	return (uint8_t *) smr + smr->peer_cma_offset;
+}
+/* Whether the peer at index id has found our name in its address table */
+static inline int smr_peer_addr_known(struct smr_region *smr, int id)
+{
+	return (size_t) id < smr->peer_addr_used &&
+	       smr_peer_addr(smr)[id].addr != FI_ADDR_UNSPEC;
+}
 static inline const char *smr_name(struct smr_region *smr)
 {
 	return (const char *) smr + smr->name_offset;
@@ -245,15 +419,21 @@ struct smr_attr {
 	const char	*name;
 	size_t		rx_count;
 	size_t		tx_count;
+	size_t		peer_count;
+	int		numa_node;	/* preferred node, -1 for default */
+	int		interleave_inject;
 };
 
-int	smr_map_create(const struct fi_provider *prov, int peer_count,
-		       struct smr_map **map);
+int	smr_map_create(const struct fi_provider *prov, struct smr_map **map);
 int	smr_map_to_region(const struct fi_provider *prov,
 			  struct smr_peer *peer_buf);
 void	smr_map_to_endpoint(struct smr_region *region, int index);
 void	smr_unmap_from_endpoint(struct smr_region *region, int index);
 void	smr_exchange_all_peers(struct smr_region *region);
+int	smr_map_activate(const struct fi_provider *prov,
+			 struct smr_region *region, int id,
+			 struct smr_region **peer_smr);
+void	smr_map_sweep(struct smr_map *map, uint64_t interval);
 int	smr_map_add(const struct fi_provider *prov,
 		    struct smr_map *map, const char *name, int id);
 void	smr_map_del(struct smr_map *map, int id);
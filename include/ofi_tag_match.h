@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2019 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _OFI_TAG_MATCH_H_
+#define _OFI_TAG_MATCH_H_
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <ofi.h>
+#include <ofi_list.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Match queue for posted receives or unexpected messages
+ *
+ * Entries are keyed by (source address, tag, ignore mask), where a source of
+ * FI_ADDR_UNSPEC matches any address.  Entries with a known source and no
+ * ignore bits are hashed by (source, tag); all other entries go on a separate
+ * wildcard list.  Every entry is also kept on a list in insertion order and
+ * carries a sequence number, so a lookup always returns the oldest matching
+ * entry, as required for MPI ordering.
+ *
+ * A lookup with a known source and no ignore bits checks the head of one
+ * bucket and the wildcard list.  Any other lookup walks the ordered list.
+ *
+ * Synchronization must be provided by the caller.
+ */
+
+struct ofi_match_entry {
+	struct dlist_entry	list_entry;	/* insertion order */
+	struct dlist_entry	hash_entry;	/* hash bucket or wildcard list */
+	uint64_t		seq;
+	fi_addr_t		addr;
+	uint64_t		tag;
+	uint64_t		ignore;
+};
+
+struct ofi_match_queue {
+	struct dlist_entry	list;
+	struct dlist_entry	wild;
+	struct dlist_entry	*hash;
+	uint64_t		hash_mask;
+	uint64_t		seq;
+};
+
+#define ofi_match_exact(addr, ignore) ((addr) != FI_ADDR_UNSPEC && !(ignore))
+
+static inline uint64_t ofi_match_hash(fi_addr_t addr, uint64_t tag)
+{
+	uint64_t hash = tag ^ (addr * 0x9e3779b97f4a7c15ULL);
+
+	hash ^= hash >> 31;
+	hash *= 0xbf58476d1ce4e5b9ULL;
+	return hash ^ (hash >> 29);
+}
+
+static inline int ofi_match_queue_init(struct ofi_match_queue *queue,
+				       size_t size)
+{
+	size_t i;
+
+	size = roundup_power_of_two(size ? size : 1);
+	queue->hash = calloc(size, sizeof(*queue->hash));
+	if (!queue->hash)
+		return -FI_ENOMEM;
+
+	for (i = 0; i < size; i++)
+		dlist_init(&queue->hash[i]);
+	dlist_init(&queue->list);
+	dlist_init(&queue->wild);
+	queue->hash_mask = size - 1;
+	queue->seq = 0;
+	return 0;
+}
+
+static inline void ofi_match_queue_close(struct ofi_match_queue *queue)
+{
+	free(queue->hash);
+}
+
+static inline int ofi_match_queue_empty(struct ofi_match_queue *queue)
+{
+	return dlist_empty(&queue->list);
+}
+
+static inline struct dlist_entry *
+ofi_match_bucket(struct ofi_match_queue *queue, struct ofi_match_entry *entry)
+{
+	return ofi_match_exact(entry->addr, entry->ignore) ?
+	       &queue->hash[ofi_match_hash(entry->addr, entry->tag) &
+			    queue->hash_mask] : &queue->wild;
+}
+
+static inline int ofi_match_entry(struct ofi_match_entry *entry,
+				  fi_addr_t addr, uint64_t tag, uint64_t ignore)
+{
+	uint64_t mask = entry->ignore | ignore;
+
+	return (entry->addr == FI_ADDR_UNSPEC || addr == FI_ADDR_UNSPEC ||
+		entry->addr == addr) &&
+	       ((entry->tag | mask) == (tag | mask));
+}
+
+static inline void ofi_match_insert(struct ofi_match_queue *queue,
+				    struct ofi_match_entry *entry,
+				    fi_addr_t addr, uint64_t tag, uint64_t ignore)
+{
+	entry->addr = addr;
+	entry->tag = tag;
+	entry->ignore = ignore;
+	entry->seq = queue->seq++;
+	dlist_insert_tail(&entry->list_entry, &queue->list);
+	dlist_insert_tail(&entry->hash_entry, ofi_match_bucket(queue, entry));
+}
+
+/* Inserts an entry as the oldest one in the queue, e.g. to put back an
+ * entry that a lookup removed but that can match again */
+static inline void ofi_match_insert_head(struct ofi_match_queue *queue,
+					 struct ofi_match_entry *entry,
+					 fi_addr_t addr, uint64_t tag,
+					 uint64_t ignore)
+{
+	struct ofi_match_entry *head;
+
+	entry->addr = addr;
+	entry->tag = tag;
+	entry->ignore = ignore;
+
+	if (ofi_match_queue_empty(queue)) {
+		entry->seq = queue->seq++;
+	} else {
+		head = container_of(queue->list.next, struct ofi_match_entry,
+				    list_entry);
+		entry->seq = head->seq - 1;
+	}
+	dlist_insert_head(&entry->list_entry, &queue->list);
+	dlist_insert_head(&entry->hash_entry, ofi_match_bucket(queue, entry));
+}
+
+static inline void ofi_match_remove(struct ofi_match_entry *entry)
+{
+	dlist_remove(&entry->list_entry);
+	dlist_remove(&entry->hash_entry);
+}
+
+static inline struct ofi_match_entry *
+ofi_match_find(struct ofi_match_queue *queue, fi_addr_t addr, uint64_t tag,
+	       uint64_t ignore)
+{
+	struct ofi_match_entry *entry, *found = NULL;
+	struct dlist_entry *bucket;
+
+	if (!ofi_match_exact(addr, ignore)) {
+		dlist_foreach_container(&queue->list, struct ofi_match_entry,
+					entry, list_entry) {
+			if (ofi_match_entry(entry, addr, tag, ignore))
+				return entry;
+		}
+		return NULL;
+	}
+
+	bucket = &queue->hash[ofi_match_hash(addr, tag) & queue->hash_mask];
+	dlist_foreach_container(bucket, struct ofi_match_entry,
+				entry, hash_entry) {
+		if (entry->addr == addr && entry->tag == tag) {
+			found = entry;
+			break;
+		}
+	}
+
+	dlist_foreach_container(&queue->wild, struct ofi_match_entry,
+				entry, hash_entry) {
+		if (found && (int64_t) (entry->seq - found->seq) > 0)
+			break;
+		if (ofi_match_entry(entry, addr, tag, ignore))
+			return entry;
+	}
+	return found;
+}
+
+static inline struct ofi_match_entry *
+ofi_match_remove_first(struct ofi_match_queue *queue, fi_addr_t addr,
+		       uint64_t tag, uint64_t ignore)
+{
+	struct ofi_match_entry *entry;
+
+	entry = ofi_match_find(queue, addr, tag, ignore);
+	if (entry)
+		ofi_match_remove(entry);
+	return entry;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _OFI_TAG_MATCH_H_ */
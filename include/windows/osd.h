@@ -853,6 +853,33 @@ static inline int ofi_free_hugepage_buf(void *memptr, size_t size)
 	return -FI_ENOSYS;
 }
 
+static inline int ofi_get_numa_node(void)
+{
+	return -FI_ENOSYS;
+}
+
+static inline int ofi_mbind_node(void *addr, size_t len, int node)
+{
+	return -FI_ENOSYS;
+}
+
+static inline int ofi_mbind_interleave(void *addr, size_t len)
+{
+	return -FI_ENOSYS;
+}
+
+static inline int ofi_get_shared_file(const void *addr, size_t len,
+				      char *path, size_t path_size,
+				      uint64_t *offset)
+{
+	return -FI_ENOSYS;
+}
+
+static inline int ofi_memfd_create(const char *name)
+{
+	return -FI_ENOSYS;
+}
+
 static inline int ofi_is_loopback_addr(struct sockaddr *addr) {
 	return (addr->sa_family == AF_INET &&
 		((struct sockaddr_in *)addr)->sin_addr.s_addr == ntohl(INADDR_LOOPBACK)) ||
@@ -938,6 +965,12 @@ typedef LONGLONG ofi_atomic_int_64_t;
 
 #define ofi_atomic_add_and_fetch(radix, ptr, val) InterlockedAdd##radix((ofi_atomic_int_##radix##_t *)(ptr), (ofi_atomic_int_##radix##_t)(val))
 #define ofi_atomic_sub_and_fetch(radix, ptr, val) InterlockedAdd##radix((ofi_atomic_int_##radix##_t *)(ptr), -(ofi_atomic_int_##radix##_t)(val))
+#define ofi_atomic_cas_bool(radix, ptr, expected, desired)				\
+	((radix) == 32 ?									\
+	 InterlockedCompareExchange((LONG *)(ptr), (LONG)(desired),			\
+				    (LONG)(expected)) == (LONG)(expected) :		\
+	 InterlockedCompareExchange64((LONGLONG *)(ptr), (LONGLONG)(desired),		\
+				      (LONGLONG)(expected)) == (LONGLONG)(expected))
 #endif /* HAVE_BUILTIN_ATOMICS */
 
 static inline int ofi_set_thread_affinity(const char *s)
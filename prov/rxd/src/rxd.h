@@ -74,9 +74,15 @@
 #define RXD_RX_POOL_CHUNK_CNT	1024
 #define RXD_MAX_PENDING		128
 #define RXD_MAX_PKT_RETRY	50
+#define RXD_INIT_TX_WINDOW	16
+#define RXD_INIT_RTO		40000
+#define RXD_MIN_RTO		20000
+#define RXD_MAX_RTO		4000000
+#define RXD_DUP_ACK_THRESH	3
 
 #define RXD_PKT_IN_USE		(1 << 0)
 #define RXD_PKT_ACKED		(1 << 1)
+#define RXD_PKT_RETRIED		(1 << 2)
 
 #define RXD_REMOTE_CQ_DATA	(1 << 0)
 #define RXD_NO_TX_COMP		(1 << 1)
@@ -86,6 +92,8 @@
 #define RXD_INLINE		(1 << 5)
 #define RXD_MULTI_RECV		(1 << 6)
 #define RXD_CANCELLED		(1 << 7)
+#define RXD_ACK_REQ		(1 << 8)
+#define RXD_RESEND_REQ		(1 << 9)
 
 struct rxd_env {
 	int spin_count;
@@ -129,12 +137,21 @@ struct rxd_peer {
 	uint64_t rx_seq_no;
 	uint64_t last_rx_ack;
 	uint64_t last_tx_ack;
+	uint64_t recover_seq;
 	uint16_t rx_window;//constant at MAX_UNACKED for now
-	uint16_t tx_window;//unused for now, will be used for slow start
+	uint16_t tx_window;//congestion window, in packets
+	uint16_t ssthresh;
+	uint16_t window_acked;
+	int srtt;//in us, scaled by 8
+	int rttvar;//in us, scaled by 4
+	int rto;//in us
 	int retry_cnt;
+	int dup_acks;
 
 	uint16_t unacked_cnt;
 	uint8_t active;
+	uint8_t rx_dropped;
+	uint8_t rx_held;
 
 	uint16_t curr_rx_id;
 	uint16_t curr_tx_id;
@@ -390,6 +407,9 @@ int rxd_ep_retry_pkt(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry);
 ssize_t rxd_ep_post_data_pkts(struct rxd_ep *ep, struct rxd_x_entry *tx_entry);
 void rxd_insert_unacked(struct rxd_ep *ep, fi_addr_t peer,
 			struct rxd_pkt_entry *pkt_entry);
+void rxd_ep_resend_unacked(struct rxd_ep *ep, struct rxd_peer *peer);
+void rxd_ep_resend_lost(struct rxd_ep *ep, struct rxd_peer *peer,
+			uint64_t end);
 ssize_t rxd_send_rts_if_needed(struct rxd_ep *rxd_ep, fi_addr_t rxd_addr);
 int rxd_ep_send_op(struct rxd_ep *rxd_ep, struct rxd_x_entry *tx_entry,
 		   const struct fi_rma_iov *rma_iov, size_t rma_count,
@@ -415,7 +435,9 @@ struct rxd_x_entry *rxd_rx_entry_init(struct rxd_ep *ep,
 void rxd_tx_entry_free(struct rxd_ep *ep, struct rxd_x_entry *tx_entry);
 void rxd_rx_entry_free(struct rxd_ep *ep, struct rxd_x_entry *rx_entry);
 int rxd_get_timeout(uint8_t retry_cnt);
-uint64_t rxd_get_retry_time(uint64_t start, uint8_t retry_cnt);
+uint64_t rxd_get_retry_time(uint64_t start, int rto, uint8_t retry_cnt);
+void rxd_peer_rtt_sample(struct rxd_peer *peer, uint64_t rtt);
+void rxd_peer_window_ack(struct rxd_peer *peer, int acked);
 
 /* Generic message functions */
 ssize_t rxd_ep_generic_recvmsg(struct rxd_ep *rxd_ep, const struct iovec *iov,
@@ -446,6 +468,7 @@ void rxd_progress_op(struct rxd_ep *ep, struct rxd_x_entry *rx_entry,
 		     struct rxd_atom_hdr *atom_hdr,
 		     void **msg, size_t size);
 void rxd_progress_tx_list(struct rxd_ep *ep, struct rxd_peer *peer);
+void rxd_progress_buf_pkts(struct rxd_ep *ep, fi_addr_t peer);
 struct rxd_x_entry *rxd_progress_multi_recv(struct rxd_ep *ep,
 					    struct rxd_x_entry *rx_entry,
 					    size_t total_size);
@@ -257,7 +257,7 @@ static int rxd_comp_pkt_seq_no(struct dlist_entry *item, const void *arg)
 	new_hdr = rxd_get_base_hdr(container_of((struct dlist_entry *) arg,
 				  struct rxd_pkt_entry, d_entry));
 
-	return new_hdr->seq_no > list_hdr->seq_no;
+	return ofi_before(new_hdr->seq_no, list_hdr->seq_no);
 }
 
 static void rxd_ep_recv_data(struct rxd_ep *ep, struct rxd_x_entry *x_entry,
@@ -287,7 +287,8 @@ static void rxd_ep_recv_data(struct rxd_ep *ep, struct rxd_x_entry *x_entry,
 
 	if (x_entry->next_seg_no < x_entry->num_segs) {
 		if (!(ep->peers[pkt->base_hdr.peer].rx_seq_no %
-		    ep->peers[pkt->base_hdr.peer].rx_window))
+		    ep->peers[pkt->base_hdr.peer].rx_window) ||
+		    pkt->base_hdr.flags & RXD_ACK_REQ)
 			rxd_ep_send_ack(ep, pkt->base_hdr.peer);
 		return;
 	}
@@ -341,7 +342,8 @@ static int rxd_move_tx_pkt(struct rxd_ep *ep, struct rxd_x_entry *tx_entry)
 {
 	struct rxd_base_hdr *hdr = rxd_get_base_hdr(tx_entry->pkt);
 
-	if (ep->peers[tx_entry->peer].unacked_cnt >= rxd_env.max_unacked)
+	if (ep->peers[tx_entry->peer].unacked_cnt >=
+	    ep->peers[tx_entry->peer].tx_window)
 		return 0;
 
 	tx_entry->start_seq = rxd_set_pkt_seq(&ep->peers[tx_entry->peer],
@@ -361,7 +363,8 @@ static int rxd_move_tx_pkt(struct rxd_ep *ep, struct rxd_x_entry *tx_entry)
 				  &ep->peers[tx_entry->peer].rma_rx_list);
 	}
 
-	return ep->peers[tx_entry->peer].unacked_cnt < rxd_env.max_unacked;
+	return ep->peers[tx_entry->peer].unacked_cnt <
+	       ep->peers[tx_entry->peer].tx_window;
 }
 
 void rxd_progress_tx_list(struct rxd_ep *ep, struct rxd_peer *peer)
@@ -887,6 +890,7 @@ void rxd_progress_op(struct rxd_ep *ep, struct rxd_x_entry *rx_entry,
 		     struct rxd_atom_hdr *atom_hdr,
 		     void **msg, size_t size)
 {
+	ep->peers[base_hdr->peer].rx_held = 0;
 
 	if (rx_entry->flags & RXD_CANCELLED) {
 		rxd_complete_rx(ep, rx_entry);
@@ -943,7 +947,10 @@ static struct rxd_x_entry *rxd_get_data_x_entry(struct rxd_ep *ep,
 	return util_buf_get_by_index(ep->tx_entry_pool, data_pkt->ext_hdr.tx_id);
 }
 
-static void rxd_progress_buf_pkts(struct rxd_ep *ep, fi_addr_t peer)
+/*
+ * Called without the rx CQ lock held, since completing a message takes it.
+ */
+void rxd_progress_buf_pkts(struct rxd_ep *ep, fi_addr_t peer)
 {
 	struct rxd_pkt_entry *pkt_entry;
 	struct rxd_base_hdr *base_hdr;
@@ -961,6 +968,13 @@ static void rxd_progress_buf_pkts(struct rxd_ep *ep, fi_addr_t peer)
 		pkt_entry = container_of((&ep->peers[peer].buf_pkts)->next,
 					struct rxd_pkt_entry, d_entry);
 		base_hdr = rxd_get_base_hdr(pkt_entry);
+		if (rxd_env.retry && ofi_before(base_hdr->seq_no,
+						ep->peers[peer].rx_seq_no)) {
+			/* data of a message that was cancelled meanwhile */
+			dlist_remove(&pkt_entry->d_entry);
+			rxd_release_repost_rx(ep, pkt_entry);
+			continue;
+		}
 		if (base_hdr->seq_no != ep->peers[peer].rx_seq_no)
 			return;
 
@@ -975,9 +989,11 @@ static void rxd_progress_buf_pkts(struct rxd_ep *ep, fi_addr_t peer)
 			if (!rx_entry)
 				break;
 
+			fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
 			rxd_progress_op(ep, rx_entry, pkt_entry, base_hdr,
 					sar_hdr, tag_hdr, data_hdr, rma_hdr,
 					atom_hdr, &msg, msg_size);
+			fastlock_release(&ep->util_ep.rx_cq->cq_lock);
 		}
 
 		dlist_remove(&pkt_entry->d_entry);
@@ -985,30 +1001,73 @@ static void rxd_progress_buf_pkts(struct rxd_ep *ep, fi_addr_t peer)
 	}
 }
 
+/*
+ * With retries enabled, data that arrives out of order is kept until the
+ * packets before it come in, as long as it falls into the rx window.  The
+ * ack reports it to the sender, which then only resends what is missing.
+ */
+static int rxd_buf_data_pkt(struct rxd_ep *ep, struct rxd_peer *peer,
+			    struct rxd_pkt_entry *pkt_entry)
+{
+	struct rxd_pkt_entry *buf_entry;
+	uint64_t seq = rxd_get_base_hdr(pkt_entry)->seq_no;
+
+	dlist_foreach_container(&peer->buf_pkts, struct rxd_pkt_entry,
+				buf_entry, d_entry) {
+		if (rxd_get_base_hdr(buf_entry)->seq_no == seq)
+			return 0;
+	}
+
+	rxd_remove_rx_pkt(ep, pkt_entry);
+	dlist_insert_order(&peer->buf_pkts, &rxd_comp_pkt_seq_no,
+			   &pkt_entry->d_entry);
+	return 1;
+}
+
 static void rxd_handle_data(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
 {
 	struct rxd_data_pkt *pkt = (struct rxd_data_pkt *) (pkt_entry->pkt);
+	struct rxd_peer *peer;
 	struct rxd_x_entry *x_entry;
 
 	if (pkt_entry->pkt_size < sizeof(*pkt) + ep->rx_prefix_size) {
 		FI_WARN(&rxd_prov, FI_LOG_CQ,
 			"Cannot process packet smaller than minimum header size\n");
-		return;
+		goto release;
 	}
 
-	if (pkt->base_hdr.seq_no == ep->peers[pkt->base_hdr.peer].rx_seq_no) {
+	peer = &ep->peers[pkt->base_hdr.peer];
+	if (pkt->base_hdr.seq_no == peer->rx_seq_no) {
 		x_entry = rxd_get_data_x_entry(ep, pkt);
 		rxd_ep_recv_data(ep, x_entry, pkt, pkt_entry->pkt_size);
-		if (!dlist_empty(&ep->peers[pkt->base_hdr.peer].buf_pkts))
+		if (!dlist_empty(&peer->buf_pkts)) {
 			rxd_progress_buf_pkts(ep, pkt->base_hdr.peer);
-	} else if (!rxd_env.retry) {
+			if (peer->last_tx_ack != peer->rx_seq_no)
+				rxd_ep_send_ack(ep, pkt->base_hdr.peer);
+		}
+		goto release;
+	}
+
+	if (!rxd_env.retry) {
 		rxd_remove_rx_pkt(ep, pkt_entry);
-		dlist_insert_order(&ep->peers[pkt->base_hdr.peer].buf_pkts,
-				   &rxd_comp_pkt_seq_no, &pkt_entry->d_entry);
-		ep->peers[pkt->base_hdr.peer].rx_seq_no++;
-	} else {
-		rxd_ep_send_ack(ep, pkt->base_hdr.peer);
+		dlist_insert_order(&peer->buf_pkts, &rxd_comp_pkt_seq_no,
+				   &pkt_entry->d_entry);
+		peer->rx_seq_no++;
+		return;
+	}
+
+	if (ofi_before(peer->rx_seq_no, pkt->base_hdr.seq_no)) {
+		if (pkt->base_hdr.seq_no - peer->rx_seq_no > peer->rx_window) {
+			peer->rx_dropped = 1;
+		} else if (rxd_buf_data_pkt(ep, peer, pkt_entry)) {
+			rxd_ep_send_ack(ep, pkt->base_hdr.peer);
+			return;
+		}
 	}
+	rxd_ep_send_ack(ep, pkt->base_hdr.peer);
+release:
+	rxd_remove_rx_pkt(ep, pkt_entry);
+	rxd_release_repost_rx(ep, pkt_entry);
 }
 
 static void rxd_handle_op(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
@@ -1032,8 +1091,10 @@ static void rxd_handle_op(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
 			return;
 		}
 
-		if (ep->peers[base_hdr->peer].peer_addr != FI_ADDR_UNSPEC)
+		if (ep->peers[base_hdr->peer].peer_addr != FI_ADDR_UNSPEC) {
+			ep->peers[base_hdr->peer].rx_dropped = 1;
 			goto ack;
+		}
 		goto release;
 	}
 
@@ -1045,6 +1106,7 @@ static void rxd_handle_op(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
 				      &msg, &msg_size);
 	if (!rx_entry) {
 		if (base_hdr->type == RXD_MSG || base_hdr->type == RXD_TAGGED) {
+			ep->peers[base_hdr->peer].rx_held = 1;
 			rxd_remove_rx_pkt(ep, pkt_entry);
 			return;
 		}
@@ -1054,13 +1116,11 @@ static void rxd_handle_op(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
 	fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
 	rxd_progress_op(ep, rx_entry, pkt_entry, base_hdr, sar_hdr, tag_hdr,
 			data_hdr, rma_hdr, atom_hdr, &msg, msg_size);
-
+	fastlock_release(&ep->util_ep.rx_cq->cq_lock);
 
 	if (!dlist_empty(&ep->peers[base_hdr->peer].buf_pkts))
 		rxd_progress_buf_pkts(ep, base_hdr->peer);
 
-	fastlock_release(&ep->util_ep.rx_cq->cq_lock);
-
 ack:
 	rxd_ep_send_ack(ep, base_hdr->peer);
 release:
@@ -1075,46 +1135,96 @@ static void rxd_handle_cts(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
 	rxd_update_peer(ep, cts->rts_addr, cts->cts_addr);
 }
 
+/*
+ * Returns 1 if the packet was not acked before.  Packets that are still being
+ * sent are released once the send completes.
+ */
+static int rxd_ack_pkt(struct rxd_ep *ep, struct rxd_peer *peer,
+		       struct rxd_pkt_entry *pkt_entry, uint64_t *sent)
+{
+	if (!(pkt_entry->flags & (RXD_PKT_ACKED | RXD_PKT_RETRIED)))
+		*sent = MAX(*sent, pkt_entry->timestamp);
+
+	if (pkt_entry->flags & RXD_PKT_IN_USE) {
+		if (pkt_entry->flags & RXD_PKT_ACKED)
+			return 0;
+		pkt_entry->flags |= RXD_PKT_ACKED;
+		return 1;
+	}
+	dlist_remove(&pkt_entry->d_entry);
+	rxd_release_tx_pkt(ep, pkt_entry);
+	peer->unacked_cnt--;
+	return 1;
+}
+
 static void rxd_handle_ack(struct rxd_ep *ep, struct rxd_pkt_entry *ack_entry)
 {
 	struct rxd_ack_pkt *ack = (struct rxd_ack_pkt *) (ack_entry->pkt);
+	struct rxd_peer *peer = &ep->peers[ack->base_hdr.peer];
 	struct rxd_pkt_entry *pkt_entry;
-	fi_addr_t peer = ack->base_hdr.peer;
-	struct rxd_base_hdr *hdr;
-
-	if (ep->peers[peer].last_rx_ack == ack->base_hdr.seq_no)
-		return;
-
-	ep->peers[peer].retry_cnt = 0;
-	ep->peers[peer].last_rx_ack = ack->base_hdr.seq_no;
+	struct dlist_entry *tmp;
+	uint64_t seq, sack = 0, sent = 0;
+	int acked = 0;
 
-	if (dlist_empty(&ep->peers[peer].unacked))
+	if (ofi_before(ack->base_hdr.seq_no, peer->last_rx_ack))
 		return;
 
-	pkt_entry = container_of((&ep->peers[peer].unacked)->next,
-				struct rxd_pkt_entry, d_entry);
+	if (ack_entry->pkt_size >= sizeof(*ack) + ep->rx_prefix_size)
+		sack = ack->sack;
 
-	while (&pkt_entry->d_entry != &ep->peers[peer].unacked) {
-		hdr = rxd_get_base_hdr(pkt_entry);
-		if (ofi_after_eq(hdr->seq_no, ack->base_hdr.seq_no))
-			break;
+	if (peer->last_rx_ack == ack->base_hdr.seq_no) {
+		if (!sack)
+			return;
+		peer->dup_acks++;
+	} else {
+		peer->retry_cnt = 0;
+		peer->dup_acks = 0;
+		peer->last_rx_ack = ack->base_hdr.seq_no;
+	}
 
-		if (pkt_entry->flags & RXD_PKT_IN_USE) {
-			pkt_entry->flags |= RXD_PKT_ACKED;
-			pkt_entry = container_of((&pkt_entry->d_entry)->next,
-						 struct rxd_pkt_entry, d_entry);
+	dlist_foreach_container_safe(&peer->unacked, struct rxd_pkt_entry,
+				     pkt_entry, d_entry, tmp) {
+		seq = rxd_get_base_hdr(pkt_entry)->seq_no;
+		if (ofi_before(seq, ack->base_hdr.seq_no)) {
+			acked += rxd_ack_pkt(ep, peer, pkt_entry, &sent);
 			continue;
 		}
-		dlist_remove(&pkt_entry->d_entry);
-		rxd_release_tx_pkt(ep, pkt_entry);
-	     	ep->peers[peer].unacked_cnt--;
-
-		pkt_entry = container_of((&ep->peers[peer].unacked)->next,
-					struct rxd_pkt_entry, d_entry);
+		if (!sack || seq - ack->base_hdr.seq_no > RXD_SACK_BITS)
+			break;
+		if (seq != ack->base_hdr.seq_no &&
+		    sack & (1ULL << (seq - ack->base_hdr.seq_no - 1)))
+			acked += rxd_ack_pkt(ep, peer, pkt_entry, &sent);
+	}
+	rxd_peer_window_ack(peer, acked);
+
+	/*
+	 * The receiver dropped the packets that followed out of order, either
+	 * because they were too far ahead or because it held back a message
+	 * for which no receive was posted.  The latter delays the ack, so it
+	 * does not make for a useful round trip time either.
+	 */
+	if (ack->base_hdr.flags & RXD_RESEND_REQ) {
+		rxd_ep_resend_unacked(ep, peer);
+		goto out;
 	}
 
-	rxd_progress_tx_list(ep, &ep->peers[ack->base_hdr.peer]);
-} 
+	if (sent)
+		rxd_peer_rtt_sample(peer, fi_gettime_us() - sent);
+
+	/*
+	 * Duplicate acks with packets acked selectively mean that the first
+	 * unacked packet got lost, once enough of them arrived that reordering
+	 * is an unlikely explanation.  The holes up to the last packet that
+	 * arrived are then resent right away.  The same holds for the holes
+	 * that are left after a partial ack while recovering from that loss.
+	 */
+	if (sack && (peer->dup_acks >= RXD_DUP_ACK_THRESH ||
+		     ofi_before(peer->last_rx_ack, peer->recover_seq)))
+		rxd_ep_resend_lost(ep, peer, ack->base_hdr.seq_no +
+				   ofi_msb(sack));
+out:
+	rxd_progress_tx_list(ep, peer);
+}
 
 void rxd_handle_send_comp(struct rxd_ep *ep, struct fi_cq_msg_entry *comp)
 {
@@ -1167,6 +1277,7 @@ void rxd_handle_recv_comp(struct rxd_ep *ep, struct fi_cq_msg_entry *comp)
 	case RXD_DATA:
 	case RXD_DATA_READ:
 		rxd_handle_data(ep, pkt_entry);
+		release = 0;
 		break;
 	default:
 		rxd_handle_op(ep, pkt_entry);
@@ -310,12 +310,77 @@ static int rxd_ep_enable(struct rxd_ep *ep)
  */
 int rxd_get_timeout(uint8_t retry_cnt)
 {
-	return MIN(1 << retry_cnt, 4000);
+	return MIN(1 << MIN(retry_cnt, 12), 4000);
 }
 
-uint64_t rxd_get_retry_time(uint64_t start, uint8_t retry_cnt)
+/*
+ * Packets are resent with exponential back-off, starting at the
+ * retransmit timeout of the peer, max 4s.
+ */
+uint64_t rxd_get_retry_time(uint64_t start, int rto, uint8_t retry_cnt)
 {
-	return start + rxd_get_timeout(retry_cnt);
+	return start + MIN((uint64_t) rto << MIN(retry_cnt, 12), RXD_MAX_RTO);
+}
+
+/*
+ * The retransmit timeout follows the smoothed round trip time of the peer
+ * and its variation, as TCP computes it (RFC 6298).  A timeout that fires
+ * while the ack is still on its way would needlessly close the tx window.
+ */
+void rxd_peer_rtt_sample(struct rxd_peer *peer, uint64_t rtt)
+{
+	int delta;
+
+	rtt = MIN(rtt, RXD_MAX_RTO);
+	if (!peer->srtt) {
+		peer->srtt = (int) rtt << 3;
+		peer->rttvar = (int) rtt << 1;
+	} else {
+		delta = (int) rtt - (peer->srtt >> 3);
+		peer->srtt += delta;
+		peer->rttvar += abs(delta) - (peer->rttvar >> 2);
+	}
+	peer->srtt = MAX(peer->srtt, 1);
+	peer->rto = MIN(MAX((peer->srtt >> 3) + peer->rttvar, RXD_MIN_RTO),
+			RXD_MAX_RTO);
+}
+
+/*
+ * The tx window of a peer limits the number of unacked packets.  It starts
+ * small and grows with every acked packet (slow start) until it reaches
+ * ssthresh, then by one packet per window of acked packets.  A retransmit
+ * timeout halves ssthresh and restarts from a single packet.  Packets that
+ * were sent before the timeout are resent as the window opens again, and
+ * do not count as another loss.  The window never exceeds max_unacked.
+ */
+void rxd_peer_window_ack(struct rxd_peer *peer, int acked)
+{
+	if (peer->tx_window < peer->ssthresh) {
+		peer->tx_window = MIN(peer->tx_window + acked, peer->ssthresh);
+		return;
+	}
+
+	peer->window_acked += acked;
+	if (peer->window_acked >= peer->tx_window) {
+		peer->window_acked -= peer->tx_window;
+		if (peer->tx_window < rxd_env.max_unacked)
+			peer->tx_window++;
+	}
+}
+
+/*
+ * A loss reported through duplicate acks only halves the window (fast
+ * recovery), since the packets that followed the lost one still arrive.
+ */
+static void rxd_peer_window_loss(struct rxd_peer *peer, bool timeout)
+{
+	if (ofi_before(peer->last_rx_ack, peer->recover_seq))
+		return;
+
+	peer->recover_seq = peer->tx_seq_no;
+	peer->ssthresh = MAX(MIN(peer->unacked_cnt, peer->tx_window) / 2, 2);
+	peer->tx_window = timeout ? 1 : peer->ssthresh;
+	peer->window_acked = 0;
 }
 
 void rxd_init_data_pkt(struct rxd_ep *ep, struct rxd_x_entry *tx_entry,
@@ -331,6 +396,7 @@ void rxd_init_data_pkt(struct rxd_ep *ep, struct rxd_x_entry *tx_entry,
 	data_pkt->base_hdr.type = (tx_entry->cq_entry.flags &
 				  (FI_READ | FI_REMOTE_READ)) ?
 				   RXD_DATA_READ : RXD_DATA;
+	data_pkt->base_hdr.flags = 0;
 
 	data_pkt->ext_hdr.rx_id = tx_entry->rx_id;
 	data_pkt->ext_hdr.tx_id = tx_entry->tx_id;
@@ -413,7 +479,8 @@ struct rxd_x_entry *rxd_tx_entry_init(struct rxd_ep *ep, const struct iovec *iov
 
 	if ((tx_entry->op == RXD_READ_REQ || tx_entry->op == RXD_ATOMIC_FETCH ||
 	     tx_entry->op == RXD_ATOMIC_COMPARE) &&
-	    ep->peers[tx_entry->peer].unacked_cnt < rxd_env.max_unacked &&
+	    ep->peers[tx_entry->peer].unacked_cnt <
+	    ep->peers[tx_entry->peer].tx_window &&
 	    ep->peers[tx_entry->peer].peer_addr != FI_ADDR_UNSPEC)
 		dlist_insert_tail(&tx_entry->entry,
 				  &ep->peers[tx_entry->peer].rma_rx_list);
@@ -431,22 +498,121 @@ void rxd_tx_entry_free(struct rxd_ep *ep, struct rxd_x_entry *tx_entry)
 	rxd_release_tx_entry(ep, tx_entry);
 }
 
-void rxd_insert_unacked(struct rxd_ep *ep, fi_addr_t peer,
-			struct rxd_pkt_entry *pkt_entry)
+static int rxd_ep_send_pkt(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry,
+			   uint64_t flags)
+{
+	struct fi_msg msg;
+	struct iovec iov;
+	void *desc;
+	int ret;
+
+	if (ep->pending_cnt >= ep->tx_size)
+		return 1;
+
+	pkt_entry->timestamp = fi_gettime_us();
+
+	iov.iov_base = rxd_pkt_start(pkt_entry);
+	iov.iov_len = pkt_entry->pkt_size;
+	desc = rxd_mr_desc(pkt_entry->mr, ep);
+	msg.msg_iov = &iov;
+	msg.desc = &desc;
+	msg.iov_count = 1;
+	msg.addr = rxd_ep_av(ep)->rxd_addr_table[pkt_entry->peer].dg_addr;
+	msg.context = &pkt_entry->context;
+	msg.data = 0;
+
+	ret = fi_sendmsg(ep->dg_ep, &msg, flags);
+	if (ret) {
+		FI_WARN(&rxd_prov, FI_LOG_EP_CTRL, "error sending packet: %d (%s)\n",
+			ret, fi_strerror(-ret));
+	} else {
+		pkt_entry->flags |= RXD_PKT_IN_USE;
+		ep->pending_cnt++;
+	}
+
+	return ret;
+}
+
+int rxd_ep_retry_pkt(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
+{
+	return rxd_ep_send_pkt(ep, pkt_entry, 0);
+}
+
+static void rxd_queue_unacked(struct rxd_ep *ep, fi_addr_t peer,
+			      struct rxd_pkt_entry *pkt_entry, uint64_t flags)
 {
 	dlist_insert_tail(&pkt_entry->d_entry,
 			  &ep->peers[peer].unacked);
 	ep->peers[peer].unacked_cnt++;
-	rxd_ep_retry_pkt(ep, pkt_entry);
+	rxd_ep_send_pkt(ep, pkt_entry, flags);
+}
+
+void rxd_insert_unacked(struct rxd_ep *ep, fi_addr_t peer,
+			struct rxd_pkt_entry *pkt_entry)
+{
+	rxd_queue_unacked(ep, peer, pkt_entry, 0);
+}
+
+static int rxd_ep_resend_pkt(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry,
+			     bool last)
+{
+	struct rxd_base_hdr *hdr = rxd_get_base_hdr(pkt_entry);
+
+	pkt_entry->flags |= RXD_PKT_RETRIED;
+	if (hdr->type == RXD_DATA || hdr->type == RXD_DATA_READ)
+		hdr->flags |= RXD_ACK_REQ;
+	return rxd_ep_send_pkt(ep, pkt_entry, last ? 0 : FI_MORE);
+}
+
+void rxd_ep_resend_unacked(struct rxd_ep *ep, struct rxd_peer *peer)
+{
+	struct rxd_pkt_entry *pkt_entry;
+	int cnt = 0;
+
+	dlist_foreach_container(&peer->unacked, struct rxd_pkt_entry,
+				pkt_entry, d_entry) {
+		if (cnt++ >= peer->tx_window)
+			break;
+		if (pkt_entry->flags & (RXD_PKT_IN_USE | RXD_PKT_ACKED))
+			continue;
+		if (rxd_ep_resend_pkt(ep, pkt_entry, cnt == peer->tx_window ||
+				      pkt_entry->d_entry.next == &peer->unacked))
+			break;
+	}
+}
+
+/*
+ * Fast retransmit: resend the packets before end that the receiver has not
+ * acked, without waiting for them to time out.  Each one is resent at most
+ * once this way, anything still missing after that is left to the timer.
+ */
+void rxd_ep_resend_lost(struct rxd_ep *ep, struct rxd_peer *peer, uint64_t end)
+{
+	struct rxd_pkt_entry *pkt_entry;
+
+	rxd_peer_window_loss(peer, false);
+
+	dlist_foreach_container(&peer->unacked, struct rxd_pkt_entry,
+				pkt_entry, d_entry) {
+		if (ofi_after_eq(rxd_get_base_hdr(pkt_entry)->seq_no, end))
+			break;
+		if (pkt_entry->flags & (RXD_PKT_IN_USE | RXD_PKT_ACKED |
+					RXD_PKT_RETRIED))
+			continue;
+		if (rxd_ep_resend_pkt(ep, pkt_entry, true))
+			break;
+	}
 }
 
 ssize_t rxd_ep_post_data_pkts(struct rxd_ep *ep, struct rxd_x_entry *tx_entry)
 {
 	struct rxd_pkt_entry *pkt_entry;
+	struct rxd_peer *peer = &ep->peers[tx_entry->peer];
 	struct rxd_data_pkt *data;
+	bool more;
 
 	while (tx_entry->bytes_done != tx_entry->cq_entry.len) {
-		if (ep->peers[tx_entry->peer].unacked_cnt >= rxd_env.max_unacked)
+		if (peer->unacked_cnt >= peer->tx_window)
 			return 0;
 
 		pkt_entry = rxd_get_tx_pkt(ep);
@@ -454,9 +620,9 @@ ssize_t rxd_ep_post_data_pkts(struct rxd_ep *ep, struct rxd_x_entry *tx_entry)
 			return -FI_ENOMEM;
 
 		if (tx_entry->op == RXD_DATA_READ && !tx_entry->bytes_done) {
-			tx_entry->start_seq = ep->peers[tx_entry->peer].tx_seq_no;
-			ep->peers[tx_entry->peer].tx_seq_no = tx_entry->start_seq +
-							      tx_entry->num_segs;
+			tx_entry->start_seq = peer->tx_seq_no;
+			peer->tx_seq_no = tx_entry->start_seq +
+					  tx_entry->num_segs;
 		}
 
 		rxd_init_data_pkt(ep, tx_entry, pkt_entry);
@@ -467,34 +633,22 @@ ssize_t rxd_ep_post_data_pkts(struct rxd_ep *ep, struct rxd_x_entry *tx_entry)
 		if (data->base_hdr.type != RXD_DATA_READ)
 			data->base_hdr.seq_no++;
 
-		rxd_insert_unacked(ep, tx_entry->peer, pkt_entry);
+		/*
+		 * Let the datagram provider send the packets of a burst
+		 * together, the last one is posted without FI_MORE.  The
+		 * packets in the middle and at the end of the tx window ask
+		 * for an ack right away, so that the window keeps moving
+		 * without waiting for the receiver's periodic ack.
+		 */
+		more = tx_entry->bytes_done != tx_entry->cq_entry.len &&
+		       peer->unacked_cnt + 1 < peer->tx_window;
+		if (!more || peer->unacked_cnt + 1 == peer->tx_window / 2)
+			data->base_hdr.flags |= RXD_ACK_REQ;
+		rxd_queue_unacked(ep, tx_entry->peer, pkt_entry,
+				  more ? FI_MORE : 0);
 	}
 
-	return ep->peers[tx_entry->peer].unacked_cnt < rxd_env.max_unacked;
-}
-
-int rxd_ep_retry_pkt(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
-{
-	int ret;
-
-	if (ep->pending_cnt >= ep->tx_size)
-		return 1;
-
-	pkt_entry->timestamp = fi_gettime_ms();
-
-	ret = fi_send(ep->dg_ep, (const void *) rxd_pkt_start(pkt_entry),
-		      pkt_entry->pkt_size, rxd_mr_desc(pkt_entry->mr, ep),
-		      rxd_ep_av(ep)->rxd_addr_table[pkt_entry->peer].dg_addr,
-		      &pkt_entry->context);
-	if (ret) {
-		FI_WARN(&rxd_prov, FI_LOG_EP_CTRL, "error sending packet: %d (%s)\n",
-			ret, fi_strerror(-ret));
-	} else {
-		pkt_entry->flags |= RXD_PKT_IN_USE;
-		ep->pending_cnt++;
-	}
-
-	return ret;
+	return peer->unacked_cnt < peer->tx_window;
 }
 
 static ssize_t rxd_ep_send_rts(struct rxd_ep *rxd_ep, fi_addr_t rxd_addr)
@@ -676,7 +830,8 @@ int rxd_ep_send_op(struct rxd_ep *rxd_ep, struct rxd_x_entry *tx_entry,
 	pkt_entry->peer = tx_entry->peer;
 	pkt_entry->pkt_size = ((char *) ptr - (char *) base_hdr) + rxd_ep->tx_prefix_size;
 
-	if (rxd_ep->peers[tx_entry->peer].unacked_cnt < rxd_env.max_unacked &&
+	if (rxd_ep->peers[tx_entry->peer].unacked_cnt <
+	    rxd_ep->peers[tx_entry->peer].tx_window &&
 	    rxd_ep->peers[tx_entry->peer].peer_addr != FI_ADDR_UNSPEC) {
 		tx_entry->start_seq = rxd_set_pkt_seq(&rxd_ep->peers[tx_entry->peer],
 						      pkt_entry);
@@ -695,8 +850,17 @@ int rxd_ep_send_op(struct rxd_ep *rxd_ep, struct rxd_x_entry *tx_entry,
 
 void rxd_ep_send_ack(struct rxd_ep *rxd_ep, fi_addr_t peer)
 {
-	struct rxd_pkt_entry *pkt_entry;
+	struct rxd_pkt_entry *pkt_entry, *buf_entry;
 	struct rxd_ack_pkt *ack;
+	uint64_t seq;
+
+	/*
+	 * While a message waits for a receive to be posted, more of the same
+	 * ack would only make the sender think that the message got lost.
+	 */
+	if (rxd_ep->peers[peer].rx_held &&
+	    rxd_ep->peers[peer].rx_seq_no == rxd_ep->peers[peer].last_tx_ack)
+		return;
 
 	pkt_entry = rxd_get_tx_pkt(rxd_ep);
 	if (!pkt_entry) {
@@ -714,6 +878,30 @@ void rxd_ep_send_ack(struct rxd_ep *rxd_ep, fi_addr_t peer)
 	ack->base_hdr.seq_no = rxd_ep->peers[peer].rx_seq_no;
 	ack->ext_hdr.tx_id = rxd_ep->peers[peer].curr_tx_id;
 	ack->ext_hdr.rx_id = rxd_ep->peers[peer].curr_rx_id;
+	ack->base_hdr.flags = 0;
+
+	ack->sack = 0;
+	dlist_foreach_container(&rxd_ep->peers[peer].buf_pkts,
+				struct rxd_pkt_entry, buf_entry, d_entry) {
+		seq = rxd_get_base_hdr(buf_entry)->seq_no;
+		if (ofi_after_eq(ack->base_hdr.seq_no, seq))
+			continue;
+		if (seq - ack->base_hdr.seq_no > RXD_SACK_BITS)
+			break;
+		ack->sack |= 1ULL << (seq - ack->base_hdr.seq_no - 1);
+	}
+
+	/*
+	 * Ops and packets beyond the rx window are dropped when they arrive
+	 * out of order, so once the sequence moves on again, the sender can
+	 * resend the packets that followed right away instead of waiting for
+	 * them to time out.
+	 */
+	if (rxd_ep->peers[peer].rx_dropped &&
+	    ack->base_hdr.seq_no != rxd_ep->peers[peer].last_tx_ack) {
+		ack->base_hdr.flags |= RXD_RESEND_REQ;
+		rxd_ep->peers[peer].rx_dropped = 0;
+	}
 	rxd_ep->peers[peer].last_tx_ack = ack->base_hdr.seq_no;
 
 	dlist_insert_tail(&pkt_entry->d_entry, &rxd_ep->ctrl_pkts);
@@ -1055,21 +1243,29 @@ static void rxd_progress_pkt_list(struct rxd_ep *ep, struct rxd_peer *peer)
 {
 	struct rxd_pkt_entry *pkt_entry;
 	uint64_t current;
-	int ret, retry = 0;
+	int ret, cnt = 0, retry = 0;
 
-	current = fi_gettime_ms();
+	current = fi_gettime_us();
 	if (peer->retry_cnt > RXD_MAX_PKT_RETRY) {
 		rxd_peer_timeout(ep, peer);
 		return;
 	}
 
+	/* Only the packets that fit into the tx window are resent */
 	dlist_foreach_container(&peer->unacked, struct rxd_pkt_entry,
 				pkt_entry, d_entry) {
+		if (cnt++ >= peer->tx_window)
+			break;
 		if (pkt_entry->flags & (RXD_PKT_IN_USE | RXD_PKT_ACKED) ||
-		    current < rxd_get_retry_time(pkt_entry->timestamp, peer->retry_cnt))
+		    current < rxd_get_retry_time(pkt_entry->timestamp,
+						 peer->rto, peer->retry_cnt))
 			continue;
+		if (!retry && !peer->retry_cnt) {
+			rxd_peer_window_loss(peer, true);
+			cnt = MIN(cnt, peer->tx_window);
+		}
 		retry = 1;
-		ret = rxd_ep_retry_pkt(ep, pkt_entry);
+		ret = rxd_ep_resend_pkt(ep, pkt_entry, true);
 		if (ret)
 			break;
 	}
@@ -1228,10 +1424,21 @@ static void rxd_init_peer(struct rxd_ep *ep, uint64_t rxd_addr)
 	ep->peers[rxd_addr].rx_seq_no = 0;
 	ep->peers[rxd_addr].last_rx_ack = 0;
 	ep->peers[rxd_addr].last_tx_ack = 0;
+	ep->peers[rxd_addr].recover_seq = 0;
 	ep->peers[rxd_addr].rx_window = rxd_env.max_unacked;
+	ep->peers[rxd_addr].tx_window = MIN(RXD_INIT_TX_WINDOW,
+					    rxd_env.max_unacked);
+	ep->peers[rxd_addr].ssthresh = rxd_env.max_unacked;
+	ep->peers[rxd_addr].window_acked = 0;
+	ep->peers[rxd_addr].srtt = 0;
+	ep->peers[rxd_addr].rttvar = 0;
+	ep->peers[rxd_addr].rto = RXD_INIT_RTO;
 	ep->peers[rxd_addr].unacked_cnt = 0;
 	ep->peers[rxd_addr].retry_cnt = 0;
+	ep->peers[rxd_addr].dup_acks = 0;
 	ep->peers[rxd_addr].active = 0;
+	ep->peers[rxd_addr].rx_dropped = 0;
+	ep->peers[rxd_addr].rx_held = 0;
 	dlist_init(&ep->peers[rxd_addr].unacked);
 	dlist_init(&ep->peers[rxd_addr].tx_list);
 	dlist_init(&ep->peers[rxd_addr].rx_list);
@@ -48,6 +48,7 @@ static void rxd_init_env(void)
 	fi_param_get_bool(&rxd_prov, "retry", &rxd_env.retry);
 	fi_param_get_int(&rxd_prov, "max_peers", &rxd_env.max_peers);
 	fi_param_get_int(&rxd_prov, "max_unacked", &rxd_env.max_unacked);
+	rxd_env.max_unacked = MIN(MAX(rxd_env.max_unacked, 1), UINT16_MAX);
 }
 
 int rxd_info_to_core(uint32_t version, const struct fi_info *rxd_info,
@@ -111,7 +112,8 @@ RXD_INI
 	fi_param_define(&rxd_prov, "max_peers", FI_PARAM_INT,
 			"Maximum number of peers to track (default: 1024)");
 	fi_param_define(&rxd_prov, "max_unacked", FI_PARAM_INT,
-			"Maximum number of packets to send at once (default: 128)");
+			"Maximum number of unacked packets per peer, which "
+			"caps the congestion window (default: 128)");
 
 	rxd_init_env();
 
@@ -71,6 +71,7 @@ static int rxd_ep_check_unexp_msg_list(struct rxd_ep *ep,
 	struct rxd_rma_hdr *rma_hdr = NULL;
 	void *msg = NULL;
 	size_t msg_size, total_size;
+	fi_addr_t peer;
 
 	while (!dlist_empty(unexp_list)) {
 		match = dlist_remove_first_match(unexp_list, &rxd_match_unexp,
@@ -97,8 +98,16 @@ static int rxd_ep_check_unexp_msg_list(struct rxd_ep *ep,
 
 		rxd_progress_op(ep, progress_entry, pkt_entry, base_hdr, sar_hdr, tag_hdr,
 				data_hdr, rma_hdr, atom_hdr, &msg, msg_size);
+		peer = base_hdr->peer;
 		rxd_release_repost_rx(ep, pkt_entry);
-		rxd_ep_send_ack(ep, base_hdr->peer);
+
+		/* data that followed the message may have been buffered */
+		if (!dlist_empty(&ep->peers[peer].buf_pkts)) {
+			fastlock_release(&ep->util_ep.rx_cq->cq_lock);
+			rxd_progress_buf_pkts(ep, peer);
+			fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
+		}
+		rxd_ep_send_ack(ep, peer);
 
 		if (!dup_entry)
 			return 1;
@@ -42,6 +42,7 @@
 
 #define RXD_IOV_LIMIT		4
 #define RXD_NAME_LENGTH		64
+#define RXD_SACK_BITS		64
 
 enum rxd_pkt_type {
 	RXD_MSG			= ofi_op_msg,
@@ -111,11 +112,14 @@ struct rxd_cts_pkt {
 
 /*
  * ACK: to signal received packets and send tx/rx id info
+ * 	- base_hdr.seq_no: next packet expected, all before it were received
+ * 	- sack: bit n is set if packet seq_no + 1 + n was received out of
+ * 		order.  Acks from peers that do not send it are shorter.
  */
 struct rxd_ack_pkt {
 	struct rxd_base_hdr	base_hdr;
 	struct rxd_ext_hdr	ext_hdr;
-	//TODO fill in more fields? Selective ack?
+	uint64_t		sack;
 };
 
 /*
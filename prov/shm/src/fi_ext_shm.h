@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2017 Intel Corporation, Inc.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _FI_EXT_SHM_H_
+#define _FI_EXT_SHM_H_
+
+/*
+ * See the fi_shm.7 man page for information about the shm provider
+ * extensions provided in this header.
+ */
+
+#include <stddef.h>
+#include <rdma/fi_domain.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FI_SHM_DOMAIN_OPS_1 "shm domain ops 1"
+
+/*
+ * Memory from mem_alloc is backed by an anonymous file.  Once registered,
+ * peers map it directly, so transfers to and from it are single copies
+ * that need neither syscalls nor ptrace permission.  Buffers must be freed
+ * through mem_free after their registrations have been closed.
+ */
+struct fi_shm_ops_domain {
+	size_t	size;
+	int	(*mem_alloc)(struct fid_domain *domain, size_t len, void **buf);
+	int	(*mem_free)(struct fid_domain *domain, void *buf);
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FI_EXT_SHM_H_ */
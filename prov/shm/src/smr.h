@@ -59,6 +59,9 @@
 #include <ofi_signal.h>
 #include <ofi_util.h>
 #include <ofi_atomic.h>
+#include <ofi_tag_match.h>
+
+#include "fi_ext_shm.h"
 
 #ifndef _SMR_H_
 #define _SMR_H_
@@ -71,6 +74,17 @@ extern struct fi_provider smr_prov;
 extern struct fi_info smr_info;
 extern struct util_prov smr_util_prov;
 
+struct smr_env {
+	int	disable_cma;
+	int	peer_idle_timeout;
+	int	wait_spin;
+	int	numa_bind;
+	int	inject_interleave;
+	size_t	cma_chunk_size;
+};
+
+extern struct smr_env smr_env;
+
 int smr_fabric(struct fi_fabric_attr *attr, struct fid_fabric **fabric,
 		void *context);
 
@@ -92,9 +106,12 @@ int smr_query_atomic(struct fid_domain *domain, enum fi_datatype datatype,
 		enum fi_op op, struct fi_atomic_attr *attr, uint64_t flags);
 
 #define SMR_IOV_LIMIT		4
+#define SMR_CMA_PEND_SIZE	64	/* concurrent CMA receives per ep */
+#define SMR_CMA_BATCH_IOV	64	/* iovecs per CMA syscall */
+#define SMR_SIGNAL_BATCH	16	/* peers woken per progress pass */
 
 struct smr_ep_entry {
-	struct dlist_entry	entry;
+	struct ofi_match_entry	match;
 	void			*context;
 	fi_addr_t		addr;
 	uint64_t		tag;
@@ -113,47 +130,133 @@ typedef int (*smr_tx_comp_func)(struct smr_ep *ep, void *context,
 		uint64_t flags, uint64_t err);
 
 
-struct smr_match_attr {
-	fi_addr_t	addr;
-	uint64_t	tag;
-	uint64_t	ignore;
+struct smr_unexp_msg {
+	struct ofi_match_entry match;
+	struct smr_cmd cmd;
 };
 
-static inline int smr_match_addr(fi_addr_t addr, fi_addr_t match_addr)
-{
-	return (addr == FI_ADDR_UNSPEC) || (match_addr == FI_ADDR_UNSPEC) ||
-		(addr == match_addr);
-}
-
-static inline int smr_match_tag(uint64_t tag, uint64_t ignore, uint64_t match_tag)
-{
-	return ((tag | ignore) == (match_tag | ignore));
-}
+/* Direction of the copies done locally for a pending transfer */
+enum {
+	smr_sar_copy_in,	/* user buffer -> bounce buffers */
+	smr_sar_copy_out,	/* bounce buffers -> user buffer */
+	smr_cma_copy,		/* peer buffer <-> user buffer through CMA */
+};
 
-struct smr_unexp_msg {
-	struct dlist_entry entry;
-	struct smr_cmd cmd;
+/*
+ * Local state of a SAR transfer in progress.  Both sides of the transfer
+ * keep one of these on ep->sar_list until all bytes have gone through the
+ * bounce buffers.  The side copying out is the last to touch the SAR message
+ * and returns it to the pool of the region owning it.
+ *
+ * CMA transfers are tracked the same way by the side doing the copy, so
+ * that a large transfer is copied in chunks between the processing of other
+ * commands, and chunks of transfers with the same peer share a syscall.
+ */
+struct smr_sar_entry {
+	struct dlist_entry	entry;
+	struct smr_cmd		cmd;
+	struct smr_ep_entry	*rx_entry;
+	struct smr_region	*sar_smr;
+	struct smr_region	*peer_smr;
+	struct smr_sar_msg	*sar_msg;
+	struct smr_resp		*resp;
+	struct iovec		iov[SMR_IOV_LIMIT];
+	size_t			iov_count;
+	size_t			bytes_done;
+	size_t			total_len;
+	int			dir;
+	int			batched;
 };
 
 DECLARE_FREESTACK(struct smr_ep_entry, smr_recv_fs);
 DECLARE_FREESTACK(struct smr_unexp_msg, smr_unexp_fs);
 DECLARE_FREESTACK(struct smr_cmd, smr_pend_fs);
-
-struct smr_queue {
-	struct dlist_entry list;
-	dlist_func_t *match_func;
-};
+DECLARE_FREESTACK(struct smr_sar_entry, smr_sar_fs);
 
 struct smr_fabric {
 	struct util_fabric	util_fabric;
 	int			dom_idx;
 };
 
+/*
+ * Windows published by a domain, the endpoints they are published in, and
+ * the memory from the domain's allocator.  All are protected by the
+ * util_domain lock.
+ */
 struct smr_domain {
 	struct util_domain	util_domain;
 	int			dom_idx;
 	int			ep_idx;
 	int			fast_rma;
+	struct dlist_entry	ep_list;
+	struct dlist_entry	mem_list;
+	struct fid_mr		*window_mr[SMR_MR_WINDOW_CNT];
+	int			window_fd[SMR_MR_WINDOW_CNT]; /* memfd, or -1 */
+	struct smr_mr_window	windows[SMR_MR_WINDOW_CNT];
+};
+
+extern struct fi_ops_mr smr_mr_ops;
+extern struct fi_shm_ops_domain smr_shm_domain_ops;
+
+/* A buffer from the fi_shm_ops_domain allocator */
+struct smr_mem {
+	struct dlist_entry	entry;
+	void			*addr;
+	size_t			len;
+	int			fd;
+};
+
+/* A peer's window, as mapped by an initiator */
+struct smr_mr_mapping {
+	struct smr_region	*region; /* peer region it was published in */
+	int			pid;
+	uint32_t		seq;
+	int			requested; /* memfd asked from the owner */
+	int			failed;
+	void			*map_addr;
+	size_t			map_len;
+	uint8_t			*base;	/* local address of the window's addr */
+	struct smr_mr_window	window;
+};
+
+struct smr_mr_peer {
+	struct dlist_entry	entry;
+	int			peer_id;
+	struct smr_mr_mapping	mappings[SMR_MR_WINDOW_CNT];
+	/* our memfd windows passed to the peer, by the seq they had then */
+	struct smr_region	*push_region;
+	int			push_pid;
+	uint32_t		push_seq[SMR_MR_WINDOW_CNT];
+};
+
+/*
+ * Messages exchanged over the mr sockets.  A request asks the owner of a
+ * memfd window for its fd, which comes back in a push.  Pushes are also
+ * sent unasked ahead of commands that refer to the sender's windows.
+ * Senders are identified by the credentials the kernel attaches to every
+ * message, never by the message itself.
+ */
+enum {
+	smr_mr_fd_req,
+	smr_mr_fd_push,
+};
+
+struct smr_mr_fd_msg {
+	uint32_t		type;
+	uint32_t		slot;
+	uint32_t		seq;
+	uint32_t		id;	/* req: requester's fi_addr at the owner */
+	uint64_t		region;	/* push: base_addr of the owner's region */
+};
+
+#define SMR_MR_FD_CACHE	64
+
+/* A memfd received from a peer and not mapped yet */
+struct smr_mr_fd {
+	struct dlist_entry	entry;
+	struct smr_mr_fd_msg	msg;
+	pid_t			pid;	/* sender, from its credentials */
+	int			fd;
 };
 
 #define SMR_PREFIX	"fi_shm://"
@@ -182,11 +285,27 @@ struct smr_ep {
 	const char		*name;
 	struct smr_region	*region;
 	struct smr_recv_fs	*recv_fs; /* protected by rx_cq lock */
-	struct smr_queue	recv_queue;
-	struct smr_queue	trecv_queue;
+	struct ofi_match_queue	recv_queue;
+	struct ofi_match_queue	trecv_queue;
 	struct smr_unexp_fs	*unexp_fs;
 	struct smr_pend_fs	*pend_fs;
-	struct smr_queue	unexp_queue;
+	struct ofi_match_queue	unexp_queue;
+	struct smr_sar_fs	*sar_fs;
+	struct dlist_entry	sar_list;
+	int			cma_pending; /* protected by rx_cq lock */
+	int			signal_sock;
+	struct smr_region	*signal_peers[SMR_SIGNAL_BATCH];
+	int			signal_cnt; /* protected by rx_cq lock */
+	struct dlist_entry	domain_entry;
+	fastlock_t		mr_lock; /* protects the mr fields below;
+					    taken after the region and cq
+					    locks, and before the domain and
+					    peer map locks */
+	struct index_map	mr_peers;
+	struct dlist_entry	mr_peer_list;
+	struct dlist_entry	mr_fd_list;
+	int			mr_fd_cnt;
+	int			mr_sock;
 };
 
 #define smr_ep_rx_flags(smr_ep) ((smr_ep)->util_ep.rx_op_flags)
@@ -195,13 +314,52 @@ struct smr_ep {
 int smr_endpoint(struct fid_domain *domain, struct fi_info *info,
 		  struct fid_ep **ep, void *context);
 
+struct smr_cq {
+	struct util_cq		util_cq;
+	uint64_t		spin_time; /* usec polled before sleeping */
+	uint64_t		max_spin;
+};
+
 int smr_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 		struct fid_cq **cq_fid, void *context);
 
-int smr_verify_peer(struct smr_ep *ep, int peer_id);
+void smr_mem_free_all(struct smr_domain *domain);
+void smr_mr_add_ep(struct smr_ep *ep);
+void smr_mr_del_ep(struct smr_ep *ep);
+void *smr_mr_window_ptr(struct smr_ep *ep, int peer_id, uint64_t addr,
+			size_t len, uint64_t key, uint64_t access);
+int smr_mr_window_iov(struct smr_ep *ep, int peer_id,
+		      const struct iovec *peer_iov, size_t count,
+		      uint64_t access, struct iovec *iov);
+int smr_mr_push_iov(struct smr_ep *ep, int peer_id, const struct iovec *iov,
+		    size_t count, uint64_t access);
+void smr_mr_progress(struct smr_ep *ep);
+
+void smr_wake(struct smr_region *region);
+void smr_signal_fini(void);
+
+/* Wake the owner of a region after posting work it must progress.  The
+ * check is a single load unless the owner is sleeping. */
+static inline void smr_signal(struct smr_region *region)
+{
+	smr_mb();
+	if (ofi_atomic_get32(&region->signal) &&
+	    ofi_atomic_cas_bool32(&region->signal, 1, 0))
+		smr_wake(region);
+}
 
-void smr_post_pend_resp(struct smr_cmd *cmd, struct smr_cmd *pend,
-			struct smr_resp *resp);
+int smr_verify_peer(struct smr_ep *ep, int peer_id,
+		    struct smr_region **peer_smr);
+int smr_verify_peer_resp(struct smr_ep *ep, int peer_id,
+			 struct smr_region **peer_smr);
+int smr_cma_enabled(struct smr_ep *ep, int peer_id,
+		    struct smr_region *peer_smr);
+int smr_peer_cma_enabled(struct smr_ep *ep, int peer_id);
+void smr_cma_publish(struct smr_ep *ep, int peer_id,
+		     struct smr_region *peer_smr);
+
+void smr_post_pend_resp(struct smr_region *smr, struct smr_cmd *cmd,
+			struct smr_cmd *pend, struct smr_resp *resp);
 void smr_generic_format(struct smr_cmd *cmd, fi_addr_t peer_id,
 		uint32_t op, uint64_t tag, uint8_t datatype, uint8_t atomic_op,
 		uint64_t data, uint64_t op_flags);
@@ -217,6 +375,31 @@ void smr_format_iov(struct smr_cmd *cmd, fi_addr_t peer_id,
 		uint32_t op, uint64_t tag, uint64_t data, uint64_t op_flags,
 		void *context, struct smr_region *smr, struct smr_resp *resp,
 		struct smr_cmd *pend);
+int smr_format_sar(struct smr_ep *ep, struct smr_cmd *cmd, fi_addr_t peer_id,
+		const struct iovec *iov, size_t count, size_t total_len,
+		uint32_t op, uint64_t tag, uint64_t data, uint64_t op_flags,
+		void *context, struct smr_region *peer_smr,
+		struct smr_resp *resp, struct smr_cmd *pend);
+
+/*
+ * Publish reserved command slots that the sender ended up not using.  The
+ * last slot is committed first so that the receiver never sees a partially
+ * committed multi-slot command.
+ */
+static inline void smr_post_noop(struct smr_region *peer_smr, int64_t pos,
+				 int cnt)
+{
+	struct smr_cmd *cmd;
+
+	while (cnt--) {
+		cmd = smr_cmd_queue_slot(smr_cmd_queue(peer_smr), pos + cnt);
+		cmd->msg.hdr.op_flags = SMR_NOOP;
+		smr_cmd_queue_commit(smr_cmd_queue(peer_smr), pos + cnt);
+	}
+}
+
+void smr_copy_to_sar(struct smr_sar_entry *entry);
+void smr_copy_from_sar(struct smr_sar_entry *entry);
 
 int smr_tx_comp(struct smr_ep *ep, void *context, uint64_t flags, uint64_t err);
 int smr_tx_comp_signal(struct smr_ep *ep, void *context, uint64_t flags,
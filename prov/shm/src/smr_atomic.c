@@ -150,7 +150,8 @@ static int smr_fetch_result(struct smr_ep *ep, struct smr_region *peer_smr,
 }
 
 static void smr_post_fetch_resp(struct smr_ep *ep, struct smr_cmd *cmd,
-				const struct iovec *result_iov, size_t count)
+				int peer_id, const struct iovec *result_iov,
+				size_t count)
 {
 	struct smr_cmd *pend;
 	struct smr_resp *resp;
@@ -162,7 +163,9 @@ static void smr_post_fetch_resp(struct smr_ep *ep, struct smr_cmd *cmd,
 			    (char **) ep->region);
 
 	pend = freestack_pop(ep->pend_fs);
-	smr_post_pend_resp(cmd, pend, resp);
+	smr_post_pend_resp(ep->region, cmd, pend, resp);
+	/* the peer's inject buffer is released through our own map */
+	pend->msg.hdr.addr = peer_id;
 	memcpy(pend->msg.data.iov, result_iov,
 	       sizeof(*result_iov) * count);
 	pend->msg.data.iov_count = count;
@@ -170,6 +173,85 @@ static void smr_post_fetch_resp(struct smr_ep *ep, struct smr_cmd *cmd,
 	ofi_cirque_commit(smr_resp_queue(ep->region));
 }
 
+/*
+ * Apply the atomic in place when every target lies in a window the peer has
+ * published (see smr_mr.c).  Only datatypes the CPU can update atomically are
+ * eligible, so the update is coherent with the peer applying commands from
+ * other initiators to the same memory.  Returns -FI_ENOENT if the operation
+ * must be sent to the peer instead.
+ */
+static int smr_direct_atomic(struct smr_ep *ep, int peer_id, uint32_t op,
+			     enum fi_datatype datatype, enum fi_op atomic_op,
+			     const struct iovec *iov, size_t count,
+			     const struct iovec *compare_iov,
+			     size_t compare_count,
+			     const struct iovec *result_iov,
+			     size_t result_count,
+			     const struct fi_rma_ioc *rma_ioc, size_t rma_count)
+{
+#ifdef HAVE_BUILTIN_MM_ATOMICS
+	uint8_t src[SMR_INJECT_SIZE], cmp[SMR_INJECT_SIZE];
+	uint8_t result[SMR_INJECT_SIZE];
+	uint8_t *dst[SMR_IOV_LIMIT];
+	uint64_t access;
+	size_t dt_size, len, total_len = 0;
+	int i;
+
+	dt_size = ofi_datatype_size(datatype);
+	if (dt_size > sizeof(uint64_t) || datatype == FI_FLOAT_COMPLEX)
+		return -FI_ENOENT;
+
+	if ((op == ofi_op_atomic_compare &&
+	     !ofi_atomic_swap_handlers[atomic_op - OFI_SWAP_OP_START][datatype]) ||
+	    (op == ofi_op_atomic_fetch &&
+	     !ofi_atomic_readwrite_handlers[atomic_op][datatype]) ||
+	    (op == ofi_op_atomic &&
+	     !ofi_atomic_write_handlers[atomic_op][datatype]))
+		return -FI_ENOENT;
+
+	access = (op == ofi_op_atomic ? 0 : FI_REMOTE_READ) |
+		 (atomic_op == FI_ATOMIC_READ ? 0 : FI_REMOTE_WRITE);
+	for (i = 0; i < rma_count; i++) {
+		len = rma_ioc[i].count * dt_size;
+		total_len += len;
+		if (total_len > SMR_INJECT_SIZE)
+			return -FI_ENOENT;
+
+		dst[i] = smr_mr_window_ptr(ep, peer_id, rma_ioc[i].addr, len,
+					   rma_ioc[i].key, access);
+		if (!dst[i])
+			return -FI_ENOENT;
+	}
+
+	if (op == ofi_op_atomic_compare)
+		ofi_copy_from_iov(cmp, total_len, compare_iov, compare_count, 0);
+	if (atomic_op != FI_ATOMIC_READ)
+		ofi_copy_from_iov(src, total_len, iov, count, 0);
+
+	for (i = 0, len = 0; i < rma_count; i++) {
+		if (op == ofi_op_atomic_compare) {
+			ofi_atomic_swap_handlers[atomic_op - OFI_SWAP_OP_START]
+				[datatype](dst[i], &src[len], &cmp[len],
+					   &result[len], rma_ioc[i].count);
+		} else if (op == ofi_op_atomic_fetch) {
+			ofi_atomic_readwrite_handlers[atomic_op][datatype](
+				dst[i], &src[len], &result[len],
+				rma_ioc[i].count);
+		} else {
+			ofi_atomic_write_handlers[atomic_op][datatype](
+				dst[i], &src[len], rma_ioc[i].count);
+		}
+		len += rma_ioc[i].count * dt_size;
+	}
+
+	if (op != ofi_op_atomic)
+		ofi_copy_to_iov(result_iov, result_count, 0, result, total_len);
+	return 0;
+#else
+	return -FI_ENOENT;
+#endif
+}
+
 static ssize_t smr_generic_atomic(struct fid_ep *ep_fid,
 			const struct fi_ioc *ioc, void **desc, size_t count,
 			const struct fi_ioc *compare_ioc, void **compare_desc,
@@ -187,6 +269,7 @@ static ssize_t smr_generic_atomic(struct fid_ep *ep_fid,
 	struct iovec iov[SMR_IOV_LIMIT];
 	struct iovec compare_iov[SMR_IOV_LIMIT];
 	struct iovec result_iov[SMR_IOV_LIMIT];
+	int64_t pos;
 	int peer_id, err = 0;
 	uint16_t flags = 0;
 	ssize_t ret = 0;
@@ -201,16 +284,10 @@ static ssize_t smr_generic_atomic(struct fid_ep *ep_fid,
 	domain = container_of(ep->util_ep.domain, struct smr_domain, util_domain);
 
 	peer_id = (int) addr;
-	ret = smr_verify_peer(ep, peer_id);
+	ret = smr_verify_peer_resp(ep, peer_id, &peer_smr);
 	if(ret)
 		return ret;
 
-	peer_smr = smr_peer_region(ep->region, peer_id);
-	fastlock_acquire(&peer_smr->lock);
-	if (peer_smr->cmd_cnt < 2) {
-		ret = -FI_EAGAIN;
-		goto unlock_region;
-	}
 
 	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
 	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq)) {
@@ -218,10 +295,9 @@ static ssize_t smr_generic_atomic(struct fid_ep *ep_fid,
 		goto unlock_cq;
 	}
 
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
 	msg_len = total_len = ofi_datatype_size(datatype) *
 			      ofi_total_ioc_cnt(ioc, count);
-	
+
 	switch (op) {
 	case ofi_op_atomic_compare:
 		assert(compare_ioc);
@@ -233,7 +309,7 @@ static ssize_t smr_generic_atomic(struct fid_ep *ep_fid,
 		assert(result_ioc);
 		ofi_ioc_to_iov(result_ioc, result_iov, result_count,
 			       ofi_datatype_size(datatype));
-		if (!domain->fast_rma)
+		if (!domain->fast_rma || !smr_cma_enabled(ep, peer_id, peer_smr))
 			flags |= SMR_RMA_REQ;
 		/* fall through */
 	case ofi_op_atomic:
@@ -248,12 +324,34 @@ static ssize_t smr_generic_atomic(struct fid_ep *ep_fid,
 		break;
 	}
 
+	if (domain->fast_rma &&
+	    !smr_direct_atomic(ep, peer_id, op, datatype, atomic_op, iov, count,
+			       compare_iov, compare_count, result_iov,
+			       result_count, rma_ioc, rma_count)) {
+		ret = ep->tx_comp(ep, context, ofi_tx_cq_flags(op), 0);
+		if (ret) {
+			FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
+				"unable to process tx completion\n");
+		}
+		goto unlock_cq;
+	}
+
+	if (smr_cmd_queue_next(smr_cmd_queue(peer_smr), 2, &pos)) {
+		ret = -FI_EAGAIN;
+		goto unlock_cq;
+	}
+
+	cmd = smr_cmd_queue_slot(smr_cmd_queue(peer_smr), pos);
 	if (total_len <= SMR_MSG_DATA_LEN && !(flags & SMR_RMA_REQ)) {
 		smr_format_inline_atomic(cmd, smr_peer_addr(ep->region)[peer_id].addr,
 					 iov, count, compare_iov, compare_count,
 					 op, datatype, atomic_op);
 	} else if (total_len <= SMR_INJECT_SIZE) {
-		tx_buf = smr_freestack_pop(smr_inject_pool(peer_smr));
+		tx_buf = smr_inject_buf_pop(peer_smr);
+		if (!tx_buf) {
+			ret = -FI_EAGAIN;
+			goto noop;
+		}
 		smr_format_inject_atomic(cmd, smr_peer_addr(ep->region)[peer_id].addr,
 					 iov, count, result_iov, result_count,
 					 compare_iov, compare_count, op, datatype,
@@ -262,20 +360,21 @@ static ssize_t smr_generic_atomic(struct fid_ep *ep_fid,
 		FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
 			"message too large\n");
 		ret = -FI_EINVAL;
-		goto unlock_cq;
+		goto noop;
 	}
 	cmd->msg.hdr.op_flags |= flags;
 
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
+	smr_format_rma_ioc(smr_cmd_queue_slot(smr_cmd_queue(peer_smr), pos + 1),
+			   rma_ioc, rma_count);
 
 	if (op != ofi_op_atomic) {
 		if (flags & SMR_RMA_REQ) {
-			smr_post_fetch_resp(ep, cmd,
+			smr_post_fetch_resp(ep, cmd, peer_id,
 				(const struct iovec *) result_iov,
 				result_count);
-			goto format_rma;
+			goto commit;
 		}
+		/* The peer cannot apply the atomic until it is committed */
 		err = smr_fetch_result(ep, peer_smr, result_iov, result_count,
 				       rma_ioc, rma_count, datatype, msg_len);
 		if (err)
@@ -289,15 +388,15 @@ static ssize_t smr_generic_atomic(struct fid_ep *ep_fid,
 			"unable to process tx completion\n");
 	}
 
-format_rma:
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
-	smr_format_rma_ioc(cmd, rma_ioc, rma_count);
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
+commit:
+	smr_cmd_queue_commit(smr_cmd_queue(peer_smr), pos + 1);
+	smr_cmd_queue_commit(smr_cmd_queue(peer_smr), pos);
+	smr_signal(peer_smr);
+	goto unlock_cq;
+noop:
+	smr_post_noop(peer_smr, pos, 2);
 unlock_cq:
 	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
-unlock_region:
-	fastlock_release(&peer_smr->lock);
 	return ret;
 }
 
@@ -352,11 +451,13 @@ static ssize_t smr_atomic_inject(struct fid_ep *ep_fid, const void *buf,
 			uint64_t key, enum fi_datatype datatype, enum fi_op op)
 {
 	struct smr_ep *ep;
+	struct smr_domain *domain;
 	struct smr_region *peer_smr;
 	struct smr_inject_buf *tx_buf;
 	struct smr_cmd *cmd;
 	struct iovec iov;
 	struct fi_rma_ioc rma_ioc;
+	int64_t pos;
 	int peer_id;
 	ssize_t ret = 0;
 	size_t total_len;
@@ -364,22 +465,15 @@ static ssize_t smr_atomic_inject(struct fid_ep *ep_fid, const void *buf,
 	assert(count <= SMR_INJECT_SIZE);
 
 	ep = container_of(ep_fid, struct smr_ep, util_ep.ep_fid.fid);
+	domain = container_of(ep->util_ep.domain, struct smr_domain, util_domain);
 
 	peer_id = (int) dest_addr;
-	ret = smr_verify_peer(ep, peer_id);
+	ret = smr_verify_peer_resp(ep, peer_id, &peer_smr);
 	if(ret)
 		return ret;
 
-	peer_smr = smr_peer_region(ep->region, peer_id);
-	fastlock_acquire(&peer_smr->lock);
-	if (peer_smr->cmd_cnt < 2) {
-		ret = -FI_EAGAIN;
-		goto unlock_region;
-	}
-
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
 	total_len = count * ofi_datatype_size(datatype);
-	
+
 	iov.iov_base = (void *) buf;
 	iov.iov_len = total_len;
 
@@ -387,26 +481,37 @@ static ssize_t smr_atomic_inject(struct fid_ep *ep_fid, const void *buf,
 	rma_ioc.count = count;
 	rma_ioc.key = key;
 
+	if (domain->fast_rma &&
+	    !smr_direct_atomic(ep, peer_id, ofi_op_atomic, datatype, op,
+			       &iov, 1, NULL, 0, NULL, 0, &rma_ioc, 1))
+		return 0;
+
+	if (smr_cmd_queue_next(smr_cmd_queue(peer_smr), 2, &pos))
+		return -FI_EAGAIN;
+
+	cmd = smr_cmd_queue_slot(smr_cmd_queue(peer_smr), pos);
+
 	if (total_len <= SMR_MSG_DATA_LEN) {
 		smr_format_inline_atomic(cmd, smr_peer_addr(ep->region)[peer_id].addr,
 					 &iov, 1, NULL, 0, ofi_op_atomic,
 					 datatype, op);
 	} else if (total_len <= SMR_INJECT_SIZE) {
-		tx_buf = smr_freestack_pop(smr_inject_pool(peer_smr));
+		tx_buf = smr_inject_buf_pop(peer_smr);
+		if (!tx_buf) {
+			smr_post_noop(peer_smr, pos, 2);
+			return -FI_EAGAIN;
+		}
 		smr_format_inject_atomic(cmd, smr_peer_addr(ep->region)[peer_id].addr,
 					 &iov, 1, NULL, 0, NULL, 0, ofi_op_atomic,
 					 datatype, op, peer_smr, tx_buf);
 	}
 
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
-	smr_format_rma_ioc(cmd, &rma_ioc, 1);
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
+	smr_format_rma_ioc(smr_cmd_queue_slot(smr_cmd_queue(peer_smr), pos + 1),
+			   &rma_ioc, 1);
+	smr_cmd_queue_commit(smr_cmd_queue(peer_smr), pos + 1);
+	smr_cmd_queue_commit(smr_cmd_queue(peer_smr), pos);
+	smr_signal(peer_smr);
 
-unlock_region:
-	fastlock_release(&peer_smr->lock);
 	return ret;
 }
 
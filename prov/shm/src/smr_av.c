@@ -90,11 +90,13 @@ static int smr_av_insert(struct fid_av *av_fid, const void *addr, size_t count,
 		if (fi_addr)
 			fi_addr[i] = (ret == 0) ? index : FI_ADDR_NOTAVAIL;
 
+		fastlock_acquire(&smr_av->smr_map->lock);
 		dlist_foreach(&util_av->ep_list, av_entry) {
 			util_ep = container_of(av_entry, struct util_ep, av_entry);
 			smr_ep = container_of(util_ep, struct smr_ep, util_ep);
 			smr_map_to_endpoint(smr_ep->region, index);
 		}
+		fastlock_release(&smr_av->smr_map->lock);
 	}
 
 	if (!(flags & FI_EVENT))
@@ -126,12 +128,12 @@ static int smr_av_remove(struct fid_av *av_fid, fi_addr_t *fi_addr, size_t count
 			break;
 		}
 
-		smr_map_del(smr_av->smr_map, fi_addr[i]);
 		dlist_foreach(&util_av->ep_list, av_entry) {
 			util_ep = container_of(av_entry, struct util_ep, av_entry);
 			smr_ep = container_of(util_ep, struct smr_ep, util_ep);
 			smr_unmap_from_endpoint(smr_ep->region, fi_addr[i]);
 		}
+		smr_map_del(smr_av->smr_map, fi_addr[i]);
 	}
 
 	fastlock_release(&util_av->lock);
@@ -143,17 +145,17 @@ static int smr_av_lookup(struct fid_av *av, fi_addr_t fi_addr, void *addr,
 {
 	struct util_av *util_av;
 	struct smr_av *smr_av;
-	struct smr_region *peer_smr;
+	struct smr_peer *peer;
 	int peer_id = (int)fi_addr;
 
 	util_av = container_of(av, struct util_av, av_fid);
 	smr_av = container_of(util_av, struct smr_av, util_av);
-	peer_smr = smr_map_get(smr_av->smr_map, peer_id);
+	peer = smr_map_peer(smr_av->smr_map, peer_id);
 
-	if (!peer_smr)
+	if (!peer)
 		return -FI_ADDR_NOTAVAIL;
 
-	strncpy((char *)addr, smr_name(peer_smr), *addrlen);
+	strncpy((char *)addr, peer->peer.name, *addrlen);
 	((char *) addr)[*addrlen] = '\0';
 	*addrlen = sizeof(struct smr_addr);
 	return 0;
@@ -226,7 +228,7 @@ int smr_av_open(struct fid_domain *domain, struct fi_av_attr *attr,
 	(*av)->fid.ops = &smr_av_fi_ops;
 	(*av)->ops = &smr_av_ops;
 
-	ret = smr_map_create(&smr_prov, SMR_MAX_PEERS, &smr_av->smr_map);
+	ret = smr_map_create(&smr_prov, &smr_av->smr_map);
 	if (ret)
 		goto close;
 
@@ -35,25 +35,104 @@
 
 #include "smr.h"
 
+/*
+ * Poll before sleeping, so latency under load stays at polling level.  The
+ * spin time doubles whenever a completion arrives within the maximum spin,
+ * whether found by polling or shortly after going to sleep, and halves
+ * whenever the CQ sleeps for longer than that.
+ */
+static ssize_t smr_cq_sreadfrom(struct fid_cq *cq_fid, void *buf, size_t count,
+				fi_addr_t *src_addr, const void *cond,
+				int timeout)
+{
+	struct smr_cq *cq;
+	uint64_t start, elapsed;
+	ssize_t ret;
+
+	cq = container_of(cq_fid, struct smr_cq, util_cq.cq_fid);
+	start = fi_gettime_us();
+
+	ret = ofi_cq_readfrom(cq_fid, buf, count, src_addr);
+	if (ret != -FI_EAGAIN)
+		return ret;
+
+	do {
+		ret = ofi_cq_readfrom(cq_fid, buf, count, src_addr);
+		elapsed = fi_gettime_us() - start;
+	} while (ret == -FI_EAGAIN && elapsed < cq->spin_time &&
+		 (timeout < 0 || elapsed < (uint64_t) timeout * 1000));
+
+	if (ret == -FI_EAGAIN) {
+		if (timeout >= 0)
+			timeout = MAX(timeout - (int) (elapsed / 1000), 0);
+		ret = ofi_cq_sreadfrom(cq_fid, buf, count, src_addr, cond,
+				       timeout);
+		elapsed = fi_gettime_us() - start;
+	}
+
+	if (elapsed <= cq->max_spin)
+		cq->spin_time = MIN(MAX(cq->spin_time * 2, 1), cq->max_spin);
+	else
+		cq->spin_time /= 2;
+	return ret;
+}
+
+static ssize_t smr_cq_sread(struct fid_cq *cq_fid, void *buf, size_t count,
+			    const void *cond, int timeout)
+{
+	return smr_cq_sreadfrom(cq_fid, buf, count, NULL, cond, timeout);
+}
+
+static const char *smr_cq_strerror(struct fid_cq *cq_fid, int prov_errno,
+				   const void *err_data, char *buf, size_t len)
+{
+	return fi_strerror(prov_errno);
+}
+
+static struct fi_ops_cq smr_cq_ops = {
+	.size = sizeof(struct fi_ops_cq),
+	.read = ofi_cq_read,
+	.readfrom = ofi_cq_readfrom,
+	.readerr = ofi_cq_readerr,
+	.sread = smr_cq_sread,
+	.sreadfrom = smr_cq_sreadfrom,
+	.signal = ofi_cq_signal,
+	.strerror = smr_cq_strerror,
+};
+
 int smr_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 		struct fid_cq **cq_fid, void *context)
 {
-	struct util_cq *util_cq;
+	struct smr_cq *cq;
 	int ret;
 
-	if (attr->wait_obj != FI_WAIT_NONE) {
-		FI_INFO(&smr_prov, FI_LOG_CQ, "CQ wait not yet supported\n");
+	switch (attr->wait_obj) {
+	case FI_WAIT_NONE:
+	case FI_WAIT_UNSPEC:
+	case FI_WAIT_FD:
+	case FI_WAIT_SET:
+		break;
+	default:
+		FI_INFO(&smr_prov, FI_LOG_CQ, "CQ wait object not supported\n");
 		return -FI_ENOSYS;
 	}
 
-	util_cq = calloc(1, sizeof(*util_cq));
-	if (!util_cq)
+	cq = calloc(1, sizeof(*cq));
+	if (!cq)
 		return -FI_ENOMEM;
 
-	ret = ofi_cq_init(&smr_prov, domain, attr, util_cq, ofi_cq_progress, context);
-	if (ret)
+	ret = ofi_cq_init(&smr_prov, domain, attr, &cq->util_cq,
+			  ofi_cq_progress, context);
+	if (ret) {
+		free(cq);
 		return ret;
+	}
 
-	(*cq_fid) = &util_cq->cq_fid;
+	/* With a single CPU the peer cannot make progress while we spin */
+	cq->max_spin = ofi_sysconf(_SC_NPROCESSORS_ONLN) > 1 ?
+		       smr_env.wait_spin : 0;
+	cq->spin_time = cq->max_spin;
+	*cq_fid = &cq->util_cq.cq_fid;
+	(*cq_fid)->ops = &smr_cq_ops;
 	return 0;
 }
@@ -58,29 +58,33 @@ static int smr_domain_close(fid_t fid)
 	if (ret)
 		return ret;
 
+	smr_mem_free_all(domain);
 	free(domain);
 	return 0;
 }
 
+static int smr_domain_ops_open(struct fid *fid, const char *name,
+			       uint64_t flags, void **ops, void *context)
+{
+	if (strcmp(name, FI_SHM_DOMAIN_OPS_1))
+		return -FI_EINVAL;
+
+	*ops = &smr_shm_domain_ops;
+	return 0;
+}
+
 static struct fi_ops smr_domain_fi_ops = {
 	.size = sizeof(struct fi_ops),
 	.close = smr_domain_close,
 	.bind = fi_no_bind,
 	.control = fi_no_control,
-	.ops_open = fi_no_ops_open,
-};
-
-static struct fi_ops_mr smr_mr_ops = {
-	.size = sizeof(struct fi_ops_mr),
-	.reg = ofi_mr_reg,
-	.regv = ofi_mr_regv,
-	.regattr = ofi_mr_regattr,
+	.ops_open = smr_domain_ops_open,
 };
 
 int smr_domain_open(struct fid_fabric *fabric, struct fi_info *info,
 		struct fid_domain **domain, void *context)
 {
-	int ret;
+	int ret, i;
 	struct smr_domain *smr_domain;
 	struct smr_fabric *smr_fabric;
 
@@ -104,6 +108,10 @@ int smr_domain_open(struct fid_fabric *fabric, struct fi_info *info,
 	smr_domain->fast_rma = smr_fast_rma_enabled(info->domain_attr->mr_mode,
 						    info->tx_attr->msg_order);
 	fastlock_release(&smr_fabric->util_fabric.lock);
+	dlist_init(&smr_domain->ep_list);
+	dlist_init(&smr_domain->mem_list);
+	for (i = 0; i < SMR_MR_WINDOW_CNT; i++)
+		smr_domain->window_fd[i] = -1;
 
 	*domain = &smr_domain->util_domain.domain_fid;
 	(*domain)->fid.ops = &smr_domain_fi_ops;
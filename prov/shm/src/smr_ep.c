@@ -33,6 +33,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "ofi_iov.h"
 #include "smr.h"
@@ -116,32 +118,26 @@ int smr_setopt(fid_t fid, int level, int optname,
 }
 
 
-static int smr_match_recv_ctx(struct dlist_entry *item, const void *args)
-{
-	struct smr_ep_entry *pending_recv;
-
-	pending_recv = container_of(item, struct smr_ep_entry, entry);
-	return pending_recv->context == args;
-}
-
-static int smr_ep_cancel_recv(struct smr_ep *ep, struct smr_queue *queue,
+static int smr_ep_cancel_recv(struct smr_ep *ep, struct ofi_match_queue *queue,
 			      void *context)
 {
 	struct smr_ep_entry *recv_entry;
-	struct dlist_entry *entry;
 	int ret = 0;
 
 	fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
-	entry = dlist_remove_first_match(&queue->list, smr_match_recv_ctx,
-					 context);
-	if (entry) {
-		recv_entry = container_of(entry, struct smr_ep_entry, entry);
+	dlist_foreach_container(&queue->list, struct smr_ep_entry, recv_entry,
+				match.list_entry) {
+		if (recv_entry->context != context)
+			continue;
+
+		ofi_match_remove(&recv_entry->match);
 		ret = ep->rx_comp(ep, (void *) recv_entry->context,
 				  recv_entry->flags | FI_RECV, 0,
 				  NULL, (void *) recv_entry->addr,
 				  recv_entry->tag, 0, FI_ECANCELED);
 		freestack_push(ep->recv_fs, recv_entry);
 		ret = ret ? ret : 1;
+		break;
 	}
 
 	fastlock_release(&ep->util_ep.rx_cq->cq_lock);
@@ -174,58 +170,130 @@ static struct fi_ops_ep smr_ep_ops = {
 	.tx_size_left = fi_no_tx_size_left,
 };
 
-int smr_verify_peer(struct smr_ep *ep, int peer_id)
+/*
+ * Returns the peer's region through peer_smr.  Use it rather than looking the
+ * region up again: an idle sweep may retire it in between.
+ */
+int smr_verify_peer(struct smr_ep *ep, int peer_id,
+		    struct smr_region **peer_smr)
 {
+	struct smr_peer *peer;
 	int ret;
 
-	if (ep->region->map->peers[peer_id].peer.addr != FI_ADDR_UNSPEC)
+	peer = smr_map_peer(ep->region->map, peer_id);
+	if (!peer)
+		return -FI_EINVAL;
+
+	/* Once mapped, only look up our address at the peer again if the
+	 * peer has inserted new addresses since the last lookup */
+	*peer_smr = smr_peer_region(ep->region, peer_id);
+	if (*peer_smr && (smr_peer_addr_known(ep->region, peer_id) ||
+			  peer->peer_gen == (*peer_smr)->peer_gen))
 		return 0;
 
-	ret = smr_map_to_region(&smr_prov, &ep->region->map->peers[peer_id]);
+	ret = smr_map_activate(&smr_prov, ep->region, peer_id, peer_smr);
 
 	return (ret == -ENOENT) ? -FI_EAGAIN : ret;
 }
 
-static int smr_match_msg(struct dlist_entry *item, const void *args)
+/*
+ * A peer that has not inserted our address yet still receives messages from
+ * us, with an unknown source, but cannot respond to them.  Hold back the
+ * transfers that need a response until it knows us.
+ */
+int smr_verify_peer_resp(struct smr_ep *ep, int peer_id,
+			 struct smr_region **peer_smr)
 {
-	struct smr_match_attr *attr = (struct smr_match_attr *)args;
-	struct smr_ep_entry *recv_entry;
+	int ret;
 
-	recv_entry = container_of(item, struct smr_ep_entry, entry);
-	return smr_match_addr(recv_entry->addr, attr->addr);
+	ret = smr_verify_peer(ep, peer_id, peer_smr);
+	if (ret)
+		return ret;
+
+	return smr_peer_addr_known(ep->region, peer_id) ? 0 : -FI_EAGAIN;
 }
 
-static int smr_match_tagged(struct dlist_entry *item, const void *args)
+/*
+ * CMA requires ptrace access to the peer, which is commonly blocked inside
+ * containers.  Probe it once per peer by reading the pid field of the peer's
+ * region through its own mapping.
+ */
+static void smr_cma_check(struct smr_ep *ep, int peer_id,
+			  struct smr_region *peer_smr)
 {
-	struct smr_match_attr *attr = (struct smr_match_attr *)args;
-	struct smr_ep_entry *recv_entry;
+	struct smr_peer *peer;
+	struct iovec local_iov, remote_iov;
+	int pid = 0;
+	ssize_t ret;
+
+	peer = smr_map_peer(ep->region->map, peer_id);
+
+	if (smr_env.disable_cma) {
+		peer->cma_cap = SMR_CMA_CAP_OFF;
+		goto out;
+	}
 
-	recv_entry = container_of(item, struct smr_ep_entry, entry);
-	return smr_match_addr(recv_entry->addr, attr->addr) &&
-	       smr_match_tag(recv_entry->tag, recv_entry->ignore, attr->tag); 
-} 
+	local_iov.iov_base = &pid;
+	local_iov.iov_len = sizeof(pid);
+	remote_iov.iov_base = (char *) peer_smr->base_addr +
+			      offsetof(struct smr_region, pid);
+	remote_iov.iov_len = sizeof(pid);
+
+	ret = process_vm_readv(peer_smr->pid, &local_iov, 1, &remote_iov, 1, 0);
+	peer->cma_cap = (ret == sizeof(pid) && pid == peer_smr->pid) ?
+			SMR_CMA_CAP_ON : SMR_CMA_CAP_OFF;
+out:
+	FI_INFO(&smr_prov, FI_LOG_EP_CTRL,
+		"CMA to peer %s %s\n", peer->peer.name,
+		peer->cma_cap == SMR_CMA_CAP_ON ? "allowed" : "denied");
+}
 
-static int smr_match_unexp(struct dlist_entry *item, const void *args)
+int smr_cma_enabled(struct smr_ep *ep, int peer_id,
+		    struct smr_region *peer_smr)
 {
-	struct smr_match_attr *attr = (struct smr_match_attr *)args;
-	struct smr_unexp_msg *unexp_msg;
+	struct smr_peer *peer;
 
-	unexp_msg = container_of(item, struct smr_unexp_msg, entry);
-	return smr_match_addr(unexp_msg->cmd.msg.hdr.addr, attr->addr) &&
-	       smr_match_tag(unexp_msg->cmd.msg.hdr.tag, attr->ignore,
-			     attr->tag);
+	peer = smr_map_peer(ep->region->map, peer_id);
+	if (peer->cma_cap == SMR_CMA_CAP_NA)
+		smr_cma_check(ep, peer_id, peer_smr);
+
+	return peer->cma_cap == SMR_CMA_CAP_ON;
 }
 
-static void smr_init_queue(struct smr_queue *queue,
-			   dlist_func_t *match_func)
+/*
+ * For sends, and RMA outside of fast_rma, the target does the CMA copy to
+ * or from the initiator.  Yama and similar policies may allow ptrace in one
+ * direction only, so our own probe says nothing about it: the target
+ * publishes its probe in our region, and we use SAR until it has.
+ */
+int smr_peer_cma_enabled(struct smr_ep *ep, int peer_id)
 {
-	dlist_init(&queue->list);
-	queue->match_func = match_func;
+	assert((size_t) peer_id < ep->region->peer_addr_used);
+	return !smr_env.disable_cma &&
+	       smr_peer_cma(ep->region)[peer_id] == SMR_CMA_CAP_ON;
 }
 
-void smr_post_pend_resp(struct smr_cmd *cmd, struct smr_cmd *pend,
-			struct smr_resp *resp)
+/* Tell a peer that we target whether we can do its CMA copies */
+void smr_cma_publish(struct smr_ep *ep, int peer_id,
+		     struct smr_region *peer_smr)
 {
+	uint8_t *cap;
+	int cma;
+
+	if (!smr_peer_addr_known(ep->region, peer_id))
+		return;
+
+	cap = &smr_peer_cma(peer_smr)[smr_peer_addr(ep->region)[peer_id].addr];
+	cma = smr_cma_enabled(ep, peer_id, peer_smr) ?
+	      SMR_CMA_CAP_ON : SMR_CMA_CAP_OFF;
+	if (*cap != cma)
+		*cap = cma;
+}
+
+void smr_post_pend_resp(struct smr_region *smr, struct smr_cmd *cmd,
+			struct smr_cmd *pend, struct smr_resp *resp)
+{
+	ofi_atomic_inc32(&smr->map->busy);
 	*pend = *cmd;
 	resp->msg_id = (uint64_t) (uintptr_t) pend;
 	resp->status = FI_EBUSY;
@@ -289,7 +357,294 @@ void smr_format_iov(struct smr_cmd *cmd, fi_addr_t peer_id,
 	cmd->msg.hdr.msg_id = (uint64_t) (uintptr_t) context;
 	memcpy(cmd->msg.data.iov, iov, sizeof(*iov) * count);
 
-	smr_post_pend_resp(cmd, pend_cmd, resp);
+	smr_post_pend_resp(smr, cmd, pend_cmd, resp);
+}
+
+void smr_copy_to_sar(struct smr_sar_entry *entry)
+{
+	struct smr_sar_buf *sar_buf;
+	size_t len;
+
+	while (entry->bytes_done < entry->cmd.msg.hdr.size) {
+		sar_buf = &entry->sar_msg->buf[(entry->bytes_done /
+				SMR_SAR_SIZE) % SMR_SAR_BUF_CNT];
+		if (sar_buf->status != smr_sar_empty)
+			break;
+
+		smr_rmb();
+		len = MIN(SMR_SAR_SIZE,
+			  entry->cmd.msg.hdr.size - entry->bytes_done);
+		ofi_copy_from_iov(sar_buf->data, len, entry->iov,
+				  entry->iov_count, entry->bytes_done);
+		smr_wmb();
+		sar_buf->status = smr_sar_full;
+		entry->bytes_done += len;
+	}
+}
+
+void smr_copy_from_sar(struct smr_sar_entry *entry)
+{
+	struct smr_sar_buf *sar_buf;
+	size_t len;
+
+	while (entry->bytes_done < entry->cmd.msg.hdr.size) {
+		sar_buf = &entry->sar_msg->buf[(entry->bytes_done /
+				SMR_SAR_SIZE) % SMR_SAR_BUF_CNT];
+		if (sar_buf->status != smr_sar_full)
+			break;
+
+		smr_rmb();
+		len = MIN(SMR_SAR_SIZE,
+			  entry->cmd.msg.hdr.size - entry->bytes_done);
+		entry->total_len += ofi_copy_to_iov(entry->iov,
+					entry->iov_count, entry->bytes_done,
+					sar_buf->data, len);
+		smr_wmb();
+		sar_buf->status = smr_sar_empty;
+		entry->bytes_done += len;
+	}
+}
+
+int smr_format_sar(struct smr_ep *ep, struct smr_cmd *cmd, fi_addr_t peer_id,
+		   const struct iovec *iov, size_t count, size_t total_len,
+		   uint32_t op, uint64_t tag, uint64_t data, uint64_t op_flags,
+		   void *context, struct smr_region *peer_smr,
+		   struct smr_resp *resp, struct smr_cmd *pend_cmd)
+{
+	struct smr_sar_entry *sar_entry;
+	struct smr_sar_msg *sar_msg;
+	int i, ret = 0;
+
+	/* The peer's SAR pool is guarded by its region lock, which the
+	 * peer holds while progressing; never block on it from a sender. */
+	if (fastlock_tryacquire(&peer_smr->lock))
+		return -FI_EAGAIN;
+
+	fastlock_acquire(&ep->util_ep.lock);
+	if (smr_freestack_isempty(smr_sar_pool(peer_smr)) ||
+	    freestack_isempty(ep->sar_fs)) {
+		ret = -FI_EAGAIN;
+		goto out;
+	}
+
+	sar_msg = smr_freestack_pop(smr_sar_pool(peer_smr));
+	for (i = 0; i < SMR_SAR_BUF_CNT; i++)
+		sar_msg->buf[i].status = smr_sar_empty;
+
+	smr_generic_format(cmd, peer_id, op, tag, 0, 0, data, op_flags);
+	cmd->msg.hdr.op_src = smr_src_sar;
+	cmd->msg.hdr.src_data = (uint64_t) ((char **) resp -
+					    (char **) ep->region);
+	cmd->msg.hdr.size = total_len;
+	cmd->msg.hdr.msg_id = (uint64_t) (uintptr_t) context;
+	cmd->msg.data.sar = (uint64_t) ((char **) sar_msg -
+					(char **) peer_smr);
+
+	sar_entry = freestack_pop(ep->sar_fs);
+	ofi_atomic_inc32(&ep->region->map->busy);
+	sar_entry->cmd = *cmd;
+	sar_entry->rx_entry = NULL;
+	sar_entry->sar_smr = peer_smr;
+	sar_entry->peer_smr = peer_smr;
+	sar_entry->sar_msg = sar_msg;
+	sar_entry->resp = resp;
+	memcpy(sar_entry->iov, iov, sizeof(*iov) * count);
+	sar_entry->iov_count = count;
+	sar_entry->bytes_done = 0;
+	sar_entry->total_len = 0;
+	sar_entry->dir = (op == ofi_op_read_req) ? smr_sar_copy_out :
+						   smr_sar_copy_in;
+
+	if (sar_entry->dir == smr_sar_copy_in)
+		smr_copy_to_sar(sar_entry);
+	dlist_insert_tail(&sar_entry->entry, &ep->sar_list);
+
+	smr_post_pend_resp(ep->region, cmd, pend_cmd, resp);
+out:
+	fastlock_release(&ep->util_ep.lock);
+	fastlock_release(&peer_smr->lock);
+	return ret;
+}
+
+/*
+ * Peers cannot signal an eventfd owned by another process, so a region's
+ * owner is woken through a datagram socket bound to an abstract address
+ * published in the region.  Wakeups are sent from a process-wide socket,
+ * created on first use.
+ */
+static pthread_once_t smr_signal_once = PTHREAD_ONCE_INIT;
+static int smr_signal_sock = -1;
+
+static void smr_signal_init(void)
+{
+	smr_signal_sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (smr_signal_sock < 0)
+		FI_WARN(&smr_prov, FI_LOG_EP_DATA,
+			"unable to create signal socket\n");
+}
+
+void smr_signal_fini(void)
+{
+	if (smr_signal_sock >= 0)
+		ofi_close_socket(smr_signal_sock);
+}
+
+void smr_wake(struct smr_region *region)
+{
+	struct sockaddr_un addr;
+	char byte = 0;
+
+	pthread_once(&smr_signal_once, smr_signal_init);
+	if (smr_signal_sock < 0 || !region->signal_addrlen)
+		return;
+
+	/* A full socket buffer means the owner already has a wakeup pending */
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, region->signal_addr, region->signal_addrlen);
+	(void) ofi_sendto_socket(smr_signal_sock, &byte, sizeof(byte),
+				 MSG_DONTWAIT, (struct sockaddr *) &addr,
+				 offsetof(struct sockaddr_un, sun_path) +
+				 region->signal_addrlen);
+}
+
+static int smr_sar_ready(struct smr_sar_entry *entry)
+{
+	struct smr_sar_buf *sar_buf;
+
+	if (entry->bytes_done == entry->cmd.msg.hdr.size ||
+	    entry->dir == smr_cma_copy)
+		return 1;
+
+	sar_buf = &entry->sar_msg->buf[(entry->bytes_done / SMR_SAR_SIZE) %
+				       SMR_SAR_BUF_CNT];
+	return sar_buf->status == (entry->dir == smr_sar_copy_in ?
+				   smr_sar_empty : smr_sar_full);
+}
+
+static int smr_ep_pending(struct smr_ep *ep)
+{
+	struct smr_sar_entry *sar_entry;
+	struct smr_resp *resp;
+	int ret = 0;
+
+	if (smr_cmd_queue_head(smr_cmd_queue(ep->region)))
+		return 1;
+
+	fastlock_acquire(&ep->region->lock);
+	if (!ofi_cirque_isempty(smr_resp_queue(ep->region))) {
+		resp = ofi_cirque_head(smr_resp_queue(ep->region));
+		ret = resp->status != FI_EBUSY;
+	}
+	fastlock_acquire(&ep->util_ep.lock);
+	dlist_foreach_container(&ep->sar_list, struct smr_sar_entry,
+				sar_entry, entry) {
+		if (smr_sar_ready(sar_entry)) {
+			ret = 1;
+			break;
+		}
+	}
+	fastlock_release(&ep->util_ep.lock);
+	fastlock_release(&ep->region->lock);
+	return ret;
+}
+
+/* Arm the region's signal word before the wait set blocks, then recheck
+ * for work posted before the peers could see it. */
+static int smr_ep_trywait(void *arg)
+{
+	struct smr_ep *ep = arg;
+	char buf[64];
+
+	while (ofi_recv_socket(ep->signal_sock, buf, sizeof(buf),
+			       MSG_DONTWAIT) > 0)
+		;
+
+	ofi_atomic_set32(&ep->region->signal, 1);
+	smr_mb();
+	if (smr_ep_pending(ep)) {
+		ofi_atomic_set32(&ep->region->signal, 0);
+		return -FI_EAGAIN;
+	}
+	return FI_SUCCESS;
+}
+
+static int smr_ep_signal_open(struct smr_ep *ep)
+{
+	struct sockaddr_un addr;
+	socklen_t len;
+	int ret;
+
+	ep->signal_sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK |
+				 SOCK_CLOEXEC, 0);
+	if (ep->signal_sock < 0)
+		return -ofi_sockerr();
+
+	/* Let the kernel pick a unique abstract address */
+	addr.sun_family = AF_UNIX;
+	if (bind(ep->signal_sock, (struct sockaddr *) &addr,
+		 sizeof(sa_family_t))) {
+		ret = -ofi_sockerr();
+		goto err;
+	}
+
+	len = sizeof(addr);
+	if (getsockname(ep->signal_sock, (struct sockaddr *) &addr, &len)) {
+		ret = -ofi_sockerr();
+		goto err;
+	}
+
+	len -= offsetof(struct sockaddr_un, sun_path);
+	if (len > SMR_SIGNAL_ADDR_SIZE) {
+		ret = -FI_EINVAL;
+		goto err;
+	}
+	memcpy(ep->region->signal_addr, addr.sun_path, len);
+	ep->region->signal_addrlen = (uint8_t) len;
+
+	if (ep->util_ep.rx_cq->wait) {
+		ret = ofi_wait_fd_add(ep->util_ep.rx_cq->wait, ep->signal_sock,
+				      FI_EPOLL_IN, smr_ep_trywait, ep,
+				      &ep->util_ep.ep_fid.fid);
+		if (ret)
+			goto err;
+	}
+	if (ep->util_ep.tx_cq->wait &&
+	    ep->util_ep.tx_cq->wait != ep->util_ep.rx_cq->wait) {
+		ret = ofi_wait_fd_add(ep->util_ep.tx_cq->wait, ep->signal_sock,
+				      FI_EPOLL_IN, smr_ep_trywait, ep,
+				      &ep->util_ep.ep_fid.fid);
+		if (ret)
+			goto del;
+	}
+	return 0;
+del:
+	if (ep->util_ep.rx_cq->wait)
+		ofi_wait_fd_del(ep->util_ep.rx_cq->wait, ep->signal_sock);
+err:
+	ep->region->signal_addrlen = 0;
+	ofi_close_socket(ep->signal_sock);
+	ep->signal_sock = -1;
+	return ret;
+}
+
+static void smr_ep_signal_close(struct smr_ep *ep)
+{
+	if (ep->signal_sock < 0)
+		return;
+
+	if (ep->util_ep.rx_cq->wait)
+		ofi_wait_fd_del(ep->util_ep.rx_cq->wait, ep->signal_sock);
+	if (ep->util_ep.tx_cq->wait &&
+	    ep->util_ep.tx_cq->wait != ep->util_ep.rx_cq->wait)
+		ofi_wait_fd_del(ep->util_ep.tx_cq->wait, ep->signal_sock);
+	ofi_close_socket(ep->signal_sock);
+}
+
+static void smr_close_queues(struct smr_ep *ep)
+{
+	ofi_match_queue_close(&ep->recv_queue);
+	ofi_match_queue_close(&ep->trecv_queue);
+	ofi_match_queue_close(&ep->unexp_queue);
 }
 
 static int smr_ep_close(struct fid *fid)
@@ -298,14 +653,19 @@ static int smr_ep_close(struct fid *fid)
 
 	ep = container_of(fid, struct smr_ep, util_ep.ep_fid.fid);
 
+	smr_ep_signal_close(ep);
 	ofi_endpoint_close(&ep->util_ep);
 
+	smr_mr_del_ep(ep);
 	if (ep->region)
 		smr_free(ep->region);
 
 	smr_recv_fs_free(ep->recv_fs);
 	smr_unexp_fs_free(ep->unexp_fs);
 	smr_pend_fs_free(ep->pend_fs);
+	smr_sar_fs_free(ep->sar_fs);
+	smr_close_queues(ep);
+	fastlock_destroy(&ep->mr_lock);
 	free(ep);
 	return 0;
 }
@@ -406,9 +766,20 @@ static int smr_ep_ctrl(struct fid *fid, int command, void *arg)
 		attr.name = ep->name;
 		attr.rx_count = ep->rx_size;
 		attr.tx_count = ep->tx_size;
+		attr.peer_count = SMR_MAX_PEERS;
+		attr.numa_node = smr_env.numa_bind ?
+				 MAX(ofi_get_numa_node(), -1) : -1;
+		attr.interleave_inject = smr_env.inject_interleave;
 		ret = smr_create(&smr_prov, av->smr_map, &attr, &ep->region);
 		if (ret)
 			return ret;
+
+		if (ep->util_ep.rx_cq->wait || ep->util_ep.tx_cq->wait) {
+			ret = smr_ep_signal_open(ep);
+			if (ret)
+				return ret;
+		}
+		smr_mr_add_ep(ep);
 		smr_exchange_all_peers(ep->region);
 		break;
 	default:
@@ -476,12 +847,26 @@ int smr_endpoint(struct fid_domain *domain, struct fi_info *info,
 	if (ret)
 		goto err1;
 
+	if (ofi_match_queue_init(&ep->recv_queue, info->rx_attr->size) ||
+	    ofi_match_queue_init(&ep->trecv_queue, info->rx_attr->size) ||
+	    ofi_match_queue_init(&ep->unexp_queue, info->rx_attr->size)) {
+		ret = -FI_ENOMEM;
+		goto err0;
+	}
+
 	ep->recv_fs = smr_recv_fs_create(info->rx_attr->size, NULL, NULL);
 	ep->unexp_fs = smr_unexp_fs_create(info->rx_attr->size, NULL, NULL);
 	ep->pend_fs = smr_pend_fs_create(info->tx_attr->size, NULL, NULL);
-	smr_init_queue(&ep->recv_queue, smr_match_msg);
-	smr_init_queue(&ep->trecv_queue, smr_match_tagged);
-	smr_init_queue(&ep->unexp_queue, smr_match_unexp);
+	ep->sar_fs = smr_sar_fs_create(info->tx_attr->size + SMR_SAR_POOL_SIZE +
+				       SMR_CMA_PEND_SIZE, NULL, NULL);
+	dlist_init(&ep->sar_list);
+	ep->cma_pending = 0;
+	ep->signal_sock = -1;
+	ep->signal_cnt = 0;
+	fastlock_init(&ep->mr_lock);
+	dlist_init(&ep->mr_peer_list);
+	dlist_init(&ep->mr_fd_list);
+	ep->mr_sock = -1;
 
 	ep->min_multi_recv_size = SMR_INJECT_SIZE;
 
@@ -496,6 +881,9 @@ int smr_endpoint(struct fid_domain *domain, struct fi_info *info,
 	*ep_fid = &ep->util_ep.ep_fid;
 	return 0;
 
+err0:
+	smr_close_queues(ep);
+	ofi_endpoint_close(&ep->util_ep);
 err1:
 	free((void *)ep->name);
 err2:
@@ -35,6 +35,30 @@
 #include <ofi_prov.h>
 #include "smr.h"
 
+struct smr_env smr_env = {
+	.disable_cma	= 0,
+	.peer_idle_timeout	= 10000,
+	.wait_spin	= 100,
+	.numa_bind	= 1,
+	.inject_interleave	= 0,
+	.cma_chunk_size	= 262144,
+};
+
+static void smr_init_env(void)
+{
+	fi_param_get_bool(&smr_prov, "disable_cma", &smr_env.disable_cma);
+	fi_param_get_int(&smr_prov, "peer_idle_timeout",
+			 &smr_env.peer_idle_timeout);
+	fi_param_get_int(&smr_prov, "wait_spin", &smr_env.wait_spin);
+	fi_param_get_bool(&smr_prov, "numa_bind", &smr_env.numa_bind);
+	fi_param_get_bool(&smr_prov, "inject_interleave",
+			  &smr_env.inject_interleave);
+	fi_param_get_size_t(&smr_prov, "cma_chunk_size",
+			    &smr_env.cma_chunk_size);
+	if (!smr_env.cma_chunk_size)
+		smr_env.cma_chunk_size = SIZE_MAX;
+}
+
 
 static void smr_resolve_addr(const char *node, const char *service,
 			     char **addr, size_t *addrlen)
@@ -106,7 +130,7 @@ static int smr_getinfo(uint32_t version, const char *node, const char *service,
 
 static void smr_fini(void)
 {
-	/* yawn */
+	smr_signal_fini();
 }
 
 struct fi_provider smr_prov = {
@@ -126,5 +150,34 @@ struct util_prov smr_util_prov = {
 
 SHM_INI
 {
+	fi_param_define(&smr_prov, "disable_cma", FI_PARAM_BOOL,
+			"Disable use of CMA (process_vm_readv/writev) and move "
+			"large transfers through shared memory bounce buffers "
+			"(default: no)");
+	fi_param_define(&smr_prov, "peer_idle_timeout", FI_PARAM_INT,
+			"Time in ms after which the region of a peer that is "
+			"not being used is unmapped, remapping it on the next "
+			"transfer (0 - never, default: 10000)");
+	fi_param_define(&smr_prov, "wait_spin", FI_PARAM_INT,
+			"Maximum time in usec that a blocking CQ read polls "
+			"for completions before sleeping.  The time actually "
+			"spent adapts to how quickly completions arrive "
+			"(default: 100)");
+	fi_param_define(&smr_prov, "numa_bind", FI_PARAM_BOOL,
+			"Place an endpoint's shared memory region on the NUMA "
+			"node of the thread enabling the endpoint "
+			"(default: yes)");
+	fi_param_define(&smr_prov, "inject_interleave", FI_PARAM_BOOL,
+			"Interleave an endpoint's inject buffers across all "
+			"NUMA nodes instead of placing them with the rest of "
+			"its region (default: no)");
+	fi_param_define(&smr_prov, "cma_chunk_size", FI_PARAM_SIZE_T,
+			"Maximum number of bytes copied with CMA in one call "
+			"before checking for other work.  Transfers with the "
+			"same peer are combined up to this size "
+			"(0 - unlimited, default: 262144)");
+
+	smr_init_env();
+
 	return &smr_prov;
 }
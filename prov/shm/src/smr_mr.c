@@ -0,0 +1,959 @@
+/*
+ * Copyright (c) 2017 Intel Corporation, Inc.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "smr.h"
+
+/*
+ * Registrations that peers can map are published as windows in the region
+ * of every enabled endpoint of the domain.  That is memory from the
+ * domain's allocator, which is backed by a memfd, and memory backed by a
+ * file peers can open, such as a POSIX shared memory object.  An initiator
+ * maps a published window the first time it targets it and then accesses
+ * the memory directly.  memfds are passed between processes over a datagram
+ * socket per endpoint, either at the initiator's request or ahead of
+ * commands that refer to the owner's windows.  Only registrations with
+ * remote access are published, and memfds are only exchanged with peers of
+ * the AV that run as the same user, as checked from their credentials.
+ */
+
+static struct smr_mem *smr_mem_find(struct smr_domain *domain,
+				    uintptr_t addr, size_t len)
+{
+	struct smr_mem *mem;
+
+	dlist_foreach_container(&domain->mem_list, struct smr_mem, mem, entry) {
+		if (addr >= (uintptr_t) mem->addr &&
+		    addr + len <= (uintptr_t) mem->addr + mem->len)
+			return mem;
+	}
+	return NULL;
+}
+
+static int smr_mem_alloc(struct fid_domain *domain_fid, size_t len,
+			 void **buf)
+{
+	struct smr_domain *domain;
+	struct smr_mem *mem;
+	int ret;
+
+	domain = container_of(domain_fid, struct smr_domain,
+			      util_domain.domain_fid);
+
+	if (!len)
+		return -FI_EINVAL;
+
+	mem = calloc(1, sizeof(*mem));
+	if (!mem)
+		return -FI_ENOMEM;
+
+	mem->fd = ofi_memfd_create("fi_shm_mr");
+	if (mem->fd < 0) {
+		ret = mem->fd;
+		goto free;
+	}
+
+	if (ftruncate(mem->fd, len)) {
+		ret = -errno;
+		goto close;
+	}
+
+	mem->addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 mem->fd, 0);
+	if (mem->addr == MAP_FAILED) {
+		ret = -errno;
+		goto close;
+	}
+	mem->len = len;
+
+	fastlock_acquire(&domain->util_domain.lock);
+	dlist_insert_tail(&mem->entry, &domain->mem_list);
+	fastlock_release(&domain->util_domain.lock);
+
+	*buf = mem->addr;
+	return 0;
+close:
+	close(mem->fd);
+free:
+	free(mem);
+	return ret;
+}
+
+static void smr_mem_release(struct smr_mem *mem)
+{
+	munmap(mem->addr, mem->len);
+	close(mem->fd);
+	free(mem);
+}
+
+static int smr_mem_free(struct fid_domain *domain_fid, void *buf)
+{
+	struct smr_domain *domain;
+	struct smr_mem *mem;
+
+	domain = container_of(domain_fid, struct smr_domain,
+			      util_domain.domain_fid);
+
+	fastlock_acquire(&domain->util_domain.lock);
+	mem = smr_mem_find(domain, (uintptr_t) buf, 0);
+	if (mem && mem->addr == buf)
+		dlist_remove(&mem->entry);
+	else
+		mem = NULL;
+	fastlock_release(&domain->util_domain.lock);
+
+	if (!mem)
+		return -FI_EINVAL;
+
+	smr_mem_release(mem);
+	return 0;
+}
+
+void smr_mem_free_all(struct smr_domain *domain)
+{
+	struct smr_mem *mem;
+
+	while (!dlist_empty(&domain->mem_list)) {
+		dlist_pop_front(&domain->mem_list, struct smr_mem, mem, entry);
+		smr_mem_release(mem);
+	}
+}
+
+struct fi_shm_ops_domain smr_shm_domain_ops = {
+	.size = sizeof(struct fi_shm_ops_domain),
+	.mem_alloc = smr_mem_alloc,
+	.mem_free = smr_mem_free,
+};
+
+static int smr_mr_sock_open(struct smr_ep *ep)
+{
+	struct sockaddr_un addr;
+	socklen_t len;
+	int ret, on = 1;
+
+	ep->mr_sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK |
+			     SOCK_CLOEXEC, 0);
+	if (ep->mr_sock < 0)
+		return -ofi_sockerr();
+
+	/* The abstract address is reachable from any process in the network
+	 * namespace: have the kernel tell us who sent each message */
+	if (setsockopt(ep->mr_sock, SOL_SOCKET, SO_PASSCRED, &on,
+		       sizeof(on))) {
+		ret = -ofi_sockerr();
+		goto err;
+	}
+
+	/* Let the kernel pick a unique abstract address */
+	addr.sun_family = AF_UNIX;
+	if (bind(ep->mr_sock, (struct sockaddr *) &addr,
+		 sizeof(sa_family_t))) {
+		ret = -ofi_sockerr();
+		goto err;
+	}
+
+	len = sizeof(addr);
+	if (getsockname(ep->mr_sock, (struct sockaddr *) &addr, &len)) {
+		ret = -ofi_sockerr();
+		goto err;
+	}
+
+	len -= offsetof(struct sockaddr_un, sun_path);
+	if (len > SMR_SIGNAL_ADDR_SIZE) {
+		ret = -FI_EINVAL;
+		goto err;
+	}
+	memcpy(ep->region->mr_addr, addr.sun_path, len);
+	ep->region->mr_addrlen = (uint8_t) len;
+	return 0;
+err:
+	ofi_close_socket(ep->mr_sock);
+	ep->mr_sock = -1;
+	return ret;
+}
+
+static int smr_mr_sendto(struct smr_ep *ep, struct sockaddr_un *addr,
+			 socklen_t addrlen, struct smr_mr_fd_msg *msg, int fd)
+{
+	union {
+		struct cmsghdr	hdr;
+		char		buf[CMSG_SPACE(sizeof(int))];
+	} ctrl;
+	struct msghdr hdr;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+
+	iov.iov_base = msg;
+	iov.iov_len = sizeof(*msg);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_name = addr;
+	hdr.msg_namelen = addrlen;
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	if (fd >= 0) {
+		hdr.msg_control = ctrl.buf;
+		hdr.msg_controllen = sizeof(ctrl.buf);
+		cmsg = CMSG_FIRSTHDR(&hdr);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+	}
+
+	if (sendmsg(ep->mr_sock, &hdr, MSG_DONTWAIT) != sizeof(*msg))
+		return -ofi_sockerr();
+	return 0;
+}
+
+static int smr_mr_send(struct smr_ep *ep, struct smr_region *peer_smr,
+		       struct smr_mr_fd_msg *msg, int fd)
+{
+	struct sockaddr_un addr;
+
+	if (ep->mr_sock < 0 || !peer_smr->mr_addrlen)
+		return -FI_ENOENT;
+
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, peer_smr->mr_addr, peer_smr->mr_addrlen);
+	return smr_mr_sendto(ep, &addr, offsetof(struct sockaddr_un, sun_path) +
+			     peer_smr->mr_addrlen, msg, fd);
+}
+
+/* Whether a request comes from the process of the peer it claims to be */
+static int smr_mr_verify_req(struct smr_ep *ep, struct smr_mr_fd_msg *msg,
+			     struct ucred *cred)
+{
+	struct smr_region *peer_smr;
+
+	if (msg->id >= SMR_MAX_PEERS ||
+	    !smr_map_peer(ep->region->map, msg->id))
+		return 0;
+
+	peer_smr = smr_peer_region(ep->region, msg->id);
+	if (!peer_smr &&
+	    smr_map_activate(&smr_prov, ep->region, msg->id, &peer_smr))
+		return 0;
+
+	return peer_smr->pid == cred->pid;
+}
+
+/* Send the memfd of one of our windows, as it is now, to a peer */
+static void smr_mr_serve(struct smr_ep *ep, struct smr_mr_fd_msg *msg,
+			 struct ucred *cred, struct sockaddr_un *addr,
+			 socklen_t addrlen)
+{
+	struct smr_domain *domain;
+
+	if (msg->slot >= SMR_MR_WINDOW_CNT || !smr_mr_verify_req(ep, msg, cred))
+		return;
+
+	domain = container_of(ep->util_ep.domain, struct smr_domain,
+			      util_domain);
+
+	fastlock_acquire(&domain->util_domain.lock);
+	if (domain->window_fd[msg->slot] >= 0) {
+		msg->type = smr_mr_fd_push;
+		msg->seq = ofi_atomic_get32(&smr_mr_windows(ep->region)
+					    [msg->slot].seq);
+		msg->region = (uintptr_t) ep->region->base_addr;
+		(void) smr_mr_sendto(ep, addr, addrlen, msg,
+				     domain->window_fd[msg->slot]);
+	}
+	fastlock_release(&domain->util_domain.lock);
+}
+
+static void smr_mr_cache_fd(struct smr_ep *ep, struct smr_mr_fd_msg *msg,
+			    pid_t pid, int fd)
+{
+	struct smr_mr_fd *mr_fd;
+
+	if (ep->mr_fd_cnt == SMR_MR_FD_CACHE) {
+		dlist_pop_front(&ep->mr_fd_list, struct smr_mr_fd, mr_fd,
+				entry);
+		close(mr_fd->fd);
+		ep->mr_fd_cnt--;
+	} else {
+		mr_fd = malloc(sizeof(*mr_fd));
+		if (!mr_fd) {
+			close(fd);
+			return;
+		}
+	}
+
+	mr_fd->msg = *msg;
+	mr_fd->pid = pid;
+	mr_fd->fd = fd;
+	dlist_insert_tail(&mr_fd->entry, &ep->mr_fd_list);
+	ep->mr_fd_cnt++;
+}
+
+/*
+ * Receive everything sent to our mr socket, and drop what does not come from
+ * a process of our own user.  Called with mr_lock held.
+ */
+static void smr_mr_drain(struct smr_ep *ep)
+{
+	union {
+		struct cmsghdr	hdr;
+		char		buf[CMSG_SPACE(sizeof(int)) +
+				    CMSG_SPACE(sizeof(struct ucred))];
+	} ctrl;
+	struct smr_mr_fd_msg msg;
+	struct sockaddr_un addr;
+	struct msghdr hdr;
+	struct cmsghdr *cmsg;
+	struct ucred cred;
+	struct iovec iov;
+	ssize_t len;
+	int fd, has_cred;
+
+	if (ep->mr_sock < 0)
+		return;
+
+	for (;;) {
+		iov.iov_base = &msg;
+		iov.iov_len = sizeof(msg);
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_name = &addr;
+		hdr.msg_namelen = sizeof(addr);
+		hdr.msg_iov = &iov;
+		hdr.msg_iovlen = 1;
+		hdr.msg_control = ctrl.buf;
+		hdr.msg_controllen = sizeof(ctrl.buf);
+
+		len = recvmsg(ep->mr_sock, &hdr, MSG_DONTWAIT |
+			      MSG_CMSG_CLOEXEC);
+		if (len < 0)
+			break;
+
+		fd = -1;
+		has_cred = 0;
+		for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg;
+		     cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET)
+				continue;
+			if (cmsg->cmsg_type == SCM_RIGHTS && fd < 0 &&
+			    cmsg->cmsg_len == CMSG_LEN(sizeof(fd))) {
+				memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+			} else if (cmsg->cmsg_type == SCM_CREDENTIALS &&
+				   cmsg->cmsg_len == CMSG_LEN(sizeof(cred))) {
+				memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+				has_cred = 1;
+			}
+		}
+
+		if (len != sizeof(msg) || !has_cred || cred.uid != geteuid() ||
+		    hdr.msg_flags & MSG_CTRUNC) {
+			FI_INFO(&smr_prov, FI_LOG_EP_CTRL,
+				"dropped message on mr socket\n");
+			if (fd >= 0)
+				close(fd);
+			continue;
+		}
+
+		if (msg.type == smr_mr_fd_push && fd >= 0) {
+			smr_mr_cache_fd(ep, &msg, cred.pid, fd);
+			continue;
+		}
+
+		if (fd >= 0)
+			close(fd);
+		if (msg.type == smr_mr_fd_req)
+			smr_mr_serve(ep, &msg, &cred, &addr, hdr.msg_namelen);
+	}
+}
+
+static int smr_mr_take_fd(struct smr_ep *ep, struct smr_region *peer_smr,
+			  int slot, uint32_t seq)
+{
+	struct smr_mr_fd *mr_fd;
+	int fd;
+
+	smr_mr_drain(ep);
+	dlist_foreach_container(&ep->mr_fd_list, struct smr_mr_fd, mr_fd,
+				entry) {
+		if (mr_fd->pid != peer_smr->pid ||
+		    mr_fd->msg.region != (uintptr_t) peer_smr->base_addr ||
+		    mr_fd->msg.slot != slot || mr_fd->msg.seq != seq)
+			continue;
+
+		dlist_remove(&mr_fd->entry);
+		ep->mr_fd_cnt--;
+		fd = mr_fd->fd;
+		free(mr_fd);
+		return fd;
+	}
+	return -FI_ENOENT;
+}
+
+/*
+ * Ask the owner of a memfd window to send us its fd.  The owner only serves
+ * peers that know their address at the owner.
+ */
+static void smr_mr_request(struct smr_ep *ep, int peer_id,
+			   struct smr_region *peer_smr, int slot)
+{
+	struct smr_mr_fd_msg msg;
+
+	if (!smr_peer_addr_known(ep->region, peer_id))
+		return;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.type = smr_mr_fd_req;
+	msg.slot = slot;
+	msg.id = (uint32_t) smr_peer_addr(ep->region)[peer_id].addr;
+	if (smr_mr_send(ep, peer_smr, &msg, -1))
+		return;
+
+	ofi_atomic_set32(&peer_smr->mr_req, 1);
+	smr_signal(peer_smr);
+}
+
+void smr_mr_progress(struct smr_ep *ep)
+{
+	if (!ofi_atomic_get32(&ep->region->mr_req))
+		return;
+
+	ofi_atomic_set32(&ep->region->mr_req, 0);
+	fastlock_acquire(&ep->mr_lock);
+	smr_mr_drain(ep);
+	fastlock_release(&ep->mr_lock);
+}
+
+static void smr_mr_write_window(struct smr_region *region, int slot,
+				const struct smr_mr_window *window)
+{
+	struct smr_mr_window *dst = &smr_mr_windows(region)[slot];
+
+	ofi_atomic_inc32(&dst->seq);
+	smr_wmb();
+	dst->key = window->key;
+	dst->addr = window->addr;
+	dst->len = window->len;
+	dst->access = window->access;
+	dst->offset = window->offset;
+	memcpy(dst->path, window->path, sizeof(dst->path));
+	smr_wmb();
+	ofi_atomic_inc32(&dst->seq);
+}
+
+static void smr_mr_publish(struct smr_domain *domain, int slot)
+{
+	struct smr_ep *ep;
+
+	dlist_foreach_container(&domain->ep_list, struct smr_ep, ep,
+				domain_entry)
+		smr_mr_write_window(ep->region, slot, &domain->windows[slot]);
+}
+
+void smr_mr_add_ep(struct smr_ep *ep)
+{
+	struct smr_domain *domain;
+	int i;
+
+	domain = container_of(ep->util_ep.domain, struct smr_domain,
+			      util_domain);
+
+	if (smr_mr_sock_open(ep))
+		FI_INFO(&smr_prov, FI_LOG_EP_CTRL,
+			"unable to open mr socket, memfd windows disabled\n");
+
+	fastlock_acquire(&domain->util_domain.lock);
+	for (i = 0; i < SMR_MR_WINDOW_CNT; i++) {
+		if (domain->window_mr[i])
+			smr_mr_write_window(ep->region, i, &domain->windows[i]);
+	}
+	dlist_insert_tail(&ep->domain_entry, &domain->ep_list);
+	fastlock_release(&domain->util_domain.lock);
+}
+
+void smr_mr_del_ep(struct smr_ep *ep)
+{
+	struct smr_domain *domain;
+	struct smr_mr_peer *mr_peer;
+	struct smr_mr_fd *mr_fd;
+	int i;
+
+	domain = container_of(ep->util_ep.domain, struct smr_domain,
+			      util_domain);
+
+	if (ep->region) {
+		fastlock_acquire(&domain->util_domain.lock);
+		dlist_remove(&ep->domain_entry);
+		fastlock_release(&domain->util_domain.lock);
+	}
+
+	if (ep->mr_sock >= 0)
+		ofi_close_socket(ep->mr_sock);
+
+	while (!dlist_empty(&ep->mr_fd_list)) {
+		dlist_pop_front(&ep->mr_fd_list, struct smr_mr_fd, mr_fd,
+				entry);
+		close(mr_fd->fd);
+		free(mr_fd);
+	}
+
+	while (!dlist_empty(&ep->mr_peer_list)) {
+		dlist_pop_front(&ep->mr_peer_list, struct smr_mr_peer,
+				mr_peer, entry);
+		for (i = 0; i < SMR_MR_WINDOW_CNT; i++) {
+			if (mr_peer->mappings[i].map_addr)
+				munmap(mr_peer->mappings[i].map_addr,
+				       mr_peer->mappings[i].map_len);
+		}
+		free(mr_peer);
+	}
+	ofi_idm_reset(&ep->mr_peers);
+}
+
+static int smr_mr_close(struct fid *fid)
+{
+	struct smr_domain *domain;
+	struct ofi_mr *mr;
+	int i;
+
+	mr = container_of(fid, struct ofi_mr, mr_fid.fid);
+	domain = container_of(mr->domain, struct smr_domain, util_domain);
+
+	fastlock_acquire(&domain->util_domain.lock);
+	for (i = 0; i < SMR_MR_WINDOW_CNT; i++) {
+		if (domain->window_mr[i] != &mr->mr_fid)
+			continue;
+
+		domain->window_mr[i] = NULL;
+		domain->windows[i].len = 0;
+		if (domain->window_fd[i] >= 0) {
+			close(domain->window_fd[i]);
+			domain->window_fd[i] = -1;
+		}
+		smr_mr_publish(domain, i);
+		break;
+	}
+	fastlock_release(&domain->util_domain.lock);
+
+	return ofi_mr_close(fid);
+}
+
+static struct fi_ops smr_mr_fi_ops = {
+	.size = sizeof(struct fi_ops),
+	.close = smr_mr_close,
+	.control = fi_no_control,
+	.ops_open = fi_no_ops_open,
+};
+
+/*
+ * Publish a registration with remote access if peers can map its memory.
+ * Peers also copy message data from or into windows, checking the access
+ * for the direction of the copy.
+ */
+static void smr_mr_share(struct smr_domain *domain, struct ofi_mr *mr,
+			 const struct fi_mr_attr *attr)
+{
+	struct smr_mr_window window;
+	struct smr_mem *mem;
+	int i, fd = -1;
+
+	if (attr->iov_count != 1 || !attr->mr_iov[0].iov_len ||
+	    !(attr->access & (FI_REMOTE_READ | FI_REMOTE_WRITE)))
+		return;
+
+	window.key = mr->key;
+	window.addr = (uintptr_t) attr->mr_iov[0].iov_base;
+	window.len = attr->mr_iov[0].iov_len;
+	window.access = attr->access;
+
+	fastlock_acquire(&domain->util_domain.lock);
+	mem = smr_mem_find(domain, window.addr, window.len);
+	if (mem) {
+		window.path[0] = '\0';
+		window.offset = window.addr - (uintptr_t) mem->addr;
+		fd = dup(mem->fd);
+	}
+	fastlock_release(&domain->util_domain.lock);
+
+	if (mem && fd < 0)
+		return;
+
+	if (!mem && ofi_get_shared_file(attr->mr_iov[0].iov_base, window.len,
+					window.path, sizeof(window.path),
+					&window.offset))
+		return;
+
+	fastlock_acquire(&domain->util_domain.lock);
+	for (i = 0; i < SMR_MR_WINDOW_CNT; i++) {
+		if (domain->window_mr[i])
+			continue;
+
+		domain->window_mr[i] = &mr->mr_fid;
+		domain->window_fd[i] = fd;
+		domain->windows[i] = window;
+		smr_mr_publish(domain, i);
+		FI_INFO(&smr_prov, FI_LOG_MR,
+			"key %" PRIu64 " shared through %s\n", mr->key,
+			mem ? "memfd" : window.path);
+		fd = -1;
+		break;
+	}
+	fastlock_release(&domain->util_domain.lock);
+
+	if (fd >= 0)
+		close(fd);
+}
+
+static int smr_mr_regattr(struct fid *fid, const struct fi_mr_attr *attr,
+			  uint64_t flags, struct fid_mr **mr_fid)
+{
+	struct smr_domain *domain;
+	struct ofi_mr *mr;
+	int ret;
+
+	ret = ofi_mr_regattr(fid, attr, flags, mr_fid);
+	if (ret)
+		return ret;
+
+	domain = container_of(fid, struct smr_domain,
+			      util_domain.domain_fid.fid);
+	mr = container_of(*mr_fid, struct ofi_mr, mr_fid);
+	mr->mr_fid.fid.ops = &smr_mr_fi_ops;
+	smr_mr_share(domain, mr, attr);
+	return 0;
+}
+
+static int smr_mr_regv(struct fid *fid, const struct iovec *iov,
+		       size_t count, uint64_t access, uint64_t offset,
+		       uint64_t requested_key, uint64_t flags,
+		       struct fid_mr **mr_fid, void *context)
+{
+	struct fi_mr_attr attr;
+
+	attr.mr_iov = iov;
+	attr.iov_count = count;
+	attr.access = access;
+	attr.offset = offset;
+	attr.requested_key = requested_key;
+	attr.context = context;
+	return smr_mr_regattr(fid, &attr, flags, mr_fid);
+}
+
+static int smr_mr_reg(struct fid *fid, const void *buf, size_t len,
+		      uint64_t access, uint64_t offset, uint64_t requested_key,
+		      uint64_t flags, struct fid_mr **mr_fid, void *context)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *) buf;
+	iov.iov_len = len;
+	return smr_mr_regv(fid, &iov, 1, access, offset, requested_key, flags,
+			   mr_fid, context);
+}
+
+struct fi_ops_mr smr_mr_ops = {
+	.size = sizeof(struct fi_ops_mr),
+	.reg = smr_mr_reg,
+	.regv = smr_mr_regv,
+	.regattr = smr_mr_regattr,
+};
+
+/* Read a consistent copy of a published window, if it is in use */
+static int smr_mr_read_window(struct smr_mr_window *src,
+			      struct smr_mr_window *window, uint32_t *seq)
+{
+	*seq = ofi_atomic_get32(&src->seq);
+	if (*seq & 1)
+		return -FI_EAGAIN;
+
+	smr_rmb();
+	window->key = src->key;
+	window->addr = src->addr;
+	window->len = src->len;
+	window->access = src->access;
+	window->offset = src->offset;
+	memcpy(window->path, src->path, sizeof(window->path));
+	smr_rmb();
+
+	if ((uint32_t) ofi_atomic_get32(&src->seq) != *seq)
+		return -FI_EAGAIN;
+	return window->len ? 0 : -FI_ENOENT;
+}
+
+/* Map a window from its file, or from fd if it is backed by a memfd */
+static int smr_mr_map(struct smr_mr_mapping *mapping, int fd)
+{
+	size_t page_size, page_off;
+	int ret = 0;
+
+	page_size = ofi_sysconf(_SC_PAGESIZE);
+	page_off = mapping->window.offset % page_size;
+	mapping->map_len = ofi_div_ceil(mapping->window.len + page_off,
+					page_size) * page_size;
+
+	if (fd < 0) {
+		fd = open(mapping->window.path, O_RDWR);
+		if (fd < 0)
+			return -errno;
+	}
+
+	mapping->map_addr = mmap(NULL, mapping->map_len,
+				 PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+				 mapping->window.offset - page_off);
+	if (mapping->map_addr == MAP_FAILED) {
+		mapping->map_addr = NULL;
+		ret = -errno;
+	} else {
+		mapping->base = (uint8_t *) mapping->map_addr + page_off;
+	}
+	close(fd);
+	return ret;
+}
+
+static struct smr_mr_peer *smr_mr_get_peer(struct smr_ep *ep, int peer_id)
+{
+	struct smr_mr_peer *mr_peer;
+
+	mr_peer = ofi_idm_lookup(&ep->mr_peers, peer_id);
+	if (mr_peer)
+		return mr_peer;
+
+	mr_peer = calloc(1, sizeof(*mr_peer));
+	if (!mr_peer)
+		return NULL;
+
+	if (ofi_idm_set(&ep->mr_peers, peer_id, mr_peer) < 0) {
+		free(mr_peer);
+		return NULL;
+	}
+	mr_peer->peer_id = peer_id;
+	dlist_insert_tail(&mr_peer->entry, &ep->mr_peer_list);
+	return mr_peer;
+}
+
+static int smr_mr_match(struct smr_mr_window *window, uint64_t addr,
+			size_t len, uint64_t key, int by_key)
+{
+	return by_key ? window->key == key :
+	       addr >= window->addr && addr + len <= window->addr + window->len;
+}
+
+/*
+ * Return the local address of [addr, addr + len) in a window of the peer,
+ * found by key if 'by_key' is set and by address otherwise, or NULL if the
+ * peer has no such window or it cannot be mapped yet.  Called with mr_lock
+ * held.
+ */
+static uint8_t *smr_mr_lookup(struct smr_ep *ep, int peer_id, uint64_t addr,
+			      size_t len, uint64_t key, uint64_t access,
+			      int by_key)
+{
+	struct smr_region *peer_smr = smr_peer_region(ep->region, peer_id);
+	struct smr_mr_mapping *mapping;
+	struct smr_mr_window window;
+	struct smr_mr_peer *mr_peer;
+	uint32_t seq;
+	int i, fd = -1;
+
+	if (!peer_smr)
+		return NULL;
+
+	for (i = 0; i < SMR_MR_WINDOW_CNT; i++) {
+		if (smr_mr_match(&smr_mr_windows(peer_smr)[i], addr, len, key,
+				 by_key) &&
+		    !smr_mr_read_window(&smr_mr_windows(peer_smr)[i],
+					&window, &seq) &&
+		    smr_mr_match(&window, addr, len, key, by_key))
+			break;
+	}
+	if (i == SMR_MR_WINDOW_CNT)
+		return NULL;
+
+	if ((window.access & access) != access || addr < window.addr ||
+	    addr + len > window.addr + window.len)
+		return NULL;
+
+	mr_peer = smr_mr_get_peer(ep, peer_id);
+	if (!mr_peer)
+		return NULL;
+
+	mapping = &mr_peer->mappings[i];
+	if (mapping->region != peer_smr || mapping->pid != peer_smr->pid ||
+	    mapping->seq != seq) {
+		if (mapping->map_addr)
+			munmap(mapping->map_addr, mapping->map_len);
+		memset(mapping, 0, sizeof(*mapping));
+		mapping->region = peer_smr;
+		mapping->pid = peer_smr->pid;
+		mapping->seq = seq;
+		mapping->window = window;
+	}
+
+	if (!mapping->map_addr && !mapping->failed) {
+		if (!window.path[0]) {
+			fd = smr_mr_take_fd(ep, peer_smr, i, seq);
+			if (fd < 0) {
+				if (!mapping->requested)
+					smr_mr_request(ep, peer_id, peer_smr,
+						       i);
+				mapping->requested = 1;
+				return NULL;
+			}
+		}
+		if (smr_mr_map(mapping, fd)) {
+			mapping->failed = 1;
+			FI_INFO(&smr_prov, FI_LOG_MR,
+				"unable to map window %d of peer %d\n",
+				i, peer_id);
+		}
+	}
+
+	return mapping->map_addr ? mapping->base + (addr - window.addr) : NULL;
+}
+
+void *smr_mr_window_ptr(struct smr_ep *ep, int peer_id, uint64_t addr,
+			size_t len, uint64_t key, uint64_t access)
+{
+	void *ptr;
+
+	fastlock_acquire(&ep->mr_lock);
+	ptr = smr_mr_lookup(ep, peer_id, addr, len, key, access, 1);
+	fastlock_release(&ep->mr_lock);
+	return ptr;
+}
+
+/*
+ * Translate the buffers of a peer, described in its address space, to our
+ * mappings of the windows that hold them.
+ */
+int smr_mr_window_iov(struct smr_ep *ep, int peer_id,
+		      const struct iovec *peer_iov, size_t count,
+		      uint64_t access, struct iovec *iov)
+{
+	int i, ret = 0;
+
+	fastlock_acquire(&ep->mr_lock);
+	for (i = 0; i < count; i++) {
+		iov[i].iov_len = peer_iov[i].iov_len;
+		iov[i].iov_base = !iov[i].iov_len ? NULL :
+				  smr_mr_lookup(ep, peer_id,
+					(uintptr_t) peer_iov[i].iov_base,
+					peer_iov[i].iov_len, 0, access, 0);
+		if (iov[i].iov_len && !iov[i].iov_base) {
+			ret = -FI_ENOENT;
+			break;
+		}
+	}
+	fastlock_release(&ep->mr_lock);
+	return ret;
+}
+
+/* Pass the memfd of one of our windows to a peer, unless it already has it */
+static int smr_mr_push(struct smr_ep *ep, int peer_id, int slot, int fd)
+{
+	struct smr_region *peer_smr = smr_peer_region(ep->region, peer_id);
+	struct smr_mr_fd_msg msg;
+	struct smr_mr_peer *mr_peer;
+	int ret;
+
+	if (!peer_smr)
+		return -FI_EAGAIN;
+
+	mr_peer = smr_mr_get_peer(ep, peer_id);
+	if (!mr_peer)
+		return -FI_ENOMEM;
+
+	if (mr_peer->push_region != peer_smr ||
+	    mr_peer->push_pid != peer_smr->pid) {
+		memset(mr_peer->push_seq, 0, sizeof(mr_peer->push_seq));
+		mr_peer->push_region = peer_smr;
+		mr_peer->push_pid = peer_smr->pid;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.seq = ofi_atomic_get32(&smr_mr_windows(ep->region)[slot].seq);
+	if (mr_peer->push_seq[slot] == msg.seq)
+		return 0;
+
+	msg.type = smr_mr_fd_push;
+	msg.slot = slot;
+	msg.region = (uintptr_t) ep->region->base_addr;
+	ret = smr_mr_send(ep, peer_smr, &msg, fd);
+	if (!ret)
+		mr_peer->push_seq[slot] = msg.seq;
+	return ret;
+}
+
+/*
+ * Check that every buffer lies in one of our windows that grants the peer
+ * 'access', so that the peer can copy to or from it directly, and pass the
+ * peer the memfds of those windows.  The fds are queued on the peer's socket before the command
+ * that refers to them is posted.
+ */
+int smr_mr_push_iov(struct smr_ep *ep, int peer_id, const struct iovec *iov,
+		    size_t count, uint64_t access)
+{
+	struct smr_domain *domain;
+	struct smr_mr_window *window;
+	int i, slot, ret = 0;
+
+	domain = container_of(ep->util_ep.domain, struct smr_domain,
+			      util_domain);
+
+	fastlock_acquire(&ep->mr_lock);
+	fastlock_acquire(&domain->util_domain.lock);
+	for (i = 0; i < count && !ret; i++) {
+		if (!iov[i].iov_len)
+			continue;
+
+		for (slot = 0; slot < SMR_MR_WINDOW_CNT; slot++) {
+			window = &domain->windows[slot];
+			if (domain->window_mr[slot] &&
+			    (window->access & access) == access &&
+			    smr_mr_match(window, (uintptr_t) iov[i].iov_base,
+					 iov[i].iov_len, 0, 0))
+				break;
+		}
+
+		if (slot == SMR_MR_WINDOW_CNT)
+			ret = -FI_ENOENT;
+		else if (domain->window_fd[slot] >= 0)
+			ret = smr_mr_push(ep, peer_id, slot,
+					  domain->window_fd[slot]);
+	}
+	fastlock_release(&domain->util_domain.lock);
+	fastlock_release(&ep->mr_lock);
+	return ret;
+}
@@ -78,7 +78,7 @@ ssize_t smr_recvmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
 	entry->flags = flags;
 	entry->addr = msg->addr;
 
-	dlist_insert_tail(&entry->entry, &ep->recv_queue.list);
+	ofi_match_insert(&ep->recv_queue, &entry->match, entry->addr, 0, 0);
 out:
 	fastlock_release(&ep->util_ep.rx_cq->cq_lock);
 	return ret;
@@ -109,7 +109,7 @@ ssize_t smr_recvv(struct fid_ep *ep_fid, const struct iovec *iov, void **desc,
 	entry->flags = smr_ep_rx_flags(ep);
 	entry->addr = src_addr;
 
-	dlist_insert_tail(&entry->entry, &ep->recv_queue.list);
+	ofi_match_insert(&ep->recv_queue, &entry->match, entry->addr, 0, 0);
 out:
 	fastlock_release(&ep->util_ep.rx_cq->cq_lock);
 	return ret;
@@ -138,7 +138,7 @@ ssize_t smr_recv(struct fid_ep *ep_fid, void *buf, size_t len, void *desc,
 	entry->flags = smr_ep_rx_flags(ep);
 	entry->addr = src_addr;
 
-	dlist_insert_tail(&entry->entry, &ep->recv_queue.list);
+	ofi_match_insert(&ep->recv_queue, &entry->match, entry->addr, 0, 0);
 out:
 	fastlock_release(&ep->util_ep.rx_cq->cq_lock);
 	return ret;
@@ -153,40 +153,45 @@ static ssize_t smr_generic_sendmsg(struct smr_ep *ep, const struct iovec *iov,
 	struct smr_inject_buf *tx_buf;
 	struct smr_resp *resp;
 	struct smr_cmd *cmd, *pend;
-	int peer_id;
+	int64_t pos;
+	int peer_id, window;
 	ssize_t ret = 0;
 	size_t total_len;
 
 	assert(iov_count <= SMR_IOV_LIMIT);
 
 	peer_id = (int) addr;
+	total_len = ofi_total_iov_len(iov, iov_count);
 
-	ret = smr_verify_peer(ep, peer_id);
+	/* the receiver responds to transfers it does not copy inline */
+	ret = total_len > SMR_INJECT_SIZE ?
+	      smr_verify_peer_resp(ep, peer_id, &peer_smr) :
+	      smr_verify_peer(ep, peer_id, &peer_smr);
 	if (ret)
 		return ret;
 
-	peer_smr = smr_peer_region(ep->region, peer_id);
-	fastlock_acquire(&peer_smr->lock);
-	if (!peer_smr->cmd_cnt) {
-		ret = -FI_EAGAIN;
-		goto unlock_region;
-	}
-
 	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
 	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq)) {
 		ret = -FI_EAGAIN;
 		goto unlock_cq;
 	}
 
-	total_len = ofi_total_iov_len(iov, iov_count);
+	if (smr_cmd_queue_next(smr_cmd_queue(peer_smr), 1, &pos)) {
+		ret = -FI_EAGAIN;
+		goto unlock_cq;
+	}
 
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
+	cmd = smr_cmd_queue_slot(smr_cmd_queue(peer_smr), pos);
 
 	if (total_len <= SMR_MSG_DATA_LEN) {
 		smr_format_inline(cmd, smr_peer_addr(ep->region)[peer_id].addr, iov,
 				  iov_count, op, tag, data, op_flags);
 	} else if (total_len <= SMR_INJECT_SIZE) {
-		tx_buf = smr_freestack_pop(smr_inject_pool(peer_smr));
+		tx_buf = smr_inject_buf_pop(peer_smr);
+		if (!tx_buf) {
+			ret = -FI_EAGAIN;
+			goto noop;
+		}
 		smr_format_inject(cmd, smr_peer_addr(ep->region)[peer_id].addr,
 				  iov, iov_count, op, tag, data, op_flags,
 				  peer_smr, tx_buf);
@@ -194,9 +199,24 @@ static ssize_t smr_generic_sendmsg(struct smr_ep *ep, const struct iovec *iov,
 		assert(!ofi_cirque_isfull(smr_resp_queue(ep->region)));
 		resp = ofi_cirque_tail(smr_resp_queue(ep->region));
 		pend = freestack_pop(ep->pend_fs);
-		smr_format_iov(cmd, smr_peer_addr(ep->region)[peer_id].addr, iov,
-			       iov_count, total_len, op, tag, data, op_flags,
-			       context, ep->region, resp, pend);
+		window = !smr_mr_push_iov(ep, peer_id, iov, iov_count,
+					  FI_REMOTE_READ);
+		if (window || smr_peer_cma_enabled(ep, peer_id)) {
+			smr_format_iov(cmd, smr_peer_addr(ep->region)[peer_id].addr,
+				       iov, iov_count, total_len, op, tag, data,
+				       op_flags, context, ep->region, resp, pend);
+			if (window)
+				cmd->msg.hdr.op_flags |= SMR_WINDOW;
+		} else {
+			ret = smr_format_sar(ep, cmd,
+					smr_peer_addr(ep->region)[peer_id].addr,
+					iov, iov_count, total_len, op, tag, data,
+					op_flags, context, peer_smr, resp, pend);
+			if (ret) {
+				freestack_push(ep->pend_fs, pend);
+				goto noop;
+			}
+		}
 		ofi_cirque_commit(smr_resp_queue(ep->region));
 		goto commit;
 	}
@@ -204,16 +224,16 @@ static ssize_t smr_generic_sendmsg(struct smr_ep *ep, const struct iovec *iov,
 	if (ret) {
 		FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
 			"unable to process tx completion\n");
-		goto unlock_cq;
 	}
 
 commit:
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
+	smr_cmd_queue_commit(smr_cmd_queue(peer_smr), pos);
+	smr_signal(peer_smr);
+	goto unlock_cq;
+noop:
+	smr_post_noop(peer_smr, pos, 1);
 unlock_cq:
 	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
-unlock_region:
-	fastlock_release(&peer_smr->lock);
 	return ret;
 }
 
@@ -264,6 +284,7 @@ static ssize_t smr_generic_inject(struct fid_ep *ep_fid, const void *buf,
 	struct smr_region *peer_smr;
 	struct smr_inject_buf *tx_buf;
 	struct smr_cmd *cmd;
+	int64_t pos;
 	int peer_id;
 	ssize_t ret = 0;
 	struct iovec msg_iov;
@@ -276,33 +297,31 @@ static ssize_t smr_generic_inject(struct fid_ep *ep_fid, const void *buf,
 	ep = container_of(ep_fid, struct smr_ep, util_ep.ep_fid.fid);
 	peer_id = (int) dest_addr;
 
-	ret = smr_verify_peer(ep, peer_id);
+	ret = smr_verify_peer(ep, peer_id, &peer_smr);
 	if (ret)
 		return ret;
 
-	peer_smr = smr_peer_region(ep->region, peer_id);
-	fastlock_acquire(&peer_smr->lock);
-	if (!peer_smr->cmd_cnt) {
-		ret = -FI_EAGAIN;
-		goto unlock;
-	}
+	if (smr_cmd_queue_next(smr_cmd_queue(peer_smr), 1, &pos))
+		return -FI_EAGAIN;
 
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
+	cmd = smr_cmd_queue_slot(smr_cmd_queue(peer_smr), pos);
 
 	if (len <= SMR_MSG_DATA_LEN) {
 		smr_format_inline(cmd, smr_peer_addr(ep->region)[peer_id].addr,
 				  &msg_iov, 1, op, tag, data, op_flags);
 	} else {
-		tx_buf = smr_freestack_pop(smr_inject_pool(peer_smr));
+		tx_buf = smr_inject_buf_pop(peer_smr);
+		if (!tx_buf) {
+			smr_post_noop(peer_smr, pos, 1);
+			return -FI_EAGAIN;
+		}
 		smr_format_inject(cmd, smr_peer_addr(ep->region)[peer_id].addr,
 				  &msg_iov, 1, op, tag, data, op_flags,
 				  peer_smr, tx_buf);
 	}
 
-	peer_smr->cmd_cnt--;
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-unlock:
-	fastlock_release(&peer_smr->lock);
+	smr_cmd_queue_commit(smr_cmd_queue(peer_smr), pos);
+	smr_signal(peer_smr);
 
 	return ret;
 }
@@ -371,7 +390,8 @@ smr_proccess_trecv_post(struct smr_ep *ep, struct smr_ep_entry *entry)
 	if (!ret || ret == -FI_EAGAIN)
 		return ret;
 
-	dlist_insert_tail(&entry->entry, &ep->trecv_queue.list);
+	ofi_match_insert(&ep->trecv_queue, &entry->match, entry->addr,
+			 entry->tag, entry->ignore);
 	return 0;
 }
 
@@ -37,6 +37,56 @@
 #include "ofi_iov.h"
 #include "smr.h"
 
+/* A sender's region is only needed to respond to it; map it on first use */
+static struct smr_region *smr_sender_region(struct smr_ep *ep, int peer_id)
+{
+	struct smr_region *peer_smr;
+
+	if (!smr_map_peer(ep->region->map, peer_id))
+		goto err;
+
+	peer_smr = smr_peer_region(ep->region, peer_id);
+	if (peer_smr ||
+	    !smr_map_activate(&smr_prov, ep->region, peer_id, &peer_smr)) {
+		smr_cma_publish(ep, peer_id, peer_smr);
+		return peer_smr;
+	}
+err:
+	FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
+		"unable to map region of peer %d\n", peer_id);
+	return NULL;
+}
+
+/*
+ * Responses written while progressing are announced to their senders once
+ * per pass, rather than paying for a fence for each response.
+ */
+static void smr_signal_flush(struct smr_ep *ep)
+{
+	int i;
+
+	for (i = 0; i < ep->signal_cnt; i++)
+		smr_signal(ep->signal_peers[i]);
+	ep->signal_cnt = 0;
+}
+
+static void smr_signal_peer(struct smr_ep *ep, struct smr_region *peer_smr)
+{
+	int i;
+
+	if (!peer_smr)
+		return;
+
+	for (i = 0; i < ep->signal_cnt; i++) {
+		if (ep->signal_peers[i] == peer_smr)
+			return;
+	}
+
+	if (ep->signal_cnt == SMR_SIGNAL_BATCH)
+		smr_signal_flush(ep);
+	ep->signal_peers[ep->signal_cnt++] = peer_smr;
+}
+
 static int smr_progress_fetch(struct smr_ep *ep, struct smr_cmd *pending,
 			      uint64_t *ret)
 {
@@ -46,8 +96,6 @@ static int smr_progress_fetch(struct smr_ep *ep, struct smr_cmd *pending,
 	uint8_t *src;
 
 	peer_smr = smr_peer_region(ep->region, pending->msg.hdr.addr);
-	if (fastlock_tryacquire(&peer_smr->lock))
-		return -FI_EAGAIN;
 
 	inj_offset = (size_t) pending->msg.hdr.src_data;
 	tx_buf = (struct smr_inject_buf *) ((char **) peer_smr +
@@ -69,17 +117,25 @@ static int smr_progress_fetch(struct smr_ep *ep, struct smr_cmd *pending,
 	}
 
 out:
-	smr_freestack_push(smr_inject_pool(peer_smr), tx_buf);
-	peer_smr->cmd_cnt++;
-	fastlock_release(&peer_smr->lock);
+	smr_inject_buf_push(peer_smr, tx_buf);
 	return 0;
 }
 
+/*
+ * Retire all the responses ready at the head of the queue under a single
+ * acquisition of the locks.  The head is first checked without locking, as
+ * responses are only ever retired by this process, so that an idle pass
+ * costs no lock.
+ */
 static void smr_progress_resp(struct smr_ep *ep)
 {
 	struct smr_resp *resp;
 	struct smr_cmd *pending;
-	int ret;
+	int ret, cnt = 0;
+
+	if (ofi_cirque_isempty(smr_resp_queue(ep->region)) ||
+	    ofi_cirque_head(smr_resp_queue(ep->region))->status == FI_EBUSY)
+		return;
 
 	fastlock_acquire(&ep->region->lock);
 	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
@@ -104,7 +160,10 @@ static void smr_progress_resp(struct smr_ep *ep)
 		}
 		freestack_push(ep->pend_fs, pending);
 		ofi_cirque_discard(smr_resp_queue(ep->region));
+		cnt++;
 	}
+	if (cnt)
+		ofi_atomic_sub32(&ep->region->map->busy, cnt);
 	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
 	fastlock_release(&ep->region->lock);
 }
@@ -144,20 +203,46 @@ static int smr_progress_inject(struct smr_cmd *cmd, struct iovec *iov,
 	}
 
 out:
-	smr_freestack_push(smr_inject_pool(ep->region), tx_buf);
+	smr_inject_buf_push(ep->region, tx_buf);
 	return err;
 }
 
+/* Copy between our buffers and a peer's, mapped through its windows */
+static ssize_t smr_copy_window(struct iovec *iov, size_t iov_count,
+			       struct iovec *peer_iov, size_t peer_count,
+			       int to_peer)
+{
+	size_t i, len, done = 0;
+
+	for (i = 0; i < peer_count; i++) {
+		if (to_peer)
+			len = ofi_copy_from_iov(peer_iov[i].iov_base,
+						peer_iov[i].iov_len, iov,
+						iov_count, done);
+		else
+			len = ofi_copy_to_iov(iov, iov_count, done,
+					      peer_iov[i].iov_base,
+					      peer_iov[i].iov_len);
+		done += len;
+		if (len < peer_iov[i].iov_len)
+			break;
+	}
+	return done;
+}
+
 static int smr_progress_iov(struct smr_cmd *cmd, struct iovec *iov,
 			    size_t iov_count, size_t *total_len,
 			    struct smr_ep *ep, int err)
 {
+	struct iovec peer_iov[SMR_IOV_LIMIT];
 	struct smr_region *peer_smr;
 	struct smr_resp *resp;
 	int peer_id, ret;
 
 	peer_id = (int) cmd->msg.hdr.addr;
-	peer_smr = smr_peer_region(ep->region, peer_id);
+	peer_smr = smr_sender_region(ep, peer_id);
+	if (!peer_smr)
+		return -FI_EIO;
 	resp = (struct smr_resp *) ((char **) peer_smr +
 				    (size_t) cmd->msg.hdr.src_data);
 
@@ -166,7 +251,15 @@ static int smr_progress_iov(struct smr_cmd *cmd, struct iovec *iov,
 		goto out;
 	}
 
-	if (cmd->msg.hdr.op == ofi_op_read_req) {
+	if (cmd->msg.hdr.op_flags & SMR_WINDOW &&
+	    !smr_mr_window_iov(ep, peer_id, cmd->msg.data.iov,
+			       cmd->msg.data.iov_count,
+			       cmd->msg.hdr.op == ofi_op_read_req ?
+			       FI_REMOTE_WRITE : FI_REMOTE_READ, peer_iov)) {
+		ret = smr_copy_window(iov, iov_count, peer_iov,
+				      cmd->msg.data.iov_count,
+				      cmd->msg.hdr.op == ofi_op_read_req);
+	} else if (cmd->msg.hdr.op == ofi_op_read_req) {
 		ret = process_vm_writev(peer_smr->pid, iov, iov_count,
 					cmd->msg.data.iov,
 					cmd->msg.data.iov_count, 0);
@@ -194,11 +287,170 @@ static int smr_progress_iov(struct smr_cmd *cmd, struct iovec *iov,
 out:
 	//Status must be set last (signals peer: op done, valid resp entry)
 	resp->status = ret;
+	smr_signal_peer(ep, peer_smr);
 
 	return -ret;
 }
 
-static int smr_progress_multi_recv(struct smr_ep *ep, struct smr_queue *queue,
+/*
+ * CMA transfers are queued on the sar_list and copied from there.  The copy
+ * is done at once if too many are already pending, if the receive buffer is
+ * short (to report the truncation), or if it is a multi-recv buffer, which
+ * must be available again to the next message.  Copies through the sender's
+ * windows need no syscall and are always done at once.
+ */
+static int smr_cma_queued(struct smr_ep *ep, struct smr_cmd *cmd,
+			  struct iovec *iov, size_t iov_count, uint32_t flags)
+{
+	return cmd->msg.hdr.op_src == smr_src_iov &&
+	       !(cmd->msg.hdr.op_flags & SMR_WINDOW) &&
+	       !(flags & FI_MULTI_RECV) &&
+	       ep->cma_pending < SMR_CMA_PEND_SIZE &&
+	       ofi_total_iov_len(iov, iov_count) >= cmd->msg.hdr.size &&
+	       smr_sender_region(ep, cmd->msg.hdr.addr);
+}
+
+/* Describe 'len' bytes of 'src' starting at 'offset' in 'dst' */
+static size_t smr_cma_iov(struct iovec *dst, struct iovec *src, size_t count,
+			  size_t offset, size_t len)
+{
+	size_t index = 0, dst_count = 0;
+
+	while (offset >= src[index].iov_len)
+		offset -= src[index++].iov_len;
+
+	(void) ofi_copy_iov_desc(dst, NULL, &dst_count, src, NULL, count,
+				 &index, &offset, len);
+	return dst_count;
+}
+
+/*
+ * Copy the next chunk of 'leader' along with the next chunks of the
+ * transfers queued behind it with the same peer and direction, in a single
+ * syscall.  A short copy fails the transfer it stopped in; the transfers
+ * after it are retried on the next pass.
+ */
+static void smr_cma_batch(struct smr_ep *ep, struct smr_sar_entry *leader)
+{
+	struct smr_sar_entry *batch[SMR_CMA_BATCH_IOV];
+	struct iovec local[SMR_CMA_BATCH_IOV];
+	struct iovec remote[SMR_CMA_BATCH_IOV];
+	struct smr_sar_entry *sar_entry;
+	struct dlist_entry *item;
+	size_t len[SMR_CMA_BATCH_IOV];
+	size_t local_cnt = 0, remote_cnt = 0, total = 0, cnt = 0, i;
+	int write = leader->cmd.msg.hdr.op == ofi_op_read_req;
+	ssize_t ret;
+
+	for (item = &leader->entry; item != &ep->sar_list &&
+	     total < smr_env.cma_chunk_size; item = item->next) {
+		sar_entry = container_of(item, struct smr_sar_entry, entry);
+		if (sar_entry->dir != smr_cma_copy || sar_entry->batched ||
+		    sar_entry->peer_smr != leader->peer_smr ||
+		    (sar_entry->cmd.msg.hdr.op == ofi_op_read_req) != write ||
+		    sar_entry->bytes_done == sar_entry->cmd.msg.hdr.size)
+			continue;
+
+		if (local_cnt + sar_entry->iov_count > SMR_CMA_BATCH_IOV ||
+		    remote_cnt + sar_entry->cmd.msg.data.iov_count >
+		    SMR_CMA_BATCH_IOV)
+			break;
+
+		len[cnt] = MIN(sar_entry->cmd.msg.hdr.size -
+			       sar_entry->bytes_done,
+			       smr_env.cma_chunk_size - total);
+		local_cnt += smr_cma_iov(&local[local_cnt], sar_entry->iov,
+					 sar_entry->iov_count,
+					 sar_entry->bytes_done, len[cnt]);
+		remote_cnt += smr_cma_iov(&remote[remote_cnt],
+					  sar_entry->cmd.msg.data.iov,
+					  sar_entry->cmd.msg.data.iov_count,
+					  sar_entry->bytes_done, len[cnt]);
+		sar_entry->batched = 1;
+		total += len[cnt];
+		batch[cnt++] = sar_entry;
+	}
+
+	if (write)
+		ret = process_vm_writev(leader->peer_smr->pid, local, local_cnt,
+					remote, remote_cnt, 0);
+	else
+		ret = process_vm_readv(leader->peer_smr->pid, local, local_cnt,
+				       remote, remote_cnt, 0);
+	if (ret < 0) {
+		FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
+			"CMA %s error: %s\n", write ? "write" : "read",
+			strerror(errno));
+		ret = 0;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		sar_entry = batch[i];
+		if ((size_t) ret < len[i]) {
+			FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
+				"partial CMA copy occurred\n");
+			sar_entry->total_len += ret;
+			sar_entry->bytes_done = sar_entry->cmd.msg.hdr.size;
+			break;
+		}
+		sar_entry->total_len += len[i];
+		sar_entry->bytes_done += len[i];
+		ret -= len[i];
+	}
+}
+
+static void smr_progress_sar(struct smr_cmd *cmd,
+			     struct smr_ep_entry *rx_entry, struct iovec *iov,
+			     size_t iov_count, struct smr_ep *ep)
+{
+	struct smr_region *peer_smr;
+	struct smr_sar_entry *sar_entry;
+
+	peer_smr = smr_sender_region(ep, cmd->msg.hdr.addr);
+
+	fastlock_acquire(&ep->util_ep.lock);
+	assert(!freestack_isempty(ep->sar_fs));
+	sar_entry = freestack_pop(ep->sar_fs);
+	ofi_atomic_inc32(&ep->region->map->busy);
+
+	sar_entry->cmd = *cmd;
+	sar_entry->rx_entry = rx_entry;
+	sar_entry->sar_smr = ep->region;
+	sar_entry->peer_smr = peer_smr;
+	sar_entry->resp = peer_smr ? (struct smr_resp *) ((char **) peer_smr +
+					(size_t) cmd->msg.hdr.src_data) : NULL;
+	memcpy(sar_entry->iov, iov, sizeof(*iov) * iov_count);
+	sar_entry->iov_count = iov_count;
+	sar_entry->bytes_done = 0;
+	sar_entry->total_len = 0;
+	sar_entry->batched = 0;
+
+	/* CMA data is copied when the sar_list is next progressed */
+	if (cmd->msg.hdr.op_src == smr_src_iov) {
+		sar_entry->sar_msg = NULL;
+		sar_entry->dir = smr_cma_copy;
+		ep->cma_pending++;
+		goto insert;
+	}
+
+	sar_entry->sar_msg = (struct smr_sar_msg *) ((char **) ep->region +
+					(size_t) cmd->msg.data.sar);
+	sar_entry->dir = (cmd->msg.hdr.op == ofi_op_read_req) ?
+			 smr_sar_copy_in : smr_sar_copy_out;
+
+	if (sar_entry->dir == smr_sar_copy_in)
+		smr_copy_to_sar(sar_entry);
+	else
+		smr_copy_from_sar(sar_entry);
+	if (sar_entry->bytes_done && peer_smr)
+		smr_signal_peer(ep, peer_smr);
+insert:
+	dlist_insert_tail(&sar_entry->entry, &ep->sar_list);
+	fastlock_release(&ep->util_ep.lock);
+}
+
+static int smr_progress_multi_recv(struct smr_ep *ep,
+				   struct ofi_match_queue *queue,
 				   struct smr_ep_entry *entry, size_t len)
 {
 	size_t left;
@@ -217,7 +469,8 @@ static int smr_progress_multi_recv(struct smr_ep *ep, struct smr_queue *queue,
 	entry->iov[0].iov_len = left;
 	entry->iov[0].iov_base = new_base;
 
-	dlist_insert_head(&entry->entry, &queue->list);
+	ofi_match_insert_head(queue, &entry->match, entry->addr, entry->tag,
+			      entry->ignore);
 
 	return 0;
 }
@@ -315,16 +568,34 @@ static int smr_progress_inject_atomic(struct smr_cmd *cmd, struct fi_ioc *ioc,
 
 out:
 	if (!(cmd->msg.hdr.op_flags & SMR_RMA_REQ))
-		smr_freestack_push(smr_inject_pool(ep->region), tx_buf);
+		smr_inject_buf_push(ep->region, tx_buf);
 
 	return err;
 }
 
+/*
+ * RMA and atomic commands are followed by an rma iov command.  The sender
+ * commits that slot first, so it is valid once the head is visible.  Both
+ * slots stay reserved until the command has been processed, since a sender
+ * may reuse a slot as soon as it is discarded.
+ */
+static struct smr_cmd *smr_next_cmd(struct smr_region *smr)
+{
+	struct smr_cmd_queue *queue = smr_cmd_queue(smr);
+
+	return smr_cmd_queue_slot(queue, ofi_atomic_get64(&queue->read_pos) + 1);
+}
+
+static void smr_discard_cmds(struct smr_region *smr, int cnt)
+{
+	while (cnt--)
+		smr_cmd_queue_discard(smr_cmd_queue(smr));
+}
+
 static int smr_progress_cmd_msg(struct smr_ep *ep, struct smr_cmd *cmd)
 {
-	struct smr_queue *recv_queue;
-	struct smr_match_attr match_attr;
-	struct dlist_entry *dlist_entry;
+	struct ofi_match_queue *recv_queue;
+	struct ofi_match_entry *match;
 	struct smr_ep_entry *entry;
 	struct smr_unexp_msg *unexp;
 	fi_addr_t addr;
@@ -340,28 +611,34 @@ static int smr_progress_cmd_msg(struct smr_ep *ep, struct smr_cmd *cmd)
 	recv_queue = (cmd->msg.hdr.op == ofi_op_tagged) ?
 		      &ep->trecv_queue : &ep->recv_queue;
 
-	if (dlist_empty(&recv_queue->list)) {
+	if (ofi_match_queue_empty(recv_queue)) {
 		FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
 			"no recv entry available\n");
 		return -FI_ENOMSG;
 	}
 
-	match_attr.addr = cmd->msg.hdr.addr;
-	match_attr.tag = cmd->msg.hdr.tag;
-
-	dlist_entry = dlist_remove_first_match(&recv_queue->list,
-					       recv_queue->match_func,
-					       &match_attr);
-	if (!dlist_entry) {
+	match = ofi_match_remove_first(recv_queue, cmd->msg.hdr.addr,
+				       cmd->msg.hdr.op == ofi_op_tagged ?
+				       cmd->msg.hdr.tag : 0, 0);
+	if (!match) {
 		if (freestack_isempty(ep->unexp_fs))
 			return -FI_EAGAIN;
 		unexp = freestack_pop(ep->unexp_fs);
 		memcpy(&unexp->cmd, cmd, sizeof(*cmd));
-		ofi_cirque_discard(smr_cmd_queue(ep->region));
-		dlist_insert_tail(&unexp->entry, &ep->unexp_queue.list);
+		smr_cmd_queue_discard(smr_cmd_queue(ep->region));
+		ofi_match_insert(&ep->unexp_queue, &unexp->match,
+				 cmd->msg.hdr.addr, cmd->msg.hdr.tag, 0);
 		return ret;
 	}
-	entry = container_of(dlist_entry, struct smr_ep_entry, entry);
+	entry = container_of(match, struct smr_ep_entry, match);
+
+	if (cmd->msg.hdr.op_src == smr_src_sar ||
+	    smr_cma_queued(ep, cmd, entry->iov, entry->iov_count,
+			   entry->flags)) {
+		smr_progress_sar(cmd, entry, entry->iov, entry->iov_count, ep);
+		smr_cmd_queue_discard(smr_cmd_queue(ep->region));
+		return 0;
+	}
 
 	switch (cmd->msg.hdr.op_src) {
 	case smr_src_inline:
@@ -389,8 +666,7 @@ static int smr_progress_cmd_msg(struct smr_ep *ep, struct smr_cmd *cmd)
 		FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
 			"unable to process rx completion\n");
 	}
-	ofi_cirque_discard(smr_cmd_queue(ep->region));
-	ep->region->cmd_cnt++;
+	smr_cmd_queue_discard(smr_cmd_queue(ep->region));
 
 	if (entry->flags & FI_MULTI_RECV) {
 		ret = smr_progress_multi_recv(ep, recv_queue, entry, total_len);
@@ -421,9 +697,7 @@ static int smr_progress_cmd_rma(struct smr_ep *ep, struct smr_cmd *cmd)
 		return -FI_ENOSPC;
 	}
 
-	ofi_cirque_discard(smr_cmd_queue(ep->region));
-	ep->region->cmd_cnt++;
-	rma_cmd = ofi_cirque_head(smr_cmd_queue(ep->region));
+	rma_cmd = smr_next_cmd(ep->region);
 
 	for (iov_count = 0; iov_count < rma_cmd->rma.rma_count; iov_count++) {
 		ret = ofi_mr_verify(&domain->util_domain.mr_map,
@@ -437,10 +711,14 @@ static int smr_progress_cmd_rma(struct smr_ep *ep, struct smr_cmd *cmd)
 		iov[iov_count].iov_base = (void *) rma_cmd->rma.rma_iov[iov_count].addr;
 		iov[iov_count].iov_len = rma_cmd->rma.rma_iov[iov_count].len;
 	}
-	ofi_cirque_discard(smr_cmd_queue(ep->region));
-	ep->region->cmd_cnt++;
 	if (ret)
-		return ret;
+		goto out;
+
+	if (cmd->msg.hdr.op_src == smr_src_sar ||
+	    smr_cma_queued(ep, cmd, iov, iov_count, 0)) {
+		smr_progress_sar(cmd, NULL, iov, iov_count, ep);
+		goto out;
+	}
 
 	switch (cmd->msg.hdr.op_src) {
 	case smr_src_inline:
@@ -468,7 +746,8 @@ static int smr_progress_cmd_rma(struct smr_ep *ep, struct smr_cmd *cmd)
 				"unable to process rx completion\n");
 		}
 	}
-
+out:
+	smr_discard_cmds(ep->region, 2);
 	return ret;
 }
 
@@ -486,9 +765,7 @@ static int smr_progress_cmd_atomic(struct smr_ep *ep, struct smr_cmd *cmd)
 	domain = container_of(ep->util_ep.domain, struct smr_domain,
 			      util_domain);
 
-	ofi_cirque_discard(smr_cmd_queue(ep->region));
-	ep->region->cmd_cnt++;
-	rma_cmd = ofi_cirque_head(smr_cmd_queue(ep->region));
+	rma_cmd = smr_next_cmd(ep->region);
 
 	for (ioc_count = 0; ioc_count < rma_cmd->rma.rma_count; ioc_count++) {
 		ret = ofi_mr_verify(&domain->util_domain.mr_map,
@@ -504,9 +781,8 @@ static int smr_progress_cmd_atomic(struct smr_ep *ep, struct smr_cmd *cmd)
 		ioc[ioc_count].addr = (void *) rma_cmd->rma.rma_ioc[ioc_count].addr;
 		ioc[ioc_count].count = rma_cmd->rma.rma_ioc[ioc_count].count;
 	}
-	ofi_cirque_discard(smr_cmd_queue(ep->region));
 	if (ret) {
-		ep->region->cmd_cnt++;
+		smr_discard_cmds(ep->region, 2);
 		return ret;
 	}
 
@@ -522,14 +798,16 @@ static int smr_progress_cmd_atomic(struct smr_ep *ep, struct smr_cmd *cmd)
 			"unidentified operation type\n");
 		err = -FI_EINVAL;
 	}
-	if (!(cmd->msg.hdr.op_flags & SMR_RMA_REQ)) {
-		ep->region->cmd_cnt++;
-	} else {
-		peer_smr = smr_peer_region(ep->region, cmd->msg.hdr.addr);
-		resp = (struct smr_resp *) ((char **) peer_smr +
-			    (size_t) cmd->msg.hdr.data);
-		resp->status = -err;
+	if (cmd->msg.hdr.op_flags & SMR_RMA_REQ) {
+		peer_smr = smr_sender_region(ep, cmd->msg.hdr.addr);
+		if (peer_smr) {
+			resp = (struct smr_resp *) ((char **) peer_smr +
+				    (size_t) cmd->msg.hdr.data);
+			resp->status = -err;
+			smr_signal_peer(ep, peer_smr);
+		}
 	}
+	smr_discard_cmds(ep->region, 2);
 
 	if (err)
 		FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
@@ -543,11 +821,17 @@ static void smr_progress_cmd(struct smr_ep *ep)
 	struct smr_cmd *cmd;
 	int ret = 0;
 
+	if (smr_cmd_queue_isempty(smr_cmd_queue(ep->region)))
+		return;
+
 	fastlock_acquire(&ep->region->lock);
 	fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
 
-	while (!ofi_cirque_isempty(smr_cmd_queue(ep->region))) {
-		cmd = ofi_cirque_head(smr_cmd_queue(ep->region));
+	while ((cmd = smr_cmd_queue_head(smr_cmd_queue(ep->region)))) {
+		if (cmd->msg.hdr.op_flags & SMR_NOOP) {
+			smr_cmd_queue_discard(smr_cmd_queue(ep->region));
+			continue;
+		}
 
 		switch (cmd->msg.hdr.op) {
 		case ofi_op_msg:
@@ -560,8 +844,7 @@ static void smr_progress_cmd(struct smr_ep *ep)
 			break;
 		case ofi_op_write_rsp:
 		case ofi_op_read_rsp:
-			ofi_cirque_discard(smr_cmd_queue(ep->region));
-			ep->region->cmd_cnt++;
+			smr_cmd_queue_discard(smr_cmd_queue(ep->region));
 			break;
 		case ofi_op_atomic:
 		case ofi_op_atomic_fetch:
@@ -582,6 +865,142 @@ static void smr_progress_cmd(struct smr_ep *ep)
 			break;
 		}
 	}
+	smr_signal_flush(ep);
+	fastlock_release(&ep->util_ep.rx_cq->cq_lock);
+	fastlock_release(&ep->region->lock);
+}
+
+static int smr_complete_sar(struct smr_ep *ep,
+			    struct smr_sar_entry *sar_entry)
+{
+	struct smr_cmd *cmd = &sar_entry->cmd;
+	struct smr_ep_entry *entry = sar_entry->rx_entry;
+	struct ofi_match_queue *recv_queue;
+	int err = 0, ret = 0;
+
+	/* Sender of a msg or write: the receiver reports completion */
+	if (sar_entry->dir == smr_sar_copy_in &&
+	    cmd->msg.hdr.op != ofi_op_read_req)
+		return 0;
+
+	if (sar_entry->dir != smr_sar_copy_in &&
+	    sar_entry->total_len != cmd->msg.hdr.size) {
+		FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
+			"recv truncated");
+		err = FI_EIO;
+	}
+
+	/* Initiator of a read: return the bounce buffers to the target */
+	if (cmd->msg.hdr.op == ofi_op_read_req &&
+	    sar_entry->dir == smr_sar_copy_out) {
+		if (fastlock_tryacquire(&sar_entry->sar_smr->lock))
+			return -FI_EAGAIN;
+		smr_freestack_push(smr_sar_pool(sar_entry->sar_smr),
+				   sar_entry->sar_msg);
+		fastlock_release(&sar_entry->sar_smr->lock);
+		smr_wmb();
+		sar_entry->resp->status = err;
+		return 0;
+	}
+
+	if ((entry || cmd->msg.hdr.op_flags & SMR_REMOTE_CQ_DATA) &&
+	    ofi_cirque_isfull(ep->util_ep.rx_cq->cirq))
+		return -FI_EAGAIN;
+
+	if (entry) {
+		ret = ep->rx_comp(ep, entry->context,
+				  smr_rx_cq_flags(cmd->msg.hdr.op,
+				  cmd->msg.hdr.op_flags), sar_entry->total_len,
+				  entry->iov[0].iov_base, &cmd->msg.hdr.addr,
+				  cmd->msg.hdr.tag, cmd->msg.hdr.data, err);
+	} else if (cmd->msg.hdr.op_flags & SMR_REMOTE_CQ_DATA) {
+		ret = ep->rx_comp(ep, (void *) cmd->msg.hdr.msg_id,
+				  smr_rx_cq_flags(cmd->msg.hdr.op,
+				  cmd->msg.hdr.op_flags), sar_entry->total_len,
+				  NULL, &cmd->msg.hdr.addr, 0,
+				  cmd->msg.hdr.data, err);
+	}
+	if (ret) {
+		FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
+			"unable to process rx completion\n");
+	}
+
+	/*
+	 * We drained the transfer: return the bounce buffers and post the
+	 * status.  As the target of a read (copy in), the initiator does both
+	 * once it has drained them, above.
+	 */
+	if (sar_entry->dir != smr_sar_copy_in) {
+		if (sar_entry->dir == smr_sar_copy_out)
+			smr_freestack_push(smr_sar_pool(ep->region),
+					   sar_entry->sar_msg);
+		//Status must be set last (signals peer: op done, valid resp entry)
+		smr_wmb();
+		if (sar_entry->resp) {
+			sar_entry->resp->status = err;
+			smr_signal_peer(ep, smr_peer_region(ep->region,
+							    cmd->msg.hdr.addr));
+		}
+	}
+
+	if (!entry)
+		return 0;
+
+	if (entry->flags & FI_MULTI_RECV) {
+		recv_queue = (cmd->msg.hdr.op == ofi_op_tagged) ?
+			      &ep->trecv_queue : &ep->recv_queue;
+		smr_progress_multi_recv(ep, recv_queue, entry,
+					sar_entry->total_len);
+		return 0;
+	}
+
+	freestack_push(ep->recv_fs, entry);
+	return 0;
+}
+
+static void smr_progress_sar_list(struct smr_ep *ep)
+{
+	struct smr_sar_entry *sar_entry;
+	struct dlist_entry *tmp;
+	size_t bytes_done;
+
+	if (dlist_empty(&ep->sar_list))
+		return;
+
+	fastlock_acquire(&ep->region->lock);
+	fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
+	fastlock_acquire(&ep->util_ep.lock);
+	dlist_foreach_container_safe(&ep->sar_list, struct smr_sar_entry,
+				     sar_entry, entry, tmp) {
+		bytes_done = sar_entry->bytes_done;
+		if (sar_entry->dir == smr_cma_copy) {
+			if (!sar_entry->batched &&
+			    bytes_done != sar_entry->cmd.msg.hdr.size)
+				smr_cma_batch(ep, sar_entry);
+			sar_entry->batched = 0;
+		} else if (sar_entry->dir == smr_sar_copy_in) {
+			smr_copy_to_sar(sar_entry);
+		} else {
+			smr_copy_from_sar(sar_entry);
+		}
+
+		/* The peer waits for the buffers just filled or drained */
+		if (sar_entry->bytes_done != bytes_done &&
+		    sar_entry->dir != smr_cma_copy && sar_entry->peer_smr)
+			smr_signal_peer(ep, sar_entry->peer_smr);
+
+		if (sar_entry->bytes_done != sar_entry->cmd.msg.hdr.size ||
+		    smr_complete_sar(ep, sar_entry))
+			continue;
+
+		if (sar_entry->dir == smr_cma_copy)
+			ep->cma_pending--;
+		dlist_remove(&sar_entry->entry);
+		freestack_push(ep->sar_fs, sar_entry);
+		ofi_atomic_dec32(&ep->region->map->busy);
+	}
+	smr_signal_flush(ep);
+	fastlock_release(&ep->util_ep.lock);
 	fastlock_release(&ep->util_ep.rx_cq->cq_lock);
 	fastlock_release(&ep->region->lock);
 }
@@ -594,13 +1013,19 @@ void smr_ep_progress(struct util_ep *util_ep)
 
 	smr_progress_resp(ep);
 	smr_progress_cmd(ep);
+	smr_progress_sar_list(ep);
+	smr_mr_progress(ep);
+
+	if (smr_env.peer_idle_timeout &&
+	    fi_gettime_ms() >= ep->region->map->next_sweep)
+		smr_map_sweep(ep->region->map, smr_env.peer_idle_timeout);
 }
 
-int smr_progress_unexp(struct smr_ep *ep, struct smr_ep_entry *entry)
+static int smr_progress_unexp_entry(struct smr_ep *ep,
+				    struct smr_ep_entry *entry)
 {
-	struct smr_match_attr match_attr;
 	struct smr_unexp_msg *unexp_msg;
-	struct dlist_entry *dlist_entry;
+	struct ofi_match_entry *match;
 	size_t total_len = 0;
 	int ret = 0;
 
@@ -611,16 +1036,21 @@ int smr_progress_unexp(struct smr_ep *ep, struct smr_ep_entry *entry)
 		goto push_entry;
 	}
 
-	match_attr.addr = entry->addr;
-	match_attr.ignore = entry->ignore;
-	match_attr.tag = entry->tag;
-	dlist_entry = dlist_remove_first_match(&ep->unexp_queue.list,
-					       ep->unexp_queue.match_func,
-					       &match_attr);
-	if (!dlist_entry)
+	match = ofi_match_remove_first(&ep->unexp_queue, entry->addr,
+				       entry->tag, entry->ignore);
+	if (!match)
 		return -FI_ENOMSG;
 
-	unexp_msg = container_of(dlist_entry, struct smr_unexp_msg, entry);
+	unexp_msg = container_of(match, struct smr_unexp_msg, match);
+
+	if (unexp_msg->cmd.msg.hdr.op_src == smr_src_sar ||
+	    smr_cma_queued(ep, &unexp_msg->cmd, entry->iov,
+			   entry->iov_count, entry->flags)) {
+		smr_progress_sar(&unexp_msg->cmd, entry, entry->iov,
+				 entry->iov_count, ep);
+		freestack_push(ep->unexp_fs, unexp_msg);
+		return 0;
+	}
 
 	switch (unexp_msg->cmd.msg.hdr.op_src) {
 	case smr_src_inline:
@@ -652,7 +1082,6 @@ int smr_progress_unexp(struct smr_ep *ep, struct smr_ep_entry *entry)
 			"unable to process rx completion\n");
 	}
 
-	ep->region->cmd_cnt++;
 	freestack_push(ep->unexp_fs, unexp_msg);
 
 	if (entry->flags & FI_MULTI_RECV) {
@@ -665,3 +1094,12 @@ push_entry:
 	freestack_push(ep->recv_fs, entry);
 	return ret;
 }
+
+int smr_progress_unexp(struct smr_ep *ep, struct smr_ep_entry *entry)
+{
+	int ret;
+
+	ret = smr_progress_unexp_entry(ep, entry);
+	smr_signal_flush(ep);
+	return ret;
+}
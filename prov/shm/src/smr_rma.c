@@ -97,6 +97,39 @@ ssize_t smr_rma_fast(struct smr_region *peer_smr, struct smr_cmd *cmd,
 	return 0;
 }
 
+/*
+ * Copy straight to or from the peer's memory if every target lies in a
+ * window it published.
+ */
+static int smr_rma_window(struct smr_ep *ep, int peer_id,
+			  const struct iovec *iov, size_t iov_count,
+			  const struct fi_rma_iov *rma_iov, size_t rma_count,
+			  uint32_t op)
+{
+	uint8_t *ptr[SMR_IOV_LIMIT];
+	size_t i, len = 0;
+
+	for (i = 0; i < rma_count; i++) {
+		ptr[i] = smr_mr_window_ptr(ep, peer_id, rma_iov[i].addr,
+					   rma_iov[i].len, rma_iov[i].key,
+					   op == ofi_op_write ?
+					   FI_REMOTE_WRITE : FI_REMOTE_READ);
+		if (!ptr[i])
+			return -FI_ENOENT;
+	}
+
+	for (i = 0; i < rma_count; i++) {
+		if (op == ofi_op_write)
+			ofi_copy_from_iov(ptr[i], rma_iov[i].len, iov,
+					  iov_count, len);
+		else
+			ofi_copy_to_iov(iov, iov_count, len, ptr[i],
+					rma_iov[i].len);
+		len += rma_iov[i].len;
+	}
+	return 0;
+}
+
 ssize_t smr_generic_rma(struct smr_ep *ep, const struct iovec *iov,
 	size_t iov_count, const struct fi_rma_iov *rma_iov, size_t rma_count,
 	void **desc, fi_addr_t addr, void *context, uint32_t op, uint64_t data,
@@ -107,7 +140,8 @@ ssize_t smr_generic_rma(struct smr_ep *ep, const struct iovec *iov,
 	struct smr_inject_buf *tx_buf;
 	struct smr_resp *resp;
 	struct smr_cmd *cmd, *pend;
-	int peer_id, cmds, err = 0, comp = 1;
+	int64_t pos;
+	int peer_id, cmds, window, err = 0, comp = 1;
 	ssize_t ret = 0;
 	size_t total_len;
 
@@ -117,32 +151,40 @@ ssize_t smr_generic_rma(struct smr_ep *ep, const struct iovec *iov,
 	domain = container_of(ep->util_ep.domain, struct smr_domain, util_domain);
 
 	peer_id = (int) addr;
-	ret = smr_verify_peer(ep, peer_id);
+	ret = smr_verify_peer_resp(ep, peer_id, &peer_smr);
 	if (ret)
 		return ret;
 
 	cmds = 1 + !(domain->fast_rma && !(op_flags & FI_REMOTE_CQ_DATA) &&
-		     rma_count == 1);
+		     rma_count == 1 && smr_cma_enabled(ep, peer_id, peer_smr));
 
-	peer_smr = smr_peer_region(ep->region, peer_id);
-	fastlock_acquire(&peer_smr->lock);
-	if (peer_smr->cmd_cnt < cmds) {
+	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
+	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq)) {
 		ret = -FI_EAGAIN;
-		goto unlock_region;
+		goto unlock_cq;
 	}
 
-	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
-	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq)) {
+	if (domain->fast_rma && !(op_flags & FI_REMOTE_CQ_DATA) &&
+	    !smr_rma_window(ep, peer_id, iov, iov_count, rma_iov, rma_count,
+			    op))
+		goto comp;
+
+	if (smr_cmd_queue_next(smr_cmd_queue(peer_smr), cmds, &pos)) {
 		ret = -FI_EAGAIN;
 		goto unlock_cq;
 	}
 
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
+	cmd = smr_cmd_queue_slot(smr_cmd_queue(peer_smr), pos);
 
 	if (cmds == 1) {
 		err = smr_rma_fast(peer_smr, cmd, iov, iov_count, rma_iov,
 				   rma_count, desc, peer_id, context, op);
-		goto commit_comp;
+		if (err)
+			smr_post_noop(peer_smr, pos, 1);
+		else
+			smr_cmd_queue_commit(smr_cmd_queue(peer_smr), pos);
+		smr_signal(peer_smr);
+		goto comp;
 	}
 
 	total_len = ofi_total_iov_len(iov, iov_count);
@@ -151,7 +193,11 @@ ssize_t smr_generic_rma(struct smr_ep *ep, const struct iovec *iov,
 		smr_format_inline(cmd, smr_peer_addr(ep->region)[peer_id].addr,
 				  iov, iov_count, op, 0, data, op_flags);
 	} else if (total_len <= SMR_INJECT_SIZE && op == ofi_op_write) {
-		tx_buf = smr_freestack_pop(smr_inject_pool(peer_smr));
+		tx_buf = smr_inject_buf_pop(peer_smr);
+		if (!tx_buf) {
+			ret = -FI_EAGAIN;
+			goto noop;
+		}
 		smr_format_inject(cmd, smr_peer_addr(ep->region)[peer_id].addr,
 				  iov, iov_count, op, 0, data, op_flags,
 				  peer_smr, tx_buf);
@@ -159,22 +205,37 @@ ssize_t smr_generic_rma(struct smr_ep *ep, const struct iovec *iov,
 		assert(!ofi_cirque_isfull(smr_resp_queue(ep->region)));
 		resp = ofi_cirque_tail(smr_resp_queue(ep->region));
 		pend = freestack_pop(ep->pend_fs);
-		smr_format_iov(cmd, smr_peer_addr(ep->region)[peer_id].addr,
-			       iov, iov_count, total_len, op, 0, data,
-			       op_flags, context, ep->region, resp, pend);
+		window = !smr_mr_push_iov(ep, peer_id, iov, iov_count,
+					  op == ofi_op_read_req ?
+					  FI_REMOTE_WRITE : FI_REMOTE_READ);
+		if (window || smr_peer_cma_enabled(ep, peer_id)) {
+			smr_format_iov(cmd, smr_peer_addr(ep->region)[peer_id].addr,
+				       iov, iov_count, total_len, op, 0, data,
+				       op_flags, context, ep->region, resp, pend);
+			if (window)
+				cmd->msg.hdr.op_flags |= SMR_WINDOW;
+		} else {
+			ret = smr_format_sar(ep, cmd,
+					smr_peer_addr(ep->region)[peer_id].addr,
+					iov, iov_count, total_len, op, 0, data,
+					op_flags, context, peer_smr, resp, pend);
+			if (ret) {
+				freestack_push(ep->pend_fs, pend);
+				goto noop;
+			}
+		}
 		ofi_cirque_commit(smr_resp_queue(ep->region));
 		comp = 0;
 	}
 
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
-	smr_format_rma_iov(cmd, rma_iov, rma_count);
-
-commit_comp:
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
+	/* The rma iov slot must be visible before the command that uses it */
+	smr_format_rma_iov(smr_cmd_queue_slot(smr_cmd_queue(peer_smr), pos + 1),
+			   rma_iov, rma_count);
+	smr_cmd_queue_commit(smr_cmd_queue(peer_smr), pos + 1);
+	smr_cmd_queue_commit(smr_cmd_queue(peer_smr), pos);
+	smr_signal(peer_smr);
 
+comp:
 	if (!comp)
 		goto unlock_cq;
 
@@ -183,11 +244,12 @@ commit_comp:
 		FI_WARN(&smr_prov, FI_LOG_EP_CTRL,
 			"unable to process tx completion\n");
 	}
+	goto unlock_cq;
 
+noop:
+	smr_post_noop(peer_smr, pos, cmds);
 unlock_cq:
 	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
-unlock_region:
-	fastlock_release(&peer_smr->lock);
 	return ret;
 }
 
@@ -305,6 +367,7 @@ ssize_t smr_generic_rma_inject(struct fid_ep *ep_fid, const void *buf,
 	struct smr_cmd *cmd;
 	struct iovec iov;
 	struct fi_rma_iov rma_iov;
+	int64_t pos;
 	int peer_id, cmds;
 	ssize_t ret = 0;
 
@@ -313,30 +376,35 @@ ssize_t smr_generic_rma_inject(struct fid_ep *ep_fid, const void *buf,
 	domain = container_of(ep->util_ep.domain, struct smr_domain, util_domain);
 
 	peer_id = (int) dest_addr;
-	ret = smr_verify_peer(ep, peer_id);
+	ret = smr_verify_peer_resp(ep, peer_id, &peer_smr);
 	if (ret)
 		return ret;
 
-	cmds = 1 + !(domain->fast_rma && !(flags & FI_REMOTE_CQ_DATA));
-
-	peer_smr = smr_peer_region(ep->region, peer_id);
-	fastlock_acquire(&peer_smr->lock);
-	if (peer_smr->cmd_cnt < cmds) {
-		ret = -FI_EAGAIN;
-		goto unlock_region;
-	}
-
 	iov.iov_base = (void *) buf;
 	iov.iov_len = len;
 	rma_iov.addr = addr;
 	rma_iov.len = len;
 	rma_iov.key = key;
 
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
+	if (domain->fast_rma && !(flags & FI_REMOTE_CQ_DATA) &&
+	    !smr_rma_window(ep, peer_id, &iov, 1, &rma_iov, 1, ofi_op_write))
+		return 0;
+
+	cmds = 1 + !(domain->fast_rma && !(flags & FI_REMOTE_CQ_DATA) &&
+		     smr_cma_enabled(ep, peer_id, peer_smr));
+
+	if (smr_cmd_queue_next(smr_cmd_queue(peer_smr), cmds, &pos))
+		return -FI_EAGAIN;
+
+	cmd = smr_cmd_queue_slot(smr_cmd_queue(peer_smr), pos);
 
 	if (cmds == 1) {
 		ret = smr_rma_fast(peer_smr, cmd, &iov, 1, &rma_iov, 1, NULL,
 				   peer_id, NULL, ofi_op_write);
+		if (ret) {
+			smr_post_noop(peer_smr, pos, 1);
+			return ret;
+		}
 		goto commit;
 	}
 
@@ -344,22 +412,22 @@ ssize_t smr_generic_rma_inject(struct fid_ep *ep_fid, const void *buf,
 		smr_format_inline(cmd, smr_peer_addr(ep->region)[peer_id].addr,
 				  &iov, 1, ofi_op_write, 0, data, flags);
 	} else {
-		tx_buf = smr_freestack_pop(smr_inject_pool(peer_smr));
+		tx_buf = smr_inject_buf_pop(peer_smr);
+		if (!tx_buf) {
+			smr_post_noop(peer_smr, pos, cmds);
+			return -FI_EAGAIN;
+		}
 		smr_format_inject(cmd, smr_peer_addr(ep->region)[peer_id].addr,
 				  &iov, 1, ofi_op_write, 0, data,
 				  flags, peer_smr, tx_buf);
 	}
 
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
-	cmd = ofi_cirque_tail(smr_cmd_queue(peer_smr));
-	smr_format_rma_iov(cmd, &rma_iov, 1);
-
+	smr_format_rma_iov(smr_cmd_queue_slot(smr_cmd_queue(peer_smr), pos + 1),
+			   &rma_iov, 1);
+	smr_cmd_queue_commit(smr_cmd_queue(peer_smr), pos + 1);
 commit:
-	ofi_cirque_commit(smr_cmd_queue(peer_smr));
-	peer_smr->cmd_cnt--;
-unlock_region:
-	fastlock_release(&peer_smr->lock);
+	smr_cmd_queue_commit(smr_cmd_queue(peer_smr), pos);
+	smr_signal(peer_smr);
 	return ret;
 }
 
@@ -10,6 +10,32 @@ dnl
 AC_DEFUN([FI_TCP_CONFIGURE],[
        # Determine if we can support the tcp provider
        tcp_h_happy=0
+       tcp_io_uring_happy=0
        AS_IF([test x"$enable_tcp" != x"no"], [tcp_h_happy=1])
+
+       # The io_uring progress engine uses the system calls directly, so
+       # only the kernel headers are needed
+       AS_IF([test $tcp_h_happy -eq 1 && \
+	      test x"$enable_tcp_io_uring" != x"no"],
+	     [AC_CHECK_HEADER([linux/io_uring.h],
+			      [AC_CHECK_DECL([IORING_FEAT_NODROP],
+					     [tcp_io_uring_happy=1], [],
+					     [#include <linux/io_uring.h>])])
+	      AC_CHECK_DECL([__NR_io_uring_setup], [],
+			    [tcp_io_uring_happy=0],
+			    [#include <sys/syscall.h>])])
+
+       AS_IF([test x"$enable_tcp_io_uring" = x"yes" && \
+	      test $tcp_io_uring_happy -eq 0],
+	     [AC_MSG_ERROR([tcp io_uring support requested but not available])])
+
+       AC_DEFINE_UNQUOTED([HAVE_TCP_IO_URING], [$tcp_io_uring_happy],
+			  [Whether the tcp provider can use io_uring])
+
        AS_IF([test $tcp_h_happy -eq 1], [$1], [$2])
 ])
+
+AC_ARG_ENABLE([tcp-io-uring],
+	      [AC_HELP_STRING([--enable-tcp-io-uring],
+			      [Build the io_uring progress engine of the tcp
+			       provider @<:@default=auto@:>@])])
@@ -34,6 +34,7 @@
 #endif /* HAVE_CONFIG_H */
 
 #include <sys/types.h>
+#include <limits.h>
 #include <netdb.h>
 #include <pthread.h>
 #include <sys/socket.h>
@@ -58,6 +59,8 @@
 #include <ofi_signal.h>
 #include <ofi_util.h>
 #include <ofi_proto.h>
+#include <ofi_tag_match.h>
+#include <ofi_atomic.h>
 
 #ifndef _TCP_H_
 #define _TCP_H_
@@ -67,16 +70,47 @@
 
 #define TCPX_MAX_CM_DATA_SIZE	(1<<8)
 #define TCPX_IOV_LIMIT		(4)
-#define TCPX_MAX_INJECT_SZ	(64)
+#define TCPX_MAX_INJECT_SZ	(4096)
 
 #define MAX_EPOLL_EVENTS	100
-#define STAGE_BUF_SIZE		512
+#define STAGE_BUF_SIZE		(1 << 16)
+
+#ifdef IOV_MAX
+#define TCPX_TX_IOV_MAX		IOV_MAX
+#else
+#define TCPX_TX_IOV_MAX		1024
+#endif
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#define TCPX_HAVE_ZEROCOPY	1
+#else
+#define TCPX_HAVE_ZEROCOPY	0
+#endif
+
+/* iovs gathered from the tx queue into one io_uring send */
+#define TCPX_URING_IOV_MAX	64
+
+/* ofi_op_hdr flag: the payload is split across the stripe sockets */
+#define TCPX_STRIPED		(1 << 7)
+#define TCPX_STRIPE_MAX		(8)
 
 extern struct fi_provider	tcpx_prov;
 extern struct util_prov		tcpx_util_prov;
 extern struct fi_info		tcpx_info;
+extern struct fi_ops_msg	tcpx_msg_ops;
+extern struct fi_ops_tagged	tcpx_tagged_ops;
+extern struct fi_ops_rma	tcpx_rma_ops;
+extern struct fi_ops_atomic	tcpx_atomic_ops;
+extern size_t			tcpx_zerocopy_size;
+extern int			tcpx_io_uring;
+extern size_t			tcpx_stripe_cnt;
+extern size_t			tcpx_stripe_size;
+extern size_t			tcpx_busy_poll;
+extern size_t			tcpx_busy_poll_budget;
 struct tcpx_xfer_entry;
 struct tcpx_ep;
+struct tcpx_rdm;
+struct tcpx_uring;
 
 enum tcpx_xfer_op_codes {
 	TCPX_OP_MSG_SEND,
@@ -87,6 +121,9 @@ enum tcpx_xfer_op_codes {
 	TCPX_OP_READ_REQ,
 	TCPX_OP_READ_RSP,
 	TCPX_OP_REMOTE_READ,
+	TCPX_OP_ATOMIC,
+	TCPX_OP_REMOTE_ATOMIC,
+	TCPX_OP_TAGGED_SEND,
 	TCPX_OP_CODE_MAX,
 };
 
@@ -109,6 +146,8 @@ struct tcpx_conn_handle {
 	struct fid		handle;
 	struct tcpx_pep		*pep;
 	SOCKET			conn_fd;
+	/* stripe sockets requested by the peer */
+	size_t			stripe_cnt;
 };
 
 struct tcpx_pep {
@@ -128,6 +167,9 @@ enum tcpx_cm_state {
 struct tcpx_msg_hdr {
 	struct ofi_op_hdr	hdr;
 	size_t			rma_iov_cnt;
+	/* part of a striped payload that follows this header */
+	uint64_t		stripe_off;
+	uint64_t		stripe_len;
 	union {
 		struct fi_rma_iov	rma_iov[TCPX_IOV_LIMIT];
 		struct fi_rma_ioc	rma_ioc[TCPX_IOV_LIMIT];
@@ -150,11 +192,53 @@ typedef int (*tcpx_rx_process_fn_t)(struct tcpx_xfer_entry *rx_entry);
 typedef void (*tcpx_ep_progress_func_t)(struct tcpx_ep *ep);
 typedef int (*tcpx_get_rx_func_t)(struct tcpx_ep *ep);
 
-struct stage_buf {
-	uint8_t			buf[STAGE_BUF_SIZE];
-	size_t			size;
-	size_t			len;
-	size_t			off;
+#if HAVE_TCP_IO_URING
+/* A receive or send submitted to the io_uring of the domain */
+struct tcpx_uring_op {
+	struct msghdr		msg;
+	struct iovec		iov[TCPX_URING_IOV_MAX];
+	/* leading bytes of a receive that go to the current rx entry */
+	size_t			user_len;
+	/* set from submission until the endpoint takes the result */
+	bool			pending;
+	/* set with res once the kernel completed the request */
+	bool			done;
+	int			res;
+};
+#endif
+
+/*
+ * An extra connection to the peer of a msg endpoint.  Each striped
+ * transfer sends one chunk of its payload on every stripe socket.
+ */
+struct tcpx_stripe_sock {
+	SOCKET			sock;
+	struct tcpx_msg_hdr	tx_hdr;
+	struct iovec		tx_iov[TCPX_IOV_LIMIT + 1];
+	size_t			tx_iov_cnt;
+	size_t			tx_rem;
+	struct tcpx_msg_hdr	rx_hdr;
+	size_t			rx_hdr_done;
+	struct iovec		rx_iov[TCPX_IOV_LIMIT];
+	size_t			rx_iov_cnt;
+	size_t			rx_rem;
+	bool			rx_active;
+};
+
+struct tcpx_stripes {
+	/* the passive side accepts the stripe sockets on its own port */
+	SOCKET			listen_sock;
+	size_t			cnt;
+	size_t			conn_cnt;
+	/* header and first chunk left to send on the primary socket */
+	struct tcpx_xfer_entry	*tx_entry;
+	size_t			tx_rem;
+	struct tcpx_xfer_entry	*rx_entry;
+	tcpx_rx_process_fn_t	rx_proc_fn;
+	struct iovec		rx_iov[TCPX_IOV_LIMIT];
+	size_t			rx_iov_cnt;
+	size_t			rx_rem;
+	struct tcpx_stripe_sock	sock[];
 };
 
 struct tcpx_ep {
@@ -167,17 +251,64 @@ struct tcpx_ep {
 	struct slist		rx_queue;
 	struct slist		tx_queue;
 	struct slist		tx_rsp_pend_queue;
+	/* sent with MSG_ZEROCOPY, waiting for the kernel to release pages */
+	struct slist		tx_zc_queue;
 	struct slist		rma_read_queue;
+	struct ofi_match_queue	trecv_queue;
+	struct ofi_match_queue	unexp_queue;
 	struct tcpx_rx_ctx	*srx_ctx;
 	enum tcpx_cm_state	cm_state;
 	/* lock for protecting tx/rx queues,rma list,cm_state*/
 	fastlock_t		lock;
 	tcpx_ep_progress_func_t progress_func;
-	tcpx_get_rx_func_t	get_rx_entry[ofi_op_write + 1];
-	struct stage_buf	stage_buf;
+	tcpx_get_rx_func_t	get_rx_entry[ofi_op_atomic_compare + 1];
+	/* bounds the buffers allocated for unexpected messages */
+	size_t			max_msg_size;
+	/* bytes read from the socket ahead of the current message */
+	struct ofi_ringbuf	stage_buf;
 	bool			send_ready_monitor;
+	bool			zc_enabled;
+	uint32_t		zc_next_id;
+	uint32_t		zc_pend_cnt;
+	/* set when the domain progresses sockets through io_uring */
+	struct tcpx_uring	*uring;
+#if HAVE_TCP_IO_URING
+	struct tcpx_uring_op	uring_rx;
+	struct tcpx_uring_op	uring_tx;
+#endif
+	/* RDM endpoint that owns this connection */
+	struct tcpx_rdm		*rdm;
+	/* set once stripe sockets were negotiated with the peer */
+	struct tcpx_stripes	*stripes;
+	size_t			stripe_req;
 };
 
+/*
+ * An RDM endpoint connects to each peer on first use.  Every connection is
+ * a tcpx_ep of its own that matches the messages it receives against the
+ * receives posted on the RDM endpoint.  All connections are progressed
+ * from a single epoll set.
+ */
+struct tcpx_rdm {
+	struct tcpx_ep		ep;
+	SOCKET			listen_sock;
+	union ofi_sock_ip	addr;
+	fi_epoll_t		epoll;
+	/* connections used to send to a peer, indexed by fi_addr */
+	struct index_map	conn_map;
+	struct dlist_entry	conn_list;
+	/* connections with work pending that epoll will not report */
+	struct dlist_entry	pend_list;
+	/* connections closed before they were set up, freed after progress */
+	struct dlist_entry	free_list;
+};
+
+/* Receives for the connections of an RDM endpoint are posted on it */
+static inline struct tcpx_ep *tcpx_rx_ep(struct tcpx_ep *ep)
+{
+	return ep->rdm ? &ep->rdm->ep : ep;
+}
+
 struct tcpx_fabric {
 	struct util_fabric	util_fabric;
 };
@@ -185,21 +316,49 @@ struct tcpx_fabric {
 struct tcpx_msg_data {
 	size_t			iov_cnt;
 	struct iovec		iov[TCPX_IOV_LIMIT+1];
-	uint8_t			inject[TCPX_MAX_INJECT_SZ];
 };
 
 struct tcpx_xfer_entry {
 	struct slist_entry	entry;
-	struct tcpx_msg_hdr	msg_hdr;
 	struct tcpx_msg_data	msg_data;
 	struct tcpx_ep		*ep;
 	uint64_t		flags;
 	void			*context;
 	uint64_t		done_len;
+	/* posted tagged receive or unexpected tagged message */
+	struct ofi_match_entry	match;
+	/* receive matched to an unexpected message that is still arriving */
+	struct tcpx_xfer_entry	*pending_recv;
+	uint8_t			*unexp_buf;
+	/* MSG_ZEROCOPY notification ids used and released by this transfer */
+	uint32_t		zc_id;
+	uint32_t		zc_cnt;
+	uint32_t		zc_done;
+	/* buffers that receive the result of a fetching atomic */
+	struct iovec		result_iov[TCPX_IOV_LIMIT];
+	size_t			result_iov_cnt;
+	/*
+	 * Pools of entries that carry data inline allocate TCPX_MAX_INJECT_SZ
+	 * bytes for inject[], so that the header and the data are sent as
+	 * one buffer.
+	 */
+	struct tcpx_msg_hdr	msg_hdr;
+	uint8_t			inject[];
 };
 
+/* Send the header and len bytes of inline data from inject[] */
+static inline void tcpx_inject_iov(struct tcpx_xfer_entry *xfer_entry,
+				   size_t len)
+{
+	assert(len <= TCPX_MAX_INJECT_SZ);
+	xfer_entry->msg_data.iov[0].iov_base = (void *) &xfer_entry->msg_hdr;
+	xfer_entry->msg_data.iov[0].iov_len = sizeof(xfer_entry->msg_hdr) + len;
+	xfer_entry->msg_data.iov_cnt = 1;
+}
+
 struct tcpx_domain {
 	struct util_domain	util_domain;
+	struct tcpx_uring	*uring;
 };
 
 struct tcpx_buf_pool {
@@ -211,6 +370,8 @@ struct tcpx_cq {
 	struct util_cq		util_cq;
 	/* buf_pools protected by util.cq_lock */
 	struct tcpx_buf_pool	buf_pools[TCPX_OP_CODE_MAX];
+	/* endpoint that busy polling starts with, see tcpx_cq_progress */
+	size_t			poll_start;
 };
 
 int tcpx_create_fabric(struct fi_fabric_attr *attr,
@@ -226,6 +387,14 @@ int tcpx_domain_open(struct fid_fabric *fabric, struct fi_info *info,
 
 int tcpx_endpoint(struct fid_domain *domain, struct fi_info *info,
 		  struct fid_ep **ep_fid, void *context);
+int tcpx_rdm_endpoint(struct fid_domain *domain, struct fi_info *info,
+		      struct fid_ep **ep_fid, void *context);
+int tcpx_query_atomic(struct fid_domain *domain, enum fi_datatype datatype,
+		      enum fi_op op, struct fi_atomic_attr *attr,
+		      uint64_t flags);
+int tcpx_setup_socket(SOCKET sock);
+void tcpx_ep_zerocopy_init(struct tcpx_ep *ep);
+void tcpx_ep_tx_rx_queues_release(struct tcpx_ep *ep);
 
 
 int tcpx_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
@@ -236,15 +405,24 @@ void tcpx_cq_report_completion(struct util_cq *cq,
 
 int tcpx_recv_msg_data(struct tcpx_xfer_entry *recv_entry);
 int tcpx_send_msg(struct tcpx_xfer_entry *tx_entry);
-int tcpx_recv_hdr(SOCKET sock, struct stage_buf *sbuf,
-		  struct tcpx_rx_detect *rx_detect);
-int tcpx_read_to_buffer(SOCKET sock, struct stage_buf *stage_buf);
+int tcpx_send_queued(struct tcpx_ep *ep, size_t *len);
+size_t tcpx_tx_queue_iov(struct tcpx_ep *ep, struct iovec *iov,
+			 size_t iov_max);
+int tcpx_recv_hdr(struct tcpx_ep *ep);
+int tcpx_read_to_buffer(SOCKET sock, struct ofi_ringbuf *sbuf);
+int tcpx_stage_free_iov(struct ofi_ringbuf *sbuf, struct iovec *iov);
+void tcpx_stage_commit(struct ofi_ringbuf *sbuf, size_t len);
+int tcpx_recv_zc_notify(SOCKET sock, uint32_t *lo, uint32_t *hi,
+			bool *copied);
+size_t tcpx_readv_from_buffer(struct ofi_ringbuf *sbuf, struct iovec *iov,
+			      int iov_cnt, size_t len);
 
 struct tcpx_xfer_entry *tcpx_xfer_entry_alloc(struct tcpx_cq *cq,
 					      enum tcpx_xfer_op_codes type);
 void tcpx_xfer_entry_release(struct tcpx_cq *tcpx_cq,
 			     struct tcpx_xfer_entry *xfer_entry);
 
+void tcpx_tx_entry_done(struct tcpx_xfer_entry *tx_entry, int ret);
 void tcpx_progress(struct util_ep *util_ep);
 void tcpx_ep_progress(struct tcpx_ep *ep);
 int tcpx_ep_shutdown_report(struct tcpx_ep *ep, fid_t fid);
@@ -252,6 +430,33 @@ int tcpx_cq_wait_ep_add(struct tcpx_ep *ep);
 void tcpx_cq_wait_ep_del(struct tcpx_ep *ep);
 void tcpx_tx_queue_insert(struct tcpx_ep *tcpx_ep,
 			  struct tcpx_xfer_entry *tx_entry);
+void tcpx_cq_progress(struct util_cq *cq);
+
+#if HAVE_TCP_IO_URING
+int tcpx_uring_open(struct tcpx_uring **uring);
+void tcpx_uring_close(struct tcpx_uring *uring);
+int tcpx_uring_fd(struct tcpx_uring *uring);
+int tcpx_uring_try(void *arg);
+void tcpx_uring_submit(struct tcpx_uring *uring);
+void tcpx_uring_reap(struct tcpx_uring *uring);
+bool tcpx_uring_op_test(struct tcpx_uring *uring, struct tcpx_uring_op *op,
+			int *res);
+void tcpx_uring_recvmsg(struct tcpx_uring *uring, SOCKET sock,
+			struct tcpx_uring_op *op);
+void tcpx_uring_sendmsg(struct tcpx_uring *uring, SOCKET sock,
+			struct tcpx_uring_op *op);
+void tcpx_uring_cancel(struct tcpx_uring *uring, struct tcpx_uring_op *op);
+#endif
+
+int tcpx_stripe_listen(struct tcpx_ep *ep, size_t cnt, uint16_t *port);
+int tcpx_stripe_connect(struct tcpx_ep *ep, size_t cnt, uint16_t port);
+void tcpx_stripe_close(struct tcpx_ep *ep);
+int tcpx_stripe_wait_add(struct tcpx_ep *ep);
+void tcpx_stripe_wait_del(struct tcpx_ep *ep);
+bool tcpx_stripe_tx_start(struct tcpx_ep *ep,
+			  struct tcpx_xfer_entry *tx_entry);
+void tcpx_stripe_tx_progress(struct tcpx_ep *ep);
+void tcpx_stripe_rx_start(struct tcpx_ep *ep);
 
 void tcpx_conn_mgr_run(struct util_eq *eq);
 int tcpx_eq_wait_try_func(void *arg);
@@ -263,5 +468,39 @@ int tcpx_get_rx_entry_op_msg(struct tcpx_ep *tcpx_ep);
 int tcpx_get_rx_entry_op_read_req(struct tcpx_ep *tcpx_ep);
 int tcpx_get_rx_entry_op_write(struct tcpx_ep *tcpx_ep);
 int tcpx_get_rx_entry_op_read_rsp(struct tcpx_ep *tcpx_ep);
+int tcpx_get_rx_entry_op_tagged(struct tcpx_ep *tcpx_ep);
+int tcpx_get_rx_entry_op_atomic(struct tcpx_ep *tcpx_ep);
+
+#if TCPX_HAVE_ZEROCOPY
+/*
+ * Large user sends and RMA writes are sent without copying when enabled.
+ * Transfers that wait for a response from the peer already complete late,
+ * so they keep using regular sends.
+ */
+static inline int tcpx_zc_flags(struct tcpx_xfer_entry *tx_entry)
+{
+	if (!tx_entry->ep->zc_enabled ||
+	    ntohll(tx_entry->msg_hdr.hdr.size) < tcpx_zerocopy_size)
+		return 0;
+
+	if (tx_entry->msg_hdr.hdr.op != ofi_op_msg &&
+	    tx_entry->msg_hdr.hdr.op != ofi_op_tagged &&
+	    tx_entry->msg_hdr.hdr.op != ofi_op_write)
+		return 0;
+
+	if (ntohl(tx_entry->msg_hdr.hdr.flags) &
+	    (OFI_DELIVERY_COMPLETE | OFI_COMMIT_COMPLETE))
+		return 0;
+
+	return MSG_ZEROCOPY;
+}
+#else
+#define tcpx_zc_flags(tx_entry) 0
+#endif
+
+int tcpx_queue_msg_resp(struct tcpx_ep *ep);
+int tcpx_unexp_deliver(struct tcpx_xfer_entry *unexp,
+		       struct tcpx_xfer_entry *recv_entry);
+void tcpx_unexp_free(struct tcpx_xfer_entry *unexp);
 
 #endif //_TCP_H_
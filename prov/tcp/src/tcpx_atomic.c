@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) 2018 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *	   Redistribution and use in source and binary forms, with or
+ *	   without modification, are permitted provided that the following
+ *	   conditions are met:
+ *
+ *		- Redistributions of source code must retain the above
+ *		  copyright notice, this list of conditions and the following
+ *		  disclaimer.
+ *
+ *		- Redistributions in binary form must reproduce the above
+ *		  copyright notice, this list of conditions and the following
+ *		  disclaimer in the documentation and/or other materials
+ *		  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <rdma/fi_errno.h>
+#include "ofi_iov.h"
+#include "tcpx.h"
+
+#include <string.h>
+
+/*
+ * Atomics are executed by the target, which receives the operands, and
+ * for compare atomics the compare values, inline after the header.  Fetch
+ * and compare atomics wait on the tx_rsp_pend_queue for a response that
+ * carries the original data back.
+ */
+static size_t tcpx_atomic_len(const struct fi_rma_ioc *rma_ioc,
+			      size_t rma_count, enum fi_datatype datatype)
+{
+	size_t i, cnt = 0;
+
+	for (i = 0; i < rma_count; i++)
+		cnt += rma_ioc[i].count;
+
+	return cnt * ofi_datatype_size(datatype);
+}
+
+static ssize_t
+tcpx_atomic_generic(struct fid_ep *ep, const struct fi_ioc *ioc, size_t count,
+		    const struct fi_ioc *compare_ioc, size_t compare_count,
+		    struct fi_ioc *result_ioc, size_t result_count,
+		    const struct fi_rma_ioc *rma_ioc, size_t rma_count,
+		    enum fi_datatype datatype, enum fi_op atomic_op,
+		    void *context, uint64_t flags, uint32_t op)
+{
+	struct tcpx_ep *tcpx_ep;
+	struct tcpx_cq *tcpx_cq;
+	struct tcpx_xfer_entry *send_entry;
+	struct iovec iov[TCPX_IOV_LIMIT];
+	size_t dt_size, len, data_len = 0;
+
+	tcpx_ep = container_of(ep, struct tcpx_ep, util_ep.ep_fid);
+	tcpx_cq = container_of(tcpx_ep->util_ep.tx_cq, struct tcpx_cq,
+			       util_cq);
+
+	assert(count <= TCPX_IOV_LIMIT);
+	assert(compare_count <= TCPX_IOV_LIMIT);
+	assert(result_count <= TCPX_IOV_LIMIT);
+	assert(rma_count <= TCPX_IOV_LIMIT);
+
+	dt_size = ofi_datatype_size(datatype);
+	len = tcpx_atomic_len(rma_ioc, rma_count, datatype);
+	if (len > (op == ofi_op_atomic_compare ? TCPX_MAX_INJECT_SZ / 2 :
+		   TCPX_MAX_INJECT_SZ))
+		return -FI_EINVAL;
+
+	send_entry = tcpx_xfer_entry_alloc(tcpx_cq, TCPX_OP_ATOMIC);
+	if (!send_entry)
+		return -FI_EAGAIN;
+
+	send_entry->msg_hdr.hdr.op = op;
+	send_entry->msg_hdr.hdr.flags = 0;
+	send_entry->msg_hdr.hdr.atomic.datatype = datatype;
+	send_entry->msg_hdr.hdr.atomic.op = atomic_op;
+	send_entry->msg_hdr.hdr.atomic.ioc_count = rma_count;
+
+	memcpy(send_entry->msg_hdr.rma_ioc, rma_ioc,
+	       rma_count * sizeof(rma_ioc[0]));
+	send_entry->msg_hdr.rma_iov_cnt = rma_count;
+
+	if (atomic_op != FI_ATOMIC_READ) {
+		ofi_ioc_to_iov(ioc, iov, count, dt_size);
+		ofi_copy_from_iov(send_entry->inject, len,
+				  iov, count, 0);
+		data_len = len;
+	}
+
+	if (op == ofi_op_atomic_compare) {
+		ofi_ioc_to_iov(compare_ioc, iov, compare_count, dt_size);
+		ofi_copy_from_iov(send_entry->inject + len, len,
+				  iov, compare_count, 0);
+		data_len += len;
+	}
+
+	tcpx_inject_iov(send_entry, data_len);
+	send_entry->msg_hdr.hdr.size =
+		htonll(data_len + sizeof(send_entry->msg_hdr));
+
+	send_entry->flags = flags | ofi_tx_cq_flags(op);
+
+	if (op != ofi_op_atomic) {
+		ofi_ioc_to_iov(result_ioc, send_entry->result_iov,
+			       result_count, dt_size);
+		send_entry->result_iov_cnt = result_count;
+		flags |= FI_DELIVERY_COMPLETE;
+	}
+
+	if (flags & (FI_TRANSMIT_COMPLETE | FI_DELIVERY_COMPLETE)) {
+		send_entry->flags &= ~FI_COMPLETION;
+		send_entry->msg_hdr.hdr.flags |= OFI_DELIVERY_COMPLETE;
+	}
+
+	if (flags & FI_COMMIT_COMPLETE) {
+		send_entry->flags &= ~FI_COMPLETION;
+		send_entry->msg_hdr.hdr.flags |= OFI_COMMIT_COMPLETE;
+	}
+
+	send_entry->msg_hdr.hdr.flags = htonl(send_entry->msg_hdr.hdr.flags);
+	send_entry->ep = tcpx_ep;
+	send_entry->context = context;
+	send_entry->done_len = 0;
+
+	fastlock_acquire(&tcpx_ep->lock);
+	tcpx_tx_queue_insert(tcpx_ep, send_entry);
+	fastlock_release(&tcpx_ep->lock);
+	return FI_SUCCESS;
+}
+
+static uint64_t tcpx_atomic_op_flags(struct fid_ep *ep, uint64_t flags)
+{
+	struct tcpx_ep *tcpx_ep;
+
+	tcpx_ep = container_of(ep, struct tcpx_ep, util_ep.ep_fid);
+	return (tcpx_ep->util_ep.tx_op_flags & FI_COMPLETION) | flags;
+}
+
+static ssize_t tcpx_atomic_writemsg(struct fid_ep *ep,
+				    const struct fi_msg_atomic *msg,
+				    uint64_t flags)
+{
+	return tcpx_atomic_generic(ep, msg->msg_iov, msg->iov_count,
+				   NULL, 0, NULL, 0, msg->rma_iov,
+				   msg->rma_iov_count, msg->datatype, msg->op,
+				   msg->context, tcpx_atomic_op_flags(ep, flags),
+				   ofi_op_atomic);
+}
+
+static ssize_t tcpx_atomic_writev(struct fid_ep *ep, const struct fi_ioc *iov,
+				  void **desc, size_t count,
+				  fi_addr_t dest_addr, uint64_t addr,
+				  uint64_t key, enum fi_datatype datatype,
+				  enum fi_op op, void *context)
+{
+	struct fi_rma_ioc rma_ioc = {
+		.addr = addr,
+		.count = ofi_total_ioc_cnt(iov, count),
+		.key = key,
+	};
+
+	return tcpx_atomic_generic(ep, iov, count, NULL, 0, NULL, 0,
+				   &rma_ioc, 1, datatype, op, context,
+				   tcpx_atomic_op_flags(ep, 0), ofi_op_atomic);
+}
+
+static ssize_t tcpx_atomic_write(struct fid_ep *ep, const void *buf,
+				 size_t count, void *desc,
+				 fi_addr_t dest_addr, uint64_t addr,
+				 uint64_t key, enum fi_datatype datatype,
+				 enum fi_op op, void *context)
+{
+	struct fi_ioc ioc = {
+		.addr = (void *) buf,
+		.count = count,
+	};
+
+	return tcpx_atomic_writev(ep, &ioc, &desc, 1, dest_addr, addr, key,
+				  datatype, op, context);
+}
+
+static ssize_t tcpx_atomic_inject(struct fid_ep *ep, const void *buf,
+				  size_t count, fi_addr_t dest_addr,
+				  uint64_t addr, uint64_t key,
+				  enum fi_datatype datatype, enum fi_op op)
+{
+	struct fi_ioc ioc = {
+		.addr = (void *) buf,
+		.count = count,
+	};
+	struct fi_rma_ioc rma_ioc = {
+		.addr = addr,
+		.count = count,
+		.key = key,
+	};
+
+	return tcpx_atomic_generic(ep, &ioc, 1, NULL, 0, NULL, 0,
+				   &rma_ioc, 1, datatype, op, NULL,
+				   FI_INJECT, ofi_op_atomic);
+}
+
+static ssize_t tcpx_atomic_readwritemsg(struct fid_ep *ep,
+					const struct fi_msg_atomic *msg,
+					struct fi_ioc *resultv,
+					void **result_desc,
+					size_t result_count, uint64_t flags)
+{
+	return tcpx_atomic_generic(ep, msg->msg_iov, msg->iov_count,
+				   NULL, 0, resultv, result_count,
+				   msg->rma_iov, msg->rma_iov_count,
+				   msg->datatype, msg->op, msg->context,
+				   tcpx_atomic_op_flags(ep, flags),
+				   ofi_op_atomic_fetch);
+}
+
+static ssize_t tcpx_atomic_readwritev(struct fid_ep *ep,
+				      const struct fi_ioc *iov, void **desc,
+				      size_t count, struct fi_ioc *resultv,
+				      void **result_desc, size_t result_count,
+				      fi_addr_t dest_addr, uint64_t addr,
+				      uint64_t key, enum fi_datatype datatype,
+				      enum fi_op op, void *context)
+{
+	struct fi_rma_ioc rma_ioc = {
+		.addr = addr,
+		.count = ofi_total_ioc_cnt(resultv, result_count),
+		.key = key,
+	};
+
+	return tcpx_atomic_generic(ep, iov, count, NULL, 0, resultv,
+				   result_count, &rma_ioc, 1, datatype, op,
+				   context, tcpx_atomic_op_flags(ep, 0),
+				   ofi_op_atomic_fetch);
+}
+
+static ssize_t tcpx_atomic_readwrite(struct fid_ep *ep, const void *buf,
+				     size_t count, void *desc, void *result,
+				     void *result_desc, fi_addr_t dest_addr,
+				     uint64_t addr, uint64_t key,
+				     enum fi_datatype datatype, enum fi_op op,
+				     void *context)
+{
+	struct fi_ioc ioc = {
+		.addr = (void *) buf,
+		.count = count,
+	};
+	struct fi_ioc resultv = {
+		.addr = result,
+		.count = count,
+	};
+
+	return tcpx_atomic_readwritev(ep, &ioc, &desc, 1, &resultv,
+				      &result_desc, 1, dest_addr, addr, key,
+				      datatype, op, context);
+}
+
+static ssize_t tcpx_atomic_compwritemsg(struct fid_ep *ep,
+					const struct fi_msg_atomic *msg,
+					const struct fi_ioc *comparev,
+					void **compare_desc,
+					size_t compare_count,
+					struct fi_ioc *resultv,
+					void **result_desc,
+					size_t result_count, uint64_t flags)
+{
+	return tcpx_atomic_generic(ep, msg->msg_iov, msg->iov_count,
+				   comparev, compare_count, resultv,
+				   result_count, msg->rma_iov,
+				   msg->rma_iov_count, msg->datatype, msg->op,
+				   msg->context, tcpx_atomic_op_flags(ep, flags),
+				   ofi_op_atomic_compare);
+}
+
+static ssize_t tcpx_atomic_compwritev(struct fid_ep *ep,
+				      const struct fi_ioc *iov, void **desc,
+				      size_t count,
+				      const struct fi_ioc *comparev,
+				      void **compare_desc,
+				      size_t compare_count,
+				      struct fi_ioc *resultv,
+				      void **result_desc, size_t result_count,
+				      fi_addr_t dest_addr, uint64_t addr,
+				      uint64_t key, enum fi_datatype datatype,
+				      enum fi_op op, void *context)
+{
+	struct fi_rma_ioc rma_ioc = {
+		.addr = addr,
+		.count = ofi_total_ioc_cnt(iov, count),
+		.key = key,
+	};
+
+	return tcpx_atomic_generic(ep, iov, count, comparev, compare_count,
+				   resultv, result_count, &rma_ioc, 1,
+				   datatype, op, context,
+				   tcpx_atomic_op_flags(ep, 0),
+				   ofi_op_atomic_compare);
+}
+
+static ssize_t tcpx_atomic_compwrite(struct fid_ep *ep, const void *buf,
+				     size_t count, void *desc,
+				     const void *compare, void *compare_desc,
+				     void *result, void *result_desc,
+				     fi_addr_t dest_addr, uint64_t addr,
+				     uint64_t key, enum fi_datatype datatype,
+				     enum fi_op op, void *context)
+{
+	struct fi_ioc ioc = {
+		.addr = (void *) buf,
+		.count = count,
+	};
+	struct fi_ioc comparev = {
+		.addr = (void *) compare,
+		.count = count,
+	};
+	struct fi_ioc resultv = {
+		.addr = result,
+		.count = count,
+	};
+
+	return tcpx_atomic_compwritev(ep, &ioc, &desc, 1, &comparev,
+				      &compare_desc, 1, &resultv,
+				      &result_desc, 1, dest_addr, addr, key,
+				      datatype, op, context);
+}
+
+int tcpx_query_atomic(struct fid_domain *domain, enum fi_datatype datatype,
+		      enum fi_op op, struct fi_atomic_attr *attr,
+		      uint64_t flags)
+{
+	int ret;
+
+	if (flags & FI_TAGGED) {
+		FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+			"tagged atomic op not supported\n");
+		return -FI_EINVAL;
+	}
+
+	ret = ofi_atomic_valid(&tcpx_prov, datatype, op, flags);
+	if (ret || !attr)
+		return ret;
+
+	attr->size = ofi_datatype_size(datatype);
+	attr->count = ((flags & FI_COMPARE_ATOMIC) ? TCPX_MAX_INJECT_SZ / 2 :
+		       TCPX_MAX_INJECT_SZ) / attr->size;
+	return FI_SUCCESS;
+}
+
+static int tcpx_atomic_valid(struct fid_ep *ep, enum fi_datatype datatype,
+			     enum fi_op op, size_t *count)
+{
+	struct fi_atomic_attr attr;
+	int ret;
+
+	ret = tcpx_query_atomic(NULL, datatype, op, &attr, 0);
+	if (!ret)
+		*count = attr.count;
+
+	return ret;
+}
+
+static int tcpx_atomic_fetch_valid(struct fid_ep *ep,
+				   enum fi_datatype datatype, enum fi_op op,
+				   size_t *count)
+{
+	struct fi_atomic_attr attr;
+	int ret;
+
+	ret = tcpx_query_atomic(NULL, datatype, op, &attr, FI_FETCH_ATOMIC);
+	if (!ret)
+		*count = attr.count;
+
+	return ret;
+}
+
+static int tcpx_atomic_comp_valid(struct fid_ep *ep,
+				  enum fi_datatype datatype, enum fi_op op,
+				  size_t *count)
+{
+	struct fi_atomic_attr attr;
+	int ret;
+
+	ret = tcpx_query_atomic(NULL, datatype, op, &attr, FI_COMPARE_ATOMIC);
+	if (!ret)
+		*count = attr.count;
+
+	return ret;
+}
+
+struct fi_ops_atomic tcpx_atomic_ops = {
+	.size = sizeof(struct fi_ops_atomic),
+	.write = tcpx_atomic_write,
+	.writev = tcpx_atomic_writev,
+	.writemsg = tcpx_atomic_writemsg,
+	.inject = tcpx_atomic_inject,
+	.readwrite = tcpx_atomic_readwrite,
+	.readwritev = tcpx_atomic_readwritev,
+	.readwritemsg = tcpx_atomic_readwritemsg,
+	.compwrite = tcpx_atomic_compwrite,
+	.compwritev = tcpx_atomic_compwritev,
+	.compwritemsg = tcpx_atomic_compwritemsg,
+	.writevalid = tcpx_atomic_valid,
+	.readwritevalid = tcpx_atomic_fetch_valid,
+	.compwritevalid = tcpx_atomic_comp_valid,
+};
@@ -34,7 +34,8 @@
 
 
 #define TCPX_DOMAIN_CAPS (FI_LOCAL_COMM | FI_REMOTE_COMM)
-#define TCPX_EP_CAPS	 (FI_MSG | FI_RMA | FI_RMA_PMEM)
+#define TCPX_EP_CAPS	 (FI_MSG | FI_TAGGED | FI_RMA | FI_ATOMIC | \
+			  FI_RMA_PMEM)
 #define TCPX_TX_CAPS	 (FI_SEND | FI_WRITE | FI_READ)
 #define TCPX_RX_CAPS	 (FI_RECV | FI_REMOTE_READ | FI_REMOTE_WRITE)
 
@@ -48,7 +49,7 @@ static struct fi_tx_attr tcpx_tx_attr = {
 	.caps = TCPX_EP_CAPS | TCPX_TX_CAPS,
 	.comp_order = FI_ORDER_STRICT,
 	.msg_order = TCPX_MSG_ORDER,
-	.inject_size = 64,
+	.inject_size = TCPX_MAX_INJECT_SZ,
 	.size = 1024,
 	.iov_limit = TCPX_IOV_LIMIT,
 	.rma_iov_limit = TCPX_IOV_LIMIT,
@@ -74,6 +75,17 @@ static struct fi_ep_attr tcpx_ep_attr = {
 	.max_order_waw_size = SIZE_MAX,
 };
 
+static struct fi_ep_attr tcpx_rdm_ep_attr = {
+	.type = FI_EP_RDM,
+	.protocol = FI_PROTO_SOCK_TCP,
+	.protocol_version = 0,
+	.max_msg_size = SIZE_MAX,
+	.tx_ctx_cnt = 1,
+	.rx_ctx_cnt = 1,
+	.max_order_raw_size = SIZE_MAX,
+	.max_order_waw_size = SIZE_MAX,
+};
+
 static struct fi_domain_attr tcpx_domain_attr = {
 	.name = "tcp",
 	.caps = TCPX_DOMAIN_CAPS,
@@ -99,7 +111,18 @@ static struct fi_fabric_attr tcpx_fabric_attr = {
 	.prov_version = FI_VERSION(TCPX_MAJOR_VERSION, TCPX_MINOR_VERSION),
 };
 
+static struct fi_info tcpx_rdm_info = {
+	.caps = TCPX_DOMAIN_CAPS | TCPX_EP_CAPS | TCPX_TX_CAPS | TCPX_RX_CAPS,
+	.addr_format = FI_SOCKADDR,
+	.tx_attr = &tcpx_tx_attr,
+	.rx_attr = &tcpx_rx_attr,
+	.ep_attr = &tcpx_rdm_ep_attr,
+	.domain_attr = &tcpx_domain_attr,
+	.fabric_attr = &tcpx_fabric_attr
+};
+
 struct fi_info tcpx_info = {
+	.next = &tcpx_rdm_info,
 	.caps = TCPX_DOMAIN_CAPS | TCPX_EP_CAPS | TCPX_TX_CAPS | TCPX_RX_CAPS,
 	.addr_format = FI_SOCKADDR,
 	.tx_attr = &tcpx_tx_attr,
@@ -37,19 +37,81 @@
 #include <ofi_iov.h>
 #include "tcpx.h"
 
+#if TCPX_HAVE_ZEROCOPY
+#include <linux/errqueue.h>
+
+int tcpx_recv_zc_notify(SOCKET sock, uint32_t *lo, uint32_t *hi,
+			bool *copied)
+{
+	char control[CMSG_SPACE(sizeof(struct sock_extended_err)) +
+		     CMSG_SPACE(sizeof(struct sockaddr_in6))];
+	struct sock_extended_err *serr;
+	struct msghdr msg = {0};
+	struct cmsghdr *cmsg;
+
+	for (;;) {
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			return -ofi_sockerr();
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (!(cmsg->cmsg_level == SOL_IP &&
+			      cmsg->cmsg_type == IP_RECVERR) &&
+			    !(cmsg->cmsg_level == SOL_IPV6 &&
+			      cmsg->cmsg_type == IPV6_RECVERR))
+				continue;
+
+			serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+			    serr->ee_errno)
+				continue;
+
+			*lo = serr->ee_info;
+			*hi = serr->ee_data;
+			*copied = !!(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+			return FI_SUCCESS;
+		}
+	}
+}
+#else
+int tcpx_recv_zc_notify(SOCKET sock, uint32_t *lo, uint32_t *hi,
+			bool *copied)
+{
+	return -FI_EAGAIN;
+}
+#endif
+
 int tcpx_send_msg(struct tcpx_xfer_entry *tx_entry)
 {
 	ssize_t bytes_sent;
 	struct msghdr msg = {0};
+	int zc_flags;
 
 	msg.msg_iov = tx_entry->msg_data.iov;
 	msg.msg_iovlen = tx_entry->msg_data.iov_cnt;
 
+	zc_flags = tcpx_zc_flags(tx_entry);
 	bytes_sent = ofi_sendmsg_tcp(tx_entry->ep->conn_fd,
-	                             &msg, MSG_NOSIGNAL);
+	                             &msg, MSG_NOSIGNAL | zc_flags);
+	if (bytes_sent < 0 && zc_flags && ofi_sockerr() == ENOBUFS) {
+		/* out of socket option memory to pin pages, copy instead */
+		zc_flags = 0;
+		bytes_sent = ofi_sendmsg_tcp(tx_entry->ep->conn_fd,
+					     &msg, MSG_NOSIGNAL);
+	}
 	if (bytes_sent < 0)
 		return ofi_sockerr() == EPIPE ? -FI_ENOTCONN : -ofi_sockerr();
 
+	if (zc_flags && bytes_sent) {
+		if (!tx_entry->zc_cnt)
+			tx_entry->zc_id = tx_entry->ep->zc_next_id;
+		tx_entry->zc_cnt++;
+		tx_entry->ep->zc_next_id++;
+		tx_entry->ep->zc_pend_cnt++;
+	}
+
 	tx_entry->done_len += bytes_sent;
 	if (tx_entry->done_len < ntohll(tx_entry->msg_hdr.hdr.size)) {
 		ofi_consume_iov(tx_entry->msg_data.iov,
@@ -60,102 +122,210 @@ int tcpx_send_msg(struct tcpx_xfer_entry *tx_entry)
 	return FI_SUCCESS;
 }
 
-static ssize_t tcpx_read_from_buffer(struct stage_buf *sbuf,
-				     uint8_t *buf, size_t len)
+/*
+ * Gathers the remaining data of the transfers at the head of the tx queue
+ * into iov.  Zero-copy transfers are sent on their own by tcpx_send_msg(),
+ * since their notification ids must not cover other transfers.
+ */
+size_t tcpx_tx_queue_iov(struct tcpx_ep *ep, struct iovec *iov,
+			 size_t iov_max)
 {
-	size_t rem_size;
-	ssize_t ret;
-
-	assert(sbuf->len >= sbuf->off);
-	rem_size = sbuf->len - sbuf->off;
-	assert(rem_size);
-	ret = (rem_size >= len)? len : rem_size;
-	memcpy(buf, &sbuf->buf[sbuf->off], ret);
-	sbuf->off += ret;
-	return ret;
+	struct tcpx_xfer_entry *tx_entry;
+	struct slist_entry *entry;
+	size_t iov_cnt = 0;
+
+	for (entry = ep->tx_queue.head; entry; entry = entry->next) {
+		tx_entry = container_of(entry, struct tcpx_xfer_entry, entry);
+		if (tcpx_zc_flags(tx_entry) ||
+		    iov_cnt + tx_entry->msg_data.iov_cnt > iov_max)
+			break;
+
+		memcpy(&iov[iov_cnt], tx_entry->msg_data.iov,
+		       tx_entry->msg_data.iov_cnt * sizeof(*iov));
+		iov_cnt += tx_entry->msg_data.iov_cnt;
+
+		if (entry == ep->tx_queue.tail)
+			break;
+	}
+	return iov_cnt;
 }
 
-int tcpx_recv_hdr(SOCKET sock, struct stage_buf *sbuf,
-		  struct tcpx_rx_detect *rx_detect)
+/* Sends the head of the tx queue with one sendmsg() call. */
+int tcpx_send_queued(struct tcpx_ep *ep, size_t *len)
 {
-	void *rem_buf;
-	size_t rem_len;
-	ssize_t bytes_recvd;
+	struct iovec iov[TCPX_TX_IOV_MAX];
+	struct msghdr msg = {0};
+	ssize_t bytes_sent;
 
-	rem_buf = (uint8_t *) &rx_detect->hdr + rx_detect->done_len;
-	rem_len = sizeof(rx_detect->hdr) - rx_detect->done_len;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = tcpx_tx_queue_iov(ep, iov, TCPX_TX_IOV_MAX);
+	bytes_sent = ofi_sendmsg_tcp(ep->conn_fd, &msg, MSG_NOSIGNAL);
+	if (bytes_sent < 0)
+		return ofi_sockerr() == EPIPE ? -FI_ENOTCONN : -ofi_sockerr();
+
+	*len = bytes_sent;
+	return FI_SUCCESS;
+}
+
+/*
+ * Describe the free space of the staging ring with up to two iovs.  An
+ * empty ring is rewound first, so that the next read lands contiguously.
+ */
+int tcpx_stage_free_iov(struct ofi_ringbuf *sbuf, struct iovec *iov)
+{
+	size_t avail, windex, endlen;
 
-	if (sbuf->len != sbuf->off) {
-		bytes_recvd = tcpx_read_from_buffer(sbuf, rem_buf, rem_len);
-	} else {
-		bytes_recvd = ofi_recv_socket(sock, rem_buf, rem_len, 0);
+	if (ofi_rbempty(sbuf))
+		ofi_rbreset(sbuf);
+
+	avail = ofi_rbavail(sbuf);
+	if (!avail)
+		return 0;
+
+	windex = sbuf->wpos & sbuf->size_mask;
+	endlen = sbuf->size - windex;
+	iov[0].iov_base = (uint8_t *) sbuf->buf + windex;
+	if (avail <= endlen) {
+		iov[0].iov_len = avail;
+		return 1;
 	}
-	if (bytes_recvd <= 0)
-		return (bytes_recvd)? -ofi_sockerr(): -FI_ENOTCONN;
 
-	rx_detect->done_len += bytes_recvd;
-	return (rem_len == bytes_recvd)? FI_SUCCESS : -FI_EAGAIN;
+	iov[0].iov_len = endlen;
+	iov[1].iov_base = sbuf->buf;
+	iov[1].iov_len = avail - endlen;
+	return 2;
 }
 
-static ssize_t tcpx_readv_from_buffer(struct stage_buf *sbuf,
-				      struct iovec *iov,
-				      int iov_cnt)
+void tcpx_stage_commit(struct ofi_ringbuf *sbuf, size_t len)
 {
-	ssize_t ret = 0;
-	size_t bytes_read;
-	int i;
-
-	if (iov_cnt == 1)
-		return tcpx_read_from_buffer(sbuf, iov[0].iov_base,
-					     iov[0].iov_len);
-
-	for (i = 0; i < iov_cnt; i++) {
-		bytes_read = tcpx_read_from_buffer(sbuf, iov[i].iov_base,
-						   iov[i].iov_len);
-		ret += bytes_read;
-		if ((bytes_read < iov[i].iov_len) ||
-		    !(sbuf->len - sbuf->off))
-			break;
+	sbuf->wpos += len;
+	ofi_rbcommit(sbuf);
+}
+
+size_t tcpx_readv_from_buffer(struct ofi_ringbuf *sbuf, struct iovec *iov,
+			      int iov_cnt, size_t len)
+{
+	size_t rindex, endlen, copied;
+
+	len = MIN(len, ofi_rbused(sbuf));
+	rindex = sbuf->rcnt & sbuf->size_mask;
+	endlen = sbuf->size - rindex;
+	copied = ofi_copy_to_iov(iov, iov_cnt, 0,
+				 (uint8_t *) sbuf->buf + rindex,
+				 MIN(len, endlen));
+	if (copied < len)
+		copied += ofi_copy_to_iov(iov, iov_cnt, copied, sbuf->buf,
+					  len - copied);
+	sbuf->rcnt += copied;
+	return copied;
+}
+
+/*
+ * With io_uring, the socket is only read by the receive submitted from
+ * tcpx_ep_progress(), and headers are taken from the staging ring alone.
+ */
+int tcpx_recv_hdr(struct tcpx_ep *ep)
+{
+	struct tcpx_rx_detect *rx_detect = &ep->rx_detect;
+	struct ofi_ringbuf *sbuf = &ep->stage_buf;
+	void *rem_buf;
+	size_t rem_len;
+	int ret;
+
+	rem_buf = (uint8_t *) &rx_detect->hdr + rx_detect->done_len;
+	rem_len = sizeof(rx_detect->hdr) - rx_detect->done_len;
+	if (!rem_len)
+		return FI_SUCCESS;
+
+	if (ep->uring) {
+		if (ofi_rbempty(sbuf))
+			return -FI_EAGAIN;
+	} else if (ofi_rbused(sbuf) < rem_len) {
+		ret = tcpx_read_to_buffer(ep->conn_fd, sbuf);
+		if (ret && ofi_rbempty(sbuf))
+			return ret;
 	}
-	return ret;
+
+	rem_len = MIN(rem_len, ofi_rbused(sbuf));
+	ofi_rbread(sbuf, rem_buf, rem_len);
+	rx_detect->done_len += rem_len;
+	return (rx_detect->done_len == sizeof(rx_detect->hdr)) ?
+		FI_SUCCESS : -FI_EAGAIN;
 }
 
+/*
+ * Payload bytes that arrived in the staging ring together with the header
+ * are copied out of it.  The rest is read straight into the posted buffer,
+ * with the free space of the ring appended to the same readv, so that the
+ * headers that follow the payload are picked up by the same system call.
+ */
 int tcpx_recv_msg_data(struct tcpx_xfer_entry *rx_entry)
 {
+	struct ofi_ringbuf *sbuf = &rx_entry->ep->stage_buf;
+	struct iovec iov[TCPX_IOV_LIMIT + 3];
 	ssize_t bytes_recvd;
+	size_t rem_len, iov_cnt;
+
+	rem_len = ntohll(rx_entry->msg_hdr.hdr.size) - rx_entry->done_len;
+	if (!rem_len)
+		return FI_SUCCESS;
+
+	if (!ofi_rbempty(sbuf)) {
+		bytes_recvd = tcpx_readv_from_buffer(sbuf,
+						     rx_entry->msg_data.iov,
+						     rx_entry->msg_data.iov_cnt,
+						     rem_len);
+		rx_entry->done_len += bytes_recvd;
+		rem_len -= bytes_recvd;
+		if (!rem_len)
+			return FI_SUCCESS;
 
-	if (rx_entry->ep->stage_buf.len != rx_entry->ep->stage_buf.off) {
-		bytes_recvd = tcpx_readv_from_buffer(&rx_entry->ep->stage_buf,
-						rx_entry->msg_data.iov,
-						rx_entry->msg_data.iov_cnt);
-	 }else {
-		bytes_recvd = ofi_readv_socket(rx_entry->ep->conn_fd,
-					       rx_entry->msg_data.iov,
-					       rx_entry->msg_data.iov_cnt);
+		ofi_consume_iov(rx_entry->msg_data.iov,
+				&rx_entry->msg_data.iov_cnt, bytes_recvd);
 	}
+
+	if (rx_entry->ep->uring)
+		return -FI_EAGAIN;
+
+	iov_cnt = rx_entry->msg_data.iov_cnt;
+	memcpy(iov, rx_entry->msg_data.iov, iov_cnt * sizeof(*iov));
+	ofi_truncate_iov(iov, &iov_cnt, rem_len);
+	rem_len = ofi_total_iov_len(iov, iov_cnt);
+	iov_cnt += tcpx_stage_free_iov(sbuf, &iov[iov_cnt]);
+
+	bytes_recvd = ofi_readv_socket(rx_entry->ep->conn_fd, iov, iov_cnt);
 	if (bytes_recvd <= 0)
 		return (bytes_recvd)? -ofi_sockerr(): -FI_ENOTCONN;
 
-	rx_entry->done_len += bytes_recvd;
-	if (rx_entry->done_len < ntohll(rx_entry->msg_hdr.hdr.size)) {
-		ofi_consume_iov(rx_entry->msg_data.iov,
-				&rx_entry->msg_data.iov_cnt,
-				bytes_recvd);
-		return -FI_EAGAIN;
+	if ((size_t) bytes_recvd > rem_len) {
+		tcpx_stage_commit(sbuf, bytes_recvd - rem_len);
+		bytes_recvd = rem_len;
 	}
-	return FI_SUCCESS;
+
+	rx_entry->done_len += bytes_recvd;
+	if (rx_entry->done_len == ntohll(rx_entry->msg_hdr.hdr.size))
+		return FI_SUCCESS;
+
+	ofi_consume_iov(rx_entry->msg_data.iov, &rx_entry->msg_data.iov_cnt,
+			bytes_recvd);
+	return -FI_EAGAIN;
 }
 
-int tcpx_read_to_buffer(SOCKET sock, struct stage_buf *stage_buf)
+/* Read as much as the socket holds into the free space of the ring. */
+int tcpx_read_to_buffer(SOCKET sock, struct ofi_ringbuf *sbuf)
 {
-	int bytes_recvd;
+	struct iovec iov[2];
+	ssize_t bytes_recvd;
+	int iov_cnt;
+
+	iov_cnt = tcpx_stage_free_iov(sbuf, iov);
+	if (!iov_cnt)
+		return FI_SUCCESS;
 
-	bytes_recvd = ofi_recv_socket(sock, stage_buf->buf,
-				      stage_buf->size, 0);
+	bytes_recvd = ofi_readv_socket(sock, iov, iov_cnt);
 	if (bytes_recvd <= 0)
 		return (bytes_recvd)? -ofi_sockerr(): -FI_ENOTCONN;
 
-	stage_buf->len = bytes_recvd;
-	stage_buf->off = 0;
+	tcpx_stage_commit(sbuf, bytes_recvd);
 	return FI_SUCCESS;
 }
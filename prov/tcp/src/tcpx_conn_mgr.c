@@ -81,7 +81,8 @@ static int rx_cm_data(SOCKET fd, struct ofi_ctrl_hdr *hdr,
 	return ret;
 }
 
-static int tx_cm_data(SOCKET fd, uint8_t type, struct tcpx_cm_context *cm_ctx)
+static int tx_cm_data(SOCKET fd, uint8_t type, struct tcpx_cm_context *cm_ctx,
+		      uint64_t conn_data)
 {
 	struct ofi_ctrl_hdr hdr;
 	ssize_t ret;
@@ -90,6 +91,7 @@ static int tx_cm_data(SOCKET fd, uint8_t type, struct tcpx_cm_context *cm_ctx)
 	hdr.version = OFI_CTRL_VERSION;
 	hdr.type = type;
 	hdr.seg_size = htons((uint16_t) cm_ctx->cm_data_sz);
+	hdr.conn_data = htonll(conn_data);
 
 	ret = ofi_send_socket(fd, &hdr, sizeof(hdr), MSG_NOSIGNAL);
 	if (ret != sizeof(hdr))
@@ -133,6 +135,7 @@ static int proc_conn_resp(struct tcpx_cm_context *cm_ctx,
 {
 	struct ofi_ctrl_hdr conn_resp;
 	struct fi_eq_cm_entry *cm_entry;
+	uint64_t stripe_data;
 	ssize_t len;
 	int ret = FI_SUCCESS;
 
@@ -140,6 +143,14 @@ static int proc_conn_resp(struct tcpx_cm_context *cm_ctx,
 	if (ret)
 		return ret;
 
+	/* the stripe count granted, and the port to connect them to */
+	stripe_data = ntohll(conn_resp.conn_data);
+	if ((uint32_t) stripe_data && (uint32_t) stripe_data <= ep->stripe_req &&
+	    tcpx_stripe_connect(ep, (uint32_t) stripe_data,
+				(uint16_t) (stripe_data >> 32)))
+		FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+			"cannot connect stripe sockets, not striping\n");
+
 	cm_entry = calloc(1, sizeof(*cm_entry) + cm_ctx->cm_data_sz);
 	if (!cm_entry)
 		return -FI_ENOMEM;
@@ -220,12 +231,24 @@ static void server_send_cm_accept(struct util_wait *wait,
 	struct fi_eq_cm_entry cm_entry = {0};
 	struct fi_eq_err_entry err_entry;
 	struct tcpx_ep *ep;
+	uint64_t stripe_data = 0;
+	uint16_t port;
+	size_t cnt;
 	int ret;
 
 	assert(cm_ctx->fid->fclass == FI_CLASS_EP);
 	ep = container_of(cm_ctx->fid, struct tcpx_ep, util_ep.ep_fid.fid);
 
-	ret = tx_cm_data(ep->conn_fd, ofi_ctrl_connresp, cm_ctx);
+	cnt = ep->uring ? 0 : MIN(ep->stripe_req, tcpx_stripe_cnt);
+	if (cnt) {
+		if (!tcpx_stripe_listen(ep, cnt, &port))
+			stripe_data = ((uint64_t) port << 32) | cnt;
+		else
+			FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+				"cannot listen for stripe sockets\n");
+	}
+
+	ret = tx_cm_data(ep->conn_fd, ofi_ctrl_connresp, cm_ctx, stripe_data);
 	if (ret)
 		goto err;
 
@@ -279,6 +302,8 @@ static void server_recv_connreq(struct util_wait *wait,
 	if (ret)
 		goto err1;
 
+	handle->stripe_cnt = MIN(ntohll(conn_req.conn_data), TCPX_STRIPE_MAX);
+
 	cm_entry = calloc(1, sizeof(*cm_entry) + cm_ctx->cm_data_sz);
 	if (!cm_entry)
 		goto err1;
@@ -336,7 +361,8 @@ static void client_send_connreq(struct util_wait *wait,
 		goto err;
 	}
 
-	ret = tx_cm_data(ep->conn_fd, ofi_ctrl_connreq, cm_ctx);
+	ret = tx_cm_data(ep->conn_fd, ofi_ctrl_connreq, cm_ctx,
+			 ep->stripe_req);
 	if (ret)
 		goto err;
 
@@ -80,6 +80,8 @@ struct tcpx_xfer_entry *tcpx_xfer_entry_alloc(struct tcpx_cq *tcpx_cq,
 		return NULL;
 	}
 	tcpx_cq->util_cq.cq_fastlock_release(&tcpx_cq->util_cq.cq_lock);
+	xfer_entry->zc_cnt = 0;
+	xfer_entry->zc_done = 0;
 	return xfer_entry;
 }
 
@@ -100,17 +102,25 @@ void tcpx_cq_report_completion(struct util_cq *cq,
 			       int err)
 {
 	struct fi_cq_err_entry err_entry;
+	uint64_t tag = 0;
+	size_t len = 0;
 
 	if (!(xfer_entry->flags & FI_COMPLETION))
 		return;
 
+	if (xfer_entry->flags & FI_RECV) {
+		len = xfer_entry->done_len - sizeof(xfer_entry->msg_hdr);
+		if (xfer_entry->flags & FI_TAGGED)
+			tag = ntohll(xfer_entry->msg_hdr.hdr.tag);
+	}
+
 	if (err) {
 		err_entry.op_context = xfer_entry->context;
 		err_entry.flags = xfer_entry->flags;
 		err_entry.len = 0;
 		err_entry.buf = NULL;
 		err_entry.data = ntohll(xfer_entry->msg_hdr.hdr.data);
-		err_entry.tag = 0;
+		err_entry.tag = tag;
 		err_entry.olen = 0;
 		err_entry.err = err;
 		err_entry.prov_errno = ofi_sockerr();
@@ -120,11 +130,11 @@ void tcpx_cq_report_completion(struct util_cq *cq,
 		ofi_cq_write_error(cq, &err_entry);
 	} else {
 		ofi_cq_write(cq, xfer_entry->context,
-			     xfer_entry->flags, 0, NULL,
-			     ntohll(xfer_entry->msg_hdr.hdr.data), 0);
+			     xfer_entry->flags, len, NULL,
+			     ntohll(xfer_entry->msg_hdr.hdr.data), tag);
 
 		if (cq->wait)
-			ofi_cq_signal(&cq->cq_fid);
+			cq->wait->signal(cq->wait);
 	}
 }
 
@@ -196,6 +206,14 @@ static int tcpx_buf_pool_init(void *pool_ctx, void *addr,
 			break;
 		case TCPX_OP_REMOTE_READ:
 			break;
+		case TCPX_OP_ATOMIC:
+			xfer_entry->msg_hdr.hdr.op = ofi_op_atomic;
+			break;
+		case TCPX_OP_REMOTE_ATOMIC:
+			break;
+		case TCPX_OP_TAGGED_SEND:
+			xfer_entry->msg_hdr.hdr.op = ofi_op_tagged;
+			break;
 		default:
 			assert(0);
 			break;
@@ -204,6 +222,22 @@ static int tcpx_buf_pool_init(void *pool_ctx, void *addr,
 	return FI_SUCCESS;
 }
 
+/* Entries of these pools may carry up to TCPX_MAX_INJECT_SZ bytes inline */
+static size_t tcpx_buf_pool_entry_size(enum tcpx_xfer_op_codes op_type)
+{
+	switch (op_type) {
+	case TCPX_OP_MSG_SEND:
+	case TCPX_OP_MSG_RESP:
+	case TCPX_OP_WRITE:
+	case TCPX_OP_ATOMIC:
+	case TCPX_OP_REMOTE_ATOMIC:
+	case TCPX_OP_TAGGED_SEND:
+		return sizeof(struct tcpx_xfer_entry) + TCPX_MAX_INJECT_SZ;
+	default:
+		return sizeof(struct tcpx_xfer_entry);
+	}
+}
+
 static int tcpx_buf_pools_create(struct tcpx_buf_pool *buf_pools)
 {
 	int i, ret;
@@ -212,7 +246,7 @@ static int tcpx_buf_pools_create(struct tcpx_buf_pool *buf_pools)
 		buf_pools[i].op_type = i;
 
 		ret = util_buf_pool_create_ex(&buf_pools[i].pool,
-					      sizeof(struct tcpx_xfer_entry),
+					      tcpx_buf_pool_entry_size(i),
 					      16, 0, 1024, tcpx_buf_pool_init,
 					      NULL, &buf_pools[i]);
 		if (ret) {
@@ -247,7 +281,7 @@ int tcpx_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 		goto free_cq;
 
 	ret = ofi_cq_init(&tcpx_prov, domain, attr, &tcpx_cq->util_cq,
-			  &ofi_cq_progress, context);
+			  &tcpx_cq_progress, context);
 	if (ret)
 		goto destroy_pool;
 
@@ -110,7 +110,7 @@ static struct fi_ops_domain tcpx_domain_ops = {
 	.poll_open = fi_poll_create,
 	.stx_ctx = fi_no_stx_context,
 	.srx_ctx = tcpx_srx_ctx,
-	.query_atomic = fi_no_query_atomic,
+	.query_atomic = tcpx_query_atomic,
 };
 
 static int tcpx_domain_close(fid_t fid)
@@ -125,6 +125,10 @@ static int tcpx_domain_close(fid_t fid)
 	if (ret)
 		return ret;
 
+#if HAVE_TCP_IO_URING
+	if (tcpx_domain->uring)
+		tcpx_uring_close(tcpx_domain->uring);
+#endif
 	free(tcpx_domain);
 	return 0;
 }
@@ -144,6 +148,27 @@ static struct fi_ops_mr tcpx_domain_fi_ops_mr = {
 	.regattr = ofi_mr_regattr,
 };
 
+/* Falls back to epoll if the ring cannot be set up. */
+static void tcpx_domain_uring_init(struct tcpx_domain *domain)
+{
+#if HAVE_TCP_IO_URING
+	int ret;
+
+	if (!tcpx_io_uring)
+		return;
+
+	ret = tcpx_uring_open(&domain->uring);
+	if (ret)
+		FI_WARN(&tcpx_prov, FI_LOG_DOMAIN,
+			"io_uring setup failed, using epoll: %s\n",
+			fi_strerror(-ret));
+#else
+	if (tcpx_io_uring)
+		FI_INFO(&tcpx_prov, FI_LOG_DOMAIN,
+			"built without io_uring support, using epoll\n");
+#endif
+}
+
 int tcpx_domain_open(struct fid_fabric *fabric, struct fi_info *info,
 		     struct fid_domain **domain, void *context)
 {
@@ -162,6 +187,8 @@ int tcpx_domain_open(struct fid_fabric *fabric, struct fi_info *info,
 	if (ret)
 		goto err;
 
+	tcpx_domain_uring_init(tcpx_domain);
+
 	*domain = &tcpx_domain->util_domain.domain_fid;
 	(*domain)->fid.ops = &tcpx_domain_fi_ops;
 	(*domain)->ops = &tcpx_domain_ops;
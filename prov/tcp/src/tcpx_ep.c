@@ -49,8 +49,6 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 
-extern struct fi_ops_rma tcpx_rma_ops;
-
 static inline struct tcpx_xfer_entry *
 tcpx_alloc_recv_entry(struct tcpx_ep *tcpx_ep)
 {
@@ -196,13 +194,10 @@ static ssize_t tcpx_sendmsg(struct fid_ep *ep, const struct fi_msg *msg,
 
 	if (flags & FI_INJECT) {
 		ofi_copy_iov_buf(msg->msg_iov, msg->iov_count, 0,
-				 tx_entry->msg_data.inject,
+				 tx_entry->inject,
 				 data_len,
 				 OFI_COPY_IOV_TO_BUF);
-
-		tx_entry->msg_data.iov[1].iov_base = (void *)tx_entry->msg_data.inject;
-		tx_entry->msg_data.iov[1].iov_len = data_len;
-		tx_entry->msg_data.iov_cnt = 2;
+		tcpx_inject_iov(tx_entry, data_len);
 	} else {
 		memcpy(&tx_entry->msg_data.iov[1], &msg->msg_iov[0],
 		       msg->iov_count * sizeof(struct iovec));
@@ -308,14 +303,9 @@ static ssize_t tcpx_inject(struct fid_ep *ep, const void *buf, size_t len,
 	if (!tx_entry)
 		return -FI_EAGAIN;
 
-	assert(len <= TCPX_MAX_INJECT_SZ);
 	tx_entry->msg_hdr.hdr.size = htonll(len + sizeof(tx_entry->msg_hdr));
-	tx_entry->msg_data.iov[0].iov_base = (void *) &tx_entry->msg_hdr;
-	tx_entry->msg_data.iov[0].iov_len = sizeof(tx_entry->msg_hdr);
-	memcpy(tx_entry->msg_data.inject, (char *) buf, len);
-	tx_entry->msg_data.iov[1].iov_base = (void *)tx_entry->msg_data.inject;
-	tx_entry->msg_data.iov[1].iov_len = len;
-	tx_entry->msg_data.iov_cnt = 2;
+	memcpy(tx_entry->inject, (char *) buf, len);
+	tcpx_inject_iov(tx_entry, len);
 
 	tx_entry->msg_hdr.hdr.flags = 0;
 	tx_entry->flags = FI_MSG | FI_SEND;
@@ -370,15 +360,9 @@ static ssize_t tcpx_injectdata(struct fid_ep *ep, const void *buf, size_t len,
 	if (!tx_entry)
 		return -FI_EAGAIN;
 
-	assert(len <= TCPX_MAX_INJECT_SZ);
 	tx_entry->msg_hdr.hdr.size = htonll(len + sizeof(tx_entry->msg_hdr));
-
-	tx_entry->msg_data.iov[0].iov_base = (void *) &tx_entry->msg_hdr;
-	tx_entry->msg_data.iov[0].iov_len = sizeof(tx_entry->msg_hdr);
-	memcpy(tx_entry->msg_data.inject, (char *) buf, len);
-	tx_entry->msg_data.iov[1].iov_base = (void *)tx_entry->msg_data.inject;
-	tx_entry->msg_data.iov[1].iov_len = len;
-	tx_entry->msg_data.iov_cnt = 2;
+	memcpy(tx_entry->inject, (char *) buf, len);
+	tcpx_inject_iov(tx_entry, len);
 
 	tx_entry->msg_hdr.hdr.flags = htonl(OFI_REMOTE_CQ_DATA);
 	tx_entry->msg_hdr.hdr.data = htonll(data);
@@ -390,7 +374,7 @@ static ssize_t tcpx_injectdata(struct fid_ep *ep, const void *buf, size_t len,
 	return FI_SUCCESS;
 }
 
-static struct fi_ops_msg tcpx_msg_ops = {
+struct fi_ops_msg tcpx_msg_ops = {
 	.size = sizeof(struct fi_ops_msg),
 	.recv = tcpx_recv,
 	.recvv = tcpx_recvv,
@@ -403,7 +387,32 @@ static struct fi_ops_msg tcpx_msg_ops = {
 	.injectdata = tcpx_injectdata,
 };
 
-static int tcpx_setup_socket(SOCKET sock)
+/*
+ * Raising SO_BUSY_POLL above net.core.busy_read requires CAP_NET_ADMIN,
+ * so failures only disable kernel busy polling on the socket.
+ */
+static void tcpx_setup_busy_poll(SOCKET sock)
+{
+#ifdef SO_BUSY_POLL
+	int optval = (int) tcpx_busy_poll;
+
+	if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, (char *) &optval,
+		       sizeof(optval))) {
+		FI_INFO(&tcpx_prov, FI_LOG_EP_CTRL,
+			"setsockopt busy poll failed\n");
+		return;
+	}
+#ifdef SO_PREFER_BUSY_POLL
+	optval = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+		       (char *) &optval, sizeof(optval)))
+		FI_INFO(&tcpx_prov, FI_LOG_EP_CTRL,
+			"setsockopt prefer busy poll failed\n");
+#endif
+#endif
+}
+
+int tcpx_setup_socket(SOCKET sock)
 {
 	int ret, optval = 1;
 
@@ -421,9 +430,30 @@ static int tcpx_setup_socket(SOCKET sock)
 		return ret;
 	}
 
+	if (tcpx_busy_poll)
+		tcpx_setup_busy_poll(sock);
+
 	return ret;
 }
 
+void tcpx_ep_zerocopy_init(struct tcpx_ep *ep)
+{
+#if TCPX_HAVE_ZEROCOPY
+	int optval = 1;
+
+	if (!tcpx_zerocopy_size)
+		return;
+
+	if (setsockopt(ep->conn_fd, SOL_SOCKET, SO_ZEROCOPY,
+		       (char *) &optval, sizeof(optval))) {
+		FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+			"setsockopt zerocopy failed\n");
+		return;
+	}
+	ep->zc_enabled = true;
+#endif
+}
+
 static int tcpx_ep_connect(struct fid_ep *ep, const void *addr,
 			   const void *param, size_t paramlen)
 {
@@ -450,6 +480,9 @@ static int tcpx_ep_connect(struct fid_ep *ep, const void *addr,
 
 	cm_ctx->fid = &tcpx_ep->util_ep.ep_fid.fid;
 	cm_ctx->type = CLIENT_SEND_CONNREQ;
+	/* io_uring progresses the primary socket only */
+	if (!tcpx_ep->uring)
+		tcpx_ep->stripe_req = MIN(tcpx_stripe_cnt, TCPX_STRIPE_MAX);
 
 	if (paramlen) {
 		cm_ctx->cm_data_sz = paramlen;
@@ -608,7 +641,7 @@ static struct fi_ops_cm tcpx_cm_ops = {
 	.join = fi_no_join,
 };
 
-static void tcpx_ep_tx_rx_queues_release(struct tcpx_ep *ep)
+void tcpx_ep_tx_rx_queues_release(struct tcpx_ep *ep)
 {
 	struct slist_entry *entry;
 	struct tcpx_xfer_entry *xfer_entry;
@@ -642,6 +675,24 @@ static void tcpx_ep_tx_rx_queues_release(struct tcpx_ep *ep)
 		tcpx_xfer_entry_release(tcpx_cq, xfer_entry);
 	}
 
+	while (!ofi_match_queue_empty(&ep->trecv_queue)) {
+		xfer_entry = container_of(ep->trecv_queue.list.next,
+					  struct tcpx_xfer_entry,
+					  match.list_entry);
+		ofi_match_remove(&xfer_entry->match);
+		tcpx_cq = container_of(xfer_entry->ep->util_ep.rx_cq,
+				       struct tcpx_cq, util_cq);
+		tcpx_xfer_entry_release(tcpx_cq, xfer_entry);
+	}
+
+	while (!ofi_match_queue_empty(&ep->unexp_queue)) {
+		xfer_entry = container_of(ep->unexp_queue.list.next,
+					  struct tcpx_xfer_entry,
+					  match.list_entry);
+		ofi_match_remove(&xfer_entry->match);
+		tcpx_unexp_free(xfer_entry);
+	}
+
 	while (!slist_empty(&ep->tx_rsp_pend_queue)) {
 		entry = ep->tx_rsp_pend_queue.head;
 		xfer_entry = container_of(entry, struct tcpx_xfer_entry, entry);
@@ -651,6 +702,15 @@ static void tcpx_ep_tx_rx_queues_release(struct tcpx_ep *ep)
 		tcpx_xfer_entry_release(tcpx_cq, xfer_entry);
 	}
 
+	while (!slist_empty(&ep->tx_zc_queue)) {
+		entry = ep->tx_zc_queue.head;
+		xfer_entry = container_of(entry, struct tcpx_xfer_entry, entry);
+		slist_remove_head(&ep->tx_zc_queue);
+		tcpx_cq = container_of(xfer_entry->ep->util_ep.tx_cq,
+				       struct tcpx_cq, util_cq);
+		tcpx_xfer_entry_release(tcpx_cq, xfer_entry);
+	}
+
 	fastlock_release(&ep->lock);
 }
 
@@ -659,12 +719,25 @@ static int tcpx_ep_close(struct fid *fid)
 	struct tcpx_ep *ep = container_of(fid, struct tcpx_ep,
 					  util_ep.ep_fid.fid);
 
+#if HAVE_TCP_IO_URING
+	if (ep->uring) {
+		/* the kernel must be done with the buffers released below */
+		fastlock_acquire(&ep->lock);
+		tcpx_uring_cancel(ep->uring, &ep->uring_rx);
+		tcpx_uring_cancel(ep->uring, &ep->uring_tx);
+		fastlock_release(&ep->lock);
+	}
+#endif
 	tcpx_ep_tx_rx_queues_release(ep);
 	tcpx_cq_wait_ep_del(ep);
 	if (ep->util_ep.eq->wait)
 		ofi_wait_fd_del(ep->util_ep.eq->wait, ep->conn_fd);
 
 	ofi_close_socket(ep->conn_fd);
+	tcpx_stripe_close(ep);
+	ofi_match_queue_close(&ep->trecv_queue);
+	ofi_match_queue_close(&ep->unexp_queue);
+	ofi_rbfree(&ep->stage_buf);
 	ofi_endpoint_close(&ep->util_ep);
 	fastlock_destroy(&ep->lock);
 
@@ -754,6 +827,9 @@ int tcpx_endpoint(struct fid_domain *domain, struct fi_info *info,
 	struct tcpx_conn_handle *handle;
 	int ret;
 
+	if (info->ep_attr && info->ep_attr->type == FI_EP_RDM)
+		return tcpx_rdm_endpoint(domain, info, ep_fid, context);
+
 	ep = calloc(1, sizeof(*ep));
 	if (!ep)
 		return -FI_ENOMEM;
@@ -763,6 +839,8 @@ int tcpx_endpoint(struct fid_domain *domain, struct fi_info *info,
 	if (ret)
 		goto err1;
 
+	ep->max_msg_size = info->ep_attr->max_msg_size;
+
 	if (info->handle) {
 		if (((fid_t) info->handle)->fclass == FI_CLASS_PEP) {
 			pep = container_of(info->handle, struct tcpx_pep,
@@ -774,6 +852,7 @@ int tcpx_endpoint(struct fid_domain *domain, struct fi_info *info,
 			handle = container_of(info->handle,
 					      struct tcpx_conn_handle, handle);
 			ep->conn_fd = handle->conn_fd;
+			ep->stripe_req = handle->stripe_cnt;
 			free(handle);
 
 			ret = tcpx_setup_socket(ep->conn_fd);
@@ -798,14 +877,28 @@ int tcpx_endpoint(struct fid_domain *domain, struct fi_info *info,
 	if (ret)
 		goto err3;
 
-	ep->stage_buf.size = STAGE_BUF_SIZE;
-	ep->stage_buf.len = 0;
-	ep->stage_buf.off = 0;
+	ret = ofi_rbinit(&ep->stage_buf, STAGE_BUF_SIZE);
+	if (ret)
+		goto err4;
 
 	slist_init(&ep->rx_queue);
 	slist_init(&ep->tx_queue);
 	slist_init(&ep->rma_read_queue);
 	slist_init(&ep->tx_rsp_pend_queue);
+	slist_init(&ep->tx_zc_queue);
+	ep->uring = container_of(domain, struct tcpx_domain,
+				 util_domain.domain_fid)->uring;
+	/* io_uring sends do not track zero-copy notifications */
+	if (!ep->uring)
+		tcpx_ep_zerocopy_init(ep);
+
+	ret = ofi_match_queue_init(&ep->trecv_queue, info->rx_attr->size);
+	if (ret)
+		goto err5;
+
+	ret = ofi_match_queue_init(&ep->unexp_queue, info->rx_attr->size);
+	if (ret)
+		goto err6;
 
 	*ep_fid = &ep->util_ep.ep_fid;
 	(*ep_fid)->fid.ops = &tcpx_ep_fi_ops;
@@ -813,13 +906,25 @@ int tcpx_endpoint(struct fid_domain *domain, struct fi_info *info,
 	(*ep_fid)->cm = &tcpx_cm_ops;
 	(*ep_fid)->msg = &tcpx_msg_ops;
 	(*ep_fid)->rma = &tcpx_rma_ops;
+	(*ep_fid)->atomic = &tcpx_atomic_ops;
+	(*ep_fid)->tagged = &tcpx_tagged_ops;
 
 	ep->get_rx_entry[ofi_op_msg] = tcpx_get_rx_entry_op_msg;
-	ep->get_rx_entry[ofi_op_tagged] = tcpx_get_rx_entry_op_invalid;
+	ep->get_rx_entry[ofi_op_tagged] = tcpx_get_rx_entry_op_tagged;
 	ep->get_rx_entry[ofi_op_read_req] = tcpx_get_rx_entry_op_read_req;
 	ep->get_rx_entry[ofi_op_read_rsp] = tcpx_get_rx_entry_op_read_rsp;
 	ep->get_rx_entry[ofi_op_write] =tcpx_get_rx_entry_op_write;
+	ep->get_rx_entry[ofi_op_write_rsp] = tcpx_get_rx_entry_op_invalid;
+	ep->get_rx_entry[ofi_op_atomic] = tcpx_get_rx_entry_op_atomic;
+	ep->get_rx_entry[ofi_op_atomic_fetch] = tcpx_get_rx_entry_op_atomic;
+	ep->get_rx_entry[ofi_op_atomic_compare] = tcpx_get_rx_entry_op_atomic;
 	return 0;
+err6:
+	ofi_match_queue_close(&ep->trecv_queue);
+err5:
+	ofi_rbfree(&ep->stage_buf);
+err4:
+	fastlock_destroy(&ep->lock);
 err3:
 	ofi_close_socket(ep->conn_fd);
 err2:
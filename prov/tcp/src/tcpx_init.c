@@ -40,22 +40,24 @@
 #include <net/if.h>
 #include <ofi_util.h>
 
+size_t tcpx_zerocopy_size;
+int tcpx_io_uring;
+size_t tcpx_stripe_cnt;
+size_t tcpx_stripe_size = 1 << 20;
+size_t tcpx_busy_poll;
+size_t tcpx_busy_poll_budget = 50;
+
 /* TODO: merge with sock_get_list_of_addr() - sock_fabric.c */
 #if HAVE_GETIFADDRS
-static void tcpx_getinfo_ifs(struct fi_info **info)
+/* Returns a copy of info for each interface, loopback interfaces last */
+static struct fi_info *tcpx_getinfo_ifs_dup(struct fi_info *info,
+					    struct ifaddrs *ifaddrs,
+					    char *tcpx_interface_name)
 {
-	char *tcpx_interface_name = NULL;
-	struct ifaddrs *ifaddrs, *ifa;
+	struct ifaddrs *ifa;
 	struct fi_info *head, *tail, *cur, *loopback;
 	size_t addrlen;
 	uint32_t addr_format;
-	int ret;
-
-	fi_param_get_str(&tcpx_prov, "iface", &tcpx_interface_name);
-
-	ret = ofi_getifaddrs(&ifaddrs);
-	if (ret)
-		return;
 
 	head = tail = loopback = NULL;
 	for (ifa = ifaddrs; ifa != NULL; ifa = ifa->ifa_next) {
@@ -87,7 +89,7 @@ static void tcpx_getinfo_ifs(struct fi_info **info)
 			continue;
 		}
 
-		cur = fi_dupinfo(*info);
+		cur = fi_dupinfo(info);
 		if (!cur)
 			break;
 
@@ -111,7 +113,6 @@ static void tcpx_getinfo_ifs(struct fi_info **info)
 		util_set_fabric_domain(&tcpx_prov, cur);
 		*/
 	}
-	freeifaddrs(ifaddrs);
 
 	if (head || loopback) {
 		if (!head) { /* loopback interface only? */
@@ -123,6 +124,39 @@ static void tcpx_getinfo_ifs(struct fi_info **info)
 			tail->next = loopback;
 		}
 	}
+	return head;
+}
+
+/* The interfaces are listed for each endpoint type in turn */
+static void tcpx_getinfo_ifs(struct fi_info **info)
+{
+	char *tcpx_interface_name = NULL;
+	struct ifaddrs *ifaddrs;
+	struct fi_info *head, *tail, *cur, *prov_info;
+	int ret;
+
+	fi_param_get_str(&tcpx_prov, "iface", &tcpx_interface_name);
+
+	ret = ofi_getifaddrs(&ifaddrs);
+	if (ret)
+		return;
+
+	head = tail = NULL;
+	for (prov_info = *info; prov_info; prov_info = prov_info->next) {
+		cur = tcpx_getinfo_ifs_dup(prov_info, ifaddrs,
+					   tcpx_interface_name);
+		if (!cur)
+			continue;
+
+		if (!head)
+			head = cur;
+		else
+			tail->next = cur;
+		for (tail = cur; tail->next; tail = tail->next)
+			;
+	}
+	freeifaddrs(ifaddrs);
+
 	fi_freeinfo(*info);
 	*info = head;
 }
@@ -136,6 +170,16 @@ static int tcpx_getinfo(uint32_t version, const char *node, const char *service,
 {
 	int ret;
 
+	/* RxM listening on a wildcard address asks its core provider for a
+	 * source without node or service.  Resolve that to the local
+	 * interfaces below rather than failing, or RxM would be missing on
+	 * the listening side only and the two sides of an RDM application
+	 * could pick different providers.  Requests made directly by an
+	 * application keep failing as before. */
+	if ((flags & OFI_CORE_PROV_ONLY) && (flags & FI_SOURCE) &&
+	    !node && !service && (!hints || !hints->src_addr))
+		flags &= ~FI_SOURCE;
+
 	ret = util_getinfo(&tcpx_util_prov, version, node, service, flags,
 			   hints, info);
 	if (ret)
@@ -168,6 +212,41 @@ TCP_INI
 #endif
 	fi_param_define(&tcpx_prov, "iface", FI_PARAM_STRING,
 			"Specify interface name");
+	fi_param_define(&tcpx_prov, "zerocopy_size", FI_PARAM_SIZE_T,
+			"Send messages and RMA writes of at least this many "
+			"bytes with MSG_ZEROCOPY, where supported.  The "
+			"transfer completes once the kernel no longer "
+			"references the buffer.  0 disables zero-copy sends "
+			"(default: 0)");
+	fi_param_get_size_t(&tcpx_prov, "zerocopy_size", &tcpx_zerocopy_size);
+	fi_param_define(&tcpx_prov, "io_uring", FI_PARAM_BOOL,
+			"Progress the sockets of a domain through a shared "
+			"io_uring instead of epoll, if the provider was built "
+			"with io_uring support and the kernel provides it "
+			"(default: no)");
+	fi_param_get_bool(&tcpx_prov, "io_uring", &tcpx_io_uring);
+	fi_param_define(&tcpx_prov, "stripe_cnt", FI_PARAM_SIZE_T,
+			"Number of extra sockets that msg endpoints open to "
+			"their peer, up to 8, to stripe large messages and "
+			"RMA writes across.  Both peers must enable striping.  "
+			"0 disables striping (default: 0)");
+	fi_param_get_size_t(&tcpx_prov, "stripe_cnt", &tcpx_stripe_cnt);
+	fi_param_define(&tcpx_prov, "stripe_size", FI_PARAM_SIZE_T,
+			"Messages and RMA writes with at least this many "
+			"bytes of payload are striped (default: 1 MiB)");
+	fi_param_get_size_t(&tcpx_prov, "stripe_size", &tcpx_stripe_size);
+	fi_param_define(&tcpx_prov, "busy_poll", FI_PARAM_SIZE_T,
+			"Set SO_BUSY_POLL to this many microseconds on "
+			"connected sockets, and let fi_cq_read poll the "
+			"sockets of the CQ's endpoints until a completion "
+			"arrives.  0 disables busy polling (default: 0)");
+	fi_param_get_size_t(&tcpx_prov, "busy_poll", &tcpx_busy_poll);
+	fi_param_define(&tcpx_prov, "busy_poll_budget", FI_PARAM_SIZE_T,
+			"Microseconds that fi_cq_read polls an empty CQ in "
+			"busy poll mode before it returns -FI_EAGAIN "
+			"(default: 50)");
+	fi_param_get_size_t(&tcpx_prov, "busy_poll_budget",
+			    &tcpx_busy_poll_budget);
 
 	return &tcpx_prov;
 }
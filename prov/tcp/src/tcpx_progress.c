@@ -58,6 +58,18 @@ static void tcpx_cq_report_xfer_fail(struct tcpx_ep *tcpx_ep, int err)
 				       struct tcpx_cq, util_cq);
 		tcpx_xfer_entry_release(tcpx_cq, tx_entry);
 	}
+
+	while (!slist_empty(&tcpx_ep->tx_zc_queue)) {
+		entry = slist_remove_head(&tcpx_ep->tx_zc_queue);
+		tx_entry = container_of(entry, struct tcpx_xfer_entry, entry);
+		tcpx_cq_report_completion(tx_entry->ep->util_ep.tx_cq,
+					  tx_entry, -err);
+
+		tcpx_cq = container_of(tx_entry->ep->util_ep.tx_cq,
+				       struct tcpx_cq, util_cq);
+		tcpx_xfer_entry_release(tcpx_cq, tx_entry);
+	}
+	tcpx_ep->zc_pend_cnt = 0;
 }
 
 static void tcpx_report_error(struct tcpx_ep *tcpx_ep, int err)
@@ -65,6 +77,12 @@ static void tcpx_report_error(struct tcpx_ep *tcpx_ep, int err)
 	struct fi_eq_err_entry err_entry = {0};
 
 	tcpx_cq_report_xfer_fail(tcpx_ep, err);
+	if (tcpx_ep->rdm) {
+		/* the RDM endpoint drops the connection */
+		tcpx_ep->cm_state = TCPX_EP_ERROR;
+		return;
+	}
+
 	err_entry.fid = &tcpx_ep->util_ep.ep_fid.fid;
 	err_entry.context = tcpx_ep->util_ep.ep_fid.fid.context;
 	err_entry.err = -err;
@@ -82,6 +100,9 @@ int tcpx_ep_shutdown_report(struct tcpx_ep *ep, fid_t fid)
 		return FI_SUCCESS;
 	tcpx_cq_report_xfer_fail(ep, -FI_ENOTCONN);
 	ep->cm_state = TCPX_EP_SHUTDOWN;
+	if (ep->rdm)
+		return FI_SUCCESS;
+
 	cm_entry.fid = fid;
 	len =  fi_eq_write(&ep->util_ep.eq->eq_fid, FI_SHUTDOWN,
 			   &cm_entry, sizeof(cm_entry), 0);
@@ -91,27 +112,20 @@ int tcpx_ep_shutdown_report(struct tcpx_ep *ep, fid_t fid)
 	return FI_SUCCESS;
 }
 
-void process_tx_entry(struct tcpx_xfer_entry *tx_entry)
+void tcpx_tx_entry_done(struct tcpx_xfer_entry *tx_entry, int ret)
 {
 	struct tcpx_cq *tcpx_cq;
-	int ret;
 
-	ret = tcpx_send_msg(tx_entry);
-	if (OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
+	slist_remove_head(&tx_entry->ep->tx_queue);
+	if (!ret && tx_entry->zc_done != tx_entry->zc_cnt) {
+		/* the queue is walked for notifications, terminate it */
+		tx_entry->entry.next = NULL;
+		slist_insert_tail(&tx_entry->entry, &tx_entry->ep->tx_zc_queue);
 		return;
+	}
 
-	if (!ret)
-		goto done;
-
-	FI_WARN(&tcpx_prov, FI_LOG_DOMAIN, "msg send failed\n");
-
-	if (ret == -FI_ENOTCONN)
-		tcpx_ep_shutdown_report(tx_entry->ep,
-					&tx_entry->ep->util_ep.ep_fid.fid);
-done:
 	tcpx_cq_report_completion(tx_entry->ep->util_ep.tx_cq,
 				  tx_entry, -ret);
-	slist_remove_head(&tx_entry->ep->tx_queue);
 
 	if (ntohl(tx_entry->msg_hdr.hdr.flags) &
 	    (OFI_DELIVERY_COMPLETE | OFI_COMMIT_COMPLETE)) {
@@ -126,13 +140,32 @@ done:
 	tcpx_xfer_entry_release(tcpx_cq, tx_entry);
 }
 
-static int tcpx_prepare_rx_entry_resp(struct tcpx_xfer_entry *rx_entry)
+void process_tx_entry(struct tcpx_xfer_entry *tx_entry)
+{
+	int ret;
+
+	ret = tcpx_send_msg(tx_entry);
+	if (OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
+		return;
+
+	if (!ret)
+		goto done;
+
+	FI_WARN(&tcpx_prov, FI_LOG_DOMAIN, "msg send failed\n");
+
+	if (ret == -FI_ENOTCONN)
+		tcpx_ep_shutdown_report(tx_entry->ep,
+					&tx_entry->ep->util_ep.ep_fid.fid);
+done:
+	tcpx_tx_entry_done(tx_entry, ret);
+}
+
+int tcpx_queue_msg_resp(struct tcpx_ep *ep)
 {
-	struct tcpx_cq *tcpx_rx_cq, *tcpx_tx_cq;
 	struct tcpx_xfer_entry *resp_entry;
+	struct tcpx_cq *tcpx_tx_cq;
 
-	tcpx_tx_cq = container_of(rx_entry->ep->util_ep.tx_cq,
-			       struct tcpx_cq, util_cq);
+	tcpx_tx_cq = container_of(ep->util_ep.tx_cq, struct tcpx_cq, util_cq);
 
 	resp_entry = tcpx_xfer_entry_alloc(tcpx_tx_cq, TCPX_OP_MSG_RESP);
 	if (!resp_entry)
@@ -148,12 +181,20 @@ static int tcpx_prepare_rx_entry_resp(struct tcpx_xfer_entry *rx_entry)
 	resp_entry->flags = 0;
 	resp_entry->context = NULL;
 	resp_entry->done_len = 0;
-	resp_entry->ep = rx_entry->ep;
-	tcpx_tx_queue_insert(resp_entry->ep, resp_entry);
+	resp_entry->ep = ep;
+	tcpx_tx_queue_insert(ep, resp_entry);
+	return FI_SUCCESS;
+}
+
+static int tcpx_prepare_rx_entry_resp(struct tcpx_xfer_entry *rx_entry)
+{
+	struct tcpx_cq *tcpx_rx_cq;
+
+	if (tcpx_queue_msg_resp(rx_entry->ep))
+		return -FI_EAGAIN;
 
 	tcpx_cq_report_completion(rx_entry->ep->util_ep.rx_cq,
 				  rx_entry, 0);
-	slist_remove_head(&rx_entry->ep->rx_queue);
 	tcpx_rx_cq = container_of(rx_entry->ep->util_ep.rx_cq,
 			       struct tcpx_cq, util_cq);
 	tcpx_xfer_entry_release(tcpx_rx_cq, rx_entry);
@@ -232,6 +273,100 @@ static int process_srx_entry(struct tcpx_xfer_entry *rx_entry)
 	return FI_SUCCESS;
 }
 
+void tcpx_unexp_free(struct tcpx_xfer_entry *unexp)
+{
+	struct tcpx_cq *tcpx_cq;
+
+	tcpx_cq = container_of(unexp->ep->util_ep.rx_cq,
+			       struct tcpx_cq, util_cq);
+	free(unexp->unexp_buf);
+	tcpx_xfer_entry_release(tcpx_cq, unexp);
+}
+
+/*
+ * Copies a fully received unexpected message into the receive that matched
+ * it, completes the receive and frees the message.
+ */
+int tcpx_unexp_deliver(struct tcpx_xfer_entry *unexp,
+		       struct tcpx_xfer_entry *recv_entry)
+{
+	struct tcpx_cq *tcpx_cq;
+	size_t len;
+	int err = 0;
+
+	if ((ntohl(unexp->msg_hdr.hdr.flags) & OFI_DELIVERY_COMPLETE) &&
+	    tcpx_queue_msg_resp(unexp->ep))
+		return -FI_EAGAIN;
+
+	len = ntohll(unexp->msg_hdr.hdr.size) - sizeof(unexp->msg_hdr);
+	if (len > ofi_total_iov_len(recv_entry->msg_data.iov,
+				    recv_entry->msg_data.iov_cnt)) {
+		FI_WARN(&tcpx_prov, FI_LOG_DOMAIN,
+			"posted rx buffer size is not big enough\n");
+		err = FI_ETRUNC;
+	}
+
+	len = ofi_copy_to_iov(recv_entry->msg_data.iov,
+			      recv_entry->msg_data.iov_cnt, 0,
+			      unexp->unexp_buf, len);
+
+	recv_entry->msg_hdr = unexp->msg_hdr;
+	recv_entry->msg_hdr.hdr.op_data = TCPX_OP_MSG_RECV;
+	recv_entry->done_len = sizeof(recv_entry->msg_hdr) + len;
+	recv_entry->flags |= unexp->flags & FI_REMOTE_CQ_DATA;
+
+	tcpx_cq_report_completion(recv_entry->ep->util_ep.rx_cq,
+				  recv_entry, err);
+	tcpx_cq = container_of(recv_entry->ep->util_ep.rx_cq,
+			       struct tcpx_cq, util_cq);
+	tcpx_xfer_entry_release(tcpx_cq, recv_entry);
+	tcpx_unexp_free(unexp);
+	return FI_SUCCESS;
+}
+
+/*
+ * An unexpected message stays queued once it has arrived, unless a receive
+ * matched or claimed it in the meantime.
+ */
+static int process_rx_unexp_entry(struct tcpx_xfer_entry *unexp)
+{
+	struct tcpx_ep *ep = unexp->ep;
+	struct tcpx_cq *tcpx_cq;
+	int ret;
+
+	ret = tcpx_recv_msg_data(unexp);
+	if (OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
+		return ret;
+
+	if (ret) {
+		FI_WARN(&tcpx_prov, FI_LOG_DOMAIN,
+			"msg recv Failed ret = %d\n", ret);
+
+		if (ret == -FI_ENOTCONN)
+			tcpx_ep_shutdown_report(ep, &ep->util_ep.ep_fid.fid);
+
+		if (unexp->pending_recv) {
+			tcpx_cq_report_completion(ep->util_ep.rx_cq,
+						  unexp->pending_recv, -ret);
+			tcpx_cq = container_of(ep->util_ep.rx_cq,
+					       struct tcpx_cq, util_cq);
+			tcpx_xfer_entry_release(tcpx_cq, unexp->pending_recv);
+			unexp->pending_recv = NULL;
+		}
+		ep->cur_rx_entry = NULL;
+		return ret;
+	}
+
+	if (unexp->pending_recv)
+		return tcpx_unexp_deliver(unexp, unexp->pending_recv);
+
+	if (unexp->flags & FI_DISCARD)
+		tcpx_unexp_free(unexp);
+	else
+		ep->cur_rx_entry = NULL;
+	return FI_SUCCESS;
+}
+
 static int tcpx_prepare_rx_write_resp(struct tcpx_xfer_entry *rx_entry)
 {
 	struct tcpx_cq *tcpx_rx_cq, *tcpx_tx_cq;
@@ -411,6 +546,238 @@ static int tcpx_validate_rx_rma_data(struct tcpx_xfer_entry *rx_entry,
 	return FI_SUCCESS;
 }
 
+/* Applies the atomic to the target buffers and returns the data length */
+static size_t tcpx_do_atomic(struct tcpx_xfer_entry *rx_entry,
+			     uint8_t *result)
+{
+	struct ofi_op_hdr *hdr = &rx_entry->msg_hdr.hdr;
+	struct fi_rma_ioc *rma_ioc = rx_entry->msg_hdr.rma_ioc;
+	uint8_t *src = rx_entry->inject;
+	size_t i, dt_size, len = 0, total_len;
+	void *dst;
+
+	dt_size = ofi_datatype_size(hdr->atomic.datatype);
+	total_len = ntohll(hdr->size) - sizeof(rx_entry->msg_hdr);
+	if (hdr->op == ofi_op_atomic_compare)
+		total_len /= 2;
+
+	for (i = 0; i < rx_entry->msg_hdr.rma_iov_cnt; i++) {
+		dst = (void *) (uintptr_t) rma_ioc[i].addr;
+		switch (hdr->op) {
+		case ofi_op_atomic:
+			ofi_atomic_write_handlers[hdr->atomic.op]
+				[hdr->atomic.datatype](dst, &src[len],
+						       rma_ioc[i].count);
+			break;
+		case ofi_op_atomic_fetch:
+			ofi_atomic_readwrite_handlers[hdr->atomic.op]
+				[hdr->atomic.datatype](dst, &src[len],
+						       &result[len],
+						       rma_ioc[i].count);
+			break;
+		case ofi_op_atomic_compare:
+			ofi_atomic_swap_handlers[hdr->atomic.op -
+						 OFI_SWAP_OP_START]
+				[hdr->atomic.datatype](dst, &src[len],
+						       &src[total_len + len],
+						       &result[len],
+						       rma_ioc[i].count);
+			break;
+		default:
+			assert(0);
+			break;
+		}
+		len += rma_ioc[i].count * dt_size;
+	}
+	return len;
+}
+
+/*
+ * The atomic is applied once the response can be queued, so that it
+ * runs exactly once even if the response entry is not available yet.
+ */
+static int tcpx_prepare_rx_atomic_resp(struct tcpx_xfer_entry *rx_entry)
+{
+	struct tcpx_cq *tcpx_rx_cq, *tcpx_tx_cq;
+	struct tcpx_xfer_entry *resp_entry;
+	size_t len;
+
+	tcpx_tx_cq = container_of(rx_entry->ep->util_ep.tx_cq,
+			       struct tcpx_cq, util_cq);
+
+	resp_entry = tcpx_xfer_entry_alloc(tcpx_tx_cq, TCPX_OP_MSG_RESP);
+	if (!resp_entry)
+		return -FI_EAGAIN;
+
+	len = tcpx_do_atomic(rx_entry, resp_entry->inject);
+	if (rx_entry->msg_hdr.hdr.op == ofi_op_atomic)
+		len = 0;
+	tcpx_inject_iov(resp_entry, len);
+
+	resp_entry->msg_hdr.hdr.op = ofi_op_msg;
+	resp_entry->msg_hdr.hdr.flags = 0;
+	resp_entry->msg_hdr.hdr.size =
+		htonll(sizeof(resp_entry->msg_hdr) + len);
+
+	resp_entry->flags = 0;
+	resp_entry->context = NULL;
+	resp_entry->done_len = 0;
+	resp_entry->ep = rx_entry->ep;
+	tcpx_tx_queue_insert(resp_entry->ep, resp_entry);
+
+	tcpx_rx_cq = container_of(rx_entry->ep->util_ep.rx_cq,
+			       struct tcpx_cq, util_cq);
+	tcpx_xfer_entry_release(tcpx_rx_cq, rx_entry);
+	return FI_SUCCESS;
+}
+
+static int process_rx_atomic_entry(struct tcpx_xfer_entry *rx_entry)
+{
+	struct tcpx_cq *tcpx_cq;
+	int ret;
+
+	tcpx_cq = container_of(rx_entry->ep->util_ep.rx_cq,
+			       struct tcpx_cq, util_cq);
+
+	ret = tcpx_recv_msg_data(rx_entry);
+	if (OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
+		return ret;
+
+	if (ret) {
+		FI_WARN(&tcpx_prov, FI_LOG_DOMAIN,
+			"msg recv Failed ret = %d\n", ret);
+		if (ret == -FI_ENOTCONN)
+			tcpx_ep_shutdown_report(rx_entry->ep,
+					&rx_entry->ep->util_ep.ep_fid.fid);
+		tcpx_xfer_entry_release(tcpx_cq, rx_entry);
+		return ret;
+	}
+
+	if (rx_entry->msg_hdr.hdr.op == ofi_op_atomic &&
+	    !(ntohl(rx_entry->msg_hdr.hdr.flags) &
+	      (OFI_DELIVERY_COMPLETE | OFI_COMMIT_COMPLETE))) {
+		tcpx_do_atomic(rx_entry, NULL);
+		tcpx_xfer_entry_release(tcpx_cq, rx_entry);
+		return FI_SUCCESS;
+	}
+
+	if (tcpx_prepare_rx_atomic_resp(rx_entry))
+		rx_entry->ep->cur_rx_proc_fn = tcpx_prepare_rx_atomic_resp;
+
+	return FI_SUCCESS;
+}
+
+static int tcpx_validate_rx_atomic(struct tcpx_xfer_entry *rx_entry)
+{
+	struct ofi_mr_map *map = &rx_entry->ep->util_ep.domain->mr_map;
+	struct ofi_op_hdr *hdr = &rx_entry->msg_hdr.hdr;
+	struct fi_rma_ioc *rma_ioc = rx_entry->msg_hdr.rma_ioc;
+	uint64_t flags, access;
+	size_t i, len = 0, data_len;
+	int ret;
+
+	switch (hdr->op) {
+	case ofi_op_atomic_fetch:
+		flags = FI_FETCH_ATOMIC;
+		break;
+	case ofi_op_atomic_compare:
+		flags = FI_COMPARE_ATOMIC;
+		break;
+	default:
+		flags = 0;
+		break;
+	}
+
+	if (rx_entry->msg_hdr.rma_iov_cnt > TCPX_IOV_LIMIT ||
+	    ofi_atomic_valid(&tcpx_prov, hdr->atomic.datatype,
+			     hdr->atomic.op, flags))
+		return -FI_EINVAL;
+
+	access = (hdr->op == ofi_op_atomic ? 0 : FI_REMOTE_READ) |
+		 (hdr->atomic.op == FI_ATOMIC_READ ? 0 : FI_REMOTE_WRITE);
+
+	for (i = 0; i < rx_entry->msg_hdr.rma_iov_cnt; i++) {
+		ret = ofi_mr_map_verify(map, (uintptr_t *) &rma_ioc[i].addr,
+					rma_ioc[i].count *
+					ofi_datatype_size(hdr->atomic.datatype),
+					rma_ioc[i].key, access, NULL);
+		if (ret)
+			return -FI_EINVAL;
+		len += rma_ioc[i].count;
+	}
+	len *= ofi_datatype_size(hdr->atomic.datatype);
+
+	data_len = ntohll(hdr->size) - sizeof(rx_entry->msg_hdr);
+	if (hdr->atomic.op == FI_ATOMIC_READ)
+		return data_len || len > TCPX_MAX_INJECT_SZ ? -FI_EINVAL : 0;
+
+	if (hdr->op == ofi_op_atomic_compare)
+		len *= 2;
+
+	return data_len != len || len > TCPX_MAX_INJECT_SZ ?
+	       -FI_EINVAL : 0;
+}
+
+static int process_rx_atomic_rsp_entry(struct tcpx_xfer_entry *tx_entry)
+{
+	struct tcpx_cq *tcpx_cq;
+	int ret;
+
+	ret = tcpx_recv_msg_data(tx_entry);
+	if (OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
+		return ret;
+
+	slist_remove_head(&tx_entry->ep->tx_rsp_pend_queue);
+	if (ret) {
+		FI_WARN(&tcpx_prov, FI_LOG_DOMAIN,
+			"msg recv Failed ret = %d\n", ret);
+		if (ret == -FI_ENOTCONN)
+			tcpx_ep_shutdown_report(tx_entry->ep,
+					&tx_entry->ep->util_ep.ep_fid.fid);
+	}
+
+	tcpx_cq_report_completion(tx_entry->ep->util_ep.tx_cq,
+				  tx_entry, -ret);
+	tcpx_cq = container_of(tx_entry->ep->util_ep.tx_cq,
+			       struct tcpx_cq, util_cq);
+	tcpx_xfer_entry_release(tcpx_cq, tx_entry);
+	return FI_SUCCESS;
+}
+
+/* The response to a fetching atomic carries the data read at the target */
+static int tcpx_get_rx_entry_atomic_rsp(struct tcpx_ep *tcpx_ep,
+					struct tcpx_xfer_entry *tx_entry)
+{
+	struct tcpx_rx_detect *rx_detect = &tcpx_ep->rx_detect;
+	size_t len;
+
+	len = ntohll(rx_detect->hdr.hdr.size) - sizeof(rx_detect->hdr);
+	if (tx_entry->msg_hdr.hdr.op != ofi_op_atomic_fetch &&
+	    tx_entry->msg_hdr.hdr.op != ofi_op_atomic_compare) {
+		FI_WARN(&tcpx_prov, FI_LOG_DOMAIN,
+			"unexpected response data\n");
+		return -FI_EIO;
+	}
+
+	memcpy(tx_entry->msg_data.iov, tx_entry->result_iov,
+	       tx_entry->result_iov_cnt * sizeof(struct iovec));
+	tx_entry->msg_data.iov_cnt = tx_entry->result_iov_cnt;
+	if (ofi_truncate_iov(tx_entry->msg_data.iov,
+			     &tx_entry->msg_data.iov_cnt, len)) {
+		FI_WARN(&tcpx_prov, FI_LOG_DOMAIN,
+			"atomic result buffer is not big enough\n");
+		return -FI_EIO;
+	}
+
+	tx_entry->msg_hdr.hdr.size = rx_detect->hdr.hdr.size;
+	tx_entry->done_len = sizeof(rx_detect->hdr);
+
+	rx_detect->done_len = 0;
+	tcpx_ep->cur_rx_entry = tx_entry;
+	tcpx_ep->cur_rx_proc_fn = process_rx_atomic_rsp_entry;
+	return FI_SUCCESS;
+}
+
 int tcpx_get_rx_entry_op_invalid(struct tcpx_ep *tcpx_ep)
 {
 	return -FI_EINVAL;
@@ -418,6 +785,7 @@ int tcpx_get_rx_entry_op_invalid(struct tcpx_ep *tcpx_ep)
 
 int tcpx_get_rx_entry_op_msg(struct tcpx_ep *tcpx_ep)
 {
+	struct tcpx_ep *rx_ep = tcpx_rx_ep(tcpx_ep);
 	struct tcpx_xfer_entry *rx_entry;
 	struct tcpx_xfer_entry *tx_entry;
 	struct slist_entry *entry;
@@ -433,6 +801,8 @@ int tcpx_get_rx_entry_op_msg(struct tcpx_ep *tcpx_ep)
 		entry = tcpx_ep->tx_rsp_pend_queue.head;
 		tx_entry = container_of(entry, struct tcpx_xfer_entry,
 					entry);
+		if (ntohll(rx_detect->hdr.hdr.size) > sizeof(rx_detect->hdr))
+			return tcpx_get_rx_entry_atomic_rsp(tcpx_ep, tx_entry);
 
 		tcpx_cq = container_of(tcpx_ep->util_ep.tx_cq, struct tcpx_cq,
 				       util_cq);
@@ -457,11 +827,11 @@ int tcpx_get_rx_entry_op_msg(struct tcpx_ep *tcpx_ep)
 		fastlock_release(&tcpx_ep->srx_ctx->lock);
 
 	} else {
-		if (slist_empty(&tcpx_ep->rx_queue))
+		if (slist_empty(&rx_ep->rx_queue))
 			return -FI_EAGAIN;
 
 		tcpx_ep->cur_rx_proc_fn = process_rx_entry;
-		entry = slist_remove_head(&tcpx_ep->rx_queue);
+		entry = slist_remove_head(&rx_ep->rx_queue);
 	}
 
 	rx_entry = container_of(entry, struct tcpx_xfer_entry,
@@ -495,6 +865,108 @@ int tcpx_get_rx_entry_op_msg(struct tcpx_ep *tcpx_ep)
 	return FI_SUCCESS;
 }
 
+static int tcpx_get_rx_entry_unexp(struct tcpx_ep *tcpx_ep)
+{
+	struct tcpx_rx_detect *rx_detect = &tcpx_ep->rx_detect;
+	struct tcpx_xfer_entry *unexp;
+	struct tcpx_cq *tcpx_cq;
+	size_t len;
+
+	tcpx_cq = container_of(tcpx_ep->util_ep.rx_cq,
+			       struct tcpx_cq, util_cq);
+
+	len = ntohll(rx_detect->hdr.hdr.size) - sizeof(rx_detect->hdr);
+	if (len > tcpx_rx_ep(tcpx_ep)->max_msg_size) {
+		FI_WARN(&tcpx_prov, FI_LOG_DOMAIN,
+			"unexpected message exceeds max message size\n");
+		return -FI_EIO;
+	}
+
+	unexp = tcpx_xfer_entry_alloc(tcpx_cq, TCPX_OP_MSG_RECV);
+	if (!unexp)
+		return -FI_EAGAIN;
+
+	unexp->unexp_buf = NULL;
+	if (len) {
+		unexp->unexp_buf = malloc(len);
+		if (!unexp->unexp_buf) {
+			unexp->ep = tcpx_ep;
+			tcpx_xfer_entry_release(tcpx_cq, unexp);
+			return -FI_ENOMEM;
+		}
+	}
+
+	unexp->msg_hdr = rx_detect->hdr;
+	unexp->msg_hdr.hdr.op_data = TCPX_OP_MSG_RECV;
+	unexp->ep = tcpx_ep;
+	unexp->done_len = sizeof(rx_detect->hdr);
+	unexp->context = NULL;
+	unexp->pending_recv = NULL;
+	unexp->flags = FI_TAGGED | FI_RECV;
+	if (ntohl(rx_detect->hdr.hdr.flags) & OFI_REMOTE_CQ_DATA)
+		unexp->flags |= FI_REMOTE_CQ_DATA;
+
+	unexp->msg_data.iov[0].iov_base = unexp->unexp_buf;
+	unexp->msg_data.iov[0].iov_len = len;
+	unexp->msg_data.iov_cnt = 1;
+
+	ofi_match_insert(&tcpx_rx_ep(tcpx_ep)->unexp_queue, &unexp->match, 0,
+			 ntohll(rx_detect->hdr.hdr.tag), 0);
+
+	rx_detect->done_len = 0;
+	tcpx_ep->cur_rx_entry = unexp;
+	tcpx_ep->cur_rx_proc_fn = process_rx_unexp_entry;
+	return FI_SUCCESS;
+}
+
+/*
+ * All messages on a connection come from the same peer, and RDM endpoints
+ * do not support directed receives, so tags are matched with a fixed
+ * source address.
+ */
+int tcpx_get_rx_entry_op_tagged(struct tcpx_ep *tcpx_ep)
+{
+	struct tcpx_rx_detect *rx_detect = &tcpx_ep->rx_detect;
+	struct tcpx_xfer_entry *rx_entry;
+	struct ofi_match_entry *match;
+	struct tcpx_cq *tcpx_cq;
+	int ret;
+
+	match = ofi_match_remove_first(&tcpx_rx_ep(tcpx_ep)->trecv_queue, 0,
+				       ntohll(rx_detect->hdr.hdr.tag), 0);
+	if (!match)
+		return tcpx_get_rx_entry_unexp(tcpx_ep);
+
+	rx_entry = container_of(match, struct tcpx_xfer_entry, match);
+	rx_entry->ep = tcpx_ep;
+	rx_entry->msg_hdr = rx_detect->hdr;
+	rx_entry->msg_hdr.hdr.op_data = TCPX_OP_MSG_RECV;
+	rx_entry->done_len = sizeof(rx_detect->hdr);
+
+	if (ntohl(rx_detect->hdr.hdr.flags) & OFI_REMOTE_CQ_DATA)
+		rx_entry->flags |= FI_REMOTE_CQ_DATA;
+
+	ret = ofi_truncate_iov(rx_entry->msg_data.iov,
+			       &rx_entry->msg_data.iov_cnt,
+			       (ntohll(rx_entry->msg_hdr.hdr.size) -
+				sizeof(rx_entry->msg_hdr)));
+	if (ret) {
+		FI_WARN(&tcpx_prov, FI_LOG_DOMAIN,
+			"posted rx buffer size is not big enough\n");
+		tcpx_cq_report_completion(rx_entry->ep->util_ep.rx_cq,
+					  rx_entry, -ret);
+		tcpx_cq = container_of(tcpx_ep->util_ep.rx_cq,
+				       struct tcpx_cq, util_cq);
+		tcpx_xfer_entry_release(tcpx_cq, rx_entry);
+		return ret;
+	}
+
+	rx_detect->done_len = 0;
+	tcpx_ep->cur_rx_entry = rx_entry;
+	tcpx_ep->cur_rx_proc_fn = process_rx_entry;
+	return FI_SUCCESS;
+}
+
 int tcpx_get_rx_entry_op_read_req(struct tcpx_ep *tcpx_ep)
 {
 	struct tcpx_xfer_entry *rx_entry;
@@ -588,14 +1060,56 @@ int tcpx_get_rx_entry_op_read_rsp(struct tcpx_ep *tcpx_ep)
 	return FI_SUCCESS;
 }
 
-static void tcpx_process_stage_buffer(struct tcpx_ep *ep)
+int tcpx_get_rx_entry_op_atomic(struct tcpx_ep *tcpx_ep)
+{
+	struct tcpx_xfer_entry *rx_entry;
+	struct tcpx_cq *tcpx_cq;
+	int ret;
+
+	tcpx_cq = container_of(tcpx_ep->util_ep.rx_cq,
+			       struct tcpx_cq, util_cq);
+
+	rx_entry = tcpx_xfer_entry_alloc(tcpx_cq, TCPX_OP_REMOTE_ATOMIC);
+	if (!rx_entry)
+		return -FI_EAGAIN;
+
+	rx_entry->msg_hdr = tcpx_ep->rx_detect.hdr;
+	rx_entry->msg_hdr.hdr.op_data = TCPX_OP_REMOTE_ATOMIC;
+	rx_entry->ep = tcpx_ep;
+	rx_entry->flags = 0;
+	rx_entry->done_len = sizeof(tcpx_ep->rx_detect.hdr);
+
+	ret = tcpx_validate_rx_atomic(rx_entry);
+	if (ret) {
+		FI_WARN(&tcpx_prov, FI_LOG_DOMAIN,
+			"invalid atomic data\n");
+		tcpx_xfer_entry_release(tcpx_cq, rx_entry);
+		return ret;
+	}
+
+	rx_entry->msg_data.iov[0].iov_base = rx_entry->inject;
+	rx_entry->msg_data.iov[0].iov_len =
+		ntohll(rx_entry->msg_hdr.hdr.size) - sizeof(rx_entry->msg_hdr);
+	rx_entry->msg_data.iov_cnt = 1;
+
+	tcpx_ep->rx_detect.done_len = 0;
+	tcpx_ep->cur_rx_entry = rx_entry;
+	tcpx_ep->cur_rx_proc_fn = process_rx_atomic_entry;
+	return FI_SUCCESS;
+}
+
+/*
+ * A single read into the staging ring may bring in several messages, all
+ * of which are processed here before returning, since the socket will not
+ * report them again.
+ */
+static void tcpx_process_rx_msg(struct tcpx_ep *ep)
 {
 	int ret;
 
-	while (ep->stage_buf.len != ep->stage_buf.off) {
+	do {
 		if (!ep->cur_rx_entry) {
-			ret = tcpx_recv_hdr(ep->conn_fd, &ep->stage_buf,
-					    &ep->rx_detect);
+			ret = tcpx_recv_hdr(ep);
 			if (OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
 				return;
 
@@ -603,14 +1117,23 @@ static void tcpx_process_stage_buffer(struct tcpx_ep *ep)
 				goto err1;
 
 			ret = ep->get_rx_entry[ep->rx_detect.hdr.hdr.op](ep);
-			if (ret == -FI_EAGAIN)
+			if (ret == -FI_EAGAIN) {
+				/* the header was consumed, e.g. a response */
+				if (!ep->rx_detect.done_len)
+					continue;
 				return;
+			}
 			if (ret)
 				goto err2;
+
+			if (ntohl(ep->cur_rx_entry->msg_hdr.hdr.flags) &
+			    TCPX_STRIPED)
+				tcpx_stripe_rx_start(ep);
 		}
+
 		assert(ep->cur_rx_proc_fn != NULL);
 		ep->cur_rx_proc_fn(ep->cur_rx_entry);
-	}
+	} while (!ep->cur_rx_entry && !ofi_rbempty(&ep->stage_buf));
 	return;
 err2:
 	tcpx_report_error(ep, ret);
@@ -620,64 +1143,265 @@ err1:
 		tcpx_ep_shutdown_report(ep, &ep->util_ep.ep_fid.fid);
 }
 
-static void tcpx_process_rx_msg(struct tcpx_ep *ep)
+/* Number of ids in [lo, hi] that belong to the transfer */
+static uint32_t tcpx_zc_overlap(struct tcpx_xfer_entry *tx_entry,
+				uint32_t lo, uint32_t hi)
 {
-	int ret;
+	int32_t first, last;
 
-	if (!ep->cur_rx_entry) {
-		if (ep->stage_buf.len == ep->stage_buf.off) {
-			ret = tcpx_read_to_buffer(ep->conn_fd, &ep->stage_buf);
-			if (ret && !OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
-				goto err1;
+	first = (int32_t) (lo - tx_entry->zc_id);
+	last = (int32_t) (hi - tx_entry->zc_id);
+	if (first < 0)
+		first = 0;
+	if (last >= (int32_t) tx_entry->zc_cnt)
+		last = tx_entry->zc_cnt - 1;
 
-			tcpx_process_stage_buffer(ep);
-			return;
+	return (last >= first) ? last - first + 1 : 0;
+}
+
+/*
+ * The kernel reports the ids of MSG_ZEROCOPY sends whose pages it no longer
+ * references, usually in order and coalesced into ranges.  A transfer
+ * completes once all of its ids were reported.
+ */
+static void process_tx_zc_queue(struct tcpx_ep *ep)
+{
+	struct tcpx_xfer_entry *tx_entry;
+	struct slist_entry *entry;
+	struct tcpx_cq *tcpx_cq;
+	uint32_t lo, hi;
+	bool copied;
+
+	while (ep->zc_pend_cnt &&
+	       !tcpx_recv_zc_notify(ep->conn_fd, &lo, &hi, &copied)) {
+		ep->zc_pend_cnt -= MIN(hi - lo + 1, ep->zc_pend_cnt);
+		if (copied && ep->zc_enabled) {
+			FI_INFO(&tcpx_prov, FI_LOG_EP_DATA,
+				"kernel copied zero-copy send, disabling "
+				"MSG_ZEROCOPY on endpoint\n");
+			ep->zc_enabled = false;
 		}
 
-		ret = tcpx_recv_hdr(ep->conn_fd, &ep->stage_buf,
-				    &ep->rx_detect);
-		if (OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
-			return;
+		if (!slist_empty(&ep->tx_queue)) {
+			tx_entry = container_of(ep->tx_queue.head,
+						struct tcpx_xfer_entry, entry);
+			tx_entry->zc_done += tcpx_zc_overlap(tx_entry, lo, hi);
+		}
 
-		if (ret)
-			goto err1;
+		for (entry = ep->tx_zc_queue.head; entry; entry = entry->next) {
+			tx_entry = container_of(entry, struct tcpx_xfer_entry,
+						entry);
+			tx_entry->zc_done += tcpx_zc_overlap(tx_entry, lo, hi);
+		}
+	}
 
-		ret = ep->get_rx_entry[ep->rx_detect.hdr.hdr.op](ep);
-		if (ret == -FI_EAGAIN)
-			return;
-		if (ret)
-			goto err2;
+	tcpx_cq = container_of(ep->util_ep.tx_cq, struct tcpx_cq, util_cq);
+	while (!slist_empty(&ep->tx_zc_queue)) {
+		tx_entry = container_of(ep->tx_zc_queue.head,
+					struct tcpx_xfer_entry, entry);
+		if (tx_entry->zc_done != tx_entry->zc_cnt)
+			break;
+
+		slist_remove_head(&ep->tx_zc_queue);
+		tcpx_cq_report_completion(ep->util_ep.tx_cq, tx_entry, 0);
+		tcpx_xfer_entry_release(tcpx_cq, tx_entry);
 	}
+}
 
-	assert(ep->cur_rx_proc_fn != NULL);
-	ep->cur_rx_proc_fn(ep->cur_rx_entry);
-	return;
-err2:
-	tcpx_report_error(ep, ret);
-	return;
-err1:
-	if (ret == -FI_ENOTCONN)
-		tcpx_ep_shutdown_report(ep, &ep->util_ep.ep_fid.fid);
+/* Accounts bytes sent from the tx queue to its transfers in queue order. */
+static void tcpx_tx_queue_consume(struct tcpx_ep *ep, size_t len)
+{
+	struct tcpx_xfer_entry *tx_entry;
+	size_t rem;
+
+	while (len) {
+		tx_entry = container_of(ep->tx_queue.head,
+					struct tcpx_xfer_entry, entry);
+		rem = ntohll(tx_entry->msg_hdr.hdr.size) - tx_entry->done_len;
+		if (len < rem) {
+			tx_entry->done_len += len;
+			ofi_consume_iov(tx_entry->msg_data.iov,
+					&tx_entry->msg_data.iov_cnt, len);
+			break;
+		}
+
+		tx_entry->done_len += rem;
+		len -= rem;
+		tcpx_tx_entry_done(tx_entry, 0);
+	}
 }
 
+/*
+ * Sends queued transfers together, so that a stream of small messages
+ * does not cost a system call per message.  Bytes sent are accounted to
+ * the transfers in queue order.
+ */
 static void process_tx_queue(struct tcpx_ep *ep)
 {
 	struct tcpx_xfer_entry *tx_entry;
-	struct slist_entry *entry;
+	size_t len;
+	int ret;
 
 	if (slist_empty(&ep->tx_queue))
 		return;
 
-	entry = ep->tx_queue.head;
-	tx_entry = container_of(entry, struct tcpx_xfer_entry,
+	tx_entry = container_of(ep->tx_queue.head, struct tcpx_xfer_entry,
 				entry);
-	process_tx_entry(tx_entry);
+	if (ep->stripes && (ep->stripes->tx_entry ||
+			    tcpx_stripe_tx_start(ep, tx_entry))) {
+		tcpx_stripe_tx_progress(ep);
+		return;
+	}
+
+	if (ep->tx_queue.head == ep->tx_queue.tail ||
+	    tcpx_zc_flags(tx_entry)) {
+		process_tx_entry(tx_entry);
+		return;
+	}
+
+	ret = tcpx_send_queued(ep, &len);
+	if (OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
+		return;
+
+	if (ret) {
+		FI_WARN(&tcpx_prov, FI_LOG_DOMAIN, "msg send failed\n");
+		if (ret == -FI_ENOTCONN)
+			tcpx_ep_shutdown_report(ep, &ep->util_ep.ep_fid.fid);
+		tcpx_tx_entry_done(tx_entry, ret);
+		return;
+	}
+
+	tcpx_tx_queue_consume(ep, len);
+}
+
+#if HAVE_TCP_IO_URING
+/*
+ * Hands the socket to the kernel for the next receive.  The payload still
+ * expected by the current rx entry is received in place, and the free
+ * space of the staging ring takes in whatever follows it.
+ */
+static void tcpx_uring_arm_rx(struct tcpx_ep *ep)
+{
+	struct tcpx_uring_op *op = &ep->uring_rx;
+	struct tcpx_xfer_entry *rx_entry = ep->cur_rx_entry;
+	size_t iov_cnt = 0, rem_len;
+
+	if (rx_entry && ofi_rbempty(&ep->stage_buf)) {
+		rem_len = ntohll(rx_entry->msg_hdr.hdr.size) -
+			  rx_entry->done_len;
+		if (rem_len) {
+			iov_cnt = rx_entry->msg_data.iov_cnt;
+			memcpy(op->iov, rx_entry->msg_data.iov,
+			       iov_cnt * sizeof(*op->iov));
+			ofi_truncate_iov(op->iov, &iov_cnt, rem_len);
+		}
+	}
+	op->user_len = ofi_total_iov_len(op->iov, iov_cnt);
+	iov_cnt += tcpx_stage_free_iov(&ep->stage_buf, &op->iov[iov_cnt]);
+	if (!iov_cnt)
+		return;
+
+	memset(&op->msg, 0, sizeof(op->msg));
+	op->msg.msg_iov = op->iov;
+	op->msg.msg_iovlen = iov_cnt;
+	tcpx_uring_recvmsg(ep->uring, ep->conn_fd, op);
+}
+
+static void tcpx_uring_arm_tx(struct tcpx_ep *ep)
+{
+	struct tcpx_uring_op *op = &ep->uring_tx;
+
+	memset(&op->msg, 0, sizeof(op->msg));
+	op->msg.msg_iov = op->iov;
+	op->msg.msg_iovlen = tcpx_tx_queue_iov(ep, op->iov,
+					       TCPX_URING_IOV_MAX);
+	tcpx_uring_sendmsg(ep->uring, ep->conn_fd, op);
+}
+
+static void tcpx_uring_rx_done(struct tcpx_ep *ep, int res)
+{
+	struct tcpx_xfer_entry *rx_entry = ep->cur_rx_entry;
+	size_t len;
+
+	if (res <= 0) {
+		if (res == -EAGAIN || res == -EINTR || res == -ECANCELED)
+			return;
+
+		if (res)
+			FI_WARN(&tcpx_prov, FI_LOG_EP_DATA,
+				"msg recv failed: %s\n", strerror(-res));
+		tcpx_ep_shutdown_report(ep, &ep->util_ep.ep_fid.fid);
+		return;
+	}
+
+	len = MIN((size_t) res, ep->uring_rx.user_len);
+	if (len) {
+		rx_entry->done_len += len;
+		if (rx_entry->done_len < ntohll(rx_entry->msg_hdr.hdr.size))
+			ofi_consume_iov(rx_entry->msg_data.iov,
+					&rx_entry->msg_data.iov_cnt, len);
+	}
+	if ((size_t) res > len)
+		tcpx_stage_commit(&ep->stage_buf, res - len);
+}
+
+static void tcpx_uring_tx_done(struct tcpx_ep *ep, int res)
+{
+	struct tcpx_xfer_entry *tx_entry;
+
+	if (res > 0) {
+		tcpx_tx_queue_consume(ep, res);
+		return;
+	}
+
+	if (res == -EAGAIN || res == -EINTR || res == -ECANCELED)
+		return;
+
+	FI_WARN(&tcpx_prov, FI_LOG_DOMAIN, "msg send failed\n");
+	tcpx_ep_shutdown_report(ep, &ep->util_ep.ep_fid.fid);
+	tx_entry = container_of(ep->tx_queue.head, struct tcpx_xfer_entry,
+				entry);
+	tcpx_tx_entry_done(tx_entry, res == -EPIPE ? -FI_ENOTCONN : res);
 }
 
+/*
+ * Picks up the receive and send completed by the kernel, processes the
+ * received data, and re-arms both.  The requests are submitted together
+ * with those of the other endpoints by tcpx_cq_progress().
+ */
+static void tcpx_uring_ep_progress(struct tcpx_ep *ep)
+{
+	int res;
+
+	tcpx_uring_reap(ep->uring);
+	if (tcpx_uring_op_test(ep->uring, &ep->uring_rx, &res))
+		tcpx_uring_rx_done(ep, res);
+
+	tcpx_process_rx_msg(ep);
+
+	if (tcpx_uring_op_test(ep->uring, &ep->uring_tx, &res))
+		tcpx_uring_tx_done(ep, res);
+
+	if (!ep->uring_rx.pending && ep->cm_state == TCPX_EP_CONNECTED)
+		tcpx_uring_arm_rx(ep);
+
+	if (!ep->uring_tx.pending && !slist_empty(&ep->tx_queue))
+		tcpx_uring_arm_tx(ep);
+}
+#endif
+
 void tcpx_ep_progress(struct tcpx_ep *ep)
 {
+#if HAVE_TCP_IO_URING
+	if (ep->uring) {
+		tcpx_uring_ep_progress(ep);
+		return;
+	}
+#endif
 	tcpx_process_rx_msg(ep);
 	process_tx_queue(ep);
+	if (!slist_empty(&ep->tx_zc_queue))
+		process_tx_zc_queue(ep);
 }
 
 void tcpx_progress(struct util_ep *util_ep)
@@ -703,6 +1427,12 @@ static int tcpx_try_func(void *util_ep)
 			       struct util_wait_fd, util_wait);
 
 	fastlock_acquire(&ep->lock);
+	if (!ofi_rbempty(&ep->stage_buf)) {
+		/* received data is waiting in the staging ring, not the socket */
+		fastlock_release(&ep->lock);
+		return -FI_EAGAIN;
+	}
+
 	if (!slist_empty(&ep->tx_queue) && !ep->send_ready_monitor) {
 		ep->send_ready_monitor = true;
 		events = FI_EPOLL_IN | FI_EPOLL_OUT;
@@ -724,15 +1454,66 @@ epoll_mod:
 	return ret;
 }
 
+#if HAVE_TCP_IO_URING
+/*
+ * Sends complete asynchronously as well, so the ring is waited on for
+ * both CQs.  All endpoints share the ring, whose fd is added once per ep.
+ */
+static int tcpx_cq_wait_uring_add(struct tcpx_ep *ep)
+{
+	struct util_wait *rx_wait = ep->util_ep.rx_cq->wait;
+	struct util_wait *tx_wait = ep->util_ep.tx_cq->wait;
+	int ret;
+
+	if (rx_wait) {
+		ret = ofi_wait_fd_add(rx_wait, tcpx_uring_fd(ep->uring),
+				      FI_EPOLL_IN, tcpx_uring_try,
+				      ep->uring, NULL);
+		if (ret)
+			return ret;
+	}
+
+	if (tx_wait) {
+		ret = ofi_wait_fd_add(tx_wait, tcpx_uring_fd(ep->uring),
+				      FI_EPOLL_IN, tcpx_uring_try,
+				      ep->uring, NULL);
+		if (ret && rx_wait)
+			ofi_wait_fd_del(rx_wait, tcpx_uring_fd(ep->uring));
+		return ret;
+	}
+	return FI_SUCCESS;
+}
+
+static void tcpx_cq_wait_uring_del(struct tcpx_ep *ep)
+{
+	if (ep->util_ep.rx_cq->wait)
+		ofi_wait_fd_del(ep->util_ep.rx_cq->wait,
+				tcpx_uring_fd(ep->uring));
+	if (ep->util_ep.tx_cq->wait)
+		ofi_wait_fd_del(ep->util_ep.tx_cq->wait,
+				tcpx_uring_fd(ep->uring));
+}
+#endif
+
 int tcpx_cq_wait_ep_add(struct tcpx_ep *ep)
 {
+#if HAVE_TCP_IO_URING
+	if (ep->uring)
+		return tcpx_cq_wait_uring_add(ep);
+#endif
+	int ret;
+
 	if (!ep->util_ep.rx_cq->wait)
 		return FI_SUCCESS;
 
-	return ofi_wait_fd_add(ep->util_ep.rx_cq->wait,
-			       ep->conn_fd, FI_EPOLL_IN,
-			       tcpx_try_func, (void *)&ep->util_ep,
-			       NULL);
+	ret = ofi_wait_fd_add(ep->util_ep.rx_cq->wait,
+			      ep->conn_fd, FI_EPOLL_IN,
+			      tcpx_try_func, (void *)&ep->util_ep,
+			      NULL);
+	if (ret || !ep->stripes)
+		return ret;
+
+	return tcpx_stripe_wait_add(ep);
 }
 
 void tcpx_cq_wait_ep_del(struct tcpx_ep *ep)
@@ -742,26 +1523,143 @@ void tcpx_cq_wait_ep_del(struct tcpx_ep *ep)
 		goto out;
 	}
 
+#if HAVE_TCP_IO_URING
+	if (ep->uring) {
+		tcpx_cq_wait_uring_del(ep);
+		goto out;
+	}
+#endif
 	if (ep->util_ep.rx_cq->wait) {
 		ofi_wait_fd_del(ep->util_ep.rx_cq->wait, ep->conn_fd);
 	}
+	tcpx_stripe_wait_del(ep);
 out:
 	fastlock_release(&ep->lock);
 }
 
+/*
+ * Transfers posted with FI_MORE are only queued, so that they go out with
+ * the next transfer in one system call.  A queue whose head has not been
+ * sent yet holds such transfers, or the socket was full at the last try.
+ */
 void tcpx_tx_queue_insert(struct tcpx_ep *tcpx_ep,
 			  struct tcpx_xfer_entry *tx_entry)
 {
-	int empty;
+	struct tcpx_xfer_entry *head;
 	struct util_wait *wait = tcpx_ep->util_ep.tx_cq->wait;
 
-	empty = slist_empty(&tcpx_ep->tx_queue);
 	slist_insert_tail(&tx_entry->entry, &tcpx_ep->tx_queue);
+	if ((tx_entry->flags & FI_MORE) ||
+	    tcpx_ep->cm_state == TCPX_EP_CONNECTING)
+		return;
 
-	if (empty) {
-		process_tx_entry(tx_entry);
+#if HAVE_TCP_IO_URING
+	if (tcpx_ep->uring) {
+		/*
+		 * Polled CQs submit the send with the requests of the other
+		 * endpoints.  A thread may be blocked on a CQ with a wait
+		 * object, so the send is submitted right away instead.
+		 */
+		if (tcpx_ep->uring_tx.pending)
+			return;
+
+		tcpx_uring_arm_tx(tcpx_ep);
+		if (wait)
+			tcpx_uring_submit(tcpx_ep->uring);
+		return;
+	}
+#endif
+	head = container_of(tcpx_ep->tx_queue.head, struct tcpx_xfer_entry,
+			    entry);
+	if (!head->done_len) {
+		process_tx_queue(tcpx_ep);
 
 		if (!slist_empty(&tcpx_ep->tx_queue) && wait)
 			wait->signal(wait);
 	}
 }
+
+static void tcpx_cq_submit(struct util_cq *cq)
+{
+#if HAVE_TCP_IO_URING
+	struct tcpx_domain *domain;
+
+	domain = container_of(cq->domain, struct tcpx_domain, util_domain);
+	if (domain->uring)
+		tcpx_uring_submit(domain->uring);
+#endif
+}
+
+static bool tcpx_cq_empty(struct util_cq *cq)
+{
+	bool empty;
+
+	cq->cq_fastlock_acquire(&cq->cq_lock);
+	empty = ofi_cirque_isempty(cq->cirq);
+	cq->cq_fastlock_release(&cq->cq_lock);
+	return empty;
+}
+
+/*
+ * Polls the endpoints of the CQ in turn until one of them produces a
+ * completion or the budget runs out.  The next call starts with the
+ * endpoint after the one that did, so that a busy endpoint does not
+ * keep the others waiting.
+ */
+static void tcpx_cq_busy_poll(struct util_cq *cq)
+{
+	struct tcpx_cq *tcpx_cq = container_of(cq, struct tcpx_cq, util_cq);
+	struct fid_list_entry *fid_entry;
+	struct dlist_entry *item;
+	struct util_ep *ep;
+	size_t i, cnt = 0;
+	uint64_t end;
+
+	end = fi_gettime_us() + tcpx_busy_poll_budget;
+	cq->cq_fastlock_acquire(&cq->ep_list_lock);
+	dlist_foreach(&cq->ep_list, item)
+		cnt++;
+	if (!cnt)
+		goto out;
+
+	tcpx_cq->poll_start %= cnt;
+	item = cq->ep_list.next;
+	for (i = 0; i < tcpx_cq->poll_start; i++)
+		item = item->next;
+
+	for (;;) {
+		fid_entry = container_of(item, struct fid_list_entry, entry);
+		ep = container_of(fid_entry->fid, struct util_ep, ep_fid.fid);
+		ep->progress(ep);
+
+		item = item->next;
+		if (item == &cq->ep_list)
+			item = item->next;
+		tcpx_cq->poll_start = (tcpx_cq->poll_start + 1) % cnt;
+
+		if (!tcpx_cq_empty(cq))
+			break;
+
+		if (!tcpx_cq->poll_start) {
+			tcpx_cq_submit(cq);
+			if (fi_gettime_us() >= end)
+				break;
+		}
+	}
+out:
+	cq->cq_fastlock_release(&cq->ep_list_lock);
+}
+
+/*
+ * With io_uring, the requests queued while progressing the endpoints are
+ * submitted to the kernel with a single system call.
+ */
+void tcpx_cq_progress(struct util_cq *cq)
+{
+	if (tcpx_busy_poll)
+		tcpx_cq_busy_poll(cq);
+	else
+		ofi_cq_progress(cq);
+
+	tcpx_cq_submit(cq);
+}
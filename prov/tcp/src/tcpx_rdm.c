@@ -0,0 +1,1603 @@
+/*
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *	   Redistribution and use in source and binary forms, with or
+ *	   without modification, are permitted provided that the following
+ *	   conditions are met:
+ *
+ *		- Redistributions of source code must retain the above
+ *		  copyright notice, this list of conditions and the following
+ *		  disclaimer.
+ *
+ *		- Redistributions in binary form must reproduce the above
+ *		  copyright notice, this list of conditions and the following
+ *		  disclaimer in the documentation and/or other materials
+ *		  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <rdma/fi_errno.h>
+#include <ofi_prov.h>
+#include "tcpx.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <ofi_util.h>
+#include <unistd.h>
+#include <string.h>
+
+enum tcpx_rdm_conn_state {
+	TCPX_RDM_CONNECTING,
+	TCPX_RDM_REQ_SENT,
+	TCPX_RDM_ACCEPTING,
+	/* refused by the peer, which connects to us instead */
+	TCPX_RDM_PARKED,
+	TCPX_RDM_CONNECTED,
+	TCPX_RDM_CLOSED,
+};
+
+struct tcpx_rdm_conn {
+	struct tcpx_ep		ep;
+	enum tcpx_rdm_conn_state state;
+	/* FI_ADDR_NOTAVAIL unless sends to the peer go through it */
+	fi_addr_t		fi_addr;
+	union ofi_sock_ip	peer;
+	struct dlist_entry	entry;
+	struct dlist_entry	pend_entry;
+};
+
+/*
+ * Both sides of a new connection start with the address of their RDM
+ * endpoint, so that the acceptor can tell which peer connected.  The
+ * header is the one of the msg endpoint CM, so the magic keeps a connection
+ * request of a msg endpoint, or of RxM layered over one, from being taken
+ * for ours.
+ */
+#define TCPX_RDM_CM_MAGIC	0x7463726d	/* "tcrm" */
+
+struct tcpx_rdm_cm_msg {
+	struct ofi_ctrl_hdr	hdr;
+	uint32_t		magic;
+	union ofi_sock_ip	addr;
+};
+
+#define TCPX_RDM_CM_DATA_SIZE \
+	(sizeof(struct tcpx_rdm_cm_msg) - sizeof(struct ofi_ctrl_hdr))
+
+static int tcpx_rdm_conn_alloc(struct tcpx_rdm *rdm, SOCKET sock,
+			       enum tcpx_rdm_conn_state state,
+			       struct tcpx_rdm_conn **conn_ptr)
+{
+	struct tcpx_rdm_conn *conn;
+	struct tcpx_ep *ep;
+	int ret;
+
+	conn = calloc(1, sizeof(*conn));
+	if (!conn)
+		return -FI_ENOMEM;
+
+	ep = &conn->ep;
+	ep->util_ep.ep_fid.fid.fclass = FI_CLASS_EP;
+	ep->util_ep.ep_fid.fid.context = rdm->ep.util_ep.ep_fid.fid.context;
+	ep->util_ep.ep_fid.msg = &tcpx_msg_ops;
+	ep->util_ep.ep_fid.tagged = &tcpx_tagged_ops;
+	ep->util_ep.ep_fid.rma = &tcpx_rma_ops;
+	ep->util_ep.ep_fid.atomic = &tcpx_atomic_ops;
+	ep->util_ep.domain = rdm->ep.util_ep.domain;
+	ep->util_ep.tx_cq = rdm->ep.util_ep.tx_cq;
+	ep->util_ep.rx_cq = rdm->ep.util_ep.rx_cq;
+	ep->util_ep.tx_op_flags = rdm->ep.util_ep.tx_op_flags;
+	ep->util_ep.rx_op_flags = rdm->ep.util_ep.rx_op_flags;
+	ep->conn_fd = sock;
+	ep->cm_state = TCPX_EP_CONNECTING;
+	ep->progress_func = tcpx_ep_progress;
+	ep->rdm = rdm;
+
+	ret = fastlock_init(&ep->lock);
+	if (ret)
+		goto err1;
+
+	ret = ofi_rbinit(&ep->stage_buf, STAGE_BUF_SIZE);
+	if (ret)
+		goto err2;
+
+	slist_init(&ep->rx_queue);
+	slist_init(&ep->tx_queue);
+	slist_init(&ep->rma_read_queue);
+	slist_init(&ep->tx_rsp_pend_queue);
+	slist_init(&ep->tx_zc_queue);
+
+	/* tagged receives are posted on the RDM endpoint */
+	ret = ofi_match_queue_init(&ep->trecv_queue, 1);
+	if (ret)
+		goto err3;
+
+	ret = ofi_match_queue_init(&ep->unexp_queue, 1);
+	if (ret)
+		goto err4;
+
+	ep->get_rx_entry[ofi_op_msg] = tcpx_get_rx_entry_op_msg;
+	ep->get_rx_entry[ofi_op_tagged] = tcpx_get_rx_entry_op_tagged;
+	ep->get_rx_entry[ofi_op_read_req] = tcpx_get_rx_entry_op_read_req;
+	ep->get_rx_entry[ofi_op_read_rsp] = tcpx_get_rx_entry_op_read_rsp;
+	ep->get_rx_entry[ofi_op_write] = tcpx_get_rx_entry_op_write;
+	ep->get_rx_entry[ofi_op_write_rsp] = tcpx_get_rx_entry_op_invalid;
+	ep->get_rx_entry[ofi_op_atomic] = tcpx_get_rx_entry_op_atomic;
+	ep->get_rx_entry[ofi_op_atomic_fetch] = tcpx_get_rx_entry_op_atomic;
+	ep->get_rx_entry[ofi_op_atomic_compare] = tcpx_get_rx_entry_op_atomic;
+	tcpx_ep_zerocopy_init(ep);
+
+	ret = fi_epoll_add(rdm->epoll, sock, state == TCPX_RDM_CONNECTING ?
+			   FI_EPOLL_OUT : FI_EPOLL_IN, conn);
+	if (ret)
+		goto err5;
+
+	conn->state = state;
+	conn->fi_addr = FI_ADDR_NOTAVAIL;
+	dlist_init(&conn->pend_entry);
+	dlist_insert_tail(&conn->entry, &rdm->conn_list);
+	*conn_ptr = conn;
+	return FI_SUCCESS;
+err5:
+	ofi_match_queue_close(&ep->unexp_queue);
+err4:
+	ofi_match_queue_close(&ep->trecv_queue);
+err3:
+	ofi_rbfree(&ep->stage_buf);
+err2:
+	fastlock_destroy(&ep->lock);
+err1:
+	free(conn);
+	return ret;
+}
+
+static void tcpx_rdm_conn_free(struct tcpx_rdm *rdm,
+			       struct tcpx_rdm_conn *conn)
+{
+	if (conn->ep.conn_fd != INVALID_SOCKET) {
+		fi_epoll_del(rdm->epoll, conn->ep.conn_fd);
+		ofi_close_socket(conn->ep.conn_fd);
+	}
+
+	tcpx_ep_tx_rx_queues_release(&conn->ep);
+	ofi_match_queue_close(&conn->ep.trecv_queue);
+	ofi_match_queue_close(&conn->ep.unexp_queue);
+	ofi_rbfree(&conn->ep.stage_buf);
+	fastlock_destroy(&conn->ep.lock);
+	dlist_remove(&conn->pend_entry);
+	dlist_remove(&conn->entry);
+	free(conn);
+}
+
+static void tcpx_rdm_fail_queue(struct slist *queue, int err)
+{
+	struct tcpx_xfer_entry *xfer_entry;
+	struct tcpx_cq *tcpx_cq;
+
+	while (!slist_empty(queue)) {
+		xfer_entry = container_of(slist_remove_head(queue),
+					  struct tcpx_xfer_entry, entry);
+		if (ntohl(xfer_entry->msg_hdr.hdr.flags) &
+		    (OFI_DELIVERY_COMPLETE | OFI_COMMIT_COMPLETE))
+			xfer_entry->flags |= FI_COMPLETION;
+
+		tcpx_cq_report_completion(xfer_entry->ep->util_ep.tx_cq,
+					  xfer_entry, err);
+		tcpx_cq = container_of(xfer_entry->ep->util_ep.tx_cq,
+				       struct tcpx_cq, util_cq);
+		tcpx_xfer_entry_release(tcpx_cq, xfer_entry);
+	}
+}
+
+static void tcpx_rdm_move_queue(struct slist *from, struct slist *to,
+				struct tcpx_ep *ep)
+{
+	struct slist_entry *entry;
+
+	while (!slist_empty(from)) {
+		entry = slist_remove_head(from);
+		container_of(entry, struct tcpx_xfer_entry, entry)->ep = ep;
+		slist_insert_tail(entry, to);
+	}
+}
+
+/*
+ * Transfers still queued on the connection fail.  Messages received on a
+ * connection that was established may still sit in the unexpected queue
+ * of the RDM endpoint, so only connections that never got there are freed
+ * right away, at the end of the current progress pass.
+ */
+static void tcpx_rdm_conn_close(struct tcpx_rdm *rdm,
+				struct tcpx_rdm_conn *conn, int err)
+{
+	struct tcpx_ep *ep = &conn->ep;
+
+	fastlock_acquire(&ep->lock);
+	if (ep->conn_fd != INVALID_SOCKET) {
+		fi_epoll_del(rdm->epoll, ep->conn_fd);
+		if (conn->state == TCPX_RDM_CONNECTED && ep->cur_rx_entry) {
+			/* fails the message being received */
+			shutdown(ep->conn_fd, SHUT_RDWR);
+			tcpx_ep_progress(ep);
+		}
+		ofi_close_socket(ep->conn_fd);
+		ep->conn_fd = INVALID_SOCKET;
+	}
+
+	tcpx_ep_shutdown_report(ep, NULL);
+	tcpx_rdm_fail_queue(&ep->tx_queue, err);
+	tcpx_rdm_fail_queue(&ep->rma_read_queue, err);
+	fastlock_release(&ep->lock);
+
+	if (conn->fi_addr != FI_ADDR_NOTAVAIL) {
+		ofi_idm_clear(&rdm->conn_map, (int) conn->fi_addr);
+		conn->fi_addr = FI_ADDR_NOTAVAIL;
+	}
+
+	dlist_remove_init(&conn->pend_entry);
+	if (conn->state != TCPX_RDM_CONNECTED) {
+		dlist_remove(&conn->entry);
+		dlist_insert_tail(&conn->entry, &rdm->free_list);
+	}
+	conn->state = TCPX_RDM_CLOSED;
+}
+
+/*
+ * Epoll reports only new data on a socket.  Connections that hold data
+ * read ahead, a header waiting for a receive to be posted, or transfers
+ * that did not fit into the socket are progressed on every pass instead.
+ */
+static void tcpx_rdm_conn_update_pend(struct tcpx_rdm *rdm,
+				      struct tcpx_rdm_conn *conn)
+{
+	struct tcpx_ep *ep = &conn->ep;
+	bool pend;
+
+	pend = ep->cm_state != TCPX_EP_CONNECTED ||
+	       !ofi_rbempty(&ep->stage_buf) ||
+	       (!ep->cur_rx_entry && ep->rx_detect.done_len) ||
+	       !slist_empty(&ep->tx_queue) || ep->zc_pend_cnt;
+
+	if (!pend)
+		dlist_remove_init(&conn->pend_entry);
+	else if (dlist_empty(&conn->pend_entry))
+		dlist_insert_tail(&conn->pend_entry, &rdm->pend_list);
+}
+
+static int tcpx_rdm_send_cm_msg(struct tcpx_rdm *rdm, SOCKET sock,
+				uint8_t type)
+{
+	struct tcpx_rdm_cm_msg msg;
+	ssize_t ret;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.hdr.version = OFI_CTRL_VERSION;
+	msg.hdr.type = type;
+	msg.hdr.seg_size = htons((uint16_t) TCPX_RDM_CM_DATA_SIZE);
+	msg.magic = htonl(TCPX_RDM_CM_MAGIC);
+	msg.addr = rdm->addr;
+
+	/* a new socket always has room for it */
+	ret = ofi_send_socket(sock, &msg, sizeof(msg), MSG_NOSIGNAL);
+	if (ret != sizeof(msg))
+		return -FI_EIO;
+
+	return FI_SUCCESS;
+}
+
+/* Reject a peer that is not an RDM endpoint the way a msg listener would */
+static void tcpx_rdm_send_nack(SOCKET sock)
+{
+	struct ofi_ctrl_hdr hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.version = OFI_CTRL_VERSION;
+	hdr.type = ofi_ctrl_nack;
+
+	(void) ofi_sendall_socket(sock, &hdr, sizeof(hdr));
+	ofi_shutdown(sock, SHUT_RDWR);
+}
+
+static int tcpx_rdm_recv_cm_msg(SOCKET sock, struct tcpx_rdm_cm_msg *msg)
+{
+	ssize_t ret;
+
+	ret = ofi_recv_socket(sock, msg, sizeof(*msg), MSG_PEEK);
+	if (ret < 0)
+		return -ofi_sockerr();
+
+	if (!ret)
+		return -FI_ENOTCONN;
+
+	/* check the header first, a foreign message may be shorter */
+	if ((size_t) ret >= sizeof(msg->hdr) &&
+	    (msg->hdr.version != OFI_CTRL_VERSION ||
+	     ntohs(msg->hdr.seg_size) != TCPX_RDM_CM_DATA_SIZE))
+		return -FI_ENOPROTOOPT;
+
+	if ((size_t) ret < sizeof(*msg))
+		return -FI_EAGAIN;
+
+	if (ntohl(msg->magic) != TCPX_RDM_CM_MAGIC)
+		return -FI_ENOPROTOOPT;
+
+	ret = ofi_recv_socket(sock, msg, sizeof(*msg), 0);
+	if (ret != sizeof(*msg))
+		return -FI_EIO;
+
+	return FI_SUCCESS;
+}
+
+static void tcpx_rdm_conn_progress(struct tcpx_rdm *rdm,
+				   struct tcpx_rdm_conn *conn);
+
+static int tcpx_rdm_conn_ready(struct tcpx_rdm *rdm,
+			       struct tcpx_rdm_conn *conn)
+{
+	fastlock_acquire(&conn->ep.lock);
+	conn->state = TCPX_RDM_CONNECTED;
+	conn->ep.cm_state = TCPX_EP_CONNECTED;
+	fastlock_release(&conn->ep.lock);
+
+	/* sends queued during the handshake go out now */
+	tcpx_rdm_conn_progress(rdm, conn);
+	return FI_SUCCESS;
+}
+
+static int tcpx_rdm_send_req(struct tcpx_rdm *rdm, struct tcpx_rdm_conn *conn)
+{
+	socklen_t len = sizeof(int);
+	int ret, err;
+
+	ret = getsockopt(conn->ep.conn_fd, SOL_SOCKET, SO_ERROR,
+			 (char *) &err, &len);
+	if (ret)
+		return -ofi_sockerr();
+
+	if (err)
+		return -err;
+
+	ret = tcpx_rdm_send_cm_msg(rdm, conn->ep.conn_fd, ofi_ctrl_connreq);
+	if (ret)
+		return ret;
+
+	ret = fi_epoll_mod(rdm->epoll, conn->ep.conn_fd, FI_EPOLL_IN, conn);
+	if (ret)
+		return ret;
+
+	conn->state = TCPX_RDM_REQ_SENT;
+	return FI_SUCCESS;
+}
+
+static int tcpx_rdm_recv_resp(struct tcpx_rdm *rdm, struct tcpx_rdm_conn *conn)
+{
+	struct tcpx_rdm_cm_msg msg;
+	int ret;
+
+	ret = tcpx_rdm_recv_cm_msg(conn->ep.conn_fd, &msg);
+	if (ret)
+		return ret;
+
+	switch (msg.hdr.type) {
+	case ofi_ctrl_connresp:
+		return tcpx_rdm_conn_ready(rdm, conn);
+	case ofi_ctrl_nack:
+		/* the connection of the peer takes over the queued transfers */
+		fi_epoll_del(rdm->epoll, conn->ep.conn_fd);
+		ofi_close_socket(conn->ep.conn_fd);
+		conn->ep.conn_fd = INVALID_SOCKET;
+		conn->state = TCPX_RDM_PARKED;
+		return FI_SUCCESS;
+	default:
+		return -FI_ECONNREFUSED;
+	}
+}
+
+/*
+ * Two peers that connect to each other at the same time end up with two
+ * connections.  The one opened by the peer with the lower address is kept,
+ * and transfers queued on the other one move over to it.  The connection
+ * of a peer that is already connected, or that is not in the AV, is only
+ * used to receive.
+ */
+static int tcpx_rdm_recv_req(struct tcpx_rdm *rdm, struct tcpx_rdm_conn *conn)
+{
+	struct tcpx_rdm_conn *mapped = NULL;
+	struct tcpx_rdm_cm_msg msg;
+	fi_addr_t fi_addr;
+	int ret, cmp;
+
+	ret = tcpx_rdm_recv_cm_msg(conn->ep.conn_fd, &msg);
+	if (ret == -FI_ENOPROTOOPT ||
+	    (!ret && msg.hdr.type != ofi_ctrl_connreq)) {
+		FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+			"rejecting connection that is not from an RDM endpoint\n");
+		tcpx_rdm_send_nack(conn->ep.conn_fd);
+		tcpx_rdm_conn_close(rdm, conn, FI_ECONNREFUSED);
+		return FI_SUCCESS;
+	}
+	if (ret)
+		return ret;
+
+	conn->peer = msg.addr;
+	fi_addr = ofi_ip_av_get_fi_addr(rdm->ep.util_ep.av, &msg.addr);
+	if (fi_addr != FI_ADDR_NOTAVAIL)
+		mapped = ofi_idm_lookup(&rdm->conn_map, (int) fi_addr);
+
+	cmp = memcmp(&rdm->addr, &msg.addr, sizeof(msg.addr));
+	if (mapped && cmp < 0 && (mapped->state == TCPX_RDM_CONNECTING ||
+				  mapped->state == TCPX_RDM_REQ_SENT)) {
+		tcpx_rdm_send_cm_msg(rdm, conn->ep.conn_fd, ofi_ctrl_nack);
+		tcpx_rdm_conn_close(rdm, conn, FI_ECONNREFUSED);
+		return FI_SUCCESS;
+	}
+
+	ret = tcpx_rdm_send_cm_msg(rdm, conn->ep.conn_fd, ofi_ctrl_connresp);
+	if (ret)
+		return ret;
+
+	if (fi_addr != FI_ADDR_NOTAVAIL && cmp &&
+	    (!mapped || mapped->state != TCPX_RDM_CONNECTED)) {
+		if (mapped) {
+			fastlock_acquire(&mapped->ep.lock);
+			tcpx_rdm_move_queue(&mapped->ep.tx_queue,
+					    &conn->ep.tx_queue, &conn->ep);
+			tcpx_rdm_move_queue(&mapped->ep.rma_read_queue,
+					    &conn->ep.rma_read_queue,
+					    &conn->ep);
+			fastlock_release(&mapped->ep.lock);
+			tcpx_rdm_conn_close(rdm, mapped, FI_ECONNREFUSED);
+		}
+
+		conn->fi_addr = fi_addr;
+		if (ofi_idm_set(&rdm->conn_map, (int) fi_addr, conn) < 0)
+			return -FI_ENOMEM;
+	}
+
+	return tcpx_rdm_conn_ready(rdm, conn);
+}
+
+static void tcpx_rdm_accept(struct tcpx_rdm *rdm)
+{
+	struct tcpx_rdm_conn *conn;
+	SOCKET sock;
+	int ret;
+
+	for (;;) {
+		sock = accept(rdm->listen_sock, NULL, 0);
+		if (sock == INVALID_SOCKET) {
+			if (!OFI_SOCK_TRY_SND_RCV_AGAIN(ofi_sockerr()))
+				FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+					"accept failed: %d\n", ofi_sockerr());
+			return;
+		}
+
+		ret = tcpx_setup_socket(sock);
+		if (!ret)
+			ret = fi_fd_nonblock(sock);
+		if (!ret)
+			ret = tcpx_rdm_conn_alloc(rdm, sock,
+						  TCPX_RDM_ACCEPTING, &conn);
+		if (ret) {
+			FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+				"failed to accept connection\n");
+			ofi_close_socket(sock);
+		}
+	}
+}
+
+static void tcpx_rdm_conn_progress(struct tcpx_rdm *rdm,
+				   struct tcpx_rdm_conn *conn)
+{
+	int ret;
+
+	switch (conn->state) {
+	case TCPX_RDM_CONNECTING:
+		ret = tcpx_rdm_send_req(rdm, conn);
+		break;
+	case TCPX_RDM_REQ_SENT:
+		ret = tcpx_rdm_recv_resp(rdm, conn);
+		break;
+	case TCPX_RDM_ACCEPTING:
+		ret = tcpx_rdm_recv_req(rdm, conn);
+		break;
+	case TCPX_RDM_CONNECTED:
+		fastlock_acquire(&conn->ep.lock);
+		tcpx_ep_progress(&conn->ep);
+		fastlock_release(&conn->ep.lock);
+		if (conn->ep.cm_state != TCPX_EP_CONNECTED) {
+			tcpx_rdm_conn_close(rdm, conn, FI_ENOTCONN);
+			return;
+		}
+		tcpx_rdm_conn_update_pend(rdm, conn);
+		return;
+	default:
+		return;
+	}
+
+	if (ret && !OFI_SOCK_TRY_SND_RCV_AGAIN(-ret)) {
+		FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+			"connection setup failed: %s\n", fi_strerror(-ret));
+		tcpx_rdm_conn_close(rdm, conn, FI_ECONNREFUSED);
+	}
+}
+
+/*
+ * All connections of the endpoint are progressed from its epoll set, so
+ * that a pass costs one system call plus one per connection with work.
+ */
+static void tcpx_rdm_progress(struct util_ep *util_ep)
+{
+	struct tcpx_rdm *rdm;
+	struct tcpx_rdm_conn *conn;
+	struct dlist_entry pend_list;
+	void *contexts[MAX_EPOLL_EVENTS];
+	int i, count;
+
+	rdm = container_of(util_ep, struct tcpx_rdm, ep.util_ep);
+	fastlock_acquire(&rdm->ep.lock);
+	count = fi_epoll_wait(rdm->epoll, contexts, MAX_EPOLL_EVENTS, 0);
+	for (i = 0; i < count; i++) {
+		if (contexts[i] == rdm) {
+			tcpx_rdm_accept(rdm);
+			continue;
+		}
+
+		conn = contexts[i];
+		if (!dlist_empty(&conn->pend_entry))
+			dlist_remove_init(&conn->pend_entry);
+		tcpx_rdm_conn_progress(rdm, conn);
+	}
+
+	/* connections re-add themselves while work is left */
+	dlist_init(&pend_list);
+	dlist_splice_tail(&pend_list, &rdm->pend_list);
+	while (!dlist_empty(&pend_list)) {
+		conn = container_of(pend_list.next, struct tcpx_rdm_conn,
+				    pend_entry);
+		dlist_remove_init(&conn->pend_entry);
+		tcpx_rdm_conn_progress(rdm, conn);
+	}
+
+	while (!dlist_empty(&rdm->free_list)) {
+		conn = container_of(rdm->free_list.next, struct tcpx_rdm_conn,
+				    entry);
+		tcpx_rdm_conn_free(rdm, conn);
+	}
+	fastlock_release(&rdm->ep.lock);
+}
+
+static int tcpx_rdm_connect(struct tcpx_rdm *rdm, fi_addr_t fi_addr,
+			    struct tcpx_rdm_conn **conn_ptr)
+{
+	struct tcpx_rdm_conn *conn;
+	struct sockaddr *addr;
+	SOCKET sock;
+	int ret;
+
+	addr = ofi_av_get_addr(rdm->ep.util_ep.av, fi_addr);
+	sock = ofi_socket(addr->sa_family, SOCK_STREAM, 0);
+	if (sock == INVALID_SOCKET)
+		return -ofi_sockerr();
+
+	ret = tcpx_setup_socket(sock);
+	if (ret)
+		goto err;
+
+	ret = fi_fd_nonblock(sock);
+	if (ret)
+		goto err;
+
+	ret = connect(sock, addr, (socklen_t) ofi_sizeofaddr(addr));
+	if (ret && !OFI_SOCK_TRY_CONN_AGAIN(ofi_sockerr())) {
+		ret = -ofi_sockerr();
+		goto err;
+	}
+
+	ret = tcpx_rdm_conn_alloc(rdm, sock, TCPX_RDM_CONNECTING, &conn);
+	if (ret)
+		goto err;
+
+	memcpy(&conn->peer, addr, ofi_sizeofaddr(addr));
+	ret = ofi_idm_set(&rdm->conn_map, (int) fi_addr, conn);
+	if (ret < 0) {
+		tcpx_rdm_conn_free(rdm, conn);
+		return -FI_ENOMEM;
+	}
+
+	conn->fi_addr = fi_addr;
+	*conn_ptr = conn;
+	return FI_SUCCESS;
+err:
+	ofi_close_socket(sock);
+	return ret;
+}
+
+/*
+ * A peer that connected to us first is sent to over its connection.
+ * Otherwise, a connection is opened and transfers queue up on it until
+ * the peer has accepted.
+ */
+static int tcpx_rdm_get_conn(struct tcpx_rdm *rdm, fi_addr_t fi_addr,
+			     struct tcpx_rdm_conn **conn_ptr)
+{
+	struct tcpx_rdm_conn *conn;
+	struct dlist_entry *entry;
+	void *addr;
+
+	if (fi_addr == FI_ADDR_UNSPEC || fi_addr > OFI_IDX_MAX_INDEX)
+		return -FI_EINVAL;
+
+	*conn_ptr = ofi_idm_lookup(&rdm->conn_map, (int) fi_addr);
+	if (*conn_ptr)
+		return FI_SUCCESS;
+
+	addr = ofi_av_get_addr(rdm->ep.util_ep.av, fi_addr);
+	dlist_foreach(&rdm->conn_list, entry) {
+		conn = container_of(entry, struct tcpx_rdm_conn, entry);
+		if (conn->state != TCPX_RDM_CONNECTED ||
+		    conn->fi_addr != FI_ADDR_NOTAVAIL ||
+		    memcmp(&conn->peer, addr, rdm->ep.util_ep.av->addrlen))
+			continue;
+
+		if (ofi_idm_set(&rdm->conn_map, (int) fi_addr, conn) < 0)
+			return -FI_ENOMEM;
+
+		conn->fi_addr = fi_addr;
+		*conn_ptr = conn;
+		return FI_SUCCESS;
+	}
+
+	return tcpx_rdm_connect(rdm, fi_addr, conn_ptr);
+}
+
+/*
+ * Transmits are posted on the connection to the peer.  The RDM endpoint
+ * stays locked until tcpx_rdm_tx_end, which also returns the result.
+ */
+static ssize_t tcpx_rdm_tx_start(struct fid_ep *ep_fid, fi_addr_t addr,
+				 struct tcpx_rdm_conn **conn)
+{
+	struct tcpx_rdm *rdm;
+
+	rdm = container_of(ep_fid, struct tcpx_rdm, ep.util_ep.ep_fid);
+	fastlock_acquire(&rdm->ep.lock);
+	*conn = NULL;
+	return tcpx_rdm_get_conn(rdm, addr, conn);
+}
+
+static ssize_t tcpx_rdm_tx_end(struct fid_ep *ep_fid,
+			       struct tcpx_rdm_conn *conn, ssize_t ret)
+{
+	struct tcpx_rdm *rdm;
+
+	rdm = container_of(ep_fid, struct tcpx_rdm, ep.util_ep.ep_fid);
+	if (conn && conn->state == TCPX_RDM_CONNECTED)
+		tcpx_rdm_conn_update_pend(rdm, conn);
+	fastlock_release(&rdm->ep.lock);
+	return ret;
+}
+
+static ssize_t tcpx_rdm_recv(struct fid_ep *ep_fid, void *buf, size_t len,
+			     void *desc, fi_addr_t src_addr, void *context)
+{
+	return tcpx_msg_ops.recv(ep_fid, buf, len, desc, src_addr, context);
+}
+
+static ssize_t tcpx_rdm_recvv(struct fid_ep *ep_fid, const struct iovec *iov,
+			      void **desc, size_t count, fi_addr_t src_addr,
+			      void *context)
+{
+	return tcpx_msg_ops.recvv(ep_fid, iov, desc, count, src_addr, context);
+}
+
+static ssize_t tcpx_rdm_recvmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
+				uint64_t flags)
+{
+	return tcpx_msg_ops.recvmsg(ep_fid, msg, flags);
+}
+
+static ssize_t tcpx_rdm_send(struct fid_ep *ep_fid, const void *buf,
+			     size_t len, void *desc, fi_addr_t dest_addr,
+			     void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_send(&conn->ep.util_ep.ep_fid, buf, len, desc,
+			      dest_addr, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_sendv(struct fid_ep *ep_fid, const struct iovec *iov,
+			      void **desc, size_t count, fi_addr_t dest_addr,
+			      void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_sendv(&conn->ep.util_ep.ep_fid, iov, desc, count,
+			       dest_addr, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_sendmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
+				uint64_t flags)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, msg->addr, &conn);
+	if (!ret)
+		ret = fi_sendmsg(&conn->ep.util_ep.ep_fid, msg, flags);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_inject(struct fid_ep *ep_fid, const void *buf,
+			       size_t len, fi_addr_t dest_addr)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_inject(&conn->ep.util_ep.ep_fid, buf, len, dest_addr);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_senddata(struct fid_ep *ep_fid, const void *buf,
+				 size_t len, void *desc, uint64_t data,
+				 fi_addr_t dest_addr, void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_senddata(&conn->ep.util_ep.ep_fid, buf, len, desc,
+				  data, dest_addr, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_injectdata(struct fid_ep *ep_fid, const void *buf,
+				   size_t len, uint64_t data,
+				   fi_addr_t dest_addr)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_injectdata(&conn->ep.util_ep.ep_fid, buf, len, data,
+				    dest_addr);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static struct fi_ops_msg tcpx_rdm_msg_ops = {
+	.size = sizeof(struct fi_ops_msg),
+	.recv = tcpx_rdm_recv,
+	.recvv = tcpx_rdm_recvv,
+	.recvmsg = tcpx_rdm_recvmsg,
+	.send = tcpx_rdm_send,
+	.sendv = tcpx_rdm_sendv,
+	.sendmsg = tcpx_rdm_sendmsg,
+	.inject = tcpx_rdm_inject,
+	.senddata = tcpx_rdm_senddata,
+	.injectdata = tcpx_rdm_injectdata,
+};
+
+static ssize_t tcpx_rdm_trecv(struct fid_ep *ep_fid, void *buf, size_t len,
+			      void *desc, fi_addr_t src_addr, uint64_t tag,
+			      uint64_t ignore, void *context)
+{
+	return tcpx_tagged_ops.recv(ep_fid, buf, len, desc, src_addr, tag,
+				    ignore, context);
+}
+
+static ssize_t tcpx_rdm_trecvv(struct fid_ep *ep_fid, const struct iovec *iov,
+			       void **desc, size_t count, fi_addr_t src_addr,
+			       uint64_t tag, uint64_t ignore, void *context)
+{
+	return tcpx_tagged_ops.recvv(ep_fid, iov, desc, count, src_addr, tag,
+				     ignore, context);
+}
+
+static ssize_t tcpx_rdm_trecvmsg(struct fid_ep *ep_fid,
+				 const struct fi_msg_tagged *msg,
+				 uint64_t flags)
+{
+	return tcpx_tagged_ops.recvmsg(ep_fid, msg, flags);
+}
+
+static ssize_t tcpx_rdm_tsend(struct fid_ep *ep_fid, const void *buf,
+			      size_t len, void *desc, fi_addr_t dest_addr,
+			      uint64_t tag, void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_tsend(&conn->ep.util_ep.ep_fid, buf, len, desc,
+			       dest_addr, tag, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_tsendv(struct fid_ep *ep_fid, const struct iovec *iov,
+			       void **desc, size_t count, fi_addr_t dest_addr,
+			       uint64_t tag, void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_tsendv(&conn->ep.util_ep.ep_fid, iov, desc, count,
+				dest_addr, tag, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_tsendmsg(struct fid_ep *ep_fid,
+				 const struct fi_msg_tagged *msg,
+				 uint64_t flags)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, msg->addr, &conn);
+	if (!ret)
+		ret = fi_tsendmsg(&conn->ep.util_ep.ep_fid, msg, flags);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_tinject(struct fid_ep *ep_fid, const void *buf,
+				size_t len, fi_addr_t dest_addr, uint64_t tag)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_tinject(&conn->ep.util_ep.ep_fid, buf, len,
+				 dest_addr, tag);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_tsenddata(struct fid_ep *ep_fid, const void *buf,
+				  size_t len, void *desc, uint64_t data,
+				  fi_addr_t dest_addr, uint64_t tag,
+				  void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_tsenddata(&conn->ep.util_ep.ep_fid, buf, len, desc,
+				   data, dest_addr, tag, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_tinjectdata(struct fid_ep *ep_fid, const void *buf,
+				    size_t len, uint64_t data,
+				    fi_addr_t dest_addr, uint64_t tag)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_tinjectdata(&conn->ep.util_ep.ep_fid, buf, len, data,
+				     dest_addr, tag);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static struct fi_ops_tagged tcpx_rdm_tagged_ops = {
+	.size = sizeof(struct fi_ops_tagged),
+	.recv = tcpx_rdm_trecv,
+	.recvv = tcpx_rdm_trecvv,
+	.recvmsg = tcpx_rdm_trecvmsg,
+	.send = tcpx_rdm_tsend,
+	.sendv = tcpx_rdm_tsendv,
+	.sendmsg = tcpx_rdm_tsendmsg,
+	.inject = tcpx_rdm_tinject,
+	.senddata = tcpx_rdm_tsenddata,
+	.injectdata = tcpx_rdm_tinjectdata,
+};
+
+static ssize_t tcpx_rdm_read(struct fid_ep *ep_fid, void *buf, size_t len,
+			     void *desc, fi_addr_t src_addr, uint64_t addr,
+			     uint64_t key, void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, src_addr, &conn);
+	if (!ret)
+		ret = fi_read(&conn->ep.util_ep.ep_fid, buf, len, desc,
+			      src_addr, addr, key, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_readv(struct fid_ep *ep_fid, const struct iovec *iov,
+			      void **desc, size_t count, fi_addr_t src_addr,
+			      uint64_t addr, uint64_t key, void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, src_addr, &conn);
+	if (!ret)
+		ret = fi_readv(&conn->ep.util_ep.ep_fid, iov, desc, count,
+			       src_addr, addr, key, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_readmsg(struct fid_ep *ep_fid,
+				const struct fi_msg_rma *msg, uint64_t flags)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, msg->addr, &conn);
+	if (!ret)
+		ret = fi_readmsg(&conn->ep.util_ep.ep_fid, msg, flags);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_write(struct fid_ep *ep_fid, const void *buf,
+			      size_t len, void *desc, fi_addr_t dest_addr,
+			      uint64_t addr, uint64_t key, void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_write(&conn->ep.util_ep.ep_fid, buf, len, desc,
+			       dest_addr, addr, key, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_writev(struct fid_ep *ep_fid, const struct iovec *iov,
+			       void **desc, size_t count, fi_addr_t dest_addr,
+			       uint64_t addr, uint64_t key, void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_writev(&conn->ep.util_ep.ep_fid, iov, desc, count,
+				dest_addr, addr, key, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_writemsg(struct fid_ep *ep_fid,
+				 const struct fi_msg_rma *msg, uint64_t flags)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, msg->addr, &conn);
+	if (!ret)
+		ret = fi_writemsg(&conn->ep.util_ep.ep_fid, msg, flags);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_inject_write(struct fid_ep *ep_fid, const void *buf,
+				     size_t len, fi_addr_t dest_addr,
+				     uint64_t addr, uint64_t key)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_inject_write(&conn->ep.util_ep.ep_fid, buf, len,
+				      dest_addr, addr, key);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_writedata(struct fid_ep *ep_fid, const void *buf,
+				  size_t len, void *desc, uint64_t data,
+				  fi_addr_t dest_addr, uint64_t addr,
+				  uint64_t key, void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_writedata(&conn->ep.util_ep.ep_fid, buf, len, desc,
+				   data, dest_addr, addr, key, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_inject_writedata(struct fid_ep *ep_fid,
+					 const void *buf, size_t len,
+					 uint64_t data, fi_addr_t dest_addr,
+					 uint64_t addr, uint64_t key)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_inject_writedata(&conn->ep.util_ep.ep_fid, buf, len,
+					  data, dest_addr, addr, key);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static struct fi_ops_rma tcpx_rdm_rma_ops = {
+	.size = sizeof(struct fi_ops_rma),
+	.read = tcpx_rdm_read,
+	.readv = tcpx_rdm_readv,
+	.readmsg = tcpx_rdm_readmsg,
+	.write = tcpx_rdm_write,
+	.writev = tcpx_rdm_writev,
+	.writemsg = tcpx_rdm_writemsg,
+	.inject = tcpx_rdm_inject_write,
+	.writedata = tcpx_rdm_writedata,
+	.injectdata = tcpx_rdm_inject_writedata,
+};
+
+static ssize_t tcpx_rdm_atomic(struct fid_ep *ep_fid, const void *buf,
+			       size_t count, void *desc, fi_addr_t dest_addr,
+			       uint64_t addr, uint64_t key,
+			       enum fi_datatype datatype, enum fi_op op,
+			       void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_atomic(&conn->ep.util_ep.ep_fid, buf, count, desc,
+				dest_addr, addr, key, datatype, op, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_atomicv(struct fid_ep *ep_fid,
+				const struct fi_ioc *iov, void **desc,
+				size_t count, fi_addr_t dest_addr,
+				uint64_t addr, uint64_t key,
+				enum fi_datatype datatype, enum fi_op op,
+				void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_atomicv(&conn->ep.util_ep.ep_fid, iov, desc, count,
+				 dest_addr, addr, key, datatype, op, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_atomicmsg(struct fid_ep *ep_fid,
+				  const struct fi_msg_atomic *msg,
+				  uint64_t flags)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, msg->addr, &conn);
+	if (!ret)
+		ret = fi_atomicmsg(&conn->ep.util_ep.ep_fid, msg, flags);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_inject_atomic(struct fid_ep *ep_fid, const void *buf,
+				      size_t count, fi_addr_t dest_addr,
+				      uint64_t addr, uint64_t key,
+				      enum fi_datatype datatype, enum fi_op op)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_inject_atomic(&conn->ep.util_ep.ep_fid, buf, count,
+				       dest_addr, addr, key, datatype, op);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_fetch_atomic(struct fid_ep *ep_fid, const void *buf,
+				     size_t count, void *desc, void *result,
+				     void *result_desc, fi_addr_t dest_addr,
+				     uint64_t addr, uint64_t key,
+				     enum fi_datatype datatype, enum fi_op op,
+				     void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_fetch_atomic(&conn->ep.util_ep.ep_fid, buf, count,
+				      desc, result, result_desc, dest_addr,
+				      addr, key, datatype, op, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_fetch_atomicv(struct fid_ep *ep_fid,
+				      const struct fi_ioc *iov, void **desc,
+				      size_t count, struct fi_ioc *resultv,
+				      void **result_desc, size_t result_count,
+				      fi_addr_t dest_addr, uint64_t addr,
+				      uint64_t key, enum fi_datatype datatype,
+				      enum fi_op op, void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_fetch_atomicv(&conn->ep.util_ep.ep_fid, iov, desc,
+				       count, resultv, result_desc,
+				       result_count, dest_addr, addr, key,
+				       datatype, op, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_fetch_atomicmsg(struct fid_ep *ep_fid,
+					const struct fi_msg_atomic *msg,
+					struct fi_ioc *resultv,
+					void **result_desc,
+					size_t result_count, uint64_t flags)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, msg->addr, &conn);
+	if (!ret)
+		ret = fi_fetch_atomicmsg(&conn->ep.util_ep.ep_fid, msg,
+					 resultv, result_desc, result_count,
+					 flags);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_compare_atomic(struct fid_ep *ep_fid,
+				       const void *buf, size_t count,
+				       void *desc, const void *compare,
+				       void *compare_desc, void *result,
+				       void *result_desc, fi_addr_t dest_addr,
+				       uint64_t addr, uint64_t key,
+				       enum fi_datatype datatype,
+				       enum fi_op op, void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_compare_atomic(&conn->ep.util_ep.ep_fid, buf, count,
+					desc, compare, compare_desc, result,
+					result_desc, dest_addr, addr, key,
+					datatype, op, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_compare_atomicv(struct fid_ep *ep_fid,
+					const struct fi_ioc *iov, void **desc,
+					size_t count,
+					const struct fi_ioc *comparev,
+					void **compare_desc,
+					size_t compare_count,
+					struct fi_ioc *resultv,
+					void **result_desc,
+					size_t result_count,
+					fi_addr_t dest_addr, uint64_t addr,
+					uint64_t key,
+					enum fi_datatype datatype,
+					enum fi_op op, void *context)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, dest_addr, &conn);
+	if (!ret)
+		ret = fi_compare_atomicv(&conn->ep.util_ep.ep_fid, iov, desc,
+					 count, comparev, compare_desc,
+					 compare_count, resultv, result_desc,
+					 result_count, dest_addr, addr, key,
+					 datatype, op, context);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static ssize_t tcpx_rdm_compare_atomicmsg(struct fid_ep *ep_fid,
+					  const struct fi_msg_atomic *msg,
+					  const struct fi_ioc *comparev,
+					  void **compare_desc,
+					  size_t compare_count,
+					  struct fi_ioc *resultv,
+					  void **result_desc,
+					  size_t result_count, uint64_t flags)
+{
+	struct tcpx_rdm_conn *conn;
+	ssize_t ret;
+
+	ret = tcpx_rdm_tx_start(ep_fid, msg->addr, &conn);
+	if (!ret)
+		ret = fi_compare_atomicmsg(&conn->ep.util_ep.ep_fid, msg,
+					   comparev, compare_desc,
+					   compare_count, resultv,
+					   result_desc, result_count, flags);
+	return tcpx_rdm_tx_end(ep_fid, conn, ret);
+}
+
+static int tcpx_rdm_atomic_valid(struct fid_ep *ep_fid,
+				 enum fi_datatype datatype, enum fi_op op,
+				 size_t *count)
+{
+	return tcpx_atomic_ops.writevalid(ep_fid, datatype, op, count);
+}
+
+static int tcpx_rdm_atomic_fetch_valid(struct fid_ep *ep_fid,
+				       enum fi_datatype datatype,
+				       enum fi_op op, size_t *count)
+{
+	return tcpx_atomic_ops.readwritevalid(ep_fid, datatype, op, count);
+}
+
+static int tcpx_rdm_atomic_comp_valid(struct fid_ep *ep_fid,
+				      enum fi_datatype datatype,
+				      enum fi_op op, size_t *count)
+{
+	return tcpx_atomic_ops.compwritevalid(ep_fid, datatype, op, count);
+}
+
+static struct fi_ops_atomic tcpx_rdm_atomic_ops = {
+	.size = sizeof(struct fi_ops_atomic),
+	.write = tcpx_rdm_atomic,
+	.writev = tcpx_rdm_atomicv,
+	.writemsg = tcpx_rdm_atomicmsg,
+	.inject = tcpx_rdm_inject_atomic,
+	.readwrite = tcpx_rdm_fetch_atomic,
+	.readwritev = tcpx_rdm_fetch_atomicv,
+	.readwritemsg = tcpx_rdm_fetch_atomicmsg,
+	.compwrite = tcpx_rdm_compare_atomic,
+	.compwritev = tcpx_rdm_compare_atomicv,
+	.compwritemsg = tcpx_rdm_compare_atomicmsg,
+	.writevalid = tcpx_rdm_atomic_valid,
+	.readwritevalid = tcpx_rdm_atomic_fetch_valid,
+	.compwritevalid = tcpx_rdm_atomic_comp_valid,
+};
+
+static int tcpx_rdm_getname(fid_t fid, void *addr, size_t *addrlen)
+{
+	struct tcpx_rdm *rdm;
+	size_t addrlen_in = *addrlen;
+
+	rdm = container_of(fid, struct tcpx_rdm, ep.util_ep.ep_fid.fid);
+	*addrlen = sizeof(rdm->addr);
+	memcpy(addr, &rdm->addr, MIN(addrlen_in, *addrlen));
+
+	return (addrlen_in < *addrlen) ? -FI_ETOOSMALL : FI_SUCCESS;
+}
+
+static struct fi_ops_cm tcpx_rdm_cm_ops = {
+	.size = sizeof(struct fi_ops_cm),
+	.setname = fi_no_setname,
+	.getname = tcpx_rdm_getname,
+	.getpeer = fi_no_getpeer,
+	.connect = fi_no_connect,
+	.listen = fi_no_listen,
+	.accept = fi_no_accept,
+	.reject = fi_no_reject,
+	.shutdown = fi_no_shutdown,
+	.join = fi_no_join,
+};
+
+/* Lets a thread block on a CQ only if all connections wait for data */
+static int tcpx_rdm_try_func(void *arg)
+{
+	struct tcpx_rdm *rdm = arg;
+	int ret;
+
+	fastlock_acquire(&rdm->ep.lock);
+	ret = dlist_empty(&rdm->pend_list) ? FI_SUCCESS : -FI_EAGAIN;
+	fastlock_release(&rdm->ep.lock);
+	return ret;
+}
+
+static int tcpx_rdm_wait_add(struct tcpx_rdm *rdm)
+{
+#ifdef HAVE_EPOLL
+	struct util_wait *rx_wait = rdm->ep.util_ep.rx_cq->wait;
+	struct util_wait *tx_wait = rdm->ep.util_ep.tx_cq->wait;
+	int ret;
+
+	if (rx_wait) {
+		ret = ofi_wait_fd_add(rx_wait, rdm->epoll, FI_EPOLL_IN,
+				      tcpx_rdm_try_func, rdm, NULL);
+		if (ret)
+			return ret;
+	}
+
+	if (tx_wait) {
+		ret = ofi_wait_fd_add(tx_wait, rdm->epoll, FI_EPOLL_IN,
+				      tcpx_rdm_try_func, rdm, NULL);
+		if (ret && rx_wait)
+			ofi_wait_fd_del(rx_wait, rdm->epoll);
+		return ret;
+	}
+	return FI_SUCCESS;
+#else
+	if (rdm->ep.util_ep.rx_cq->wait || rdm->ep.util_ep.tx_cq->wait)
+		return -FI_ENOSYS;
+	return FI_SUCCESS;
+#endif
+}
+
+static void tcpx_rdm_wait_del(struct tcpx_rdm *rdm)
+{
+#ifdef HAVE_EPOLL
+	if (rdm->ep.util_ep.rx_cq->wait)
+		ofi_wait_fd_del(rdm->ep.util_ep.rx_cq->wait, rdm->epoll);
+	if (rdm->ep.util_ep.tx_cq->wait)
+		ofi_wait_fd_del(rdm->ep.util_ep.tx_cq->wait, rdm->epoll);
+#endif
+}
+
+static int tcpx_rdm_enable(struct tcpx_rdm *rdm)
+{
+	int ret;
+
+	if (!rdm->ep.util_ep.rx_cq || !rdm->ep.util_ep.tx_cq)
+		return -FI_ENOCQ;
+
+	if (!rdm->ep.util_ep.av)
+		return -FI_ENOAV;
+
+	if (rdm->ep.cm_state != TCPX_EP_CONNECTING)
+		return -FI_EOPBADSTATE;
+
+	if (listen(rdm->listen_sock, SOMAXCONN)) {
+		FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+			"socket listen failed\n");
+		return -ofi_sockerr();
+	}
+
+	ret = fi_epoll_add(rdm->epoll, rdm->listen_sock, FI_EPOLL_IN, rdm);
+	if (ret)
+		return ret;
+
+	ret = tcpx_rdm_wait_add(rdm);
+	if (ret) {
+		fi_epoll_del(rdm->epoll, rdm->listen_sock);
+		return ret;
+	}
+
+	rdm->ep.cm_state = TCPX_EP_CONNECTED;
+	return FI_SUCCESS;
+}
+
+static int tcpx_rdm_ctrl(struct fid *fid, int command, void *arg)
+{
+	struct tcpx_rdm *rdm;
+
+	rdm = container_of(fid, struct tcpx_rdm, ep.util_ep.ep_fid.fid);
+	switch (command) {
+	case FI_ENABLE:
+		return tcpx_rdm_enable(rdm);
+	default:
+		return -FI_ENOSYS;
+	}
+}
+
+static int tcpx_rdm_bind(struct fid *fid, struct fid *bfid, uint64_t flags)
+{
+	struct tcpx_rdm *rdm;
+
+	rdm = container_of(fid, struct tcpx_rdm, ep.util_ep.ep_fid.fid);
+	if (bfid->fclass == FI_CLASS_SRX_CTX)
+		return -FI_ENOSYS;
+
+	return ofi_ep_bind(&rdm->ep.util_ep, bfid, flags);
+}
+
+static int tcpx_rdm_close(struct fid *fid)
+{
+	struct tcpx_rdm *rdm;
+	struct tcpx_rdm_conn *conn;
+
+	rdm = container_of(fid, struct tcpx_rdm, ep.util_ep.ep_fid.fid);
+	if (rdm->ep.cm_state == TCPX_EP_CONNECTED)
+		tcpx_rdm_wait_del(rdm);
+
+	/* unexpected messages refer to the connections they came in on */
+	tcpx_ep_tx_rx_queues_release(&rdm->ep);
+	while (!dlist_empty(&rdm->conn_list)) {
+		conn = container_of(rdm->conn_list.next, struct tcpx_rdm_conn,
+				    entry);
+		tcpx_rdm_conn_free(rdm, conn);
+	}
+	while (!dlist_empty(&rdm->free_list)) {
+		conn = container_of(rdm->free_list.next, struct tcpx_rdm_conn,
+				    entry);
+		tcpx_rdm_conn_free(rdm, conn);
+	}
+
+	ofi_close_socket(rdm->listen_sock);
+	fi_epoll_close(rdm->epoll);
+	ofi_idm_reset(&rdm->conn_map);
+	ofi_match_queue_close(&rdm->ep.trecv_queue);
+	ofi_match_queue_close(&rdm->ep.unexp_queue);
+	ofi_endpoint_close(&rdm->ep.util_ep);
+	fastlock_destroy(&rdm->ep.lock);
+
+	free(rdm);
+	return 0;
+}
+
+static struct fi_ops tcpx_rdm_fi_ops = {
+	.size = sizeof(struct fi_ops),
+	.close = tcpx_rdm_close,
+	.bind = tcpx_rdm_bind,
+	.control = tcpx_rdm_ctrl,
+	.ops_open = fi_no_ops_open,
+};
+
+static struct fi_ops_ep tcpx_rdm_ep_ops = {
+	.size = sizeof(struct fi_ops_ep),
+	.cancel = fi_no_cancel,
+	.getopt = fi_no_getopt,
+	.setopt = fi_no_setopt,
+	.tx_ctx = fi_no_tx_ctx,
+	.rx_ctx = fi_no_rx_ctx,
+	.rx_size_left = fi_no_rx_size_left,
+	.tx_size_left = fi_no_tx_size_left,
+};
+
+/*
+ * The endpoint listens on its source address, or on an address that can
+ * reach the destination it was opened for.  Peers learn the address from
+ * fi_getname and connect to it.
+ */
+static int tcpx_rdm_listen_init(struct tcpx_rdm *rdm, struct fi_info *info)
+{
+	union ofi_sock_ip addr;
+	socklen_t len;
+	void *src_addr;
+	size_t src_addrlen;
+	int ret;
+
+	memset(&addr, 0, sizeof(addr));
+	if (info->src_addr) {
+		memcpy(&addr, info->src_addr,
+		       MIN(info->src_addrlen, sizeof(addr)));
+	} else if (info->dest_addr &&
+		   !ofi_get_src_addr(info->addr_format, info->dest_addr,
+				     info->dest_addrlen, &src_addr,
+				     &src_addrlen)) {
+		memcpy(&addr, src_addr, MIN(src_addrlen, sizeof(addr)));
+		free(src_addr);
+	} else {
+		addr.sin.sin_family = AF_INET;
+		addr.sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	}
+
+	rdm->listen_sock = ofi_socket(addr.sa.sa_family, SOCK_STREAM, 0);
+	if (rdm->listen_sock == INVALID_SOCKET)
+		return -ofi_sockerr();
+
+	ret = tcpx_setup_socket(rdm->listen_sock);
+	if (ret)
+		goto err;
+
+	ret = fi_fd_nonblock(rdm->listen_sock);
+	if (ret)
+		goto err;
+
+	if (bind(rdm->listen_sock, &addr.sa,
+		 (socklen_t) ofi_sizeofaddr(&addr.sa))) {
+		FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL, "failed to bind listener\n");
+		ret = -ofi_sockerr();
+		goto err;
+	}
+
+	len = sizeof(rdm->addr);
+	memset(&rdm->addr, 0, sizeof(rdm->addr));
+	if (ofi_getsockname(rdm->listen_sock, &rdm->addr.sa, &len)) {
+		ret = -ofi_sockerr();
+		goto err;
+	}
+	return FI_SUCCESS;
+err:
+	ofi_close_socket(rdm->listen_sock);
+	return ret;
+}
+
+int tcpx_rdm_endpoint(struct fid_domain *domain, struct fi_info *info,
+		      struct fid_ep **ep_fid, void *context)
+{
+	struct tcpx_rdm *rdm;
+	int ret;
+
+	rdm = calloc(1, sizeof(*rdm));
+	if (!rdm)
+		return -FI_ENOMEM;
+
+	ret = ofi_endpoint_init(domain, &tcpx_util_prov, info,
+				&rdm->ep.util_ep, context, tcpx_rdm_progress);
+	if (ret)
+		goto err1;
+
+	rdm->ep.max_msg_size = info->ep_attr->max_msg_size;
+
+	ret = fastlock_init(&rdm->ep.lock);
+	if (ret)
+		goto err2;
+
+	slist_init(&rdm->ep.rx_queue);
+	slist_init(&rdm->ep.tx_queue);
+	slist_init(&rdm->ep.rma_read_queue);
+	slist_init(&rdm->ep.tx_rsp_pend_queue);
+	slist_init(&rdm->ep.tx_zc_queue);
+
+	ret = ofi_match_queue_init(&rdm->ep.trecv_queue, info->rx_attr->size);
+	if (ret)
+		goto err3;
+
+	ret = ofi_match_queue_init(&rdm->ep.unexp_queue, info->rx_attr->size);
+	if (ret)
+		goto err4;
+
+	ret = fi_epoll_create(&rdm->epoll);
+	if (ret)
+		goto err5;
+
+	ret = tcpx_rdm_listen_init(rdm, info);
+	if (ret)
+		goto err6;
+
+	rdm->ep.conn_fd = INVALID_SOCKET;
+	rdm->ep.cm_state = TCPX_EP_CONNECTING;
+	dlist_init(&rdm->conn_list);
+	dlist_init(&rdm->pend_list);
+	dlist_init(&rdm->free_list);
+
+	*ep_fid = &rdm->ep.util_ep.ep_fid;
+	(*ep_fid)->fid.ops = &tcpx_rdm_fi_ops;
+	(*ep_fid)->ops = &tcpx_rdm_ep_ops;
+	(*ep_fid)->cm = &tcpx_rdm_cm_ops;
+	(*ep_fid)->msg = &tcpx_rdm_msg_ops;
+	(*ep_fid)->rma = &tcpx_rdm_rma_ops;
+	(*ep_fid)->atomic = &tcpx_rdm_atomic_ops;
+	(*ep_fid)->tagged = &tcpx_rdm_tagged_ops;
+	return 0;
+err6:
+	fi_epoll_close(rdm->epoll);
+err5:
+	ofi_match_queue_close(&rdm->ep.unexp_queue);
+err4:
+	ofi_match_queue_close(&rdm->ep.trecv_queue);
+err3:
+	fastlock_destroy(&rdm->ep.lock);
+err2:
+	ofi_endpoint_close(&rdm->ep.util_ep);
+err1:
+	free(rdm);
+	return ret;
+}
@@ -200,13 +200,10 @@ static ssize_t tcpx_rma_writemsg(struct fid_ep *ep, const struct fi_msg_rma *msg
 
 	if (flags & FI_INJECT) {
 		ofi_copy_iov_buf(msg->msg_iov, msg->iov_count, 0,
-				 send_entry->msg_data.inject,
+				 send_entry->inject,
 				 data_len,
 				 OFI_COPY_IOV_TO_BUF);
-
-		send_entry->msg_data.iov[1].iov_base = (void *)send_entry->msg_data.inject;
-		send_entry->msg_data.iov[1].iov_len = data_len;
-		send_entry->msg_data.iov_cnt++;
+		tcpx_inject_iov(send_entry, data_len);
 	} else {
 		memcpy(&send_entry->msg_data.iov[1], &msg->msg_iov[0],
 		       msg->iov_count * sizeof(struct iovec));
@@ -335,7 +332,6 @@ static ssize_t tcpx_rma_inject_common(struct fid_ep *ep, const void *buf,
 	if (!send_entry)
 		return -FI_EAGAIN;
 
-	assert(len <= TCPX_MAX_INJECT_SZ);
 	send_entry->msg_hdr.hdr.size = htonll(len + sizeof(send_entry->msg_hdr));
 	send_entry->msg_hdr.hdr.flags = 0;
 
@@ -344,14 +340,8 @@ static ssize_t tcpx_rma_inject_common(struct fid_ep *ep, const void *buf,
 	send_entry->msg_hdr.rma_iov[0].len = len;
 	send_entry->msg_hdr.rma_iov_cnt = 1;
 
-	send_entry->msg_data.iov[0].iov_base = (void *) &send_entry->msg_hdr;
-	send_entry->msg_data.iov[0].iov_len = sizeof(send_entry->msg_hdr);
-
-	memcpy(send_entry->msg_data.inject, (uint8_t *)buf, len);
-	send_entry->msg_data.iov[1].iov_base = (void *)send_entry->msg_data.inject;
-	send_entry->msg_data.iov[1].iov_len = len;
-
-	send_entry->msg_data.iov_cnt = 2;
+	memcpy(send_entry->inject, (uint8_t *)buf, len);
+	tcpx_inject_iov(send_entry, len);
 
 	if (flags & FI_REMOTE_CQ_DATA) {
 		send_entry->msg_hdr.hdr.flags |= OFI_REMOTE_CQ_DATA;
@@ -0,0 +1,561 @@
+/*
+ * Copyright (c) 2019 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *	   Redistribution and use in source and binary forms, with or
+ *	   without modification, are permitted provided that the following
+ *	   conditions are met:
+ *
+ *		- Redistributions of source code must retain the above
+ *		  copyright notice, this list of conditions and the following
+ *		  disclaimer.
+ *
+ *		- Redistributions in binary form must reproduce the above
+ *		  copyright notice, this list of conditions and the following
+ *		  disclaimer in the documentation and/or other materials
+ *		  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <rdma/fi_errno.h>
+#include <ofi_prov.h>
+#include <sys/types.h>
+#include <ofi_util.h>
+#include <ofi_iov.h>
+#include "tcpx.h"
+
+/*
+ * Large transfers of a msg endpoint may be split across extra connections
+ * to the same peer, which lets the kernel spread the data over several
+ * TCP streams.  The active side asks for stripe sockets in its connection
+ * request, and the passive side grants them with the port of a listening
+ * socket of the endpoint, which the active side connects to before it
+ * reports the connection.
+ *
+ * The header and the first chunk of a striped transfer are sent on the
+ * primary socket, and every stripe socket carries one more chunk with a
+ * header of its own that gives its offset in the payload.  Only the
+ * transfer at the head of the tx queue is striped, and the primary socket
+ * does not move on to the next message before all chunks were received,
+ * so message ordering is kept.
+ */
+
+static struct tcpx_stripes *tcpx_stripe_alloc(size_t cnt)
+{
+	struct tcpx_stripes *stripes;
+	size_t i;
+
+	stripes = calloc(1, sizeof(*stripes) + cnt * sizeof(*stripes->sock));
+	if (!stripes)
+		return NULL;
+
+	stripes->listen_sock = INVALID_SOCKET;
+	stripes->cnt = cnt;
+	for (i = 0; i < cnt; i++)
+		stripes->sock[i].sock = INVALID_SOCKET;
+	return stripes;
+}
+
+void tcpx_stripe_close(struct tcpx_ep *ep)
+{
+	struct tcpx_stripes *stripes = ep->stripes;
+	size_t i;
+
+	if (!stripes)
+		return;
+
+	for (i = 0; i < stripes->conn_cnt; i++)
+		ofi_close_socket(stripes->sock[i].sock);
+	if (stripes->listen_sock != INVALID_SOCKET)
+		ofi_close_socket(stripes->listen_sock);
+	free(stripes);
+	ep->stripes = NULL;
+}
+
+int tcpx_stripe_listen(struct tcpx_ep *ep, size_t cnt, uint16_t *port)
+{
+	union ofi_sock_ip addr;
+	socklen_t len = sizeof(addr);
+	int ret;
+
+	ep->stripes = tcpx_stripe_alloc(cnt);
+	if (!ep->stripes)
+		return -FI_ENOMEM;
+
+	if (getsockname(ep->conn_fd, &addr.sa, &len))
+		goto err;
+
+	ep->stripes->listen_sock = ofi_socket(addr.sa.sa_family,
+					      SOCK_STREAM, 0);
+	if (ep->stripes->listen_sock == INVALID_SOCKET)
+		goto err;
+
+	ofi_addr_set_port(&addr.sa, 0);
+	if (bind(ep->stripes->listen_sock, &addr.sa, len) ||
+	    listen(ep->stripes->listen_sock, (int) cnt) ||
+	    getsockname(ep->stripes->listen_sock, &addr.sa, &len))
+		goto err;
+
+	ret = fi_fd_nonblock(ep->stripes->listen_sock);
+	if (ret)
+		goto close;
+
+	*port = ofi_addr_get_port(&addr.sa);
+	return FI_SUCCESS;
+err:
+	ret = -ofi_sockerr();
+close:
+	tcpx_stripe_close(ep);
+	return ret;
+}
+
+int tcpx_stripe_connect(struct tcpx_ep *ep, size_t cnt, uint16_t port)
+{
+	union ofi_sock_ip addr;
+	socklen_t len = sizeof(addr);
+	SOCKET sock;
+	int ret;
+
+	ep->stripes = tcpx_stripe_alloc(cnt);
+	if (!ep->stripes)
+		return -FI_ENOMEM;
+
+	if (getpeername(ep->conn_fd, &addr.sa, &len)) {
+		ret = -ofi_sockerr();
+		goto err;
+	}
+
+	/* the peer is listening, so the connects complete without it */
+	ofi_addr_set_port(&addr.sa, port);
+	while (ep->stripes->conn_cnt < cnt) {
+		sock = ofi_socket(addr.sa.sa_family, SOCK_STREAM, 0);
+		if (sock == INVALID_SOCKET) {
+			ret = -ofi_sockerr();
+			goto err;
+		}
+
+		ep->stripes->sock[ep->stripes->conn_cnt++].sock = sock;
+		ret = tcpx_setup_socket(sock);
+		if (ret)
+			goto err;
+
+		if (connect(sock, &addr.sa, len)) {
+			ret = -ofi_sockerr();
+			goto err;
+		}
+
+		ret = fi_fd_nonblock(sock);
+		if (ret)
+			goto err;
+	}
+	return FI_SUCCESS;
+err:
+	tcpx_stripe_close(ep);
+	return ret;
+}
+
+static int tcpx_stripe_try(void *arg)
+{
+	struct tcpx_ep *ep = arg;
+	int ret = FI_SUCCESS;
+
+	/* the stripe sockets are not monitored for writability */
+	fastlock_acquire(&ep->lock);
+	if (ep->stripes && ep->stripes->tx_entry)
+		ret = -FI_EAGAIN;
+	fastlock_release(&ep->lock);
+	return ret;
+}
+
+static int tcpx_stripe_sock_wait_add(struct tcpx_ep *ep, SOCKET sock)
+{
+	if (!ep->util_ep.rx_cq->wait)
+		return FI_SUCCESS;
+
+	return ofi_wait_fd_add(ep->util_ep.rx_cq->wait, sock, FI_EPOLL_IN,
+			       tcpx_stripe_try, ep, NULL);
+}
+
+int tcpx_stripe_wait_add(struct tcpx_ep *ep)
+{
+	size_t i;
+	int ret;
+
+	for (i = 0; i < ep->stripes->conn_cnt; i++) {
+		ret = tcpx_stripe_sock_wait_add(ep, ep->stripes->sock[i].sock);
+		if (ret)
+			return ret;
+	}
+	return FI_SUCCESS;
+}
+
+void tcpx_stripe_wait_del(struct tcpx_ep *ep)
+{
+	size_t i;
+
+	if (!ep->stripes || !ep->util_ep.rx_cq->wait)
+		return;
+
+	for (i = 0; i < ep->stripes->conn_cnt; i++)
+		ofi_wait_fd_del(ep->util_ep.rx_cq->wait,
+				ep->stripes->sock[i].sock);
+}
+
+/*
+ * The passive side accepts the stripe sockets once they are needed.  The
+ * peer connected them before it reported the connection, so they wait in
+ * the backlog of the listening socket.
+ */
+static void tcpx_stripe_accept(struct tcpx_ep *ep)
+{
+	struct tcpx_stripes *stripes = ep->stripes;
+	union ofi_sock_ip peer, addr;
+	socklen_t len = sizeof(peer);
+	SOCKET sock;
+
+	if (getpeername(ep->conn_fd, &peer.sa, &len))
+		return;
+
+	while (stripes->conn_cnt < stripes->cnt) {
+		len = sizeof(addr);
+		sock = accept(stripes->listen_sock, &addr.sa, &len);
+		if (sock == INVALID_SOCKET)
+			return;
+
+		if (!ofi_equals_ipaddr(&addr.sa, &peer.sa) ||
+		    tcpx_setup_socket(sock) || fi_fd_nonblock(sock) ||
+		    tcpx_stripe_sock_wait_add(ep, sock)) {
+			FI_WARN(&tcpx_prov, FI_LOG_EP_CTRL,
+				"dropping stripe connection\n");
+			ofi_close_socket(sock);
+			continue;
+		}
+		stripes->sock[stripes->conn_cnt++].sock = sock;
+	}
+
+	ofi_close_socket(stripes->listen_sock);
+	stripes->listen_sock = INVALID_SOCKET;
+}
+
+static void tcpx_stripe_iov(struct iovec *dst, size_t *dst_cnt,
+			    const struct iovec *src, size_t src_cnt,
+			    size_t offset, size_t len)
+{
+	memcpy(dst, src, src_cnt * sizeof(*src));
+	*dst_cnt = src_cnt;
+	ofi_consume_iov(dst, dst_cnt, offset);
+	ofi_truncate_iov(dst, dst_cnt, len);
+}
+
+/*
+ * Splits the payload of the transfer at the head of the tx queue into one
+ * chunk for the primary socket and one for each stripe socket.  Zero-copy
+ * sends are not used for striped transfers.
+ */
+bool tcpx_stripe_tx_start(struct tcpx_ep *ep, struct tcpx_xfer_entry *tx_entry)
+{
+	struct tcpx_stripes *stripes = ep->stripes;
+	struct tcpx_stripe_sock *stripe;
+	size_t len, chunk, off, cnt, i;
+
+	if (tx_entry->done_len ||
+	    (tx_entry->msg_hdr.hdr.op != ofi_op_msg &&
+	     tx_entry->msg_hdr.hdr.op != ofi_op_tagged &&
+	     tx_entry->msg_hdr.hdr.op != ofi_op_write))
+		return false;
+
+	/* data sent inline shares iov[0] with the header, see tcpx_inject_iov */
+	len = ntohll(tx_entry->msg_hdr.hdr.size) - sizeof(tx_entry->msg_hdr);
+	if (len <= TCPX_MAX_INJECT_SZ || len < tcpx_stripe_size)
+		return false;
+
+	if (stripes->conn_cnt < stripes->cnt) {
+		tcpx_stripe_accept(ep);
+		if (stripes->conn_cnt < stripes->cnt)
+			return false;
+	}
+
+	cnt = stripes->cnt + 1;
+	chunk = ofi_div_ceil(len, cnt);
+	for (i = 0; i < stripes->cnt; i++) {
+		stripe = &stripes->sock[i];
+		off = MIN(chunk * (i + 1), len);
+
+		stripe->tx_hdr = tx_entry->msg_hdr;
+		stripe->tx_hdr.stripe_off = htonll(off);
+		stripe->tx_hdr.stripe_len = htonll(MIN(chunk, len - off));
+		stripe->tx_iov[0].iov_base = &stripe->tx_hdr;
+		stripe->tx_iov[0].iov_len = sizeof(stripe->tx_hdr);
+		stripe->tx_iov_cnt = 1;
+		stripe->tx_rem = sizeof(stripe->tx_hdr) + MIN(chunk, len - off);
+		if (off == len)
+			continue;
+
+		tcpx_stripe_iov(&stripe->tx_iov[1], &stripe->tx_iov_cnt,
+				&tx_entry->msg_data.iov[1],
+				tx_entry->msg_data.iov_cnt - 1,
+				off, MIN(chunk, len - off));
+		stripe->tx_iov_cnt++;
+	}
+
+	tx_entry->msg_hdr.hdr.flags |= htonl(TCPX_STRIPED);
+	tx_entry->msg_hdr.stripe_off = 0;
+	tx_entry->msg_hdr.stripe_len = htonll(chunk);
+	ofi_truncate_iov(tx_entry->msg_data.iov, &tx_entry->msg_data.iov_cnt,
+			 sizeof(tx_entry->msg_hdr) + chunk);
+	stripes->tx_rem = sizeof(tx_entry->msg_hdr) + chunk;
+	stripes->tx_entry = tx_entry;
+	return true;
+}
+
+static int tcpx_stripe_send(SOCKET sock, struct iovec *iov, size_t *iov_cnt,
+			    size_t *rem)
+{
+	struct msghdr msg = {0};
+	ssize_t bytes_sent;
+
+	msg.msg_iov = iov;
+	msg.msg_iovlen = *iov_cnt;
+	bytes_sent = ofi_sendmsg_tcp(sock, &msg, MSG_NOSIGNAL);
+	if (bytes_sent < 0) {
+		if (OFI_SOCK_TRY_SND_RCV_AGAIN(ofi_sockerr()))
+			return -FI_EAGAIN;
+		return ofi_sockerr() == EPIPE ? -FI_ENOTCONN : -ofi_sockerr();
+	}
+
+	*rem -= bytes_sent;
+	if (*rem) {
+		ofi_consume_iov(iov, iov_cnt, bytes_sent);
+		return -FI_EAGAIN;
+	}
+	return FI_SUCCESS;
+}
+
+void tcpx_stripe_tx_progress(struct tcpx_ep *ep)
+{
+	struct tcpx_stripes *stripes = ep->stripes;
+	struct tcpx_xfer_entry *tx_entry = stripes->tx_entry;
+	struct tcpx_stripe_sock *stripe;
+	bool done = true;
+	size_t i;
+	int ret;
+
+	if (stripes->tx_rem) {
+		ret = tcpx_stripe_send(ep->conn_fd, tx_entry->msg_data.iov,
+				       &tx_entry->msg_data.iov_cnt,
+				       &stripes->tx_rem);
+		if (ret && ret != -FI_EAGAIN)
+			goto err;
+		done = !ret;
+	}
+
+	for (i = 0; i < stripes->cnt; i++) {
+		stripe = &stripes->sock[i];
+		if (!stripe->tx_rem)
+			continue;
+
+		ret = tcpx_stripe_send(stripe->sock, stripe->tx_iov,
+				       &stripe->tx_iov_cnt, &stripe->tx_rem);
+		if (ret && ret != -FI_EAGAIN)
+			goto err;
+		done = done && !ret;
+	}
+
+	if (!done)
+		return;
+
+	tx_entry->done_len = ntohll(tx_entry->msg_hdr.hdr.size);
+	stripes->tx_entry = NULL;
+	tcpx_tx_entry_done(tx_entry, 0);
+	return;
+err:
+	FI_WARN(&tcpx_prov, FI_LOG_DOMAIN, "striped send failed\n");
+	stripes->tx_entry = NULL;
+	ofi_shutdown(ep->conn_fd, SHUT_RDWR);
+	tcpx_ep_shutdown_report(ep, &ep->util_ep.ep_fid.fid);
+	tcpx_tx_entry_done(tx_entry, ret);
+}
+
+/* The first chunk follows the header on the primary socket */
+static int tcpx_stripe_recv_primary(struct tcpx_xfer_entry *rx_entry,
+				    size_t rem_len)
+{
+	struct ofi_ringbuf *sbuf = &rx_entry->ep->stage_buf;
+	ssize_t bytes_recvd;
+
+	if (!ofi_rbempty(sbuf)) {
+		bytes_recvd = tcpx_readv_from_buffer(sbuf,
+						     rx_entry->msg_data.iov,
+						     rx_entry->msg_data.iov_cnt,
+						     rem_len);
+		rx_entry->done_len += bytes_recvd;
+		rem_len -= bytes_recvd;
+		if (!rem_len)
+			return FI_SUCCESS;
+
+		ofi_consume_iov(rx_entry->msg_data.iov,
+				&rx_entry->msg_data.iov_cnt, bytes_recvd);
+	}
+
+	bytes_recvd = ofi_readv_socket(rx_entry->ep->conn_fd,
+				       rx_entry->msg_data.iov,
+				       rx_entry->msg_data.iov_cnt);
+	if (bytes_recvd <= 0)
+		return (bytes_recvd) ? -ofi_sockerr() : -FI_ENOTCONN;
+
+	rx_entry->done_len += bytes_recvd;
+	if ((size_t) bytes_recvd == rem_len)
+		return FI_SUCCESS;
+
+	ofi_consume_iov(rx_entry->msg_data.iov, &rx_entry->msg_data.iov_cnt,
+			bytes_recvd);
+	return -FI_EAGAIN;
+}
+
+static int tcpx_stripe_recv(struct tcpx_stripes *stripes,
+			    struct tcpx_stripe_sock *stripe, size_t len)
+{
+	ssize_t bytes_recvd;
+	size_t off;
+
+	if (stripe->rx_hdr_done < sizeof(stripe->rx_hdr)) {
+		bytes_recvd = ofi_recv_socket(stripe->sock,
+					      (uint8_t *) &stripe->rx_hdr +
+					      stripe->rx_hdr_done,
+					      sizeof(stripe->rx_hdr) -
+					      stripe->rx_hdr_done, 0);
+		if (bytes_recvd <= 0)
+			return (bytes_recvd) ? -ofi_sockerr() : -FI_ENOTCONN;
+
+		stripe->rx_hdr_done += bytes_recvd;
+		if (stripe->rx_hdr_done < sizeof(stripe->rx_hdr))
+			return -FI_EAGAIN;
+
+		off = ntohll(stripe->rx_hdr.stripe_off);
+		stripe->rx_rem = ntohll(stripe->rx_hdr.stripe_len);
+		if (off > len || stripe->rx_rem > len - off ||
+		    stripe->rx_rem > stripes->rx_rem)
+			return -FI_EIO;
+
+		if (stripe->rx_rem)
+			tcpx_stripe_iov(stripe->rx_iov, &stripe->rx_iov_cnt,
+					stripes->rx_iov, stripes->rx_iov_cnt,
+					off, stripe->rx_rem);
+	}
+
+	if (stripe->rx_rem) {
+		bytes_recvd = ofi_readv_socket(stripe->sock, stripe->rx_iov,
+					       stripe->rx_iov_cnt);
+		if (bytes_recvd <= 0)
+			return (bytes_recvd) ? -ofi_sockerr() : -FI_ENOTCONN;
+
+		stripe->rx_rem -= bytes_recvd;
+		stripes->rx_rem -= bytes_recvd;
+		if (stripe->rx_rem) {
+			ofi_consume_iov(stripe->rx_iov, &stripe->rx_iov_cnt,
+					bytes_recvd);
+			return -FI_EAGAIN;
+		}
+	}
+
+	stripe->rx_active = false;
+	return FI_SUCCESS;
+}
+
+/*
+ * Stays the process function of the primary socket until the chunks from
+ * all sockets were received, and then hands the transfer to the function
+ * that completes it.  If a socket fails, the primary socket is shut down,
+ * so that the transfer fails like any other on the connection.
+ */
+static int tcpx_stripe_rx_process(struct tcpx_xfer_entry *rx_entry)
+{
+	struct tcpx_ep *ep = rx_entry->ep;
+	struct tcpx_stripes *stripes = ep->stripes;
+	size_t len, primary_len, i;
+	int ret;
+
+	len = ntohll(rx_entry->msg_hdr.hdr.size) - sizeof(rx_entry->msg_hdr);
+	primary_len = sizeof(rx_entry->msg_hdr) +
+		      ntohll(rx_entry->msg_hdr.stripe_len);
+	if (rx_entry->done_len < primary_len) {
+		ret = tcpx_stripe_recv_primary(rx_entry, primary_len -
+					       rx_entry->done_len);
+		if (ret && !OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
+			goto err;
+	}
+
+	if (stripes->conn_cnt < stripes->cnt)
+		tcpx_stripe_accept(ep);
+
+	for (i = 0; i < stripes->conn_cnt; i++) {
+		if (!stripes->sock[i].rx_active)
+			continue;
+
+		ret = tcpx_stripe_recv(stripes, &stripes->sock[i], len);
+		if (ret && !OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
+			goto err;
+	}
+
+	if (rx_entry->done_len < primary_len || stripes->rx_rem)
+		return -FI_EAGAIN;
+
+	memcpy(rx_entry->msg_data.iov, stripes->rx_iov,
+	       stripes->rx_iov_cnt * sizeof(*stripes->rx_iov));
+	rx_entry->msg_data.iov_cnt = stripes->rx_iov_cnt;
+	rx_entry->done_len = ntohll(rx_entry->msg_hdr.hdr.size);
+	goto done;
+err:
+	FI_WARN(&tcpx_prov, FI_LOG_DOMAIN, "striped recv failed\n");
+	ofi_shutdown(ep->conn_fd, SHUT_RDWR);
+done:
+	stripes->rx_entry = NULL;
+	ep->cur_rx_proc_fn = stripes->rx_proc_fn;
+	return ep->cur_rx_proc_fn(rx_entry);
+}
+
+void tcpx_stripe_rx_start(struct tcpx_ep *ep)
+{
+	struct tcpx_xfer_entry *rx_entry = ep->cur_rx_entry;
+	struct tcpx_stripes *stripes = ep->stripes;
+	size_t len, chunk, i;
+
+	len = ntohll(rx_entry->msg_hdr.hdr.size) - sizeof(rx_entry->msg_hdr);
+	chunk = ntohll(rx_entry->msg_hdr.stripe_len);
+	if (!stripes || chunk > len) {
+		FI_WARN(&tcpx_prov, FI_LOG_DOMAIN,
+			"unexpected striped transfer\n");
+		ofi_shutdown(ep->conn_fd, SHUT_RDWR);
+		return;
+	}
+
+	memcpy(stripes->rx_iov, rx_entry->msg_data.iov,
+	       rx_entry->msg_data.iov_cnt * sizeof(*stripes->rx_iov));
+	stripes->rx_iov_cnt = rx_entry->msg_data.iov_cnt;
+	stripes->rx_rem = len - chunk;
+	ofi_truncate_iov(rx_entry->msg_data.iov, &rx_entry->msg_data.iov_cnt,
+			 chunk);
+
+	for (i = 0; i < stripes->cnt; i++) {
+		stripes->sock[i].rx_hdr_done = 0;
+		stripes->sock[i].rx_rem = 0;
+		stripes->sock[i].rx_active = true;
+	}
+
+	stripes->rx_entry = rx_entry;
+	stripes->rx_proc_fn = ep->cur_rx_proc_fn;
+	ep->cur_rx_proc_fn = tcpx_stripe_rx_process;
+}
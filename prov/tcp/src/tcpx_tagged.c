@@ -0,0 +1,537 @@
+/*
+ * Copyright (c) 2019 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *	   Redistribution and use in source and binary forms, with or
+ *	   without modification, are permitted provided that the following
+ *	   conditions are met:
+ *
+ *		- Redistributions of source code must retain the above
+ *		  copyright notice, this list of conditions and the following
+ *		  disclaimer.
+ *
+ *		- Redistributions in binary form must reproduce the above
+ *		  copyright notice, this list of conditions and the following
+ *		  disclaimer in the documentation and/or other materials
+ *		  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <rdma/fi_errno.h>
+#include "ofi_iov.h"
+#include <ofi_prov.h>
+#include "tcpx.h"
+
+#include <sys/types.h>
+#include <ofi_util.h>
+#include <string.h>
+
+#define TCPX_TRECV_FLAGS (FI_PEEK | FI_CLAIM | FI_DISCARD)
+
+static inline struct tcpx_xfer_entry *
+tcpx_alloc_tsend_entry(struct tcpx_ep *tcpx_ep)
+{
+	struct tcpx_xfer_entry *send_entry;
+	struct tcpx_cq *tcpx_cq;
+
+	tcpx_cq = container_of(tcpx_ep->util_ep.tx_cq, struct tcpx_cq,
+			       util_cq);
+
+	send_entry = tcpx_xfer_entry_alloc(tcpx_cq, TCPX_OP_TAGGED_SEND);
+	if (send_entry) {
+		send_entry->ep = tcpx_ep;
+		send_entry->done_len = 0;
+	}
+	return send_entry;
+}
+
+static inline struct tcpx_xfer_entry *
+tcpx_alloc_trecv_entry(struct tcpx_ep *tcpx_ep)
+{
+	struct tcpx_xfer_entry *recv_entry;
+	struct tcpx_cq *tcpx_cq;
+
+	tcpx_cq = container_of(tcpx_ep->util_ep.rx_cq, struct tcpx_cq,
+			       util_cq);
+
+	recv_entry = tcpx_xfer_entry_alloc(tcpx_cq, TCPX_OP_MSG_RECV);
+	if (recv_entry) {
+		recv_entry->ep = tcpx_ep;
+		recv_entry->done_len = 0;
+	}
+	return recv_entry;
+}
+
+static void tcpx_trecv_release(struct tcpx_xfer_entry *recv_entry)
+{
+	struct tcpx_cq *tcpx_cq;
+
+	tcpx_cq = container_of(recv_entry->ep->util_ep.rx_cq, struct tcpx_cq,
+			       util_cq);
+	tcpx_xfer_entry_release(tcpx_cq, recv_entry);
+}
+
+static int tcpx_unexp_done(struct tcpx_xfer_entry *unexp)
+{
+	return unexp->done_len == ntohll(unexp->msg_hdr.hdr.size);
+}
+
+/* Hands a matched unexpected message to a receive */
+static int tcpx_trecv_unexp(struct tcpx_xfer_entry *recv_entry,
+			    struct tcpx_xfer_entry *unexp)
+{
+	if (!tcpx_unexp_done(unexp)) {
+		unexp->pending_recv = recv_entry;
+		return FI_SUCCESS;
+	}
+
+	return tcpx_unexp_deliver(unexp, recv_entry);
+}
+
+static void tcpx_unexp_discard(struct tcpx_xfer_entry *unexp)
+{
+	if (tcpx_unexp_done(unexp))
+		tcpx_unexp_free(unexp);
+	else
+		unexp->flags |= FI_DISCARD;
+}
+
+/* Fails with -FI_EAGAIN rather than queueing the completion on overflow */
+static int tcpx_unexp_write_comp(struct tcpx_ep *tcpx_ep,
+				 struct tcpx_xfer_entry *unexp, void *context)
+{
+	struct util_cq *cq = tcpx_ep->util_ep.rx_cq;
+	int ret;
+
+	cq->cq_fastlock_acquire(&cq->cq_lock);
+	if (ofi_cirque_isfull(cq->cirq))
+		ret = -FI_EAGAIN;
+	else
+		ret = ofi_cq_write_thread_unsafe(cq, context,
+				unexp->flags & ~FI_DISCARD,
+				ntohll(unexp->msg_hdr.hdr.size) -
+				sizeof(unexp->msg_hdr), NULL,
+				ntohll(unexp->msg_hdr.hdr.data),
+				ntohll(unexp->msg_hdr.hdr.tag));
+	cq->cq_fastlock_release(&cq->cq_lock);
+	if (!ret && cq->wait)
+		cq->wait->signal(cq->wait);
+	return ret;
+}
+
+/*
+ * FI_PEEK reports the first matching unexpected message without receiving
+ * it.  With FI_CLAIM the message is set aside for a later FI_CLAIM receive
+ * that passes the same context; with FI_DISCARD it is dropped.
+ */
+static ssize_t tcpx_trecv_peek(struct tcpx_ep *tcpx_ep,
+			       const struct fi_msg_tagged *msg, uint64_t flags)
+{
+	struct util_cq *cq = tcpx_ep->util_ep.rx_cq;
+	struct fi_cq_err_entry err_entry = {0};
+	struct tcpx_xfer_entry *unexp;
+	struct ofi_match_entry *match;
+	ssize_t ret;
+
+	fastlock_acquire(&tcpx_ep->lock);
+	match = ofi_match_find(&tcpx_ep->unexp_queue, 0, msg->tag,
+			       msg->ignore);
+	if (!match) {
+		err_entry.op_context = msg->context;
+		err_entry.flags = FI_TAGGED | FI_RECV;
+		err_entry.tag = msg->tag;
+		err_entry.err = FI_ENOMSG;
+		ret = ofi_cq_write_error(cq, &err_entry);
+		goto unlock;
+	}
+
+	unexp = container_of(match, struct tcpx_xfer_entry, match);
+	ret = tcpx_unexp_write_comp(tcpx_ep, unexp, msg->context);
+	if (ret)
+		goto unlock;
+
+	if (flags & FI_CLAIM) {
+		ofi_match_remove(match);
+		((struct fi_context *) msg->context)->internal[0] = unexp;
+	} else if (flags & FI_DISCARD) {
+		ofi_match_remove(match);
+		tcpx_unexp_discard(unexp);
+	}
+unlock:
+	fastlock_release(&tcpx_ep->lock);
+	return ret;
+}
+
+static ssize_t tcpx_trecv_claim(struct tcpx_ep *tcpx_ep,
+				struct tcpx_xfer_entry *recv_entry,
+				uint64_t flags)
+{
+	struct tcpx_xfer_entry *unexp;
+	ssize_t ret;
+
+	unexp = ((struct fi_context *) recv_entry->context)->internal[0];
+	if (!unexp)
+		return -FI_EINVAL;
+
+	if (flags & FI_DISCARD) {
+		ret = tcpx_unexp_write_comp(tcpx_ep, unexp,
+					    recv_entry->context);
+		if (ret)
+			return ret;
+
+		tcpx_unexp_discard(unexp);
+		tcpx_trecv_release(recv_entry);
+		return FI_SUCCESS;
+	}
+
+	return tcpx_trecv_unexp(recv_entry, unexp);
+}
+
+static ssize_t tcpx_trecv_post(struct tcpx_ep *tcpx_ep,
+			       struct tcpx_xfer_entry *recv_entry,
+			       uint64_t tag, uint64_t ignore, uint64_t flags)
+{
+	struct ofi_match_entry *match;
+	ssize_t ret;
+
+	fastlock_acquire(&tcpx_ep->lock);
+	if (flags & FI_CLAIM) {
+		ret = tcpx_trecv_claim(tcpx_ep, recv_entry, flags);
+		goto out;
+	}
+
+	match = ofi_match_remove_first(&tcpx_ep->unexp_queue, 0, tag, ignore);
+	if (!match) {
+		ofi_match_insert(&tcpx_ep->trecv_queue, &recv_entry->match, 0,
+				 tag, ignore);
+		fastlock_release(&tcpx_ep->lock);
+		return FI_SUCCESS;
+	}
+
+	ret = tcpx_trecv_unexp(recv_entry,
+			       container_of(match, struct tcpx_xfer_entry, match));
+	if (ret)
+		ofi_match_insert_head(&tcpx_ep->unexp_queue, match, 0,
+				      match->tag, 0);
+out:
+	if (ret)
+		tcpx_trecv_release(recv_entry);
+	fastlock_release(&tcpx_ep->lock);
+	return ret;
+}
+
+static ssize_t tcpx_trecvmsg(struct fid_ep *ep, const struct fi_msg_tagged *msg,
+			     uint64_t flags)
+{
+	struct tcpx_xfer_entry *recv_entry;
+	struct tcpx_ep *tcpx_ep;
+
+	tcpx_ep = container_of(ep, struct tcpx_ep, util_ep.ep_fid);
+
+	assert(msg->iov_count <= TCPX_IOV_LIMIT);
+
+	if (flags & FI_PEEK)
+		return tcpx_trecv_peek(tcpx_ep, msg, flags);
+
+	recv_entry = tcpx_alloc_trecv_entry(tcpx_ep);
+	if (!recv_entry)
+		return -FI_EAGAIN;
+
+	recv_entry->msg_data.iov_cnt = msg->iov_count;
+	memcpy(&recv_entry->msg_data.iov[0], &msg->msg_iov[0],
+	       msg->iov_count * sizeof(struct iovec));
+
+	recv_entry->flags = ((tcpx_ep->util_ep.rx_op_flags & FI_COMPLETION) |
+			     (flags & ~TCPX_TRECV_FLAGS) | FI_TAGGED | FI_RECV);
+	recv_entry->context = msg->context;
+
+	return tcpx_trecv_post(tcpx_ep, recv_entry, msg->tag, msg->ignore,
+			       flags);
+}
+
+static ssize_t tcpx_trecv(struct fid_ep *ep, void *buf, size_t len, void *desc,
+			  fi_addr_t src_addr, uint64_t tag, uint64_t ignore,
+			  void *context)
+{
+	struct tcpx_xfer_entry *recv_entry;
+	struct tcpx_ep *tcpx_ep;
+
+	tcpx_ep = container_of(ep, struct tcpx_ep, util_ep.ep_fid);
+
+	recv_entry = tcpx_alloc_trecv_entry(tcpx_ep);
+	if (!recv_entry)
+		return -FI_EAGAIN;
+
+	recv_entry->msg_data.iov_cnt = 1;
+	recv_entry->msg_data.iov[0].iov_base = buf;
+	recv_entry->msg_data.iov[0].iov_len = len;
+
+	recv_entry->flags = ((tcpx_ep->util_ep.rx_op_flags & FI_COMPLETION) |
+			     FI_TAGGED | FI_RECV);
+	recv_entry->context = context;
+
+	return tcpx_trecv_post(tcpx_ep, recv_entry, tag, ignore, 0);
+}
+
+static ssize_t tcpx_trecvv(struct fid_ep *ep, const struct iovec *iov,
+			   void **desc, size_t count, fi_addr_t src_addr,
+			   uint64_t tag, uint64_t ignore, void *context)
+{
+	struct tcpx_xfer_entry *recv_entry;
+	struct tcpx_ep *tcpx_ep;
+
+	tcpx_ep = container_of(ep, struct tcpx_ep, util_ep.ep_fid);
+
+	assert(count <= TCPX_IOV_LIMIT);
+
+	recv_entry = tcpx_alloc_trecv_entry(tcpx_ep);
+	if (!recv_entry)
+		return -FI_EAGAIN;
+
+	recv_entry->msg_data.iov_cnt = count;
+	memcpy(recv_entry->msg_data.iov, iov, count * sizeof(*iov));
+
+	recv_entry->flags = ((tcpx_ep->util_ep.rx_op_flags & FI_COMPLETION) |
+			     FI_TAGGED | FI_RECV);
+	recv_entry->context = context;
+
+	return tcpx_trecv_post(tcpx_ep, recv_entry, tag, ignore, 0);
+}
+
+static ssize_t tcpx_tsendmsg(struct fid_ep *ep, const struct fi_msg_tagged *msg,
+			     uint64_t flags)
+{
+	struct tcpx_xfer_entry *tx_entry;
+	struct tcpx_ep *tcpx_ep;
+	uint64_t data_len;
+
+	tcpx_ep = container_of(ep, struct tcpx_ep, util_ep.ep_fid);
+
+	tx_entry = tcpx_alloc_tsend_entry(tcpx_ep);
+	if (!tx_entry)
+		return -FI_EAGAIN;
+
+	assert(msg->iov_count <= TCPX_IOV_LIMIT);
+	data_len = ofi_total_iov_len(msg->msg_iov, msg->iov_count);
+	assert(!(flags & FI_INJECT) || (data_len <= TCPX_MAX_INJECT_SZ));
+	tx_entry->msg_hdr.hdr.size = htonll(data_len + sizeof(tx_entry->msg_hdr));
+	tx_entry->msg_hdr.hdr.flags = 0;
+	tx_entry->msg_hdr.hdr.tag = htonll(msg->tag);
+
+	tx_entry->msg_data.iov[0].iov_base = (void *) &tx_entry->msg_hdr;
+	tx_entry->msg_data.iov[0].iov_len = sizeof(tx_entry->msg_hdr);
+	tx_entry->msg_data.iov_cnt = msg->iov_count + 1;
+
+	if (flags & FI_INJECT) {
+		ofi_copy_iov_buf(msg->msg_iov, msg->iov_count, 0,
+				 tx_entry->inject,
+				 data_len,
+				 OFI_COPY_IOV_TO_BUF);
+		tcpx_inject_iov(tx_entry, data_len);
+	} else {
+		memcpy(&tx_entry->msg_data.iov[1], &msg->msg_iov[0],
+		       msg->iov_count * sizeof(struct iovec));
+	}
+
+	tx_entry->flags = ((tcpx_ep->util_ep.tx_op_flags & FI_COMPLETION) |
+			   flags | FI_TAGGED | FI_SEND);
+
+	if (flags & FI_REMOTE_CQ_DATA) {
+		tx_entry->msg_hdr.hdr.flags |= OFI_REMOTE_CQ_DATA;
+		tx_entry->msg_hdr.hdr.data = htonll(msg->data);
+	}
+
+	if (flags & (FI_TRANSMIT_COMPLETE | FI_DELIVERY_COMPLETE)) {
+		tx_entry->msg_hdr.hdr.flags |= OFI_DELIVERY_COMPLETE;
+		tx_entry->flags &= ~FI_COMPLETION;
+	}
+
+	tx_entry->msg_hdr.hdr.flags = htonl(tx_entry->msg_hdr.hdr.flags);
+	tx_entry->context = msg->context;
+
+	fastlock_acquire(&tcpx_ep->lock);
+	tcpx_tx_queue_insert(tcpx_ep, tx_entry);
+	fastlock_release(&tcpx_ep->lock);
+	return FI_SUCCESS;
+}
+
+static ssize_t tcpx_tsend(struct fid_ep *ep, const void *buf, size_t len,
+			  void *desc, fi_addr_t dest_addr, uint64_t tag,
+			  void *context)
+{
+	struct tcpx_xfer_entry *tx_entry;
+	struct tcpx_ep *tcpx_ep;
+
+	tcpx_ep = container_of(ep, struct tcpx_ep, util_ep.ep_fid);
+
+	tx_entry = tcpx_alloc_tsend_entry(tcpx_ep);
+	if (!tx_entry)
+		return -FI_EAGAIN;
+
+	tx_entry->msg_hdr.hdr.size = htonll(len + sizeof(tx_entry->msg_hdr));
+	tx_entry->msg_hdr.hdr.tag = htonll(tag);
+	tx_entry->msg_data.iov[0].iov_base = (void *) &tx_entry->msg_hdr;
+	tx_entry->msg_data.iov[0].iov_len = sizeof(tx_entry->msg_hdr);
+	tx_entry->msg_data.iov[1].iov_base = (void *) buf;
+	tx_entry->msg_data.iov[1].iov_len = len;
+	tx_entry->msg_data.iov_cnt = 2;
+	tx_entry->context = context;
+	tx_entry->flags = ((tcpx_ep->util_ep.tx_op_flags & FI_COMPLETION) |
+			   FI_TAGGED | FI_SEND);
+
+	tx_entry->msg_hdr.hdr.flags = 0;
+	fastlock_acquire(&tcpx_ep->lock);
+	tcpx_tx_queue_insert(tcpx_ep, tx_entry);
+	fastlock_release(&tcpx_ep->lock);
+	return FI_SUCCESS;
+}
+
+static ssize_t tcpx_tsendv(struct fid_ep *ep, const struct iovec *iov,
+			   void **desc, size_t count, fi_addr_t dest_addr,
+			   uint64_t tag, void *context)
+{
+	struct tcpx_xfer_entry *tx_entry;
+	struct tcpx_ep *tcpx_ep;
+	uint64_t data_len;
+
+	tcpx_ep = container_of(ep, struct tcpx_ep, util_ep.ep_fid);
+
+	tx_entry = tcpx_alloc_tsend_entry(tcpx_ep);
+	if (!tx_entry)
+		return -FI_EAGAIN;
+
+	assert(count <= TCPX_IOV_LIMIT);
+	data_len = ofi_total_iov_len(iov, count);
+	tx_entry->msg_hdr.hdr.size = htonll(data_len + sizeof(tx_entry->msg_hdr));
+	tx_entry->msg_hdr.hdr.tag = htonll(tag);
+	tx_entry->msg_data.iov[0].iov_base = (void *) &tx_entry->msg_hdr;
+	tx_entry->msg_data.iov[0].iov_len = sizeof(tx_entry->msg_hdr);
+	tx_entry->msg_data.iov_cnt = count + 1;
+	memcpy(&tx_entry->msg_data.iov[1], &iov[0],
+	       count * sizeof(struct iovec));
+
+	tx_entry->msg_hdr.hdr.flags = 0;
+	tx_entry->context = context;
+	tx_entry->flags = ((tcpx_ep->util_ep.tx_op_flags & FI_COMPLETION) |
+			   FI_TAGGED | FI_SEND);
+
+	fastlock_acquire(&tcpx_ep->lock);
+	tcpx_tx_queue_insert(tcpx_ep, tx_entry);
+	fastlock_release(&tcpx_ep->lock);
+	return FI_SUCCESS;
+}
+
+static ssize_t tcpx_tinject(struct fid_ep *ep, const void *buf, size_t len,
+			    fi_addr_t dest_addr, uint64_t tag)
+{
+	struct tcpx_xfer_entry *tx_entry;
+	struct tcpx_ep *tcpx_ep;
+
+	tcpx_ep = container_of(ep, struct tcpx_ep, util_ep.ep_fid);
+
+	tx_entry = tcpx_alloc_tsend_entry(tcpx_ep);
+	if (!tx_entry)
+		return -FI_EAGAIN;
+
+	assert(len <= TCPX_MAX_INJECT_SZ);
+	tx_entry->msg_hdr.hdr.size = htonll(len + sizeof(tx_entry->msg_hdr));
+	tx_entry->msg_hdr.hdr.tag = htonll(tag);
+	memcpy(tx_entry->inject, (char *) buf, len);
+	tcpx_inject_iov(tx_entry, len);
+
+	tx_entry->msg_hdr.hdr.flags = 0;
+	tx_entry->flags = FI_TAGGED | FI_SEND;
+
+	fastlock_acquire(&tcpx_ep->lock);
+	tcpx_tx_queue_insert(tcpx_ep, tx_entry);
+	fastlock_release(&tcpx_ep->lock);
+	return FI_SUCCESS;
+}
+
+static ssize_t tcpx_tsenddata(struct fid_ep *ep, const void *buf, size_t len,
+			      void *desc, uint64_t data, fi_addr_t dest_addr,
+			      uint64_t tag, void *context)
+{
+	struct tcpx_xfer_entry *tx_entry;
+	struct tcpx_ep *tcpx_ep;
+
+	tcpx_ep = container_of(ep, struct tcpx_ep, util_ep.ep_fid);
+
+	tx_entry = tcpx_alloc_tsend_entry(tcpx_ep);
+	if (!tx_entry)
+		return -FI_EAGAIN;
+
+	tx_entry->msg_hdr.hdr.size = htonll(len + sizeof(tx_entry->msg_hdr));
+	tx_entry->msg_hdr.hdr.tag = htonll(tag);
+	tx_entry->msg_data.iov[0].iov_base = (void *) &tx_entry->msg_hdr;
+	tx_entry->msg_data.iov[0].iov_len = sizeof(tx_entry->msg_hdr);
+	tx_entry->msg_data.iov[1].iov_base = (void *) buf;
+	tx_entry->msg_data.iov[1].iov_len = len;
+	tx_entry->msg_data.iov_cnt = 2;
+
+	tx_entry->msg_hdr.hdr.flags = htonl(OFI_REMOTE_CQ_DATA);
+	tx_entry->msg_hdr.hdr.data = htonll(data);
+
+	tx_entry->context = context;
+	tx_entry->flags = ((tcpx_ep->util_ep.tx_op_flags & FI_COMPLETION) |
+			   FI_TAGGED | FI_SEND);
+
+	fastlock_acquire(&tcpx_ep->lock);
+	tcpx_tx_queue_insert(tcpx_ep, tx_entry);
+	fastlock_release(&tcpx_ep->lock);
+	return FI_SUCCESS;
+}
+
+static ssize_t tcpx_tinjectdata(struct fid_ep *ep, const void *buf, size_t len,
+				uint64_t data, fi_addr_t dest_addr, uint64_t tag)
+{
+	struct tcpx_xfer_entry *tx_entry;
+	struct tcpx_ep *tcpx_ep;
+
+	tcpx_ep = container_of(ep, struct tcpx_ep, util_ep.ep_fid);
+
+	tx_entry = tcpx_alloc_tsend_entry(tcpx_ep);
+	if (!tx_entry)
+		return -FI_EAGAIN;
+
+	assert(len <= TCPX_MAX_INJECT_SZ);
+	tx_entry->msg_hdr.hdr.size = htonll(len + sizeof(tx_entry->msg_hdr));
+	tx_entry->msg_hdr.hdr.tag = htonll(tag);
+	memcpy(tx_entry->inject, (char *) buf, len);
+	tcpx_inject_iov(tx_entry, len);
+
+	tx_entry->msg_hdr.hdr.flags = htonl(OFI_REMOTE_CQ_DATA);
+	tx_entry->msg_hdr.hdr.data = htonll(data);
+	tx_entry->flags = FI_TAGGED | FI_SEND;
+
+	fastlock_acquire(&tcpx_ep->lock);
+	tcpx_tx_queue_insert(tcpx_ep, tx_entry);
+	fastlock_release(&tcpx_ep->lock);
+	return FI_SUCCESS;
+}
+
+struct fi_ops_tagged tcpx_tagged_ops = {
+	.size = sizeof(struct fi_ops_tagged),
+	.recv = tcpx_trecv,
+	.recvv = tcpx_trecvv,
+	.recvmsg = tcpx_trecvmsg,
+	.send = tcpx_tsend,
+	.sendv = tcpx_tsendv,
+	.sendmsg = tcpx_tsendmsg,
+	.inject = tcpx_tinject,
+	.senddata = tcpx_tsenddata,
+	.injectdata = tcpx_tinjectdata,
+};
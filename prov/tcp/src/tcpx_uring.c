@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2019 Intel Corporation. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *	   Redistribution and use in source and binary forms, with or
+ *	   without modification, are permitted provided that the following
+ *	   conditions are met:
+ *
+ *		- Redistributions of source code must retain the above
+ *		  copyright notice, this list of conditions and the following
+ *		  disclaimer.
+ *
+ *		- Redistributions in binary form must reproduce the above
+ *		  copyright notice, this list of conditions and the following
+ *		  disclaimer in the documentation and/or other materials
+ *		  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "tcpx.h"
+
+#if HAVE_TCP_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * io_uring progress engine.  All endpoints of a domain share one ring.
+ * Each connected endpoint keeps at most one receive and one send in
+ * flight.  Requests are only queued when an endpoint is progressed, and
+ * are handed to the kernel together by tcpx_uring_submit() once per CQ
+ * progress, so that a poll over many connections costs a single system
+ * call.  Completions are reaped from the shared completion ring without
+ * a system call and recorded in the request, which the owning endpoint
+ * picks up under its own lock the next time it is progressed.
+ */
+#define TCPX_URING_ENTRIES	1024
+
+struct tcpx_uring {
+	int			fd;
+	fastlock_t		lock;
+	unsigned		to_submit;
+
+	unsigned		*sq_head;
+	unsigned		*sq_tail;
+	unsigned		*sq_flags;
+	unsigned		*sq_array;
+	unsigned		sq_mask;
+	unsigned		sq_entries;
+	struct io_uring_sqe	*sqes;
+
+	unsigned		*cq_head;
+	unsigned		*cq_tail;
+	unsigned		cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	void			*sq_ring;
+	size_t			sq_ring_size;
+	void			*cq_ring;
+	size_t			cq_ring_size;
+	size_t			sqes_size;
+};
+
+static int tcpx_uring_enter(struct tcpx_uring *uring, unsigned to_submit,
+			    unsigned min_complete, unsigned flags)
+{
+	int ret;
+
+	do {
+		ret = (int) syscall(__NR_io_uring_enter, uring->fd, to_submit,
+				    min_complete, flags, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret < 0 ? -errno : ret;
+}
+
+int tcpx_uring_open(struct tcpx_uring **uring)
+{
+	struct io_uring_params params;
+	struct tcpx_uring *ring;
+	int ret;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return -FI_ENOMEM;
+
+	memset(&params, 0, sizeof(params));
+	ring->fd = (int) syscall(__NR_io_uring_setup, TCPX_URING_ENTRIES,
+				 &params);
+	if (ring->fd < 0) {
+		ret = -errno;
+		goto free;
+	}
+
+	/* completions must not be dropped when the ring overflows */
+	if (!(params.features & IORING_FEAT_NODROP)) {
+		ret = -FI_ENOSYS;
+		goto close;
+	}
+
+	ring->sq_ring_size = params.sq_off.array +
+			     params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes +
+			     params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, ring->fd,
+			     IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ret = -errno;
+		goto close;
+	}
+
+	ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, ring->fd,
+			     IORING_OFF_CQ_RING);
+	if (ring->cq_ring == MAP_FAILED) {
+		ret = -errno;
+		goto unmap_sq;
+	}
+
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ret = -errno;
+		goto unmap_cq;
+	}
+
+	ring->sq_head = (unsigned *) ((char *) ring->sq_ring +
+				      params.sq_off.head);
+	ring->sq_tail = (unsigned *) ((char *) ring->sq_ring +
+				      params.sq_off.tail);
+	ring->sq_flags = (unsigned *) ((char *) ring->sq_ring +
+				       params.sq_off.flags);
+	ring->sq_array = (unsigned *) ((char *) ring->sq_ring +
+				       params.sq_off.array);
+	ring->sq_mask = *(unsigned *) ((char *) ring->sq_ring +
+				       params.sq_off.ring_mask);
+	ring->sq_entries = params.sq_entries;
+
+	ring->cq_head = (unsigned *) ((char *) ring->cq_ring +
+				      params.cq_off.head);
+	ring->cq_tail = (unsigned *) ((char *) ring->cq_ring +
+				      params.cq_off.tail);
+	ring->cq_mask = *(unsigned *) ((char *) ring->cq_ring +
+				       params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ring +
+					      params.cq_off.cqes);
+
+	ret = fastlock_init(&ring->lock);
+	if (ret)
+		goto unmap_sqes;
+
+	*uring = ring;
+	return FI_SUCCESS;
+
+unmap_sqes:
+	munmap(ring->sqes, ring->sqes_size);
+unmap_cq:
+	munmap(ring->cq_ring, ring->cq_ring_size);
+unmap_sq:
+	munmap(ring->sq_ring, ring->sq_ring_size);
+close:
+	close(ring->fd);
+free:
+	free(ring);
+	return ret;
+}
+
+void tcpx_uring_close(struct tcpx_uring *uring)
+{
+	fastlock_destroy(&uring->lock);
+	munmap(uring->sqes, uring->sqes_size);
+	munmap(uring->cq_ring, uring->cq_ring_size);
+	munmap(uring->sq_ring, uring->sq_ring_size);
+	close(uring->fd);
+	free(uring);
+}
+
+int tcpx_uring_fd(struct tcpx_uring *uring)
+{
+	return uring->fd;
+}
+
+static void tcpx_uring_submit_locked(struct tcpx_uring *uring)
+{
+	int ret;
+
+	if (!uring->to_submit)
+		return;
+
+	ret = tcpx_uring_enter(uring, uring->to_submit, 0, 0);
+	if (ret < 0) {
+		/* EAGAIN or EBUSY: retried on the next progress */
+		if (ret != -EAGAIN && ret != -EBUSY)
+			FI_WARN(&tcpx_prov, FI_LOG_EP_DATA,
+				"io_uring_enter failed: %s\n", strerror(-ret));
+		return;
+	}
+	uring->to_submit -= MIN((unsigned) ret, uring->to_submit);
+}
+
+void tcpx_uring_submit(struct tcpx_uring *uring)
+{
+	fastlock_acquire(&uring->lock);
+	tcpx_uring_submit_locked(uring);
+	fastlock_release(&uring->lock);
+}
+
+static void tcpx_uring_reap_locked(struct tcpx_uring *uring)
+{
+	struct tcpx_uring_op *op;
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+
+	/* completions that did not fit are kept by the kernel until asked */
+	if (__atomic_load_n(uring->sq_flags, __ATOMIC_RELAXED) &
+	    IORING_SQ_CQ_OVERFLOW)
+		(void) tcpx_uring_enter(uring, 0, 0, IORING_ENTER_GETEVENTS);
+
+	head = *uring->cq_head;
+	tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &uring->cqes[head & uring->cq_mask];
+		op = (struct tcpx_uring_op *) (uintptr_t) cqe->user_data;
+		if (!op)
+			continue;
+
+		op->res = cqe->res;
+		op->done = true;
+	}
+	__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+void tcpx_uring_reap(struct tcpx_uring *uring)
+{
+	fastlock_acquire(&uring->lock);
+	tcpx_uring_reap_locked(uring);
+	fastlock_release(&uring->lock);
+}
+
+/*
+ * Takes the result of a completed request.  The request is owned by the
+ * caller's endpoint, but its result is written while reaping on behalf of
+ * any endpoint of the domain, hence the ring lock.  The request stays
+ * pending until its result is taken, since the endpoint has not accounted
+ * for the data yet, and must not submit the same buffers again.
+ */
+bool tcpx_uring_op_test(struct tcpx_uring *uring, struct tcpx_uring_op *op,
+			int *res)
+{
+	bool done;
+
+	fastlock_acquire(&uring->lock);
+	done = op->done;
+	if (done) {
+		op->done = false;
+		op->pending = false;
+		*res = op->res;
+	}
+	fastlock_release(&uring->lock);
+	return done;
+}
+
+static struct io_uring_sqe *tcpx_uring_get_sqe(struct tcpx_uring *uring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, index;
+
+	tail = *uring->sq_tail;
+	if (tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >=
+	    uring->sq_entries) {
+		tcpx_uring_submit_locked(uring);
+		if (tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >=
+		    uring->sq_entries)
+			return NULL;
+	}
+
+	index = tail & uring->sq_mask;
+	sqe = &uring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	uring->sq_array[index] = index;
+	return sqe;
+}
+
+static void tcpx_uring_queue_sqe(struct tcpx_uring *uring)
+{
+	__atomic_store_n(uring->sq_tail, *uring->sq_tail + 1,
+			 __ATOMIC_RELEASE);
+	uring->to_submit++;
+}
+
+static void tcpx_uring_queue_msg(struct tcpx_uring *uring, uint8_t opcode,
+				 SOCKET sock, struct tcpx_uring_op *op)
+{
+	struct io_uring_sqe *sqe;
+
+	fastlock_acquire(&uring->lock);
+	sqe = tcpx_uring_get_sqe(uring);
+	if (!sqe) {
+		/* the kernel is backed up, the endpoint retries later */
+		fastlock_release(&uring->lock);
+		return;
+	}
+
+	sqe->opcode = opcode;
+	sqe->fd = sock;
+	sqe->addr = (uintptr_t) &op->msg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = (uintptr_t) op;
+	op->pending = true;
+	op->done = false;
+	tcpx_uring_queue_sqe(uring);
+	fastlock_release(&uring->lock);
+}
+
+/*
+ * Receives are single shot.  A multishot receive only lands in buffers
+ * that the provider hands to the kernel up front, so every payload would
+ * be copied into the user buffer afterwards.  A single-shot RECVMSG
+ * receives the payload in place, and is re-armed in the same batched
+ * submission as the other requests, so it costs no extra system call.
+ */
+void tcpx_uring_recvmsg(struct tcpx_uring *uring, SOCKET sock,
+			struct tcpx_uring_op *op)
+{
+	tcpx_uring_queue_msg(uring, IORING_OP_RECVMSG, sock, op);
+}
+
+void tcpx_uring_sendmsg(struct tcpx_uring *uring, SOCKET sock,
+			struct tcpx_uring_op *op)
+{
+	tcpx_uring_queue_msg(uring, IORING_OP_SENDMSG, sock, op);
+}
+
+/*
+ * Waits until the kernel is done with a request, so that its buffers can
+ * be released.  Completions of other endpoints are recorded as usual.
+ */
+void tcpx_uring_cancel(struct tcpx_uring *uring, struct tcpx_uring_op *op)
+{
+	struct io_uring_sqe *sqe;
+
+	fastlock_acquire(&uring->lock);
+	tcpx_uring_reap_locked(uring);
+	if (op->pending && !op->done) {
+		while (!(sqe = tcpx_uring_get_sqe(uring)))
+			tcpx_uring_reap_locked(uring);
+
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (uintptr_t) op;
+		tcpx_uring_queue_sqe(uring);
+		tcpx_uring_submit_locked(uring);
+	}
+
+	while (op->pending && !op->done) {
+		(void) tcpx_uring_enter(uring, uring->to_submit, 1,
+					IORING_ENTER_GETEVENTS);
+		tcpx_uring_reap_locked(uring);
+	}
+	op->pending = false;
+	op->done = false;
+	fastlock_release(&uring->lock);
+}
+
+/*
+ * Wait object try function of the ring.  Requests queued by endpoints are
+ * handed to the kernel before the caller blocks on the ring.
+ */
+int tcpx_uring_try(void *arg)
+{
+	struct tcpx_uring *uring = arg;
+	int ret = FI_SUCCESS;
+
+	fastlock_acquire(&uring->lock);
+	tcpx_uring_submit_locked(uring);
+	if (uring->to_submit ||
+	    *uring->cq_head != __atomic_load_n(uring->cq_tail,
+					       __ATOMIC_ACQUIRE))
+		ret = -FI_EAGAIN;
+	fastlock_release(&uring->lock);
+	return ret;
+}
+
+#endif /* HAVE_TCP_IO_URING */
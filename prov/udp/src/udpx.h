@@ -41,6 +41,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/udp.h>
 
 #include <rdma/fabric.h>
 #include <rdma/fi_atomic.h>
@@ -55,6 +56,7 @@
 
 #include <ofi.h>
 #include <ofi_enosys.h>
+#include <ofi_iov.h>
 #include <ofi_rbuf.h>
 #include <ofi_list.h>
 #include <ofi_signal.h>
@@ -83,6 +85,30 @@ int udpx_eq_open(struct fid_fabric *fabric, struct fi_eq_attr *attr,
 
 #define UDPX_FLAG_MULTI_RECV	1
 #define UDPX_IOV_LIMIT		4
+#define UDPX_MAX_BATCH		64
+#define UDPX_MAX_MSG_SIZE	1472
+
+#if HAVE_RECVMMSG && HAVE_SENDMMSG
+#define UDPX_HAVE_MMSG		1
+#else
+#define UDPX_HAVE_MMSG		0
+#endif
+
+#if defined(UDP_SEGMENT) && defined(UDP_GRO)
+#define UDPX_HAVE_GSO		1
+#else
+#define UDPX_HAVE_GSO		0
+#endif
+
+/* A GSO send is a single IP packet of at most 64 segments */
+#define UDPX_GSO_MAX_SEGS	64
+#define UDPX_GSO_MAX_SIZE	(UINT16_MAX - sizeof(struct ip) - 8)
+#define UDPX_GRO_BUF_SIZE	(UINT16_MAX + 1)
+
+/* datagrams received or sent per system call */
+extern size_t udpx_batch_size;
+extern int udpx_gso;
+extern int udpx_gro;
 
 struct udpx_ep_entry {
 	void			*context;
@@ -94,6 +120,42 @@ struct udpx_ep_entry {
 
 OFI_DECLARE_CIRQUE(struct udpx_ep_entry, udpx_rx_cirq);
 
+/* A send posted with FI_MORE, which is sent with the next one */
+struct udpx_tx_entry {
+	void			*context;
+	struct iovec		iov[UDPX_IOV_LIMIT];
+	uint8_t			iov_count;
+	socklen_t		addrlen;
+	union ofi_sock_ip	addr;
+};
+
+OFI_DECLARE_CIRQUE(struct udpx_tx_entry, udpx_tx_cirq);
+
+/*
+ * Datagrams that the kernel coalesced with GRO, which are handed out to
+ * the posted receives one segment at a time.
+ */
+struct udpx_gro_buf {
+	size_t			seg_size;
+	size_t			len;
+	size_t			off;
+	struct sockaddr_in6	addr;
+	uint8_t			data[UDPX_GRO_BUF_SIZE];
+};
+
+/*
+ * Datagrams received for multi-receive buffers, which are packed into
+ * the buffers one after the other.  Datagrams that find no posted
+ * receive are held until the next progress call.
+ */
+struct udpx_rx_slab {
+	size_t			cnt;
+	size_t			next;
+	size_t			len[UDPX_MAX_BATCH];
+	struct sockaddr_in6	addr[UDPX_MAX_BATCH];
+	uint8_t			data[UDPX_MAX_BATCH][UDPX_MAX_MSG_SIZE];
+};
+
 struct udpx_ep;
 typedef void (*udpx_rx_comp_func)(struct udpx_ep *ep, void *context,
 		uint64_t flags, size_t len, void *buf, void *addr);
@@ -104,6 +166,11 @@ struct udpx_ep {
 	udpx_rx_comp_func	rx_comp;
 	udpx_tx_comp_func	tx_comp;
 	struct udpx_rx_cirq	*rxq;    /* protected by rx_cq lock */
+	struct udpx_tx_cirq	*txq;    /* protected by tx_cq lock */
+	struct udpx_gro_buf	*gro;    /* protected by rx_cq lock */
+	struct udpx_rx_slab	*slab;   /* protected by rx_cq lock */
+	size_t			min_multi_recv;
+	bool			gso;
 	SOCKET			sock;
 	int			is_bound;
 	ofi_atomic32_t		ref;
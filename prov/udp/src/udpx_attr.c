@@ -36,13 +36,13 @@
 struct fi_tx_attr udpx_tx_attr = {
 	.caps = FI_MSG | FI_SEND | FI_MULTICAST,
 	.comp_order = FI_ORDER_STRICT,
-	.inject_size = 1472,
+	.inject_size = UDPX_MAX_MSG_SIZE,
 	.size = 1024,
 	.iov_limit = UDPX_IOV_LIMIT
 };
 
 struct fi_rx_attr udpx_rx_attr = {
-	.caps = FI_MSG | FI_RECV | FI_SOURCE | FI_MULTICAST,
+	.caps = FI_MSG | FI_RECV | FI_SOURCE | FI_MULTICAST | FI_MULTI_RECV,
 	.comp_order = FI_ORDER_STRICT,
 	.total_buffered_recv = (1 << 16),
 	.size = 1024,
@@ -53,7 +53,7 @@ struct fi_ep_attr udpx_ep_attr = {
 	.type = FI_EP_DGRAM,
 	.protocol = FI_PROTO_UDP,
 	.protocol_version = 0,
-	.max_msg_size = 1472,
+	.max_msg_size = UDPX_MAX_MSG_SIZE,
 	.tx_ctx_cnt = 1,
 	.rx_ctx_cnt = 1
 };
@@ -80,7 +80,8 @@ struct fi_fabric_attr udpx_fabric_attr = {
 };
 
 struct fi_info udpx_info = {
-	.caps = FI_MSG | FI_SEND | FI_RECV | FI_SOURCE | FI_MULTICAST,
+	.caps = FI_MSG | FI_SEND | FI_RECV | FI_SOURCE | FI_MULTICAST |
+		FI_MULTI_RECV,
 	.addr_format = FI_SOCKADDR,
 	.tx_attr = &udpx_tx_attr,
 	.rx_attr = &udpx_rx_attr,
@@ -194,13 +194,28 @@ static struct fi_ops_cm udpx_cm_ops = {
 static int udpx_getopt(fid_t fid, int level, int optname,
 		       void *optval, size_t *optlen)
 {
-	return -FI_ENOPROTOOPT;
+	struct udpx_ep *ep =
+		container_of(fid, struct udpx_ep, util_ep.ep_fid.fid);
+
+	if ((level != FI_OPT_ENDPOINT) || (optname != FI_OPT_MIN_MULTI_RECV))
+		return -FI_ENOPROTOOPT;
+
+	*(size_t *)optval = ep->min_multi_recv;
+	*optlen = sizeof(size_t);
+	return 0;
 }
 
 static int udpx_setopt(fid_t fid, int level, int optname,
 		       const void *optval, size_t optlen)
 {
-	return -FI_ENOPROTOOPT;
+	struct udpx_ep *ep =
+		container_of(fid, struct udpx_ep, util_ep.ep_fid.fid);
+
+	if ((level != FI_OPT_ENDPOINT) || (optname != FI_OPT_MIN_MULTI_RECV))
+		return -FI_ENOPROTOOPT;
+
+	ep->min_multi_recv = *(size_t *)optval;
+	return 0;
 }
 
 static struct fi_ops_ep udpx_ep_ops = {
@@ -256,6 +271,29 @@ static void udpx_rx_src_comp(struct udpx_ep *ep, void *context, uint64_t flags,
 	udpx_rx_comp(ep, context, flags, len, buf, addr);
 }
 
+/* Called with the rx CQ lock held, like the rx_comp handlers */
+static void udpx_rx_trunc(struct udpx_ep *ep, void *context, uint64_t flags,
+			  size_t len, void *buf, size_t olen)
+{
+	struct util_cq *cq = ep->util_ep.rx_cq;
+	struct fi_cq_err_entry err_entry = {
+		.op_context	= context,
+		.flags		= FI_RECV | flags,
+		.len		= len,
+		.buf		= buf,
+		.olen		= olen,
+		.err		= FI_ETRUNC,
+		.prov_errno	= -FI_ETRUNC,
+	};
+
+	FI_WARN(&udpx_prov, FI_LOG_EP_DATA,
+		"datagram truncated by %zu bytes\n", olen);
+	if (ofi_cq_write_error_thread_unsafe(cq, &err_entry))
+		return;
+	if (cq->wait)
+		cq->wait->signal(cq->wait);
+}
+
 static void udpx_rx_comp_signal(struct udpx_ep *ep, void *context,
 			uint64_t flags, size_t len, void *buf, void *addr)
 {
@@ -270,38 +308,454 @@ static void udpx_rx_src_comp_signal(struct udpx_ep *ep, void *context,
 	ep->util_ep.rx_cq->wait->signal(ep->util_ep.rx_cq->wait);
 }
 
-static void udpx_ep_progress(struct util_ep *util_ep)
+#if UDPX_HAVE_MMSG
+static int udpx_recv_batch(SOCKET sock, struct msghdr *hdr, size_t *len,
+			   size_t cnt)
+{
+	struct mmsghdr msgs[UDPX_MAX_BATCH];
+	size_t i;
+	int ret;
+
+	for (i = 0; i < cnt; i++)
+		msgs[i].msg_hdr = hdr[i];
+
+	/* MSG_TRUNC reports the full length of truncated datagrams */
+	ret = recvmmsg(sock, msgs, (unsigned int) cnt, MSG_TRUNC, NULL);
+	for (i = 0; ret > 0 && i < (size_t) ret; i++) {
+		len[i] = msgs[i].msg_len;
+		hdr[i].msg_flags = msgs[i].msg_hdr.msg_flags;
+	}
+	return ret;
+}
+
+static int udpx_send_batch(SOCKET sock, struct msghdr *hdr, size_t cnt)
+{
+	struct mmsghdr msgs[UDPX_MAX_BATCH];
+	size_t i;
+
+	for (i = 0; i < cnt; i++)
+		msgs[i].msg_hdr = hdr[i];
+
+	return sendmmsg(sock, msgs, (unsigned int) cnt, 0);
+}
+#else
+static int udpx_recv_batch(SOCKET sock, struct msghdr *hdr, size_t *len,
+			   size_t cnt)
+{
+	ssize_t ret;
+	size_t i;
+
+	for (i = 0; i < cnt; i++) {
+		ret = ofi_recvmsg_udp(sock, &hdr[i], 0);
+		if (ret < 0)
+			return i ? (int) i : -1;
+		len[i] = ret;
+	}
+	return (int) cnt;
+}
+
+static int udpx_send_batch(SOCKET sock, struct msghdr *hdr, size_t cnt)
+{
+	size_t i;
+
+	for (i = 0; i < cnt; i++) {
+		if (ofi_sendmsg_udp(sock, &hdr[i], 0) < 0)
+			return i ? (int) i : -1;
+	}
+	return (int) cnt;
+}
+#endif
+
+/*
+ * Copies a datagram into the receive at the head of the queue.  Datagrams
+ * are packed into a multi-receive buffer, which is released once less
+ * than min_multi_recv bytes are left in it.
+ */
+static void udpx_rx_copy(struct udpx_ep *ep, uint8_t *data, size_t len,
+			 void *addr)
 {
-	struct udpx_ep *ep;
 	struct udpx_ep_entry *entry;
+	uint64_t flags = 0;
+	void *context;
+	uint8_t *buf;
+	size_t size;
+
+	entry = ofi_cirque_head(ep->rxq);
+	context = entry->context;
+	if (!(entry->flags & UDPX_FLAG_MULTI_RECV)) {
+		buf = NULL;
+		size = ofi_copy_to_iov(entry->iov, entry->iov_count, 0,
+				       data, len);
+		ofi_cirque_discard(ep->rxq);
+	} else {
+		buf = entry->iov[0].iov_base;
+		size = MIN(len, entry->iov[0].iov_len);
+		memcpy(buf, data, size);
+		entry->iov[0].iov_base = buf + size;
+		entry->iov[0].iov_len -= size;
+		if (entry->iov[0].iov_len < ep->min_multi_recv) {
+			flags = FI_MULTI_RECV;
+			ofi_cirque_discard(ep->rxq);
+		}
+	}
+
+	if (size < len)
+		udpx_rx_trunc(ep, context, flags, size, buf, len - size);
+	else
+		ep->rx_comp(ep, context, flags, size, buf, addr);
+}
+
+static inline bool udpx_rx_multi(struct udpx_ep *ep)
+{
+	return !ofi_cirque_isempty(ep->rxq) &&
+	       (ofi_cirque_head(ep->rxq)->flags & UDPX_FLAG_MULTI_RECV);
+}
+
+static size_t udpx_slab_deliver(struct udpx_ep *ep)
+{
+	struct udpx_rx_slab *slab = ep->slab;
+
+	while (slab->next < slab->cnt && !ofi_cirque_isempty(ep->rxq) &&
+	       !ofi_cirque_isfull(ep->util_ep.rx_cq->cirq)) {
+		udpx_rx_copy(ep, slab->data[slab->next],
+			     slab->len[slab->next], &slab->addr[slab->next]);
+		slab->next++;
+	}
+	return slab->cnt - slab->next;
+}
+
+/*
+ * Receives a batch of datagrams into the slab while a multi-receive
+ * buffer is at the head of the queue.  Returns the number of datagrams
+ * that are still held in the slab.
+ */
+static size_t udpx_ep_progress_slab(struct udpx_ep *ep)
+{
+	struct udpx_rx_slab *slab = ep->slab;
+	struct msghdr hdr[UDPX_MAX_BATCH];
+	struct iovec iov[UDPX_MAX_BATCH];
+	size_t cnt, i;
+	int ret;
+
+	if (udpx_slab_deliver(ep) || !udpx_rx_multi(ep))
+		return slab->cnt - slab->next;
+
+	cnt = MIN(ofi_cirque_freecnt(ep->util_ep.rx_cq->cirq),
+		  udpx_batch_size);
+	for (i = 0; i < cnt; i++) {
+		iov[i].iov_base = slab->data[i];
+		iov[i].iov_len = sizeof(slab->data[i]);
+		hdr[i].msg_name = &slab->addr[i];
+		hdr[i].msg_namelen = sizeof(slab->addr[i]);
+		hdr[i].msg_iov = &iov[i];
+		hdr[i].msg_iovlen = 1;
+		hdr[i].msg_control = NULL;
+		hdr[i].msg_controllen = 0;
+		hdr[i].msg_flags = 0;
+	}
+
+	ret = cnt ? udpx_recv_batch(ep->sock, hdr, slab->len, cnt) : 0;
+	slab->cnt = ret > 0 ? ret : 0;
+	slab->next = 0;
+	return udpx_slab_deliver(ep);
+}
+
+#if UDPX_HAVE_GSO
+/* Reads the next buffer, which holds datagrams of seg_size bytes each */
+static int udpx_gro_read(struct udpx_ep *ep)
+{
+	struct udpx_gro_buf *gro = ep->gro;
+	char ctrl[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
 	struct msghdr hdr;
-	struct sockaddr_in6 addr;
+	struct iovec iov;
 	ssize_t ret;
 
-	ep = container_of(util_ep, struct udpx_ep, util_ep);
-	hdr.msg_name = &addr;
-	hdr.msg_namelen = sizeof(addr);
-	hdr.msg_control = NULL;
-	hdr.msg_controllen = 0;
+	iov.iov_base = gro->data;
+	iov.iov_len = sizeof(gro->data);
+	hdr.msg_name = &gro->addr;
+	hdr.msg_namelen = sizeof(gro->addr);
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	hdr.msg_control = ctrl;
+	hdr.msg_controllen = sizeof(ctrl);
 	hdr.msg_flags = 0;
 
+	ret = ofi_recvmsg_udp(ep->sock, &hdr, 0);
+	if (ret < 0)
+		return -1;
+
+	gro->len = gro->seg_size = ret;
+	gro->off = 0;
+	for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+		if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+			gro->seg_size = *(int *) CMSG_DATA(cmsg);
+	}
+	return 0;
+}
+
+/*
+ * Copies the datagrams of coalesced buffers into the posted receives.
+ * Segments that find no receive stay buffered for the next call.
+ */
+static void udpx_ep_progress_gro(struct udpx_ep *ep)
+{
+	struct udpx_gro_buf *gro = ep->gro;
+	size_t cnt, len;
+
+	cnt = MIN(ofi_cirque_usedcnt(ep->rxq),
+		  ofi_cirque_freecnt(ep->util_ep.rx_cq->cirq));
+	while (cnt--) {
+		if (gro->off == gro->len && udpx_gro_read(ep))
+			break;
+
+		len = MIN(gro->seg_size, gro->len - gro->off);
+		udpx_rx_copy(ep, &gro->data[gro->off], len, &gro->addr);
+		gro->off += len;
+	}
+}
+#else
+static void udpx_ep_progress_gro(struct udpx_ep *ep)
+{
+}
+#endif
+
+/*
+ * Receives into as many posted buffers as the socket has datagrams for,
+ * up to the batch size and the room left in the CQ.  Multi-receive
+ * buffers are filled through the slab.
+ */
+static void udpx_ep_progress_rx(struct udpx_ep *ep)
+{
+	struct msghdr hdr[UDPX_MAX_BATCH];
+	struct sockaddr_in6 addr[UDPX_MAX_BATCH];
+	size_t len[UDPX_MAX_BATCH];
+	struct udpx_ep_entry *entry;
+	size_t cnt, size, i;
+	int ret;
+
 	fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
-	if (ofi_cirque_isempty(ep->rxq))
+	if (ep->gro) {
+		udpx_ep_progress_gro(ep);
 		goto out;
+	}
 
-	entry = ofi_cirque_head(ep->rxq);
-	hdr.msg_iov = entry->iov;
-	hdr.msg_iovlen = entry->iov_count;
+	if (ep->slab && udpx_ep_progress_slab(ep))
+		goto out;
 
-	ret = ofi_recvmsg_udp(ep->sock, &hdr, 0);
-	if (ret >= 0) {
-		ep->rx_comp(ep, entry->context, 0, ret, NULL, &addr);
+	cnt = MIN(ofi_cirque_usedcnt(ep->rxq),
+		  ofi_cirque_freecnt(ep->util_ep.rx_cq->cirq));
+	cnt = MIN(cnt, udpx_batch_size);
+	for (i = 0; i < cnt; i++) {
+		entry = &ep->rxq->buf[(ep->rxq->rcnt + i) & ep->rxq->size_mask];
+		if (entry->flags & UDPX_FLAG_MULTI_RECV)
+			break;
+		hdr[i].msg_name = &addr[i];
+		hdr[i].msg_namelen = sizeof(addr[i]);
+		hdr[i].msg_iov = entry->iov;
+		hdr[i].msg_iovlen = entry->iov_count;
+		hdr[i].msg_control = NULL;
+		hdr[i].msg_controllen = 0;
+		hdr[i].msg_flags = 0;
+	}
+
+	cnt = i;
+	if (!cnt)
+		goto out;
+
+	ret = udpx_recv_batch(ep->sock, hdr, len, cnt);
+	for (i = 0; ret > 0 && i < (size_t) ret; i++) {
+		entry = ofi_cirque_head(ep->rxq);
+		if (hdr[i].msg_flags & MSG_TRUNC) {
+			size = ofi_total_iov_len(entry->iov, entry->iov_count);
+			udpx_rx_trunc(ep, entry->context, 0, MIN(len[i], size),
+				      NULL, len[i] > size ? len[i] - size : 0);
+		} else {
+			ep->rx_comp(ep, entry->context, 0, len[i], NULL,
+				    &addr[i]);
+		}
 		ofi_cirque_discard(ep->rxq);
 	}
 out:
 	fastlock_release(&ep->util_ep.rx_cq->cq_lock);
 }
 
+struct udpx_tx_err {
+	void			*context;
+	int			err;
+};
+
+union udpx_gso_ctrl {
+	char			buf[CMSG_SPACE(sizeof(uint16_t))];
+	struct cmsghdr		align;
+};
+
+static inline struct udpx_tx_entry *
+udpx_tx_entry_at(struct udpx_ep *ep, size_t i)
+{
+	return &ep->txq->buf[(ep->txq->rcnt + i) & ep->txq->size_mask];
+}
+
+/*
+ * Describes the queued sends from index first on as one message.  With
+ * GSO, a run of sends to the same peer that have the same size, of which
+ * only the last may be shorter, becomes a single message that the kernel
+ * splits into datagrams again.  Returns the number of sends described.
+ */
+static size_t udpx_tx_msg(struct udpx_ep *ep, size_t first, size_t cnt,
+			  struct msghdr *hdr, struct iovec *iov,
+			  union udpx_gso_ctrl *ctrl)
+{
+	struct udpx_tx_entry *entry, *next;
+	size_t seg_size, total, len, i;
+
+	entry = udpx_tx_entry_at(ep, first);
+	memcpy(iov, entry->iov, entry->iov_count * sizeof(*iov));
+	hdr->msg_name = &entry->addr;
+	hdr->msg_namelen = entry->addrlen;
+	hdr->msg_iov = iov;
+	hdr->msg_iovlen = entry->iov_count;
+	hdr->msg_control = NULL;
+	hdr->msg_controllen = 0;
+	hdr->msg_flags = 0;
+
+	seg_size = total = ofi_total_iov_len(entry->iov, entry->iov_count);
+	for (i = first + 1; ep->gso && seg_size && i < cnt &&
+	     i - first < UDPX_GSO_MAX_SEGS; i++) {
+		next = udpx_tx_entry_at(ep, i);
+		len = ofi_total_iov_len(next->iov, next->iov_count);
+		if (!len || len > seg_size || total + len > UDPX_GSO_MAX_SIZE ||
+		    next->addrlen != entry->addrlen ||
+		    memcmp(&next->addr, &entry->addr, entry->addrlen))
+			break;
+
+		memcpy(&iov[hdr->msg_iovlen], next->iov,
+		       next->iov_count * sizeof(*iov));
+		hdr->msg_iovlen += next->iov_count;
+		total += len;
+		if (len < seg_size) {
+			i++;
+			break;
+		}
+	}
+
+#if UDPX_HAVE_GSO
+	if (i - first > 1) {
+		struct cmsghdr *cmsg;
+
+		hdr->msg_control = ctrl->buf;
+		hdr->msg_controllen = sizeof(ctrl->buf);
+		cmsg = CMSG_FIRSTHDR(hdr);
+		cmsg->cmsg_level = SOL_UDP;
+		cmsg->cmsg_type = UDP_SEGMENT;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+		*(uint16_t *) CMSG_DATA(cmsg) = (uint16_t) seg_size;
+	}
+#endif
+	return i - first;
+}
+
+/*
+ * Sends the transfers queued with FI_MORE, which must be called with the
+ * tx CQ lock held.  Transfers that fail are removed from the queue and
+ * returned in errs, to be reported once the lock was released.
+ */
+static size_t udpx_tx_flush(struct udpx_ep *ep, struct udpx_tx_err *errs)
+{
+	struct msghdr hdr[UDPX_MAX_BATCH];
+	struct iovec iov[UDPX_MAX_BATCH * UDPX_IOV_LIMIT];
+	union udpx_gso_ctrl ctrl[UDPX_MAX_BATCH];
+	size_t seg_cnt[UDPX_MAX_BATCH];
+	struct udpx_tx_entry *entry;
+	size_t cnt, msg_cnt, i, j, err_cnt = 0;
+	int ret;
+
+	while (!ofi_cirque_isempty(ep->txq)) {
+		cnt = ofi_cirque_usedcnt(ep->txq);
+		for (i = 0, msg_cnt = 0; i < cnt; i += seg_cnt[msg_cnt++]) {
+			seg_cnt[msg_cnt] = udpx_tx_msg(ep, i, cnt, &hdr[msg_cnt],
+						       &iov[i * UDPX_IOV_LIMIT],
+						       &ctrl[msg_cnt]);
+		}
+
+		ret = udpx_send_batch(ep->sock, hdr, msg_cnt);
+		if (ret < 0) {
+			if (OFI_SOCK_TRY_SND_RCV_AGAIN(errno))
+				break;
+
+			if (seg_cnt[0] > 1) {
+				FI_WARN(&udpx_prov, FI_LOG_EP_DATA,
+					"GSO send failed, disabling GSO: %s\n",
+					strerror(errno));
+				ep->gso = false;
+				continue;
+			}
+
+			entry = ofi_cirque_remove(ep->txq);
+			errs[err_cnt].context = entry->context;
+			errs[err_cnt++].err = errno;
+			continue;
+		}
+
+		for (i = 0; i < (size_t) ret; i++) {
+			for (j = 0; j < seg_cnt[i]; j++) {
+				entry = ofi_cirque_remove(ep->txq);
+				ep->tx_comp(ep, entry->context);
+			}
+		}
+	}
+	return err_cnt;
+}
+
+static void udpx_tx_report(struct udpx_ep *ep, struct udpx_tx_err *errs,
+			   size_t cnt)
+{
+	struct fi_cq_err_entry err_entry;
+	size_t i;
+
+	for (i = 0; i < cnt; i++) {
+		FI_WARN(&udpx_prov, FI_LOG_EP_DATA, "send failed: %s\n",
+			strerror(errs[i].err));
+		memset(&err_entry, 0, sizeof err_entry);
+		err_entry.op_context = errs[i].context;
+		err_entry.flags = FI_SEND;
+		err_entry.err = errs[i].err;
+		err_entry.prov_errno = errs[i].err;
+		(void) ofi_cq_write_error(ep->util_ep.tx_cq, &err_entry);
+	}
+}
+
+/*
+ * Returns true if sends are still queued because the socket is full.
+ * Callers may check for queued sends without holding the lock, since a
+ * send that another thread is queuing at the same time is not ordered
+ * against theirs anyway.
+ */
+static bool udpx_tx_drain(struct udpx_ep *ep)
+{
+	struct udpx_tx_err errs[UDPX_MAX_BATCH];
+	size_t err_cnt;
+	bool queued;
+
+	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
+	err_cnt = udpx_tx_flush(ep, errs);
+	queued = !ofi_cirque_isempty(ep->txq);
+	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
+	udpx_tx_report(ep, errs, err_cnt);
+	return queued;
+}
+
+static void udpx_ep_progress(struct util_ep *util_ep)
+{
+	struct udpx_ep *ep;
+
+	ep = container_of(util_ep, struct udpx_ep, util_ep);
+	if (ep->util_ep.rx_cq)
+		udpx_ep_progress_rx(ep);
+	if (ep->util_ep.tx_cq && !ofi_cirque_isempty(ep->txq))
+		(void) udpx_tx_drain(ep);
+}
+
 static ssize_t udpx_recvmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
 			    uint64_t flags)
 {
@@ -310,19 +764,30 @@ static ssize_t udpx_recvmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
 	ssize_t ret;
 
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
+	if ((flags & FI_MULTI_RECV) && msg->iov_count != 1)
+		return -FI_EINVAL;
+
 	fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
 	if (ofi_cirque_isfull(ep->rxq)) {
 		ret = -FI_EAGAIN;
 		goto out;
 	}
 
+	if ((flags & FI_MULTI_RECV) && !ep->slab) {
+		ep->slab = calloc(1, sizeof(*ep->slab));
+		if (!ep->slab) {
+			ret = -FI_ENOMEM;
+			goto out;
+		}
+	}
+
 	entry = ofi_cirque_tail(ep->rxq);
 	entry->context = msg->context;
 	for (entry->iov_count = 0; entry->iov_count < msg->iov_count;
 	     entry->iov_count++) {
 		entry->iov[entry->iov_count] = msg->msg_iov[entry->iov_count];
 	}
-	entry->flags = 0;
+	entry->flags = (flags & FI_MULTI_RECV) ? UDPX_FLAG_MULTI_RECV : 0;
 
 	ofi_cirque_commit(ep->rxq);
 	ret = 0;
@@ -335,12 +800,14 @@ static ssize_t udpx_recvv(struct fid_ep *ep_fid, const struct iovec *iov,
 			  void **desc, size_t count, fi_addr_t src_addr,
 			  void *context)
 {
+	struct udpx_ep *ep;
 	struct fi_msg msg;
 
+	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
 	msg.msg_iov = iov;
 	msg.iov_count = count;
 	msg.context = context;
-	return udpx_recvmsg(ep_fid, &msg, 0);
+	return udpx_recvmsg(ep_fid, &msg, ep->util_ep.rx_op_flags);
 }
 
 static ssize_t udpx_recv(struct fid_ep *ep_fid, void *buf, size_t len,
@@ -348,9 +815,16 @@ static ssize_t udpx_recv(struct fid_ep *ep_fid, void *buf, size_t len,
 {
 	struct udpx_ep *ep;
 	struct udpx_ep_entry *entry;
+	struct iovec iov;
 	ssize_t ret;
 
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
+	if (ep->util_ep.rx_op_flags & FI_MULTI_RECV) {
+		iov.iov_base = buf;
+		iov.iov_len = len;
+		return udpx_recvv(ep_fid, &iov, &desc, 1, src_addr, context);
+	}
+
 	fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
 	if (ofi_cirque_isfull(ep->rxq)) {
 		ret = -FI_EAGAIN;
@@ -387,20 +861,77 @@ udpx_dest_addrlen(struct udpx_ep *ep, fi_addr_t addr, uint64_t flags)
 		ep->util_ep.av->addrlen;
 }
 
-static ssize_t udpx_sendto(struct udpx_ep *ep, const void *buf, size_t len,
-			   const void *addr, size_t addrlen, void *context)
+static void udpx_tx_insert(struct udpx_ep *ep, const struct iovec *iov,
+			   size_t count, const void *addr, size_t addrlen,
+			   void *context)
 {
+	struct udpx_tx_entry *entry;
+
+	entry = ofi_cirque_tail(ep->txq);
+	entry->context = context;
+	for (entry->iov_count = 0; entry->iov_count < count;
+	     entry->iov_count++)
+		entry->iov[entry->iov_count] = iov[entry->iov_count];
+	memcpy(&entry->addr, addr, addrlen);
+	entry->addrlen = (socklen_t) addrlen;
+	ofi_cirque_commit(ep->txq);
+}
+
+/*
+ * Sends posted with FI_MORE are queued, and go out together with the
+ * next send posted without it, or when the endpoint is progressed.
+ * Sends that carry FI_INJECT are never queued, since the buffer must be
+ * reusable on return.
+ */
+static ssize_t udpx_sendv_to(struct udpx_ep *ep, const struct iovec *iov,
+			     size_t count, const void *addr, size_t addrlen,
+			     void *context, uint64_t flags)
+{
+	struct udpx_tx_err errs[UDPX_MAX_BATCH];
+	struct msghdr hdr;
+	size_t err_cnt = 0;
 	ssize_t ret;
 
 	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
-	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq)) {
+	if (!ofi_cirque_isempty(ep->txq) &&
+	    (ofi_cirque_usedcnt(ep->txq) >= udpx_batch_size ||
+	     (flags & FI_INJECT)))
+		err_cnt = udpx_tx_flush(ep, errs);
+
+	if (ofi_cirque_usedcnt(ep->txq) >= udpx_batch_size ||
+	    ofi_cirque_freecnt(ep->util_ep.tx_cq->cirq) <=
+	    ofi_cirque_usedcnt(ep->txq)) {
 		ret = -FI_EAGAIN;
 		goto out;
 	}
 
-	ret = ofi_sendto_socket(ep->sock, buf, len, 0,
-				addr, (socklen_t)addrlen);
-	if (ret == (ssize_t)len) {
+	if ((flags & FI_MORE) && !(flags & FI_INJECT)) {
+		udpx_tx_insert(ep, iov, count, addr, addrlen, context);
+		ret = 0;
+		goto out;
+	}
+
+	if (!ofi_cirque_isempty(ep->txq)) {
+		if (flags & FI_INJECT) {
+			ret = -FI_EAGAIN;
+			goto out;
+		}
+		udpx_tx_insert(ep, iov, count, addr, addrlen, context);
+		err_cnt += udpx_tx_flush(ep, &errs[err_cnt]);
+		ret = 0;
+		goto out;
+	}
+
+	hdr.msg_name = (void *) addr;
+	hdr.msg_namelen = (socklen_t) addrlen;
+	hdr.msg_iov = (struct iovec *) iov;
+	hdr.msg_iovlen = count;
+	hdr.msg_control = NULL;
+	hdr.msg_controllen = 0;
+	hdr.msg_flags = 0;
+
+	ret = ofi_sendmsg_udp(ep->sock, &hdr, 0);
+	if (ret >= 0) {
 		ep->tx_comp(ep, context);
 		ret = 0;
 	} else {
@@ -408,6 +939,7 @@ static ssize_t udpx_sendto(struct udpx_ep *ep, const void *buf, size_t len,
 	}
 out:
 	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
+	udpx_tx_report(ep, errs, err_cnt);
 	return ret;
 }
 
@@ -415,55 +947,40 @@ static ssize_t udpx_send(struct fid_ep *ep_fid, const void *buf, size_t len,
 			 void *desc, fi_addr_t dest_addr, void *context)
 {
 	struct udpx_ep *ep;
+	struct iovec iov;
 
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
-	return udpx_sendto(ep, buf, len, ofi_ip_av_get_addr(ep->util_ep.av, (int)dest_addr),
-			   ep->util_ep.av->addrlen, context);
+	iov.iov_base = (void *) buf;
+	iov.iov_len = len;
+	return udpx_sendv_to(ep, &iov, 1,
+			     ofi_ip_av_get_addr(ep->util_ep.av, (int)dest_addr),
+			     ep->util_ep.av->addrlen, context, 0);
 }
 
 static ssize_t udpx_send_mc(struct fid_ep *ep_fid, const void *buf, size_t len,
 			    void *desc, fi_addr_t dest_addr, void *context)
 {
 	struct udpx_ep *ep;
+	struct iovec iov;
 
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
-	return udpx_sendto(ep, buf, len, (const void *) (uintptr_t) dest_addr,
-			   ofi_sizeofaddr((const void *) (uintptr_t) dest_addr),
-			   context);
+	iov.iov_base = (void *) buf;
+	iov.iov_len = len;
+	return udpx_sendv_to(ep, &iov, 1, (const void *) (uintptr_t) dest_addr,
+			     ofi_sizeofaddr((const void *) (uintptr_t) dest_addr),
+			     context, 0);
 }
 
 static ssize_t udpx_sendmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
 			    uint64_t flags)
 {
 	struct udpx_ep *ep;
-	struct msghdr hdr;
-	ssize_t ret;
 
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
-	hdr.msg_name = (void *)udpx_dest_addr(ep, msg->addr, flags);
-	hdr.msg_namelen = (int)udpx_dest_addrlen(ep, msg->addr, flags);
-	hdr.msg_iov = (struct iovec *)msg->msg_iov;
-	hdr.msg_iovlen = msg->iov_count;
-	hdr.msg_control = NULL;
-	hdr.msg_controllen = 0;
-	hdr.msg_flags = 0;
-
-	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
-	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq)) {
-		ret = -FI_EAGAIN;
-		goto out;
-	}
-
-	ret = ofi_sendmsg_udp(ep->sock, &hdr, 0);
-	if (ret >= 0) {
-		ep->tx_comp(ep, msg->context);
-		ret = 0;
-	} else {
-		ret = -errno;
-	}
-out:
-	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
-	return ret;
+	return udpx_sendv_to(ep, msg->msg_iov, msg->iov_count,
+			     udpx_dest_addr(ep, msg->addr, flags),
+			     udpx_dest_addrlen(ep, msg->addr, flags),
+			     msg->context, flags);
 }
 
 static ssize_t udpx_sendv(struct fid_ep *ep_fid, const struct iovec *iov,
@@ -501,6 +1018,9 @@ static ssize_t udpx_inject(struct fid_ep *ep_fid, const void *buf, size_t len,
 	ssize_t ret;
 
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
+	if (!ofi_cirque_isempty(ep->txq) && udpx_tx_drain(ep))
+		return -FI_EAGAIN;
+
 	ret = ofi_sendto_socket(ep->sock, buf, len, 0,
 				ofi_ip_av_get_addr(ep->util_ep.av, (int)dest_addr),
 				(socklen_t)ep->util_ep.av->addrlen);
@@ -514,6 +1034,9 @@ static ssize_t udpx_inject_mc(struct fid_ep *ep_fid, const void *buf,
 	ssize_t ret;
 
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
+	if (!ofi_cirque_isempty(ep->txq) && udpx_tx_drain(ep))
+		return -FI_EAGAIN;
+
 	ret = ofi_sendto_socket(ep->sock, buf, len, 0,
 				(const void *)(uintptr_t)dest_addr,
 				(socklen_t)ofi_sizeofaddr((const void *)(uintptr_t)dest_addr));
@@ -557,6 +1080,13 @@ static int udpx_ep_close(struct fid *fid)
 		return -FI_EBUSY;
 	}
 
+	if (ep->util_ep.tx_cq) {
+		(void) udpx_tx_drain(ep);
+		fid_list_remove(&ep->util_ep.tx_cq->ep_list,
+				&ep->util_ep.tx_cq->ep_list_lock,
+				&ep->util_ep.ep_fid.fid);
+	}
+
 	if (ep->util_ep.rx_cq) {
 		if (ep->util_ep.rx_cq->wait) {
 			wait = container_of(ep->util_ep.rx_cq->wait,
@@ -568,7 +1098,10 @@ static int udpx_ep_close(struct fid *fid)
 				&ep->util_ep.ep_fid.fid);
 	}
 
+	udpx_tx_cirq_free(ep->txq);
 	udpx_rx_cirq_free(ep->rxq);
+	free(ep->gro);
+	free(ep->slab);
 	ofi_close_socket(ep->sock);
 	ofi_endpoint_close(&ep->util_ep);
 	free(ep);
@@ -590,6 +1123,13 @@ static int udpx_ep_bind_cq(struct udpx_ep *ep, struct util_cq *cq,
 		ofi_atomic_inc32(&cq->ref);
 		ep->tx_comp = cq->wait ? udpx_tx_comp_signal :
 					 udpx_tx_comp;
+
+		/* sends queued with FI_MORE are flushed by progress */
+		ret = fid_list_insert(&cq->ep_list,
+				      &cq->ep_list_lock,
+				      &ep->util_ep.ep_fid.fid);
+		if (ret)
+			return ret;
 	}
 
 	if (flags & FI_RECV) {
@@ -720,18 +1260,54 @@ static struct fi_ops udpx_ep_fi_ops = {
 	.ops_open = fi_no_ops_open,
 };
 
+#if UDPX_HAVE_GSO
+static void udpx_ep_init_offload(struct udpx_ep *ep)
+{
+	int val = 0;
+
+	/* Kernels without GSO reject setting the default segment size */
+	ep->gso = udpx_gso && !setsockopt(ep->sock, SOL_UDP, UDP_SEGMENT,
+					  &val, sizeof(val));
+	if (!udpx_gro)
+		return;
+
+	ep->gro = calloc(1, sizeof(*ep->gro));
+	if (!ep->gro)
+		return;
+
+	val = 1;
+	if (setsockopt(ep->sock, SOL_UDP, UDP_GRO, &val, sizeof(val))) {
+		FI_INFO(&udpx_prov, FI_LOG_EP_CTRL, "UDP GRO not supported: %s\n",
+			strerror(errno));
+		free(ep->gro);
+		ep->gro = NULL;
+	}
+}
+#else
+static void udpx_ep_init_offload(struct udpx_ep *ep)
+{
+}
+#endif
+
 static int udpx_ep_init(struct udpx_ep *ep, struct fi_info *info)
 {
 	int family;
 	int ret;
 
 	ofi_atomic_initialize32(&ep->ref, 0);
+	ep->min_multi_recv = UDPX_MAX_MSG_SIZE;
 	ep->rxq = udpx_rx_cirq_create(info->rx_attr->size);
 	if (!ep->rxq) {
 		ret = -FI_ENOMEM;
 		return ret;
 	}
 
+	ep->txq = udpx_tx_cirq_create(UDPX_MAX_BATCH);
+	if (!ep->txq) {
+		ret = -FI_ENOMEM;
+		goto err1;
+	}
+
 	family = info->src_addr ?
 		 ((struct sockaddr *) info->src_addr)->sa_family : AF_INET;
 	ep->sock = socket(family, SOCK_DGRAM, IPPROTO_UDP);
@@ -751,10 +1327,12 @@ static int udpx_ep_init(struct udpx_ep *ep, struct fi_info *info)
 	if (ret)
 		goto err2;
 
+	udpx_ep_init_offload(ep);
 	return 0;
 err2:
 	ofi_close_socket(ep->sock);
 err1:
+	udpx_tx_cirq_free(ep->txq);
 	udpx_rx_cirq_free(ep->rxq);
 	return ret;
 }
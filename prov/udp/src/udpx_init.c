@@ -40,6 +40,10 @@
 #include <net/if.h>
 
 
+size_t udpx_batch_size = 32;
+int udpx_gso;
+int udpx_gro;
+
 #if HAVE_GETIFADDRS
 static void udpx_getinfo_ifs(struct fi_info **info)
 {
@@ -145,5 +149,24 @@ struct fi_provider udpx_prov = {
 
 UDP_INI
 {
+	fi_param_define(&udpx_prov, "batch_size", FI_PARAM_SIZE_T,
+			"Maximum number of datagrams that are received or "
+			"sent with a single system call (default: 32, "
+			"max: 64)");
+	fi_param_get_size_t(&udpx_prov, "batch_size", &udpx_batch_size);
+	udpx_batch_size = MAX(MIN(udpx_batch_size, UDPX_MAX_BATCH), 1);
+
+	fi_param_define(&udpx_prov, "gso", FI_PARAM_BOOL,
+			"Hand consecutive sends of the same size to the same "
+			"peer to the kernel as a single UDP GSO send "
+			"(default: no)");
+	fi_param_get_bool(&udpx_prov, "gso", &udpx_gso);
+
+	fi_param_define(&udpx_prov, "gro", FI_PARAM_BOOL,
+			"Let the kernel coalesce received datagrams with UDP "
+			"GRO, which are copied into the posted receives "
+			"(default: no)");
+	fi_param_get_bool(&udpx_prov, "gro", &udpx_gro);
+
 	return &udpx_prov;
 }
@@ -65,8 +65,8 @@ int ofi_cq_write_overflow(struct util_cq *cq, void *context, uint64_t flags, siz
 	return 0;
 }
 
-int ofi_cq_write_error(struct util_cq *cq,
-		       const struct fi_cq_err_entry *err_entry)
+int ofi_cq_write_error_thread_unsafe(struct util_cq *cq,
+				     const struct fi_cq_err_entry *err_entry)
 {
 	struct util_cq_oflow_err_entry *entry;
 	struct fi_cq_tagged_entry *comp;
@@ -77,7 +77,6 @@ int ofi_cq_write_error(struct util_cq *cq,
 		return -FI_ENOMEM;
 
 	entry->comp = *err_entry;
-	cq->cq_fastlock_acquire(&cq->cq_lock);
 	slist_insert_tail(&entry->list_entry, &cq->oflow_err_list);
 
 	if (OFI_UNLIKELY(ofi_cirque_isfull(cq->cirq))) {
@@ -89,10 +88,20 @@ int ofi_cq_write_error(struct util_cq *cq,
 		comp->flags = UTIL_FLAG_ERROR;
 		ofi_cirque_commit(cq->cirq);
 	}
+	return 0;
+}
+
+int ofi_cq_write_error(struct util_cq *cq,
+		       const struct fi_cq_err_entry *err_entry)
+{
+	int ret;
+
+	cq->cq_fastlock_acquire(&cq->cq_lock);
+	ret = ofi_cq_write_error_thread_unsafe(cq, err_entry);
 	cq->cq_fastlock_release(&cq->cq_lock);
-	if (cq->wait)
+	if (!ret && cq->wait)
 		cq->wait->signal(cq->wait);
-	return 0;
+	return ret;
 }
 
 int ofi_cq_write_error_peek(struct util_cq *cq, uint64_t tag, void *context)
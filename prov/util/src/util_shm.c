@@ -50,22 +50,75 @@ static void smr_peer_addr_init(struct smr_addr *peer)
 }
 
 /* TODO: Determine if aligning SMR data helps performance */
+/*
+ * The owner of a region receives into it, so its queues are placed on the
+ * owner's NUMA node.  Senders fill the inject pool, which can optionally be
+ * interleaved across nodes instead.  Placement is best effort.
+ */
+static void smr_place(const struct fi_provider *prov,
+		      const struct smr_attr *attr, void *addr,
+		      size_t total_size, size_t inject_offset, size_t sar_offset)
+{
+	size_t page_size;
+	char *start, *end;
+	int ret;
+
+	ret = ofi_mbind_node(addr, total_size, attr->numa_node);
+	if (ret) {
+		FI_INFO(prov, FI_LOG_EP_CTRL,
+			"unable to place region %s on NUMA node %d: %s\n",
+			attr->name, attr->numa_node, fi_strerror(-ret));
+		return;
+	}
+	FI_INFO(prov, FI_LOG_EP_CTRL, "region %s placed on NUMA node %d\n",
+		attr->name, attr->numa_node);
+
+	if (!attr->interleave_inject)
+		return;
+
+	page_size = ofi_sysconf(_SC_PAGESIZE);
+	start = (char *) fi_get_aligned_sz((size_t) addr + inject_offset,
+					   page_size);
+	end = (char *) addr + (sar_offset & ~(page_size - 1));
+	if (start >= end)
+		return;
+
+	ret = ofi_mbind_interleave(start, end - start);
+	if (ret)
+		FI_INFO(prov, FI_LOG_EP_CTRL,
+			"unable to interleave inject pool of %s: %s\n",
+			attr->name, fi_strerror(-ret));
+	else
+		FI_INFO(prov, FI_LOG_EP_CTRL,
+			"region %s inject pool interleaved\n", attr->name);
+}
+
 int smr_create(const struct fi_provider *prov, struct smr_map *map,
 	       const struct smr_attr *attr, struct smr_region **smr)
 {
-	size_t total_size, cmd_queue_offset, peer_addr_offset;
+	size_t total_size, cmd_queue_offset, peer_addr_offset, peer_cma_offset;
 	size_t resp_queue_offset, inject_pool_offset, name_offset;
+	size_t sar_pool_offset, inject_queue_offset, mr_window_offset;
 	int fd, ret, i;
 	void *mapped_addr;
 
 	cmd_queue_offset = sizeof(**smr);
 	resp_queue_offset = cmd_queue_offset + sizeof(struct smr_cmd_queue) +
-			sizeof(struct smr_cmd) * attr->rx_count;
-	inject_pool_offset = resp_queue_offset + sizeof(struct smr_resp_queue) +
+			sizeof(struct smr_cmd_queue_entry) * attr->rx_count;
+	inject_queue_offset = resp_queue_offset + sizeof(struct smr_resp_queue) +
 			sizeof(struct smr_resp) * attr->tx_count;
-	peer_addr_offset = inject_pool_offset + sizeof(struct smr_inject_pool) +
-			sizeof(struct smr_inject_pool_entry) * attr->rx_count;
-	name_offset = peer_addr_offset + sizeof(struct smr_addr) * SMR_MAX_PEERS;
+	inject_pool_offset = inject_queue_offset +
+			sizeof(struct smr_inject_queue) +
+			sizeof(struct smr_inject_queue_entry) * attr->rx_count;
+	sar_pool_offset = inject_pool_offset +
+			sizeof(struct smr_inject_buf) * attr->rx_count;
+	mr_window_offset = sar_pool_offset + sizeof(struct smr_sar_pool) +
+			sizeof(struct smr_sar_pool_entry) * SMR_SAR_POOL_SIZE;
+	peer_addr_offset = mr_window_offset +
+			sizeof(struct smr_mr_window) * SMR_MR_WINDOW_CNT;
+	peer_cma_offset = peer_addr_offset +
+			sizeof(struct smr_addr) * attr->peer_count;
+	name_offset = peer_cma_offset + attr->peer_count;
 	total_size = name_offset + strlen(attr->name) + 1;
 	total_size = roundup_power_of_two(total_size);
 
@@ -91,11 +144,17 @@ int smr_create(const struct fi_provider *prov, struct smr_map *map,
 	/* TODO: If we unlink here, can other processes open the region? */
 	close(fd);
 
+	/* Set the policy before the pages are first touched */
+	if (attr->numa_node >= 0)
+		smr_place(prov, attr, mapped_addr, total_size,
+			  inject_pool_offset, sar_pool_offset);
+
 	*smr = mapped_addr;
 	fastlock_init(&(*smr)->lock);
 	fastlock_acquire(&(*smr)->lock);
 
 	(*smr)->map = map;
+	(*smr)->base_addr = mapped_addr;
 	(*smr)->version = SMR_VERSION;
 	(*smr)->flags = SMR_FLAG_ATOMIC | SMR_FLAG_DEBUG;
 	(*smr)->pid = getpid();
@@ -104,15 +163,25 @@ int smr_create(const struct fi_provider *prov, struct smr_map *map,
 	(*smr)->cmd_queue_offset = cmd_queue_offset;
 	(*smr)->resp_queue_offset = resp_queue_offset;
 	(*smr)->inject_pool_offset = inject_pool_offset;
+	(*smr)->inject_queue_offset = inject_queue_offset;
+	(*smr)->sar_pool_offset = sar_pool_offset;
+	(*smr)->mr_window_offset = mr_window_offset;
 	(*smr)->peer_addr_offset = peer_addr_offset;
+	(*smr)->peer_addr_cnt = attr->peer_count;
+	(*smr)->peer_addr_used = 0;
+	(*smr)->peer_cma_offset = peer_cma_offset;
 	(*smr)->name_offset = name_offset;
-	(*smr)->cmd_cnt = attr->rx_count;
+	ofi_atomic_initialize32(&(*smr)->signal, 0);
+	ofi_atomic_initialize32(&(*smr)->mr_req, 0);
 
 	smr_cmd_queue_init(smr_cmd_queue(*smr), attr->rx_count);
 	smr_resp_queue_init(smr_resp_queue(*smr), attr->tx_count);
-	smr_inject_pool_init(smr_inject_pool(*smr), attr->rx_count);
-	for (i = 0; i < SMR_MAX_PEERS; i++)
-		smr_peer_addr_init(&smr_peer_addr(*smr)[i]);
+	smr_inject_queue_init(smr_inject_queue(*smr), attr->rx_count);
+	for (i = 0; i < attr->rx_count; i++)
+		smr_inject_buf_push(*smr, &smr_inject_pool(*smr)[i]);
+	smr_sar_pool_init(smr_sar_pool(*smr), SMR_SAR_POOL_SIZE);
+	for (i = 0; i < SMR_MR_WINDOW_CNT; i++)
+		ofi_atomic_initialize32(&smr_mr_windows(*smr)[i].seq, 0);
 
 	strncpy((char *) smr_name(*smr), attr->name, total_size - name_offset);
 	fastlock_release(&(*smr)->lock);
@@ -131,21 +200,16 @@ void smr_free(struct smr_region *smr)
 	shm_unlink(smr_name(smr));
 }
 
-int smr_map_create(const struct fi_provider *prov, int peer_count,
-		   struct smr_map **map)
+int smr_map_create(const struct fi_provider *prov, struct smr_map **map)
 {
-	int i;
-
 	(*map) = calloc(1, sizeof(struct smr_map));
 	if (!*map) {
 		FI_WARN(prov, FI_LOG_DOMAIN, "failed to create SHM region group\n");
 		return -FI_ENOMEM;
 	}
 
-	for (i = 0; i < peer_count; i++)
-		smr_peer_addr_init(&(*map)->peers[i].peer);
-
 	fastlock_init(&(*map)->lock);
+	ofi_atomic_initialize32(&(*map)->busy, 0);
 
 	return 0;
 }
@@ -153,6 +217,7 @@ int smr_map_create(const struct fi_provider *prov, int peer_count,
 int smr_map_to_region(const struct fi_provider *prov, struct smr_peer *peer_buf)
 {
 	struct smr_region *peer;
+	struct stat st;
 	size_t size;
 	int fd, ret = 0;
 
@@ -162,6 +227,14 @@ int smr_map_to_region(const struct fi_provider *prov, struct smr_peer *peer_buf)
 		return -errno;
 	}
 
+	/* Regions are created private to their user; one made accessible by
+	 * another user could direct our memory files to its own process */
+	if (fstat(fd, &st) || st.st_uid != geteuid()) {
+		FI_WARN(prov, FI_LOG_AV, "peer region not owned by our user\n");
+		ret = -FI_EACCES;
+		goto out;
+	}
+
 	peer = mmap(NULL, sizeof(*peer), PROT_READ | PROT_WRITE,
 		    MAP_SHARED, fd, 0);
 	if (peer == MAP_FAILED) {
@@ -177,6 +250,14 @@ int smr_map_to_region(const struct fi_provider *prov, struct smr_peer *peer_buf)
 		goto out;
 	}
 
+	if (peer->version != SMR_VERSION) {
+		FI_WARN(prov, FI_LOG_AV, "peer uses shm protocol version %d, "
+			"expected %d\n", peer->version, SMR_VERSION);
+		munmap(peer, sizeof(*peer));
+		ret = -FI_EINVAL;
+		goto out;
+	}
+
 	size = peer->total_size;
 	munmap(peer, sizeof(*peer));
 
@@ -188,28 +269,62 @@ out:
 	return ret;
 }
 
+/*
+ * The address table is sized for every possible peer but only initialized up
+ * to the highest index published, so its pages are touched as the AV grows.
+ * Peers never look past peer_addr_used.
+ */
+static void smr_peer_addr_grow(struct smr_region *region, size_t index)
+{
+	size_t i;
+
+	if (index < region->peer_addr_used)
+		return;
+
+	for (i = region->peer_addr_used; i <= index; i++) {
+		smr_peer_addr_init(&smr_peer_addr(region)[i]);
+		smr_peer_cma(region)[i] = SMR_CMA_CAP_NA;
+	}
+	smr_wmb();
+	region->peer_addr_used = index + 1;
+}
+
 void smr_map_to_endpoint(struct smr_region *region, int index)
 {
 	struct smr_region *peer_smr;
 	struct smr_addr *local_peers, *peer_peers;
-	int peer_index;
+	struct smr_peer *peer;
+	size_t peer_index, peer_used;
 
+	peer = smr_map_peer(region->map, index);
+	if (!peer || (size_t) index >= region->peer_addr_cnt)
+		return;
+
+	smr_peer_addr_grow(region, index);
 	local_peers = smr_peer_addr(region);
+	if (strncmp(local_peers[index].name, peer->peer.name, SMR_NAME_SIZE)) {
+		strncpy(local_peers[index].name, peer->peer.name,
+			SMR_NAME_SIZE);
+		smr_peer_cma(region)[index] = SMR_CMA_CAP_NA;
+		smr_wmb();
+		region->peer_gen++;
+	}
 
-	strncpy(smr_peer_addr(region)[index].name,
-		region->map->peers[index].peer.name, SMR_NAME_SIZE);
-	if (region->map->peers[index].peer.addr == FI_ADDR_UNSPEC)
+	peer_smr = peer->region;
+	if (!peer_smr)
 		return;
 
-	peer_smr = smr_peer_region(region, index);
-	peer_peers = smr_peer_addr(peer_smr);
+	peer->peer_gen = peer_smr->peer_gen;
+	peer_used = MIN(peer_smr->peer_addr_used, peer_smr->peer_addr_cnt);
+	smr_rmb();
 
-	for (peer_index = 0; peer_index < SMR_MAX_PEERS; peer_index++) {
+	peer_peers = smr_peer_addr(peer_smr);
+	for (peer_index = 0; peer_index < peer_used; peer_index++) {
 		if (!strncmp(smr_name(region),
 		    peer_peers[peer_index].name, SMR_NAME_SIZE))
 			break;
 	}
-	if (peer_index != SMR_MAX_PEERS) {
+	if (peer_index != peer_used) {
 		peer_peers[peer_index].addr = index;
 		local_peers[index].addr = peer_index;
 	}
@@ -218,69 +333,212 @@ void smr_map_to_endpoint(struct smr_region *region, int index)
 void smr_unmap_from_endpoint(struct smr_region *region, int index)
 {
 	struct smr_region *peer_smr;
-	struct smr_addr *local_peers, *peer_peers;
-	int peer_index;
+	struct smr_addr *local_peers;
+	struct smr_peer *peer;
+	fi_addr_t peer_index;
 
-	local_peers = smr_peer_addr(region);
+	peer = smr_map_peer(region->map, index);
+	if (!peer || (size_t) index >= region->peer_addr_used)
+		return;
 
+	local_peers = smr_peer_addr(region);
 	memset(local_peers[index].name, 0, SMR_NAME_SIZE);
-	peer_index = region->map->peers[index].peer.addr;
-	if (peer_index == FI_ADDR_UNSPEC)
+	smr_peer_cma(region)[index] = SMR_CMA_CAP_NA;
+	peer_index = local_peers[index].addr;
+	local_peers[index].addr = FI_ADDR_UNSPEC;
+	peer_smr = peer->region ? peer->region : peer->retired;
+	if (peer_index == FI_ADDR_UNSPEC || !peer_smr)
 		return;
 
-	peer_smr = smr_peer_region(region, index);
-	peer_peers = smr_peer_addr(peer_smr);
-
-	peer_peers[peer_index].addr = FI_ADDR_UNSPEC;
+	smr_peer_addr(peer_smr)[peer_index].addr = FI_ADDR_UNSPEC;
 }
 
+/* Publishes the names of the peers already in the AV; no region is mapped */
 void smr_exchange_all_peers(struct smr_region *region)
 {
 	int i;
-	for (i = 0; i < SMR_MAX_PEERS; i++)
+
+	fastlock_acquire(&region->map->lock);
+	for (i = 0; i < region->map->peer_cnt; i++)
 		smr_map_to_endpoint(region, i);
+	fastlock_release(&region->map->lock);
+}
+
+/*
+ * Slow path of a transfer to a peer: map (or revive) its region, and look for
+ * our name in its address table if it has added names since we last looked.
+ * The region is returned under the map lock, so a concurrent sweep cannot
+ * retire it before the caller sees it.
+ */
+int smr_map_activate(const struct fi_provider *prov, struct smr_region *region,
+		     int id, struct smr_region **peer_smr)
+{
+	struct smr_map *map = region->map;
+	struct smr_peer *peer;
+	int ret = 0;
+
+	fastlock_acquire(&map->lock);
+	peer = smr_map_peer(map, id);
+	if (!peer) {
+		ret = -FI_EINVAL;
+		goto out;
+	}
+
+	if (!peer->region) {
+		if (peer->retired) {
+			peer->region = peer->retired;
+			peer->retired = NULL;
+		} else {
+			ret = smr_map_to_region(prov, peer);
+			if (ret)
+				goto out;
+		}
+	}
+	peer->last_epoch = map->epoch;
+
+	if (!smr_peer_addr_known(region, id))
+		smr_map_to_endpoint(region, id);
+	else
+		peer->peer_gen = peer->region->peer_gen;
+	*peer_smr = peer->region;
+out:
+	fastlock_release(&map->lock);
+	return ret;
+}
+
+/*
+ * Stamp a mapped region as used in the current epoch, reviving it if it was
+ * retired.  Returns NULL if the region is not mapped.
+ */
+struct smr_region *smr_map_use(struct smr_map *map, int id)
+{
+	struct smr_region *region = NULL;
+	struct smr_peer *peer;
+
+	fastlock_acquire(&map->lock);
+	peer = smr_map_peer(map, id);
+	if (!peer)
+		goto out;
+
+	if (!peer->region && peer->retired) {
+		peer->region = peer->retired;
+		peer->retired = NULL;
+	}
+	if (peer->region)
+		peer->last_epoch = map->epoch;
+	region = peer->region;
+out:
+	fastlock_release(&map->lock);
+	return region;
+}
+
+/*
+ * Called from progress every interval.  Regions not used during the last
+ * interval are retired, and regions retired a full interval ago are unmapped.
+ */
+void smr_map_sweep(struct smr_map *map, uint64_t interval)
+{
+	struct smr_peer *peer;
+	uint64_t now;
+	int i;
+
+	fastlock_acquire(&map->lock);
+	now = fi_gettime_ms();
+	if (now < map->next_sweep)
+		goto out;
+
+	map->next_sweep = now + interval;
+	if (ofi_atomic_get32(&map->busy))
+		goto out;
+
+	for (i = 0; i < map->peer_cnt; i++) {
+		peer = smr_map_peer(map, i);
+		if (!peer)
+			continue;
+
+		if (peer->retired) {
+			munmap(peer->retired, peer->retired->total_size);
+			peer->retired = NULL;
+		}
+		if (peer->region && peer->last_epoch != map->epoch) {
+			peer->retired = peer->region;
+			peer->region = NULL;
+		}
+	}
+	map->epoch++;
+out:
+	fastlock_release(&map->lock);
 }
 
 int smr_map_add(const struct fi_provider *prov, struct smr_map *map,
 		const char *name, int id)
 {
+	struct smr_peer *peer;
 	int ret = 0;
 
 	fastlock_acquire(&map->lock);
-	strncpy(map->peers[id].peer.name, name, SMR_NAME_SIZE);
-	map->peers[id].peer.name[SMR_NAME_SIZE - 1] = '\0';
-	ret = smr_map_to_region(prov, &map->peers[id]);
-	if (!ret)
-		map->peers[id].peer.addr = id;
-	fastlock_release(&map->lock);
+	peer = smr_map_peer(map, id);
+	if (!peer) {
+		peer = calloc(1, sizeof(*peer));
+		if (!peer) {
+			ret = -FI_ENOMEM;
+			goto out;
+		}
+		if (ofi_idm_set(&map->peers, id, peer) < 0) {
+			FI_WARN(prov, FI_LOG_AV, "shm peer map is full\n");
+			free(peer);
+			ret = -FI_ENOMEM;
+			goto out;
+		}
+	}
 
-	return ret == -ENOENT ? 0 : ret;
+	strncpy(peer->peer.name, name, SMR_NAME_SIZE);
+	peer->peer.name[SMR_NAME_SIZE - 1] = '\0';
+	peer->peer.addr = id;
+	if (id >= map->peer_cnt)
+		map->peer_cnt = id + 1;
+out:
+	fastlock_release(&map->lock);
+	return ret;
 }
 
 void smr_map_del(struct smr_map *map, int id)
 {
-	if (id >= SMR_MAX_PEERS || id < 0 ||
-	    map->peers[id].peer.addr == FI_ADDR_UNSPEC)
-		return;
+	struct smr_peer *peer;
 
-	munmap(map->peers[id].region, map->peers[id].region->total_size);
-	map->peers[id].peer.addr = FI_ADDR_UNSPEC;
+	fastlock_acquire(&map->lock);
+	peer = smr_map_peer(map, id);
+	if (!peer)
+		goto out;
+
+	if (peer->region)
+		munmap(peer->region, peer->region->total_size);
+	if (peer->retired)
+		munmap(peer->retired, peer->retired->total_size);
+	ofi_idm_clear(&map->peers, id);
+	free(peer);
+out:
+	fastlock_release(&map->lock);
 }
 
 void smr_map_free(struct smr_map *map)
 {
 	int i;
 
-	for (i = 0; i < SMR_MAX_PEERS; i++)
+	for (i = 0; i < map->peer_cnt; i++)
 		smr_map_del(map, i);
 
+	fastlock_destroy(&map->lock);
 	free(map);
 }
 
 struct smr_region *smr_map_get(struct smr_map *map, int id)
 {
+	struct smr_peer *peer;
+
 	if (id < 0 || id >= SMR_MAX_PEERS)
 		return NULL;
 
-	return map->peers[id].region;
+	peer = smr_map_peer(map, id);
+	return peer ? peer->region : NULL;
 }
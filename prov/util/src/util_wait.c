@@ -276,6 +276,10 @@ static int util_wait_fd_run(struct fid_wait *wait_fid, int timeout)
 		}
 
 		ret = fi_epoll_wait(wait->epoll_fd, ep_context, 1, timeout);
+		/* e.g. io_uring completion work, queued on the waiting thread */
+		if (ret == -FI_EINTR)
+			continue;
+
 		if (ret < 0) {
 			FI_WARN(wait->util_wait.prov, FI_LOG_FABRIC,
 				"poll failed\n");
@@ -36,7 +36,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 
 #include "ofi.h"
 #include "ofi_osd.h"
@@ -64,3 +69,130 @@ ssize_t ofi_get_hugepage_size(void)
 
 	return val * 1024;
 }
+
+#define OFI_NUMA_MAX_NODES	1024
+#define OFI_NUMA_MASK_BITS	(8 * sizeof(unsigned long))
+
+int ofi_get_numa_node(void)
+{
+	unsigned int cpu, node;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL))
+		return -errno;
+
+	return (int) node;
+}
+
+static int ofi_mbind(void *addr, size_t len, int mode,
+		     const unsigned long *mask)
+{
+	if (syscall(SYS_mbind, addr, len, mode, mask, OFI_NUMA_MAX_NODES + 1, 0))
+		return -errno;
+
+	return 0;
+}
+
+int ofi_mbind_node(void *addr, size_t len, int node)
+{
+	unsigned long mask[OFI_NUMA_MAX_NODES / OFI_NUMA_MASK_BITS] = { 0 };
+
+	if (node < 0 || node >= OFI_NUMA_MAX_NODES)
+		return -FI_EINVAL;
+
+	mask[node / OFI_NUMA_MASK_BITS] |= 1UL << (node % OFI_NUMA_MASK_BITS);
+	return ofi_mbind(addr, len, MPOL_PREFERRED, mask);
+}
+
+int ofi_mbind_interleave(void *addr, size_t len)
+{
+	unsigned long mask[OFI_NUMA_MAX_NODES / OFI_NUMA_MASK_BITS] = { 0 };
+	FILE *fd;
+	char *line = NULL, *cur;
+	size_t len_line = 0;
+	long first, last;
+
+	fd = fopen("/sys/devices/system/node/online", "r");
+	if (!fd)
+		return -errno;
+
+	/* The list of online nodes reads like "0-3,5" */
+	if (getline(&line, &len_line, fd) == -1) {
+		free(line);
+		fclose(fd);
+		return -FI_ENOENT;
+	}
+	fclose(fd);
+
+	for (cur = line; *cur && *cur != '\n'; cur++) {
+		first = strtol(cur, &cur, 10);
+		last = (*cur == '-') ? strtol(cur + 1, &cur, 10) : first;
+		for (; first <= last && first < OFI_NUMA_MAX_NODES; first++)
+			mask[first / OFI_NUMA_MASK_BITS] |=
+				1UL << (first % OFI_NUMA_MASK_BITS);
+		if (*cur != ',')
+			break;
+	}
+	free(line);
+
+	return ofi_mbind(addr, len, MPOL_INTERLEAVE, mask);
+}
+
+/*
+ * Find the file shared by a MAP_SHARED mapping that covers [addr, addr + len)
+ * and that other processes can open by name, along with the offset of addr
+ * in that file.
+ */
+int ofi_get_shared_file(const void *addr, size_t len, char *path,
+			size_t path_size, uint64_t *offset)
+{
+	uintptr_t start, end, base = (uintptr_t) addr;
+	unsigned long long file_off;
+	char perms[5], *line = NULL, *name;
+	size_t len_line = 0, name_len;
+	int ret = -FI_ENOENT, n;
+	FILE *fd;
+
+	fd = fopen("/proc/self/maps", "r");
+	if (!fd)
+		return -errno;
+
+	while (getline(&line, &len_line, fd) != -1) {
+		n = 0;
+		if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR " %4s %llx %*x:%*x %*u %n",
+			   &start, &end, perms, &file_off, &n) != 4 || !n)
+			continue;
+		if (base < start || base >= end)
+			continue;
+
+		name = line + n;
+		name_len = strcspn(name, "\n");
+		name[name_len] = '\0';
+		if (base + len > end || perms[3] != 's' || name[0] != '/' ||
+		    strstr(name, " (deleted)") || name_len >= path_size)
+			break;
+
+		memcpy(path, name, name_len + 1);
+		*offset = file_off + (base - start);
+		ret = 0;
+		break;
+	}
+
+	free(line);
+	fclose(fd);
+	return ret;
+}
+
+#define OFI_MFD_CLOEXEC	0x0001U	/* MFD_CLOEXEC, absent from older libcs */
+
+/* Create an anonymous file that can be mapped and passed to other processes */
+int ofi_memfd_create(const char *name)
+{
+#ifdef SYS_memfd_create
+	int fd;
+
+	fd = syscall(SYS_memfd_create, name, OFI_MFD_CLOEXEC);
+	return fd < 0 ? -errno : fd;
+#else
+	return -FI_ENOSYS;
+#endif
+}